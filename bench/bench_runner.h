@@ -0,0 +1,49 @@
+#pragma once
+
+// Iteration driver shared by the microbenchmarks. Every benchmark is repeated with a growing
+// iteration count until it runs for at least bench_min_time seconds; the report follows the
+// Google Benchmark layout.
+
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <functional>
+#include <string>
+
+struct counters {
+    uint64_t items = 0;     // units of work processed, see the benchmark
+    uint64_t bytes = 0;     // data bytes described or moved
+};
+
+using bench_fn = std::function<void(size_t iterations, counters& c)>;
+
+inline double bench_min_time = 0.2;
+
+inline void print_header() {
+    std::printf("%-36s %15s %12s %15s %16s\n", "Benchmark", "Time", "Iterations", "Items",
+                "Bytes");
+    std::printf("%s\n", std::string(98, '-').c_str());
+}
+
+inline void run(const std::string& name, const std::string& filter, const bench_fn& fn) {
+    if (!filter.empty() && (name.find(filter) == std::string::npos)) {
+        return;
+    }
+    size_t iterations = 1;
+    for (;;) {
+        counters c;
+        const auto start = std::chrono::steady_clock::now();
+        fn(iterations, c);
+        const std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+        if ((elapsed.count() >= bench_min_time) || (iterations >= (1ULL << 32))) {
+            std::printf("%-36s %12.1f ns %12zu %12.3fM/s %10.1f MiB/s\n", name.c_str(),
+                        elapsed.count() * 1e9 / iterations, iterations,
+                        c.items / elapsed.count() / 1e6, c.bytes / elapsed.count() / (1 << 20));
+            return;
+        }
+        // aim for the minimum time with some headroom, but at most 10x per step
+        const double factor = elapsed.count() > 0 ? 1.4 * bench_min_time / elapsed.count() : 10.0;
+        iterations = static_cast<size_t>(iterations * (factor < 10.0 ? (factor > 1.1 ? factor : 1.1)
+                                                                      : 10.0)) + 1;
+    }
+}
@@ -0,0 +1,206 @@
+// Microbenchmarks of the OS independent descriptor and ring logic (libxdma/dma_core.c) at various
+// scatter-gather list sizes, plus the same transfers executed by the software model of the IP.
+//
+// Usage: core_bench [filter] [--min-time=<seconds>]
+//
+// See bench_runner.h for how the benchmarks are timed (default minimum time 0.2s).
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <vector>
+
+#include "bench_runner.h"
+#include "dma_core.h"
+#include "xdma_model.h"
+
+namespace {
+
+const size_t page_size = 4096;
+const UINT32 sg_sizes[] = { 1, 8, 64, 256, 2050 }; // 2050 = XDMA_MAX_DESCRIPTORS of the driver
+
+// page aligned host memory, freed on scope exit
+struct aligned_buffer {
+    explicit aligned_buffer(size_t size)
+        : size(size), data(std::aligned_alloc(page_size, (size + page_size - 1) & ~(page_size - 1))) {
+        std::memset(data, 0, size);
+    }
+    ~aligned_buffer() { std::free(data); }
+    aligned_buffer(const aligned_buffer&) = delete;
+    aligned_buffer& operator=(const aligned_buffer&) = delete;
+    template <typename T> T* as() { return static_cast<T*>(data); }
+    uint64_t bus() const { return reinterpret_cast<uintptr_t>(data); }
+    size_t size;
+    void* data;
+};
+
+XDMA_DESC_PARAMS default_params() {
+    XDMA_DESC_PARAMS params;
+    params.streaming = FALSE;
+    params.fixedAddress = FALSE;
+    params.alignAddr = 1;
+    params.alignLength = 1;
+    params.dataPathBytes = 16;  // 128 bit
+    params.mrrsBytes = 512;
+    return params;
+}
+
+// one page per element, as the driver gets it for a page aligned user buffer
+std::vector<XDMA_SG_ELEMENT> page_list(uint64_t base, UINT32 n) {
+    std::vector<XDMA_SG_ELEMENT> sg(n);
+    for (UINT32 i = 0; i < n; i++) {
+        sg[i].address = base + i * page_size;
+        sg[i].length = page_size;
+        sg[i].reserved = 0;
+    }
+    return sg;
+}
+
+XDMA_SG_VIEW view(const std::vector<XDMA_SG_ELEMENT>& sg) {
+    XDMA_SG_VIEW v;
+    v.elements = sg.data();
+    v.stride = sizeof(XDMA_SG_ELEMENT);
+    v.numElements = static_cast<UINT32>(sg.size());
+    return v;
+}
+
+void bench_build(const std::string& filter, UINT32 n) {
+    aligned_buffer desc(n * sizeof(DMA_DESCRIPTOR));
+    const auto sg = page_list(0x100000000ULL, n);
+    const XDMA_SG_VIEW v = view(sg);
+    const XDMA_DESC_PARAMS params = default_params();
+
+    run("DescriptorBuildList/" + std::to_string(n), filter, [&](size_t iterations, counters& c) {
+        UINT32 misaligned;
+        for (size_t i = 0; i < iterations; i++) {
+            c.bytes += DescriptorBuildList(&params, desc.as<DMA_DESCRIPTOR>(), desc.bus(), 0, TRUE,
+                                           &v, &misaligned);
+        }
+        c.items = iterations * n;
+    });
+
+    run("DescriptorOptimizeList/" + std::to_string(n), filter, [&](size_t iterations, counters& c) {
+        UINT32 misaligned;
+        DescriptorBuildList(&params, desc.as<DMA_DESCRIPTOR>(), desc.bus(), 0, TRUE, &v, &misaligned);
+        for (size_t i = 0; i < iterations; i++) {
+            DescriptorOptimizeList(&params, desc.as<DMA_DESCRIPTOR>(), n,
+                                   static_cast<UINT32>(desc.bus()));
+        }
+        c.items = iterations * n;
+    });
+}
+
+void bench_ring(const std::string& filter, UINT32 n) {
+    const UINT32 num_blocks = n + 1; // a full ring holds numBlocks - 1 results
+    aligned_buffer results(num_blocks * sizeof(DMA_RESULT));
+    aligned_buffer blocks(num_blocks * page_size);
+    std::vector<unsigned char> output(n * page_size);
+    DMA_RESULT* r = results.as<DMA_RESULT>();
+
+    run("RingCollectResults/" + std::to_string(n), filter, [&](size_t iterations, counters& c) {
+        for (size_t i = 0; i < iterations; i++) {
+            for (UINT32 b = 0; b < n; b++) { // what the engine writes back
+                r[b].status = XDMA_RESULT_MAGIC | XDMA_RESULT_EOP_BIT;
+            }
+            UINT32 tail = 0;
+            c.items += RingCollectResults(r, &tail, num_blocks);
+        }
+    });
+
+    struct copy_context {
+        unsigned char* blocks;
+        unsigned char* output;
+    } ctx = { blocks.as<unsigned char>(), output.data() };
+    const XDMA_RING_COPY copy = [](void* context, UINT32 block, size_t offset, size_t length) {
+        copy_context* cc = static_cast<copy_context*>(context);
+        std::memcpy(cc->output + offset, cc->blocks + block * page_size, length);
+        return static_cast<BOOLEAN>(TRUE);
+    };
+
+    run("RingConsume/" + std::to_string(n), filter, [&](size_t iterations, counters& c) {
+        for (size_t i = 0; i < iterations; i++) {
+            for (UINT32 b = 0; b < n; b++) {
+                r[b].length = page_size;
+            }
+            UINT32 head = 0;
+            size_t num_bytes;
+            UINT32 consumed;
+            RingConsume(r, &head, n, num_blocks, output.size(), copy, &ctx, &num_bytes, &consumed);
+            c.items += consumed;
+            c.bytes += num_bytes;
+        }
+    });
+}
+
+void bench_model(const std::string& filter, UINT32 n) {
+    XDMA_MODEL_CONFIG config;
+    xdma_model_config_init(&config);
+    config.numH2C = 1;
+    config.numC2H = 0;
+    config.cardMemorySize = n * page_size;
+    XDMA_MODEL* model = xdma_model_create(&config);
+    if (model == nullptr) {
+        std::fprintf(stderr, "xdma_model_create failed\n");
+        std::exit(1);
+    }
+
+    aligned_buffer desc(n * sizeof(DMA_DESCRIPTOR));
+    aligned_buffer data(n * page_size);
+    const auto sg = page_list(data.bus(), n);
+    const XDMA_SG_VIEW v = view(sg);
+    const XDMA_DESC_PARAMS params = default_params();
+    const uint32_t sgdma = SGDMA_BLOCK_OFFSET;
+
+    // what XDMA_EngineProgramDma does for a H2C transfer, executed by the model
+    run("ModelTransferH2C/" + std::to_string(n), filter, [&](size_t iterations, counters& c) {
+        for (size_t i = 0; i < iterations; i++) {
+            UINT32 misaligned;
+            DescriptorBuildList(&params, desc.as<DMA_DESCRIPTOR>(), desc.bus(), 0, TRUE, &v,
+                                &misaligned);
+            const UINT32 firstAdj = DescriptorOptimizeList(&params, desc.as<DMA_DESCRIPTOR>(), n,
+                                                           static_cast<UINT32>(desc.bus()));
+            xdma_model_write32(model, sgdma + offsetof(XDMA_SGDMA_REGS, firstDescLo),
+                               static_cast<uint32_t>(desc.bus()));
+            xdma_model_write32(model, sgdma + offsetof(XDMA_SGDMA_REGS, firstDescHi),
+                               static_cast<uint32_t>(desc.bus() >> 32));
+            xdma_model_write32(model, sgdma + offsetof(XDMA_SGDMA_REGS, firstDescAdj), firstAdj);
+            xdma_model_write32(model, offsetof(XDMA_ENGINE_REGS, controlW1S), XDMA_CTRL_RUN_BIT);
+            c.items += xdma_model_run(model);
+            const uint32_t status = xdma_model_read32(model, offsetof(XDMA_ENGINE_REGS, statusRC));
+            xdma_model_write32(model, offsetof(XDMA_ENGINE_REGS, controlW1C), XDMA_CTRL_RUN_BIT);
+            if (status & XDMA_STAT_EXPECTED_ZERO) {
+                std::fprintf(stderr, "unexpected engine status 0x%08x\n", status);
+                std::exit(1);
+            }
+            c.bytes += n * page_size;
+        }
+    });
+    xdma_model_destroy(model);
+}
+
+} // namespace
+
+int main(int argc, char* argv[]) {
+    std::string filter;
+    for (int i = 1; i < argc; i++) {
+        const std::string arg = argv[i];
+        if (arg.compare(0, 11, "--min-time=") == 0) {
+            bench_min_time = std::atof(arg.c_str() + 11);
+        } else {
+            filter = arg;
+        }
+    }
+
+    print_header();
+    for (UINT32 n : sg_sizes) {
+        bench_build(filter, n);
+    }
+    for (UINT32 n : sg_sizes) {
+        bench_ring(filter, n);
+    }
+    for (UINT32 n : sg_sizes) {
+        bench_model(filter, n);
+    }
+    return 0;
+}
@@ -0,0 +1,118 @@
+// Microbenchmarks of the test data patterns of the exe/ tools (exe/common/xdma_pattern.cpp) for
+// every instruction set the CPU supports, at a cache resident and a memory bound buffer size.
+// memset and memcmp over the same buffers show the bandwidth the kernels should reach.
+//
+// Usage: pattern_bench [filter] [--min-time=<seconds>]
+//
+// See bench_runner.h for how the benchmarks are timed (default minimum time 0.2s).
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <vector>
+
+#include "bench_runner.h"
+#include "xdma_pattern.h"
+
+namespace {
+
+const size_t buffer_sizes[] = { 256 << 10, 64 << 20 };
+
+const struct {
+    pattern_type type;
+    const char* name;
+} patterns[] = {
+    { pattern_type::counter, "counter" },
+    { pattern_type::prbs, "prbs" },
+    { pattern_type::stamp, "stamp" },
+};
+
+std::string size_name(size_t size) {
+    return (size >= (1 << 20)) ? std::to_string(size >> 20) + "M" : std::to_string(size >> 10) + "K";
+}
+
+void bench_baseline(const std::string& filter, size_t size) {
+    std::vector<unsigned char> a(size, 1);
+    std::vector<unsigned char> b(size, 1);
+
+    run("memset/" + size_name(size), filter, [&](size_t iterations, counters& c) {
+        for (size_t i = 0; i < iterations; i++) {
+            std::memset(a.data(), static_cast<int>(i), size);
+        }
+        c.items = iterations * size / 4;
+        c.bytes = iterations * size;
+    });
+
+    std::memset(a.data(), 1, size);
+    run("memcmp/" + size_name(size), filter, [&](size_t iterations, counters& c) {
+        for (size_t i = 0; i < iterations; i++) {
+            b[i % size] = 1; // keeps the compiler from hoisting memcmp out of the loop
+            if (std::memcmp(a.data(), b.data(), size) != 0) {
+                std::fprintf(stderr, "memcmp mismatch\n");
+                std::exit(1);
+            }
+        }
+        c.items = iterations * size / 4;
+        c.bytes = iterations * size;
+    });
+}
+
+void bench_pattern(const std::string& filter, pattern_type type, const char* name, pattern_isa isa,
+                   size_t size) {
+    std::vector<unsigned char> buffer(size);
+    const std::string suffix = std::string(name) + "/" + pattern_isa_name(isa) + "/" + size_name(size);
+
+    run("Fill/" + suffix, filter, [&](size_t iterations, counters& c) {
+        pattern_stream stream(type, 1, 4096, isa);
+        for (size_t i = 0; i < iterations; i++) {
+            stream.fill(buffer.data(), size);
+        }
+        c.items = iterations * size / 4;
+        c.bytes = iterations * size;
+    });
+
+    // the first buffer of the stream, checked by a new reader every iteration
+    pattern_stream(type, 1, 4096, isa).fill(buffer.data(), size);
+    run("Verify/" + suffix, filter, [&](size_t iterations, counters& c) {
+        for (size_t i = 0; i < iterations; i++) {
+            pattern_stream reader(type, 1, 4096, isa);
+            if (!reader.verify(buffer.data(), size)) {
+                std::fprintf(stderr, "%s: unexpected mismatch\n", suffix.c_str());
+                std::exit(1);
+            }
+        }
+        c.items = iterations * size / 4;
+        c.bytes = iterations * size;
+    });
+}
+
+} // namespace
+
+int main(int argc, char* argv[]) {
+    std::string filter;
+    for (int i = 1; i < argc; i++) {
+        const std::string arg = argv[i];
+        if (arg.compare(0, 11, "--min-time=") == 0) {
+            bench_min_time = std::atof(arg.c_str() + 11);
+        } else {
+            filter = arg;
+        }
+    }
+
+    print_header();
+    for (size_t size : buffer_sizes) {
+        bench_baseline(filter, size);
+    }
+    const pattern_isa isas[] = { pattern_isa::scalar, pattern_isa::sse2, pattern_isa::avx2 };
+    for (size_t size : buffer_sizes) {
+        for (const auto& p : patterns) {
+            for (pattern_isa isa : isas) {
+                if (isa <= pattern_best_isa()) {
+                    bench_pattern(filter, p.type, p.name, isa, size);
+                }
+            }
+        }
+    }
+    return 0;
+}
@@ -0,0 +1,75 @@
+#pragma once
+
+// Bounded lock-free queue between exactly one producer thread and one consumer thread. The
+// producer owns 'tail', the consumer owns 'head'; each side only reads the index of the other.
+
+#include <atomic>
+#include <cstddef>
+#include <vector>
+
+template <typename T>
+class spsc_queue {
+public:
+    // the capacity is rounded up to a power of two
+    explicit spsc_queue(size_t min_capacity) : items(round_up(min_capacity)), mask(items.size() - 1) {
+    }
+
+    spsc_queue(const spsc_queue&) = delete;
+    spsc_queue& operator=(const spsc_queue&) = delete;
+
+    // producer only, returns false if the queue is full
+    bool push(const T& item) {
+        const size_t t = tail.load(std::memory_order_relaxed);
+        const size_t h = head.load(std::memory_order_acquire);
+        if (t - h == items.size()) {
+            return false;
+        }
+        items[t & mask] = item;
+        tail.store(t + 1, std::memory_order_release);
+        if (t + 1 - h > high_water.load(std::memory_order_relaxed)) {
+            high_water.store(t + 1 - h, std::memory_order_relaxed);
+        }
+        return true;
+    }
+
+    // consumer only, returns false if the queue is empty
+    bool pop(T& item) {
+        const size_t h = head.load(std::memory_order_relaxed);
+        if (h == tail.load(std::memory_order_acquire)) {
+            return false;
+        }
+        item = items[h & mask];
+        head.store(h + 1, std::memory_order_release);
+        return true;
+    }
+
+    // approximate when called while the other side runs
+    size_t size() const {
+        return tail.load(std::memory_order_acquire) - head.load(std::memory_order_acquire);
+    }
+
+    // largest number of items the queue held, as seen by the producer
+    size_t max_size() const {
+        return high_water.load(std::memory_order_relaxed);
+    }
+
+    size_t capacity() const {
+        return items.size();
+    }
+
+private:
+    static size_t round_up(size_t n) {
+        size_t capacity = 1;
+        while (capacity < n) {
+            capacity <<= 1;
+        }
+        return capacity;
+    }
+
+    std::vector<T> items;
+    const size_t mask;
+    // head and tail on separate cache lines so that the two threads do not share one
+    alignas(64) std::atomic<size_t> head{ 0 };
+    alignas(64) std::atomic<size_t> tail{ 0 };
+    std::atomic<size_t> high_water{ 0 };
+};
@@ -0,0 +1,555 @@
+// Test data patterns for the exe/ tools, see xdma_pattern.h.
+
+#include "xdma_pattern.h"
+
+#include <algorithm>
+#include <cstring>
+#include <stdexcept>
+
+#if defined(__x86_64__) || defined(_M_X64) || defined(__i386__) || defined(_M_IX86)
+#define PATTERN_X86
+#include <immintrin.h>
+#if defined(_MSC_VER) && !defined(__clang__)
+#include <intrin.h>
+#define TARGET_SSE2
+#define TARGET_AVX2
+#else
+#define TARGET_SSE2 __attribute__((target("sse2")))
+#define TARGET_AVX2 __attribute__((target("avx2")))
+#endif
+#endif
+
+// ============= Kernels ======================================================
+//
+// ramp_*: the words first, first + 1, ... (counter pattern and stamp payload)
+// prbs_*: 'groups' times one step of all eight LFSRs, the states are updated in place
+// *_verify: return the index of the first word which differs from the pattern and store the expected
+//           word, or return n (8 * groups) if all match. prbs_verify always steps the LFSRs over all
+//           groups, so the stream stays in sync after a mismatch.
+
+namespace {
+
+inline uint32_t xorshift32(uint32_t x) {
+    x ^= x << 13;
+    x ^= x >> 17;
+    x ^= x << 5;
+    return x;
+}
+
+inline uint32_t load_word(const uint8_t* p) {
+    uint32_t v;
+    std::memcpy(&v, p, sizeof(v));
+    return v;
+}
+
+inline void store_word(uint8_t* p, uint32_t v) {
+    std::memcpy(p, &v, sizeof(v));
+}
+
+void ramp_fill_scalar(uint8_t* out, size_t n, uint32_t first) {
+    for (size_t i = 0; i < n; ++i) {
+        store_word(out + 4 * i, first + static_cast<uint32_t>(i));
+    }
+}
+
+size_t ramp_verify_scalar(const uint8_t* in, size_t n, uint32_t first, uint32_t* expected) {
+    for (size_t i = 0; i < n; ++i) {
+        if (load_word(in + 4 * i) != first + static_cast<uint32_t>(i)) {
+            *expected = first + static_cast<uint32_t>(i);
+            return i;
+        }
+    }
+    return n;
+}
+
+void prbs_fill_scalar(uint8_t* out, size_t groups, uint32_t* lanes) {
+    for (size_t g = 0; g < groups; ++g) {
+        for (unsigned l = 0; l < 8; ++l) {
+            lanes[l] = xorshift32(lanes[l]);
+            store_word(out + 32 * g + 4 * l, lanes[l]);
+        }
+    }
+}
+
+size_t prbs_verify_scalar(const uint8_t* in, size_t groups, uint32_t* lanes, uint32_t* expected) {
+    size_t first = 8 * groups;
+    for (size_t g = 0; g < groups; ++g) {
+        for (unsigned l = 0; l < 8; ++l) {
+            lanes[l] = xorshift32(lanes[l]);
+            if ((first == 8 * groups) && (load_word(in + 32 * g + 4 * l) != lanes[l])) {
+                first = 8 * g + l;
+                *expected = lanes[l];
+            }
+        }
+    }
+    return first;
+}
+
+#ifdef PATTERN_X86
+
+TARGET_SSE2 void ramp_fill_sse2(uint8_t* out, size_t n, uint32_t first) {
+    __m128i v = _mm_add_epi32(_mm_set1_epi32(static_cast<int>(first)), _mm_setr_epi32(0, 1, 2, 3));
+    const __m128i step = _mm_set1_epi32(4);
+    size_t i = 0;
+    for (; i + 4 <= n; i += 4) {
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(out + 4 * i), v);
+        v = _mm_add_epi32(v, step);
+    }
+    ramp_fill_scalar(out + 4 * i, n - i, first + static_cast<uint32_t>(i));
+}
+
+TARGET_SSE2 size_t ramp_verify_sse2(const uint8_t* in, size_t n, uint32_t first, uint32_t* expected) {
+    __m128i v = _mm_add_epi32(_mm_set1_epi32(static_cast<int>(first)), _mm_setr_epi32(0, 1, 2, 3));
+    const __m128i step = _mm_set1_epi32(4);
+    size_t i = 0;
+    for (; i + 4 <= n; i += 4) {
+        const __m128i data = _mm_loadu_si128(reinterpret_cast<const __m128i*>(in + 4 * i));
+        if (_mm_movemask_epi8(_mm_cmpeq_epi32(data, v)) != 0xFFFF) {
+            break;
+        }
+        v = _mm_add_epi32(v, step);
+    }
+    return i + ramp_verify_scalar(in + 4 * i, n - i, first + static_cast<uint32_t>(i), expected);
+}
+
+TARGET_SSE2 inline __m128i xorshift32_sse2(__m128i x) {
+    x = _mm_xor_si128(x, _mm_slli_epi32(x, 13));
+    x = _mm_xor_si128(x, _mm_srli_epi32(x, 17));
+    return _mm_xor_si128(x, _mm_slli_epi32(x, 5));
+}
+
+TARGET_SSE2 void prbs_fill_sse2(uint8_t* out, size_t groups, uint32_t* lanes) {
+    __m128i lo = _mm_loadu_si128(reinterpret_cast<const __m128i*>(lanes));
+    __m128i hi = _mm_loadu_si128(reinterpret_cast<const __m128i*>(lanes + 4));
+    for (size_t g = 0; g < groups; ++g) {
+        lo = xorshift32_sse2(lo);
+        hi = xorshift32_sse2(hi);
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(out + 32 * g), lo);
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(out + 32 * g + 16), hi);
+    }
+    _mm_storeu_si128(reinterpret_cast<__m128i*>(lanes), lo);
+    _mm_storeu_si128(reinterpret_cast<__m128i*>(lanes + 4), hi);
+}
+
+TARGET_SSE2 size_t prbs_verify_sse2(const uint8_t* in, size_t groups, uint32_t* lanes,
+                                    uint32_t* expected) {
+    __m128i lo = _mm_loadu_si128(reinterpret_cast<const __m128i*>(lanes));
+    __m128i hi = _mm_loadu_si128(reinterpret_cast<const __m128i*>(lanes + 4));
+    size_t g = 0;
+    for (; g < groups; ++g) {
+        lo = xorshift32_sse2(lo);
+        hi = xorshift32_sse2(hi);
+        const __m128i eq_lo = _mm_cmpeq_epi32(lo, _mm_loadu_si128(reinterpret_cast<const __m128i*>(in + 32 * g)));
+        const __m128i eq_hi = _mm_cmpeq_epi32(hi, _mm_loadu_si128(reinterpret_cast<const __m128i*>(in + 32 * g + 16)));
+        if (_mm_movemask_epi8(_mm_and_si128(eq_lo, eq_hi)) != 0xFFFF) {
+            break;
+        }
+    }
+    _mm_storeu_si128(reinterpret_cast<__m128i*>(lanes), lo);
+    _mm_storeu_si128(reinterpret_cast<__m128i*>(lanes + 4), hi);
+    if (g == groups) {
+        return 8 * groups;
+    }
+    size_t first = 8 * groups;
+    for (unsigned l = 0; l < 8; ++l) {
+        if (load_word(in + 32 * g + 4 * l) != lanes[l]) {
+            first = 8 * g + l;
+            *expected = lanes[l];
+            break;
+        }
+    }
+    // keep the stream in sync: step the LFSRs over the groups which were not compared
+    for (; g + 1 < groups; ++g) {
+        lo = xorshift32_sse2(lo);
+        hi = xorshift32_sse2(hi);
+    }
+    _mm_storeu_si128(reinterpret_cast<__m128i*>(lanes), lo);
+    _mm_storeu_si128(reinterpret_cast<__m128i*>(lanes + 4), hi);
+    return first;
+}
+
+TARGET_AVX2 void ramp_fill_avx2(uint8_t* out, size_t n, uint32_t first) {
+    __m256i v = _mm256_add_epi32(_mm256_set1_epi32(static_cast<int>(first)),
+                                 _mm256_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7));
+    const __m256i step = _mm256_set1_epi32(8);
+    size_t i = 0;
+    for (; i + 8 <= n; i += 8) {
+        _mm256_storeu_si256(reinterpret_cast<__m256i*>(out + 4 * i), v);
+        v = _mm256_add_epi32(v, step);
+    }
+    ramp_fill_scalar(out + 4 * i, n - i, first + static_cast<uint32_t>(i));
+}
+
+TARGET_AVX2 size_t ramp_verify_avx2(const uint8_t* in, size_t n, uint32_t first, uint32_t* expected) {
+    __m256i v = _mm256_add_epi32(_mm256_set1_epi32(static_cast<int>(first)),
+                                 _mm256_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7));
+    const __m256i step = _mm256_set1_epi32(8);
+    size_t i = 0;
+    for (; i + 8 <= n; i += 8) {
+        const __m256i data = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(in + 4 * i));
+        if (_mm256_movemask_epi8(_mm256_cmpeq_epi32(data, v)) != -1) {
+            break;
+        }
+        v = _mm256_add_epi32(v, step);
+    }
+    return i + ramp_verify_scalar(in + 4 * i, n - i, first + static_cast<uint32_t>(i), expected);
+}
+
+TARGET_AVX2 inline __m256i xorshift32_avx2(__m256i x) {
+    x = _mm256_xor_si256(x, _mm256_slli_epi32(x, 13));
+    x = _mm256_xor_si256(x, _mm256_srli_epi32(x, 17));
+    return _mm256_xor_si256(x, _mm256_slli_epi32(x, 5));
+}
+
+TARGET_AVX2 void prbs_fill_avx2(uint8_t* out, size_t groups, uint32_t* lanes) {
+    __m256i x = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(lanes));
+    for (size_t g = 0; g < groups; ++g) {
+        x = xorshift32_avx2(x);
+        _mm256_storeu_si256(reinterpret_cast<__m256i*>(out + 32 * g), x);
+    }
+    _mm256_storeu_si256(reinterpret_cast<__m256i*>(lanes), x);
+}
+
+TARGET_AVX2 size_t prbs_verify_avx2(const uint8_t* in, size_t groups, uint32_t* lanes,
+                                    uint32_t* expected) {
+    __m256i x = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(lanes));
+    size_t g = 0;
+    for (; g < groups; ++g) {
+        x = xorshift32_avx2(x);
+        const __m256i data = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(in + 32 * g));
+        if (_mm256_movemask_epi8(_mm256_cmpeq_epi32(data, x)) != -1) {
+            break;
+        }
+    }
+    _mm256_storeu_si256(reinterpret_cast<__m256i*>(lanes), x);
+    if (g == groups) {
+        return 8 * groups;
+    }
+    size_t first = 8 * groups;
+    for (unsigned l = 0; l < 8; ++l) {
+        if (load_word(in + 32 * g + 4 * l) != lanes[l]) {
+            first = 8 * g + l;
+            *expected = lanes[l];
+            break;
+        }
+    }
+    // keep the stream in sync: step the LFSRs over the groups which were not compared
+    for (; g + 1 < groups; ++g) {
+        x = xorshift32_avx2(x);
+    }
+    _mm256_storeu_si256(reinterpret_cast<__m256i*>(lanes), x);
+    return first;
+}
+
+#endif // PATTERN_X86
+
+struct kernels {
+    void (*ramp_fill)(uint8_t* out, size_t n, uint32_t first);
+    size_t (*ramp_verify)(const uint8_t* in, size_t n, uint32_t first, uint32_t* expected);
+    void (*prbs_fill)(uint8_t* out, size_t groups, uint32_t* lanes);
+    size_t (*prbs_verify)(const uint8_t* in, size_t groups, uint32_t* lanes, uint32_t* expected);
+};
+
+const kernels& kernels_for(pattern_isa isa) {
+    static const kernels scalar = { ramp_fill_scalar, ramp_verify_scalar, prbs_fill_scalar, prbs_verify_scalar };
+#ifdef PATTERN_X86
+    static const kernels sse2 = { ramp_fill_sse2, ramp_verify_sse2, prbs_fill_sse2, prbs_verify_sse2 };
+    static const kernels avx2 = { ramp_fill_avx2, ramp_verify_avx2, prbs_fill_avx2, prbs_verify_avx2 };
+    switch (isa) {
+    case pattern_isa::avx2:
+        return avx2;
+    case pattern_isa::sse2:
+        return sse2;
+    default:
+        break;
+    }
+#else
+    (void)isa;
+#endif
+    return scalar;
+}
+
+uint64_t splitmix64(uint64_t z) {
+    z += 0x9E3779B97F4A7C15ull;
+    z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ull;
+    z = (z ^ (z >> 27)) * 0x94D049BB133111EBull;
+    return z ^ (z >> 31);
+}
+
+// first payload word of the stamp block with sequence number 'seq'
+uint32_t stamp_base(uint64_t seq) {
+    return static_cast<uint32_t>(splitmix64(seq));
+}
+
+// 'word' with bytes [from, to) taken from 'data', where data[0] is byte 'from' of the word
+uint32_t merge_bytes(uint32_t word, const uint8_t* data, unsigned from, unsigned to) {
+    for (unsigned b = from; b < to; ++b) {
+        word = (word & ~(0xFFu << (8 * b))) | (static_cast<uint32_t>(data[b - from]) << (8 * b));
+    }
+    return word;
+}
+
+unsigned first_differing_byte(uint32_t a, uint32_t b) {
+    unsigned byte = 0;
+    for (uint32_t diff = a ^ b; (diff & 0xFF) == 0; diff >>= 8) {
+        byte++;
+    }
+    return byte;
+}
+
+} // namespace
+
+// ============= Instruction set ==============================================
+
+pattern_isa pattern_best_isa() {
+#if defined(PATTERN_X86) && defined(_MSC_VER) && !defined(__clang__)
+    int info[4];
+    __cpuid(info, 0);
+    const int max_leaf = info[0];
+    __cpuid(info, 1);
+    const bool os_avx = (info[2] & (1 << 27)) && (info[2] & (1 << 28)) && ((_xgetbv(0) & 6) == 6);
+    if (os_avx && (max_leaf >= 7)) {
+        __cpuidex(info, 7, 0);
+        if (info[1] & (1 << 5)) {
+            return pattern_isa::avx2;
+        }
+    }
+    return pattern_isa::sse2; // every x86 CPU which runs Windows 8 or later
+#elif defined(PATTERN_X86)
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2")) {
+        return pattern_isa::avx2;
+    }
+    if (__builtin_cpu_supports("sse2")) {
+        return pattern_isa::sse2;
+    }
+    return pattern_isa::scalar;
+#else
+    return pattern_isa::scalar;
+#endif
+}
+
+const char* pattern_isa_name(pattern_isa isa) {
+    switch (isa) {
+    case pattern_isa::avx2:
+        return "avx2";
+    case pattern_isa::sse2:
+        return "sse2";
+    default:
+        return "scalar";
+    }
+}
+
+// ============= Stream =======================================================
+
+pattern_stream::pattern_stream(pattern_type type, uint64_t seed, size_t block_size, pattern_isa isa)
+    : type(type), kernel_isa(std::min(isa, pattern_best_isa())), seed(seed),
+      words_per_block(block_size / 4) {
+    if ((type == pattern_type::stamp) && ((block_size < 8) || (block_size % 4 != 0))) {
+        throw std::invalid_argument("stamp block size must be a multiple of 4 and at least 8 bytes");
+    }
+    for (unsigned l = 0; l < 8; ++l) {
+        const auto state = static_cast<uint32_t>(splitmix64(seed * 8 + l));
+        lanes[l] = (state != 0) ? state : (l + 1); // zero is the fixed point of xorshift
+    }
+}
+
+uint64_t pattern_stream::position() const {
+    return 4 * word_index - (partial_bytes ? (4 - partial_bytes) : 0);
+}
+
+uint32_t pattern_stream::next_word() {
+    uint32_t value = 0;
+    switch (type) {
+    case pattern_type::counter:
+        value = static_cast<uint32_t>(seed + word_index);
+        break;
+    case pattern_type::prbs: {
+        uint32_t& lane = lanes[word_index % 8];
+        lane = xorshift32(lane);
+        value = lane;
+        break;
+    }
+    case pattern_type::stamp: {
+        const uint64_t seq = seed + word_index / words_per_block;
+        const uint64_t i = word_index % words_per_block;
+        value = (i == 0) ? static_cast<uint32_t>(seq)
+              : (i == 1) ? static_cast<uint32_t>(seq >> 32)
+              : stamp_base(seq) + static_cast<uint32_t>(i - 2);
+        break;
+    }
+    }
+    word_index++;
+    return value;
+}
+
+void pattern_stream::fill_words(uint8_t* out, size_t n) {
+    const kernels& k = kernels_for(kernel_isa);
+    switch (type) {
+    case pattern_type::counter:
+        k.ramp_fill(out, n, static_cast<uint32_t>(seed + word_index));
+        word_index += n;
+        break;
+    case pattern_type::prbs: {
+        for (; (n > 0) && (word_index % 8 != 0); --n, out += 4) {
+            store_word(out, next_word());
+        }
+        const size_t groups = n / 8;
+        k.prbs_fill(out, groups, lanes);
+        word_index += 8 * groups;
+        out += 32 * groups;
+        for (n -= 8 * groups; n > 0; --n, out += 4) {
+            store_word(out, next_word());
+        }
+        break;
+    }
+    case pattern_type::stamp:
+        while (n > 0) {
+            const uint64_t i = word_index % words_per_block;
+            if (i < 2) { // sequence number
+                store_word(out, next_word());
+                out += 4;
+                n--;
+                continue;
+            }
+            const size_t chunk = static_cast<size_t>(std::min<uint64_t>(n, words_per_block - i));
+            const uint64_t seq = seed + word_index / words_per_block;
+            k.ramp_fill(out, chunk, stamp_base(seq) + static_cast<uint32_t>(i - 2));
+            word_index += chunk;
+            out += 4 * chunk;
+            n -= chunk;
+        }
+        break;
+    }
+}
+
+// returns the index of the first word which differs and stores its expected value, or n if all
+// words match
+size_t pattern_stream::verify_words(const uint8_t* in, size_t n, uint32_t* expected_word) {
+    const kernels& k = kernels_for(kernel_isa);
+    size_t first = n;
+    uint32_t expected = 0;
+    // compare one word in scalar code
+    const auto check_word = [&](size_t index) {
+        const uint32_t value = next_word();
+        if ((first == n) && (load_word(in + 4 * index) != value)) {
+            first = index;
+            expected = value;
+        }
+    };
+
+    switch (type) {
+    case pattern_type::counter:
+        first = k.ramp_verify(in, n, static_cast<uint32_t>(seed + word_index), &expected);
+        word_index += n;
+        break;
+    case pattern_type::prbs: {
+        size_t i = 0;
+        for (; (i < n) && (word_index % 8 != 0); ++i) {
+            check_word(i);
+        }
+        const size_t groups = (n - i) / 8;
+        uint32_t group_expected = 0;
+        const size_t found = k.prbs_verify(in + 4 * i, groups, lanes, &group_expected);
+        if ((first == n) && (found < 8 * groups)) {
+            first = i + found;
+            expected = group_expected;
+        }
+        word_index += 8 * groups;
+        for (i += 8 * groups; i < n; ++i) {
+            check_word(i);
+        }
+        break;
+    }
+    case pattern_type::stamp:
+        for (size_t i = 0; i < n;) {
+            const uint64_t w = word_index % words_per_block;
+            if (w < 2) {
+                check_word(i++);
+                continue;
+            }
+            const size_t chunk = static_cast<size_t>(std::min<uint64_t>(n - i, words_per_block - w));
+            if (first == n) {
+                const uint64_t seq = seed + word_index / words_per_block;
+                const size_t found = k.ramp_verify(in + 4 * i, chunk,
+                                                   stamp_base(seq) + static_cast<uint32_t>(w - 2),
+                                                   &expected);
+                if (found < chunk) {
+                    first = i + found;
+                }
+            }
+            word_index += chunk;
+            i += chunk;
+        }
+        break;
+    }
+    *expected_word = expected;
+    return first;
+}
+
+void pattern_stream::fill(void* buffer, size_t length) {
+    auto p = static_cast<uint8_t*>(buffer);
+    for (; (partial_bytes != 0) && (length > 0); --length) {
+        *p++ = static_cast<uint8_t>(partial_word >> (8 * partial_bytes));
+        partial_bytes = (partial_bytes + 1) % 4;
+    }
+    const size_t n = length / 4;
+    fill_words(p, n);
+    p += 4 * n;
+    length -= 4 * n;
+    if (length > 0) {
+        partial_word = next_word();
+        for (unsigned b = 0; b < length; ++b) {
+            p[b] = static_cast<uint8_t>(partial_word >> (8 * b));
+        }
+        partial_bytes = static_cast<unsigned>(length);
+    }
+}
+
+bool pattern_stream::verify(const void* buffer, size_t length, pattern_mismatch* mismatch) {
+    auto p = static_cast<const uint8_t*>(buffer);
+    bool ok = true;
+    const auto report = [&](uint64_t offset, uint32_t expected, uint32_t actual) {
+        if (ok && (mismatch != nullptr)) {
+            mismatch->offset = offset;
+            mismatch->expected = expected;
+            mismatch->actual = actual;
+        }
+        ok = false;
+    };
+
+    // rest of a word started by the previous call
+    if ((partial_bytes != 0) && (length > 0)) {
+        const unsigned from = partial_bytes;
+        const unsigned to = static_cast<unsigned>(std::min<size_t>(4, from + length));
+        const uint32_t actual = merge_bytes(partial_word, p, from, to);
+        if (actual != partial_word) {
+            report(position() + first_differing_byte(actual, partial_word) - from, partial_word, actual);
+        }
+        p += to - from;
+        length -= to - from;
+        partial_bytes = to % 4;
+    }
+
+    const size_t n = length / 4;
+    const uint64_t start = position();
+    uint32_t expected = 0;
+    const size_t found = verify_words(p, n, &expected);
+    if (found < n) {
+        const uint32_t actual = load_word(p + 4 * found);
+        report(start + 4 * found + first_differing_byte(actual, expected), expected, actual);
+    }
+    p += 4 * n;
+    length -= 4 * n;
+
+    if (length > 0) {
+        const uint64_t offset = position();
+        partial_word = next_word();
+        partial_bytes = static_cast<unsigned>(length);
+        const uint32_t actual = merge_bytes(partial_word, p, 0, partial_bytes);
+        if (actual != partial_word) {
+            report(offset + first_differing_byte(actual, partial_word), partial_word, actual);
+        }
+    }
+    return ok;
+}
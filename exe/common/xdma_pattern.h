@@ -0,0 +1,66 @@
+#pragma once
+
+// Test data patterns for the exe/ tools. A pattern_stream produces an endless, reproducible byte
+// stream from a pattern type and a seed. The writer fills its buffers from one stream, the reader
+// verifies what it received against a second stream with the same parameters. Both continue where
+// the previous call stopped, so buffers may have any length and need not end on a word boundary.
+//
+// The bulk of the work runs in SSE2 or AVX2 kernels, selected at runtime, with a scalar fallback
+// for other CPUs. All kernels produce the same stream, which consists of little-endian 32-bit words:
+//   counter   word i is seed + i
+//   prbs      eight interleaved xorshift32 LFSRs seeded from the seed; word i is the next output
+//             of LFSR i % 8
+//   stamp     blocks of block_size bytes, each starting with its 64-bit sequence number
+//             (seed + block index), followed by a counter starting at a value derived from it.
+//             Dropped, repeated or reordered blocks show up as a wrong sequence number.
+
+#include <cstddef>
+#include <cstdint>
+
+enum class pattern_type { counter, prbs, stamp };
+enum class pattern_isa { scalar, sse2, avx2 };
+
+// the best instruction set the CPU supports
+pattern_isa pattern_best_isa();
+
+const char* pattern_isa_name(pattern_isa isa);
+
+struct pattern_mismatch {
+    uint64_t offset;    // stream offset of the first byte which differs
+    uint32_t expected;  // the 32-bit stream word holding that byte
+    uint32_t actual;    // the same word as received
+};
+
+class pattern_stream {
+public:
+    // block_size is only used by pattern_type::stamp, it must be a multiple of 4 and at least 8.
+    // An isa the CPU does not support is lowered to pattern_best_isa().
+    pattern_stream(pattern_type type, uint64_t seed, size_t block_size = 4096,
+                   pattern_isa isa = pattern_best_isa());
+
+    // write the next 'length' bytes of the stream to 'buffer'
+    void fill(void* buffer, size_t length);
+
+    // compare 'buffer' with the next 'length' bytes of the stream. Returns false and describes the
+    // first difference in 'mismatch' if they differ. The stream advances by 'length' either way.
+    bool verify(const void* buffer, size_t length, pattern_mismatch* mismatch = nullptr);
+
+    // number of bytes filled or verified so far
+    uint64_t position() const;
+
+    pattern_isa isa() const { return kernel_isa; }
+
+private:
+    uint32_t next_word();
+    void fill_words(uint8_t* out, size_t n);
+    size_t verify_words(const uint8_t* in, size_t n, uint32_t* expected);
+
+    pattern_type type;
+    pattern_isa kernel_isa;
+    uint64_t seed;
+    uint64_t word_index = 0;        // index of the next word to generate
+    uint32_t lanes[8];              // prbs: LFSR states
+    uint64_t words_per_block;       // stamp
+    uint32_t partial_word = 0;      // word of which only 'partial_bytes' are consumed
+    unsigned partial_bytes = 0;
+};
@@ -1,11 +1,10 @@
-#include <array>
 #include <algorithm>
+#include <chrono>
 #include <iostream>
 #include <iomanip>
-#include <numeric>
+#include <memory>
 #include <string>
 #include <system_error>
-#include <thread>
 #include <vector>
 
 #define NOMINMAX
@@ -17,6 +16,22 @@
 
 #pragma comment(lib, "setupapi.lib")
 
+static const char* help_text =
+"streaming_dma.exe streams data through the AXI-ST engines h2c_0 and c2h_0 with overlapped I/O.\n"
+"\n"
+"Usage: streaming_dma.exe [-b block_size] [-q depth] [-t seconds] [-d h2c|c2h|both] [-v] [-p]\n"
+"\n"
+"  -b    bytes per ReadFile()/WriteFile() request (default 65536)\n"
+"  -q    outstanding requests per direction (default 8)\n"
+"  -t    run time in seconds (default 5)\n"
+"  -d    directions to stream (default both)\n"
+"  -v    write a 32-bit counter and check that c2h_0 receives it back (loopback design)\n"
+"  -p    print the first received block\n"
+"\n"
+"The requests of both directions complete on one I/O completion port and are re-issued right\n"
+"away, so the engine queue of the driver never runs empty. The throughput of every second and\n"
+"the sustained throughput of the whole run are printed.\n";
+
 // ============= Static Utility Functions =====================================
 
 static std::vector<std::string> get_device_paths(GUID guid) {
@@ -114,15 +129,14 @@ static void print_bytes(size_t addr, BYTE* data, size_t length) {
 // ============= windows device handle  =======================================
 struct device_file {
     HANDLE h;
-    device_file(const std::string& path, DWORD accessFlags);
+    device_file(const std::string& path, DWORD accessFlags, DWORD attributes = FILE_ATTRIBUTE_NORMAL);
     ~device_file();
 };
 
-device_file::device_file(const std::string& path, DWORD accessFlags) {
-    h = CreateFile(path.c_str(), accessFlags, 0, NULL, OPEN_EXISTING,
-        FILE_ATTRIBUTE_NORMAL, NULL);
+device_file::device_file(const std::string& path, DWORD accessFlags, DWORD attributes) {
+    h = CreateFile(path.c_str(), accessFlags, 0, NULL, OPEN_EXISTING, attributes, NULL);
     if (h == INVALID_HANDLE_VALUE) {
-        throw std::runtime_error("CreateFile control failed: " + std::to_string(GetLastError()));
+        throw std::runtime_error("CreateFile " + path + " failed: " + std::to_string(GetLastError()));
     }
 }
 
@@ -136,11 +150,9 @@ class xdma_device {
 public:
     xdma_device(const std::string& device_path);
 
-    // transfer data from Host PC to FPGA Card using SGDMA engine
-    size_t write_to_engine(void* buffer, size_t size);
-
-    // transfer data from FPGA Card to Host PC using SGDMA engine
-    size_t read_from_engine(void* buffer, size_t size);
+    // overlapped handles of the streaming engines
+    HANDLE h2c() const { return h2c0.h; }
+    HANDLE c2h() const { return c2h0.h; }
 private:
     device_file control;
     device_file h2c0;
@@ -151,10 +163,10 @@ private:
 
 xdma_device::xdma_device(const std::string& device_path) :
     control(device_path + "\\control", GENERIC_READ | GENERIC_WRITE),
-    h2c0(device_path + "\\h2c_0", GENERIC_WRITE),
-    c2h0(device_path + "\\c2h_0", GENERIC_READ) {
+    h2c0(device_path + "\\h2c_0", GENERIC_WRITE, FILE_ATTRIBUTE_NORMAL | FILE_FLAG_OVERLAPPED),
+    c2h0(device_path + "\\c2h_0", GENERIC_READ, FILE_ATTRIBUTE_NORMAL | FILE_FLAG_OVERLAPPED) {
 
-    std::cout << std::hex << "h2c_0=0x" << read_register(0x0) << ", c2h_0=0x" << read_register(0x1000) << "\n";
+    std::cout << std::hex << "h2c_0=0x" << read_register(0x0) << ", c2h_0=0x" << read_register(0x1000) << std::dec << "\n";
 
     if (!is_bit_set(read_register(0x0), 15) || !is_bit_set(read_register(0x1000), 15)) {
         throw std::runtime_error("XDMA engines h2c_0 and/or c2h_0 are not streaming engines!");
@@ -173,75 +185,150 @@ uint32_t xdma_device::read_register(long addr) {
     return value;
 }
 
-size_t xdma_device::write_to_engine(void* buffer, size_t size) {
-    unsigned long num_bytes_written;
-    if (!WriteFile(h2c0.h, buffer, (DWORD)size, &num_bytes_written, NULL)) {
-        throw std::runtime_error("Failed to write to stream! " + std::to_string(GetLastError()));
-    }
-
-    return num_bytes_written;
-}
+// ============ overlapped streaming ==========================================
 
-size_t xdma_device::read_from_engine(void* buffer, size_t size) {
-    unsigned long num_bytes_read;
-    if (!ReadFile(c2h0.h, buffer, (DWORD)size, &num_bytes_read, NULL)) {
-        throw std::runtime_error("Failed to read from stream! " + std::to_string(GetLastError()));
-    }
-    return num_bytes_read;
-}
-
-// ======================= main ===============================================
-
-static bool err = false;
+// page aligned DMA buffer
+struct aligned_buffer_deleter {
+    void operator()(BYTE* p) const { _aligned_free(p); }
+};
+using aligned_buffer = std::unique_ptr<BYTE, aligned_buffer_deleter>;
 
-void read(xdma_device& dev, void* buffer, const size_t size, const size_t block_size = 4096) {
+// one request of the buffer pool, OVERLAPPED first so it can be recovered from the completion
+struct io_request {
+    OVERLAPPED ov;
+    aligned_buffer buffer;
+};
 
-    size_t bytes_remaining = size;
-    try {
-        while (bytes_remaining > 0) {
-            const size_t offset = size - bytes_remaining;
-            const size_t bytes_to_read = bytes_remaining < block_size ? bytes_remaining : block_size;
-            bytes_remaining -= dev.read_from_engine((char*)buffer + offset, bytes_to_read);
+// a direction with its pool of 'depth' requests
+class stream {
+public:
+    stream(HANDLE h, bool h2c, size_t block_size, unsigned depth, bool verify)
+        : h(h), h2c(h2c), block_size(block_size), verify(verify), requests(depth) {
+        for (auto& r : requests) {
+            r.buffer.reset(static_cast<BYTE*>(_aligned_malloc(block_size, 4096)));
+            if (!r.buffer) {
+                throw std::runtime_error("Allocating the buffer pool failed");
+            }
+            memset(r.buffer.get(), 0, block_size);
         }
-    } catch (const std::exception& e) {
-        err = true;
-        std::cout << e.what();
     }
-    std::cout << "finished reading " << size - bytes_remaining << " bytes" << std::endl;
-}
-
-void write(xdma_device& dev, void* buffer, const size_t size, const size_t chunks = 1) {
 
-    const size_t chunk_size = size / chunks;
+    const char* name() const { return h2c ? "h2c_0" : "c2h_0"; }
 
-    if (size % chunks != 0) {
-        throw std::runtime_error("size not evenly divisible by chunks!");
+    // issue all requests of the pool
+    void start() {
+        for (auto& r : requests) {
+            issue(r);
+        }
     }
 
-    size_t bytes_written = 0;
-    try {
-        for (unsigned i = 0; i < chunks; ++i) {
-            bytes_written += dev.write_to_engine((char*)buffer + (i * chunk_size), chunk_size);
+    void issue(io_request& r) {
+        memset(&r.ov, 0, sizeof(r.ov));
+        BOOL ok;
+        if (h2c) {
+            if (verify) { // continue the counter where the previous request stopped
+                auto data = reinterpret_cast<uint32_t*>(r.buffer.get());
+                for (size_t i = 0; i < block_size / sizeof(uint32_t); ++i) {
+                    data[i] = write_counter++;
+                }
+            }
+            ok = WriteFile(h, r.buffer.get(), (DWORD)block_size, NULL, &r.ov);
+        } else {
+            ok = ReadFile(h, r.buffer.get(), (DWORD)block_size, NULL, &r.ov);
+        }
+        // with FILE_FLAG_OVERLAPPED, a request which completes right away is also queued to the port
+        if (!ok && GetLastError() != ERROR_IO_PENDING) {
+            throw std::runtime_error(std::string(h2c ? "WriteFile" : "ReadFile") + " failed: " +
+                                     std::to_string(GetLastError()));
+        }
+        outstanding++;
+    }
 
+    // account a completed request, returns false if the received data is not the counter
+    bool complete(io_request& r, DWORD num_bytes) {
+        outstanding--;
+        total_bytes += num_bytes;
+        interval_bytes += num_bytes;
+        if (!h2c && first_block.empty() && num_bytes > 0) {
+            first_block.assign(r.buffer.get(), r.buffer.get() + num_bytes);
         }
-    } catch (const std::exception& e) {
-        err = true;
-        std::cout << e.what();
+        if (!verify || h2c) {
+            return true;
+        }
+        // bytes of a little-endian 32-bit counter continuing across requests
+        const BYTE* data = r.buffer.get();
+        for (DWORD i = 0; i < num_bytes; ++i, ++read_offset) {
+            const uint32_t expected = static_cast<uint32_t>(read_offset / 4);
+            if (data[i] != static_cast<BYTE>(expected >> (8 * (read_offset % 4)))) {
+                std::cout << "Data mismatch at stream offset " << read_offset << "\n";
+                return false;
+            }
+        }
+        return true;
     }
-    std::cout << "finished writing " << bytes_written << " bytes" << std::endl;
-}
 
-int __cdecl main() {
+    uint64_t take_interval_bytes() {
+        const auto bytes = interval_bytes;
+        interval_bytes = 0;
+        return bytes;
+    }
 
-    constexpr size_t num_dma_blocks = 40;
-    constexpr size_t dma_block_size = 0x1000; // 4kB
-    constexpr size_t num_uint32_per_block = dma_block_size / sizeof(uint32_t);
-    constexpr size_t array_size = num_uint32_per_block * num_dma_blocks;
+    HANDLE h;
+    const bool h2c;
+    const size_t block_size;
+    const bool verify;
+    std::vector<io_request> requests;
+    unsigned outstanding = 0;
+    uint64_t total_bytes = 0;
+    uint64_t interval_bytes = 0;
+    uint32_t write_counter = 0;
+    uint64_t read_offset = 0;
+    std::vector<BYTE> first_block;
+};
 
-    alignas(128) std::array<uint32_t, array_size> write_data;
-    alignas(128) std::array<uint32_t, array_size> read_data = { { 0 } };
+static double megabytes_per_second(uint64_t bytes, double seconds) {
+    return seconds > 0 ? bytes / seconds / 1e6 : 0.0;
+}
 
-    std::iota(std::begin(write_data), std::end(write_data), 0);
+// ======================= main ===============================================
+
+int __cdecl main(int argc, char* argv[]) {
+
+    size_t block_size = 64 * 1024;
+    unsigned depth = 8;
+    double run_time = 5.0;
+    bool use_h2c = true;
+    bool use_c2h = true;
+    bool verify = false;
+    bool print = false;
+
+    for (int i = 1; i < argc; ++i) {
+        const std::string opt = argv[i];
+        const bool has_value = (i + 1 < argc);
+        if (opt == "-b" && has_value) {
+            block_size = std::stoul(argv[++i], nullptr, 0);
+        } else if (opt == "-q" && has_value) {
+            depth = std::stoul(argv[++i], nullptr, 0);
+        } else if (opt == "-t" && has_value) {
+            run_time = std::stod(argv[++i]);
+        } else if (opt == "-d" && has_value) {
+            const std::string dir = argv[++i];
+            use_h2c = (dir == "h2c" || dir == "both");
+            use_c2h = (dir == "c2h" || dir == "both");
+        } else if (opt == "-v") {
+            verify = true;
+        } else if (opt == "-p") {
+            print = true;
+        } else {
+            std::cout << help_text;
+            return 0;
+        }
+    }
+    if (block_size == 0 || block_size > MAXDWORD || depth == 0 || (!use_h2c && !use_c2h) ||
+        (verify && (block_size % sizeof(uint32_t) != 0))) {
+        std::cout << help_text;
+        return 0;
+    }
 
     try {
         const auto device_paths = get_device_paths(GUID_DEVINTERFACE_XDMA);
@@ -251,19 +338,102 @@ int __cdecl main() {
 
         xdma_device dev(device_paths[0]);
 
-        std::thread read_thread(read, std::ref(dev),
-            (void*)read_data.data(), read_data.size() * sizeof(uint32_t), dma_block_size*32);
-        std::thread write_thread(write, std::ref(dev),
-            (void*)write_data.data(), write_data.size() * sizeof(uint32_t), 40);
+        // both directions complete on one port, the completion key is the index into 'streams'
+        std::vector<std::unique_ptr<stream>> streams;
+        if (use_h2c) {
+            streams.emplace_back(new stream(dev.h2c(), true, block_size, depth, verify));
+        }
+        if (use_c2h) {
+            streams.emplace_back(new stream(dev.c2h(), false, block_size, depth, verify));
+        }
+        HANDLE port = NULL;
+        for (ULONG_PTR key = 0; key < streams.size(); ++key) {
+            port = CreateIoCompletionPort(streams[key]->h, port, key, 1);
+            if (port == NULL) {
+                throw std::runtime_error("CreateIoCompletionPort failed: " + std::to_string(GetLastError()));
+            }
+        }
 
-        write_thread.join();
-        read_thread.join();
+        std::cout << "Streaming " << block_size << " byte blocks, " << depth
+                  << " outstanding requests per direction for " << run_time << "s\n";
+        std::cout << std::fixed << std::setprecision(1);
 
-        if (!err) {
-            print_bytes(0, (BYTE*)read_data.data(), read_data.size() * sizeof(uint32_t));
+        using clock = std::chrono::steady_clock;
+        const auto start = clock::now();
+        const auto deadline = start + std::chrono::duration_cast<clock::duration>(std::chrono::duration<double>(run_time));
+        auto next_report = start + std::chrono::seconds(1);
+        for (auto& s : streams) {
+            s->start();
+        }
+
+        bool ok = true;
+        bool reads_cancelled = false;
+        for (;;) {
+            unsigned outstanding = 0;
+            for (auto& s : streams) {
+                outstanding += s->outstanding;
+            }
+            if (outstanding == 0) {
+                break;
+            }
+            const auto now = clock::now();
+            const bool stopping = (now >= deadline) || !ok;
+
+            // once no more data is written, a read would wait for data which never comes
+            if (stopping && use_c2h && !reads_cancelled && (!use_h2c || streams[0]->outstanding == 0)) {
+                CancelIoEx(dev.c2h(), NULL);
+                reads_cancelled = true;
+            }
+            if (now >= next_report) {
+                std::cout << "[" << std::setw(5) << std::chrono::duration<double>(now - start).count() << "s]";
+                for (auto& s : streams) {
+                    std::cout << "  " << s->name() << " " << std::setw(8)
+                              << megabytes_per_second(s->take_interval_bytes(), 1.0) << " MB/s";
+                }
+                std::cout << std::endl;
+                next_report += std::chrono::seconds(1);
+            }
+
+            DWORD num_bytes = 0;
+            ULONG_PTR key = 0;
+            OVERLAPPED* ov = NULL;
+            const BOOL completed = GetQueuedCompletionStatus(port, &num_bytes, &key, &ov, 100);
+            if (ov == NULL) {
+                if (GetLastError() != WAIT_TIMEOUT) {
+                    throw std::runtime_error("GetQueuedCompletionStatus failed: " + std::to_string(GetLastError()));
+                }
+                continue;
+            }
+            stream& s = *streams[key];
+            io_request& r = *CONTAINING_RECORD(ov, io_request, ov);
+            if (!completed) {
+                const DWORD error = GetLastError();
+                if (error != ERROR_OPERATION_ABORTED || !reads_cancelled) {
+                    throw std::runtime_error(std::string(s.name()) + " request failed: " + std::to_string(error));
+                }
+            }
+            ok = s.complete(r, num_bytes) && ok;
+            if (ok && !stopping) {
+                s.issue(r);
+            }
+        }
+        const double elapsed = std::chrono::duration<double>(clock::now() - start).count();
+        CloseHandle(port);
+
+        for (auto& s : streams) {
+            std::cout << s->name() << ": " << s->total_bytes << " bytes in " << elapsed << "s, "
+                      << megabytes_per_second(s->total_bytes, elapsed) << " MB/s sustained\n";
+        }
+        if (verify) {
+            std::cout << (ok ? "Received data matches the counter written to h2c_0\n" : "Data mismatch!\n");
+        }
+        if (print && use_c2h) {
+            print_bytes(0, streams.back()->first_block.data(), streams.back()->first_block.size());
         }
+        return ok ? 0 : -1;
 
     } catch (const std::exception& e) {
-        std::cout << e.what();
+        std::cout << e.what() << "\n";
+        return -1;
     }
 }
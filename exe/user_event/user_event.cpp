@@ -51,6 +51,13 @@ public:
         return buffer;
     }
 
+    void ioctl(DWORD code, void* in, DWORD in_size, void* out, DWORD out_size) {
+        unsigned long num_bytes_returned;
+        if (!DeviceIoControl(h, code, in, in_size, out, out_size, &num_bytes_returned, NULL)) {
+            throw std::runtime_error("DeviceIoControl failed: " + get_windows_error_msg());
+        }
+    }
+
 private:
     HANDLE h;
 };
@@ -95,10 +102,41 @@ static std::vector<std::string> get_device_paths(GUID guid) {
     return device_paths;
 }
 
-int __cdecl main(int, char* argv[]) {
+static void wait_on_events(const std::string& dev_path, uint32_t mask) {
+
+    // a single 'events' device file waits on all selected events at once
+    device_file events(dev_path + "\\events", GENERIC_READ | GENERIC_WRITE);
+    events.ioctl(IOCTL_XDMA_EVENTS_SET_MASK, &mask, sizeof(mask), NULL, 0);
+    std::cout << "Waiting on event mask 0x" << std::hex << mask << std::dec << "...\n";
+
+    while (true) {
+        auto data = events.read<XDMA_EVENTS_DATA>(0); // this blocks in driver until any event is triggered
+        for (unsigned event_id = 0; event_id < XDMA_MAX_USER_EVENTS; ++event_id) {
+            if (data.firedMask & (1 << event_id)) {
+                const auto time_us = (double)data.timestamp[event_id] * 1e6 / (double)data.frequency;
+                std::cout << "event_" << event_id << " received! count=" << data.count[event_id]
+                    << " time=" << std::fixed << time_us << "us\n";
+            }
+        } // else timed out, so try again
+    }
+}
+
+int __cdecl main(int argc, char* argv[]) {
 
     try {
         std::cout << argv[0] << "\n";
+
+        if ((argc == 3) && (std::string(argv[1]) == "-m")) {
+            const auto dev_paths = get_device_paths(GUID_DEVINTERFACE_XDMA);
+            if (dev_paths.empty()) {
+                throw std::runtime_error("No XDMA device driver installed!");
+            }
+            std::cout << "This application opens the 'events' device file and waits on any of the selected events to be triggered.\n";
+            std::cout << "This application loops indefinitely. To exit press CTRL-C.\n";
+            wait_on_events(dev_paths[0], std::stoul(argv[2], nullptr, 0));
+            return 0;
+        }
+
         std::cout << "This application opens all user event device files (event_0 to event_15) and waits on an event to be triggered.\n";
         std::cout << "When an event is triggered, a corresponding message is printed to the terminal.\n";
         std::cout << "This application loops indefinitely. To exit press CTRL-C.\n";
@@ -0,0 +1,56 @@
+#pragma once
+
+// Device abstraction of xdma_bench. xdma_bench.cpp only talks to these interfaces; the driver
+// backend (device_windows.cpp) and the software model backend (device_model.cpp) implement them.
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <string>
+
+enum class direction { h2c = 0, c2h = 1 };
+enum class completion_mode { interrupt = 0, poll = 1 };
+
+// One DMA engine with 'depth' host buffers ("slots") of equal size.
+class bench_channel {
+public:
+    virtual ~bench_channel() = default;
+
+    // start transferring the whole buffer of 'slot' to/from card address 'card_offset'
+    virtual void submit(unsigned slot, uint64_t card_offset) = 0;
+
+    // wait for the oldest outstanding transfer and return its slot. Throws if it failed.
+    virtual unsigned wait() = 0;
+};
+
+class bench_device {
+public:
+    virtual ~bench_device() = default;
+
+    virtual std::string name() const = 0;
+
+    virtual unsigned num_channels(direction dir) const = 0;
+
+    // select how the completion of transfers on an engine is detected. The engine may be open,
+    // but must have no transfer outstanding; the mode stays when its channels are closed.
+    virtual void set_mode(direction dir, unsigned channel, completion_mode mode) = 0;
+
+    // the channel is used by a single thread, different channels by different threads
+    virtual std::unique_ptr<bench_channel> open(direction dir, unsigned channel, size_t size,
+                                                unsigned depth) = 0;
+
+    // pin the threads the backend runs on its own to 'cpu'; the model has one which executes
+    // the descriptors, the driver backend has none
+    virtual void pin_threads(unsigned cpu) {
+        (void)cpu;
+    }
+};
+
+// the backend linked into the executable
+std::unique_ptr<bench_device> open_device();
+
+// user + kernel time consumed by the process so far
+double process_cpu_seconds();
+
+// pin the calling thread to 'cpu', throws if that fails
+void pin_thread(unsigned cpu);
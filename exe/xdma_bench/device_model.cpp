@@ -0,0 +1,414 @@
+// xdma_bench backend for the software model of the XDMA IP (model/xdma_model.h).
+//
+// The backend does what the driver does for a read/write request: it builds the descriptor list
+// with libxdma/dma_core, programs the SGDMA and engine registers and detects the completion either
+// from the engine interrupt or by polling the writeback buffer. Requests of a channel queue up
+// like on the sequential engine queue of the driver. A separate thread runs the model, so the
+// "card" makes progress independently of the threads which submit and wait.
+
+#include <condition_variable>
+#include <cstdlib>
+#include <cstring>
+#include <deque>
+#include <mutex>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <pthread.h>
+#include <sys/resource.h>
+
+#include "bench_device.h"
+#include "dma_core.h"
+#include "xdma_model.h"
+
+namespace {
+
+const size_t page_size = 4096;
+
+void pin(pthread_t thread, unsigned cpu) {
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    CPU_SET(cpu, &set);
+    const int error = pthread_setaffinity_np(thread, sizeof(set), &set);
+    if (error != 0) {
+        throw std::runtime_error("Pinning a thread to CPU " + std::to_string(cpu) + " failed: " +
+                                 std::strerror(error));
+    }
+}
+
+// page aligned host memory
+struct host_buffer {
+    explicit host_buffer(size_t size)
+        : data(std::aligned_alloc(page_size, (size + page_size - 1) & ~(page_size - 1))) {
+        if (data == nullptr) {
+            throw std::runtime_error("Allocating host memory failed");
+        }
+        std::memset(data, 0xA5, size);
+    }
+    ~host_buffer() { std::free(data); }
+    host_buffer(const host_buffer&) = delete;
+    host_buffer& operator=(const host_buffer&) = delete;
+    uint64_t bus() const { return reinterpret_cast<uintptr_t>(data); }
+    void* data;
+};
+
+class model_device;
+
+class model_channel : public bench_channel {
+public:
+    model_channel(model_device& device, direction dir, unsigned channel, size_t size,
+                  unsigned depth);
+    ~model_channel();
+
+    void submit(unsigned slot, uint64_t card_offset) override;
+    unsigned wait() override;
+
+private:
+    friend class model_device;
+
+    uint32_t engine_reg(size_t reg) const { return engine_base + static_cast<uint32_t>(reg); }
+    uint32_t sgdma_reg(size_t reg) const { return sgdma_base + static_cast<uint32_t>(reg); }
+
+    // all of the below are called with the model lock held
+    void set_mode(completion_mode mode);
+    void start_next();
+    void complete(bool writeback_error);
+    bool check_writeback();
+
+    struct request {
+        unsigned slot;
+        uint64_t card_offset;
+    };
+
+    model_device& device;
+    const direction dir;
+    const unsigned index;
+    const size_t size;
+    const uint32_t engine_base;
+    const uint32_t sgdma_base;
+    bool poll = false;
+    std::vector<std::unique_ptr<host_buffer>> buffers;
+    std::vector<std::vector<XDMA_SG_ELEMENT>> sg_lists;
+    std::unique_ptr<host_buffer> descriptors;
+    std::unique_ptr<host_buffer> writeback;
+
+    std::deque<request> queued;     // waiting for the engine
+    bool active = false;            // a transfer is running on the engine
+    unsigned active_slot = 0;
+    uint32_t active_descriptors = 0;
+    std::deque<unsigned> completed;
+    std::string error;
+    std::condition_variable done;
+};
+
+class model_device : public bench_device {
+public:
+    model_device() {
+        XDMA_MODEL_CONFIG config;
+        xdma_model_config_init(&config);
+        model = xdma_model_create(&config);
+        if (model == nullptr) {
+            throw std::runtime_error("xdma_model_create failed");
+        }
+        for (auto& modes : this->modes) {
+            for (auto& mode : modes) {
+                mode = completion_mode::interrupt;
+            }
+        }
+        xdma_model_set_irq(model, on_irq, this);
+        // route all channel interrupts, engines only request them in interrupt mode
+        write32(IRQ_BLOCK_OFFSET + offsetof(XDMA_IRQ_REGS, channelIntEnableW1S), 0xFF);
+        hardware = std::thread(&model_device::run_hardware, this);
+    }
+
+    ~model_device() {
+        {
+            std::lock_guard<std::mutex> l(lock);
+            stop = true;
+        }
+        work.notify_all();
+        hardware.join();
+        xdma_model_destroy(model);
+    }
+
+    std::string name() const override {
+        return "xdma_model";
+    }
+
+    unsigned num_channels(direction) const override {
+        return XDMA_MODEL_MAX_CHANNELS;
+    }
+
+    void set_mode(direction dir, unsigned channel, completion_mode mode) override {
+        std::lock_guard<std::mutex> l(lock);
+        model_channel* c = open_channels[static_cast<unsigned>(dir)][channel];
+        if (c != nullptr) { // like the IOCTL on the engine of an open device node
+            if (c->active || !c->queued.empty()) {
+                throw std::runtime_error("the engine is busy");
+            }
+            c->set_mode(mode);
+        }
+        modes[static_cast<unsigned>(dir)][channel] = mode;
+    }
+
+    std::unique_ptr<bench_channel> open(direction dir, unsigned channel, size_t size,
+                                        unsigned depth) override {
+        return std::unique_ptr<bench_channel>(new model_channel(*this, dir, channel, size, depth));
+    }
+
+    void pin_threads(unsigned cpu) override {
+        pin(hardware.native_handle(), cpu);
+    }
+
+private:
+    friend class model_channel;
+
+    uint32_t read32(uint32_t offset) { return xdma_model_read32(model, offset); }
+    void write32(uint32_t offset, uint32_t value) { xdma_model_write32(model, offset, value); }
+
+    static void on_irq(void* context, uint32_t channelPending, uint32_t userPending) {
+        // like the driver ISR: mask the fired channels until the "DPC" has serviced them
+        model_device* device = static_cast<model_device*>(context);
+        (void)userPending;
+        device->write32(IRQ_BLOCK_OFFSET + offsetof(XDMA_IRQ_REGS, channelIntEnableW1C),
+                        channelPending);
+        device->masked |= channelPending;
+    }
+
+    void service_interrupts() {
+        const uint32_t pending = masked;
+        masked = 0;
+        for (auto& channels : open_channels) {
+            for (auto* c : channels) {
+                if ((c != nullptr) && !c->poll && c->active &&
+                    !(read32(c->engine_reg(offsetof(XDMA_ENGINE_REGS, status))) & XDMA_BUSY_BIT)) {
+                    c->complete(false);
+                }
+            }
+        }
+        write32(IRQ_BLOCK_OFFSET + offsetof(XDMA_IRQ_REGS, channelIntEnableW1S), pending);
+    }
+
+    void run_hardware() {
+        std::unique_lock<std::mutex> l(lock);
+        while (!stop) {
+            const size_t processed = xdma_model_run(model);
+            if (masked != 0) {
+                service_interrupts();
+            }
+            if (processed == 0) {
+                work.wait(l, [&] { return stop || kicked || (masked != 0); });
+                kicked = false;
+            }
+        }
+    }
+
+    void kick() {
+        kicked = true;
+        work.notify_one();
+    }
+
+    XDMA_MODEL* model = nullptr;
+    std::mutex lock;                // serializes all calls into the model, see xdma_model.h
+    std::condition_variable work;   // an engine was started, an interrupt fired or stop is set
+    bool kicked = false;
+    bool stop = false;
+    uint32_t masked = 0;            // channel interrupts waiting for service_interrupts()
+    completion_mode modes[2][XDMA_MODEL_MAX_CHANNELS];
+    model_channel* open_channels[2][XDMA_MODEL_MAX_CHANNELS] = {};
+    std::thread hardware;
+};
+
+// ============= Channel ======================================================
+
+model_channel::model_channel(model_device& device, direction dir, unsigned channel, size_t size,
+                             unsigned depth)
+    : device(device), dir(dir), index(channel), size(size),
+      engine_base(static_cast<uint32_t>(dir) * BLOCK_OFFSET + channel * ENGINE_OFFSET),
+      sgdma_base(SGDMA_BLOCK_OFFSET + static_cast<uint32_t>(dir) * BLOCK_OFFSET +
+                 channel * ENGINE_OFFSET) {
+
+    if (size > XDMA_WB_COUNT_MASK * page_size) {
+        throw std::runtime_error("transfer size too large for the model");
+    }
+    const UINT32 num_pages = static_cast<UINT32>((size + page_size - 1) / page_size);
+    for (unsigned slot = 0; slot < depth; ++slot) {
+        buffers.emplace_back(new host_buffer(size));
+        std::vector<XDMA_SG_ELEMENT> sg(num_pages);
+        for (UINT32 i = 0; i < num_pages; ++i) {
+            sg[i].address = buffers.back()->bus() + i * page_size;
+            sg[i].length = static_cast<UINT32>(i + 1 < num_pages ? page_size
+                                                                  : size - i * page_size);
+            sg[i].reserved = 0;
+        }
+        sg_lists.push_back(std::move(sg));
+    }
+    descriptors.reset(new host_buffer(num_pages * sizeof(DMA_DESCRIPTOR)));
+    writeback.reset(new host_buffer(sizeof(XDMA_POLL_WB)));
+
+    std::lock_guard<std::mutex> l(device.lock);
+    if (device.open_channels[static_cast<unsigned>(dir)][channel] != nullptr) {
+        throw std::runtime_error("channel is already open");
+    }
+    device.open_channels[static_cast<unsigned>(dir)][channel] = this;
+
+    // the writeback buffer setup of the driver
+    device.write32(engine_reg(offsetof(XDMA_ENGINE_REGS, pollModeWbLo)),
+                   static_cast<uint32_t>(writeback->bus()));
+    device.write32(engine_reg(offsetof(XDMA_ENGINE_REGS, pollModeWbHi)),
+                   static_cast<uint32_t>(writeback->bus() >> 32));
+    set_mode(device.modes[static_cast<unsigned>(dir)][channel]);
+}
+
+void model_channel::set_mode(completion_mode mode) {
+    // what XDMA_EngineSetPollMode does
+    poll = (mode == completion_mode::poll);
+    if (poll) {
+        device.write32(engine_reg(offsetof(XDMA_ENGINE_REGS, controlW1S)), XDMA_CTRL_POLL_MODE);
+        device.write32(engine_reg(offsetof(XDMA_ENGINE_REGS, intEnableMaskW1C)), XDMA_CTRL_IE_ALL);
+    } else {
+        device.write32(engine_reg(offsetof(XDMA_ENGINE_REGS, controlW1C)), XDMA_CTRL_POLL_MODE);
+        device.write32(engine_reg(offsetof(XDMA_ENGINE_REGS, intEnableMaskW1S)), XDMA_CTRL_IE_ALL);
+    }
+}
+
+model_channel::~model_channel() {
+    std::unique_lock<std::mutex> l(device.lock);
+    // outstanding transfers still use the buffers
+    while (active) {
+        if (poll) {
+            check_writeback();
+            l.unlock();
+            std::this_thread::yield();
+            l.lock();
+        } else {
+            done.wait(l);
+        }
+    }
+    device.open_channels[static_cast<unsigned>(dir)][index] = nullptr;
+}
+
+void model_channel::start_next() {
+    if (active || queued.empty()) {
+        return;
+    }
+    const request r = queued.front();
+    queued.pop_front();
+
+    XDMA_DESC_PARAMS params;
+    params.streaming = FALSE;
+    params.fixedAddress = FALSE;
+    params.alignAddr = 1;
+    params.alignLength = 1;
+    params.dataPathBytes = 16; // pcieWidth of the default model configuration
+    params.mrrsBytes = 512;
+
+    XDMA_SG_VIEW sg;
+    sg.elements = sg_lists[r.slot].data();
+    sg.stride = sizeof(XDMA_SG_ELEMENT);
+    sg.numElements = static_cast<UINT32>(sg_lists[r.slot].size());
+
+    DMA_DESCRIPTOR* desc = static_cast<DMA_DESCRIPTOR*>(descriptors->data);
+    UINT32 misaligned;
+    DescriptorBuildList(&params, desc, descriptors->bus(), r.card_offset, dir == direction::h2c,
+                        &sg, &misaligned);
+    const UINT32 first_adj = DescriptorOptimizeList(&params, desc, sg.numElements,
+                                                    static_cast<UINT32>(descriptors->bus()));
+
+    static_cast<XDMA_POLL_WB*>(writeback->data)->completedDescCount = 0;
+    device.write32(sgdma_reg(offsetof(XDMA_SGDMA_REGS, firstDescLo)),
+                   static_cast<uint32_t>(descriptors->bus()));
+    device.write32(sgdma_reg(offsetof(XDMA_SGDMA_REGS, firstDescHi)),
+                   static_cast<uint32_t>(descriptors->bus() >> 32));
+    device.write32(sgdma_reg(offsetof(XDMA_SGDMA_REGS, firstDescAdj)), first_adj);
+    device.write32(engine_reg(offsetof(XDMA_ENGINE_REGS, controlW1S)), XDMA_CTRL_RUN_BIT);
+
+    active = true;
+    active_slot = r.slot;
+    active_descriptors = sg.numElements;
+    device.kick();
+}
+
+void model_channel::complete(bool writeback_error) {
+    const uint32_t status = device.read32(engine_reg(offsetof(XDMA_ENGINE_REGS, statusRC)));
+    device.write32(engine_reg(offsetof(XDMA_ENGINE_REGS, controlW1C)), XDMA_CTRL_RUN_BIT);
+    active = false;
+    if ((status & XDMA_STAT_EXPECTED_ZERO) || writeback_error) {
+        std::ostringstream msg;
+        msg << "transfer failed, engine status 0x" << std::hex << status;
+        error = msg.str();
+        queued.clear();
+    } else {
+        completed.push_back(active_slot);
+        start_next();
+    }
+    done.notify_one();
+}
+
+bool model_channel::check_writeback() {
+    // EnginePollTransfer: the engine writes the completed descriptor count to host memory
+    const auto* wb = static_cast<const XDMA_POLL_WB*>(writeback->data);
+    switch (WritebackCheck(wb->completedDescCount, active_descriptors)) {
+    case XDMA_WB_PENDING:
+        return false;
+    case XDMA_WB_DONE:
+        complete(false);
+        return true;
+    default:
+        complete(true);
+        return true;
+    }
+}
+
+void model_channel::submit(unsigned slot, uint64_t card_offset) {
+    std::lock_guard<std::mutex> l(device.lock);
+    if (!error.empty()) {
+        throw std::runtime_error(error);
+    }
+    queued.push_back(request{ slot, card_offset });
+    start_next();
+}
+
+unsigned model_channel::wait() {
+    std::unique_lock<std::mutex> l(device.lock);
+    if (poll) {
+        while (completed.empty() && error.empty()) {
+            if (active && check_writeback()) {
+                continue;
+            }
+            l.unlock();
+            std::this_thread::yield();
+            l.lock();
+        }
+    } else {
+        done.wait(l, [&] { return !completed.empty() || !error.empty(); });
+    }
+    if (completed.empty()) {
+        throw std::runtime_error(error);
+    }
+    const unsigned slot = completed.front();
+    completed.pop_front();
+    return slot;
+}
+
+} // namespace
+
+std::unique_ptr<bench_device> open_device() {
+    return std::unique_ptr<bench_device>(new model_device());
+}
+
+double process_cpu_seconds() {
+    struct rusage usage;
+    if (getrusage(RUSAGE_SELF, &usage) != 0) {
+        return 0.0;
+    }
+    const auto to_seconds = [](const struct timeval& t) { return t.tv_sec + t.tv_usec * 1e-6; };
+    return to_seconds(usage.ru_utime) + to_seconds(usage.ru_stime);
+}
+
+void pin_thread(unsigned cpu) {
+    pin(pthread_self(), cpu);
+}
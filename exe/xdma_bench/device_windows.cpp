@@ -0,0 +1,268 @@
+// xdma_bench backend for the XDMA driver: one overlapped file handle per channel, and one handle
+// per engine for the completion mode which stays open as long as the device.
+
+#include <deque>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#define NOMINMAX
+#include <Windows.h>
+#include <SetupAPI.h>
+#include <INITGUID.H>
+
+#include "xdma_public.h"
+#include "bench_device.h"
+
+#pragma comment(lib, "setupapi.lib")
+
+static std::string get_windows_error_msg(DWORD error) {
+
+    char msg_buffer[256];
+    FormatMessageA(FORMAT_MESSAGE_FROM_SYSTEM, NULL, error,
+                   MAKELANGID(LANG_NEUTRAL, SUBLANG_DEFAULT), (LPSTR)&msg_buffer, 256, NULL);
+    return{ msg_buffer, 256 };
+}
+
+static std::vector<std::string> get_device_paths(GUID guid) {
+
+    auto device_info = SetupDiGetClassDevs((LPGUID)&guid, NULL, NULL, DIGCF_PRESENT | DIGCF_DEVICEINTERFACE);
+    if (device_info == INVALID_HANDLE_VALUE) {
+        throw std::runtime_error("GetDevices INVALID_HANDLE_VALUE");
+    }
+
+    SP_DEVICE_INTERFACE_DATA device_interface = { 0 };
+    device_interface.cbSize = sizeof(SP_DEVICE_INTERFACE_DATA);
+
+    // enumerate through devices
+    std::vector<std::string> device_paths;
+    for (unsigned index = 0;
+         SetupDiEnumDeviceInterfaces(device_info, NULL, &guid, index, &device_interface);
+         ++index) {
+
+        // get required buffer size
+        unsigned long detail_length = 0;
+        if (!SetupDiGetDeviceInterfaceDetail(device_info, &device_interface, NULL, 0, &detail_length, NULL) && GetLastError() != ERROR_INSUFFICIENT_BUFFER) {
+            throw std::runtime_error("SetupDiGetDeviceInterfaceDetail - get length failed");
+        }
+
+        // allocate space for device interface detail
+        auto dev_detail = reinterpret_cast<PSP_DEVICE_INTERFACE_DETAIL_DATA>(new char[detail_length]);
+        dev_detail->cbSize = sizeof(SP_DEVICE_INTERFACE_DETAIL_DATA);
+
+        // get device interface detail
+        if (!SetupDiGetDeviceInterfaceDetail(device_info, &device_interface, dev_detail, detail_length, NULL, NULL)) {
+            delete[] dev_detail;
+            throw std::runtime_error("SetupDiGetDeviceInterfaceDetail - get detail failed");
+        }
+        device_paths.emplace_back(dev_detail->DevicePath);
+        delete[] dev_detail;
+    }
+
+    SetupDiDestroyDeviceInfoList(device_info);
+
+    return device_paths;
+}
+
+static std::string node_name(direction dir, unsigned channel) {
+    return std::string(dir == direction::h2c ? "\\h2c_" : "\\c2h_") + std::to_string(channel);
+}
+
+// ============= Channel ======================================================
+
+class driver_channel : public bench_channel {
+public:
+    driver_channel(const std::string& path, direction dir, size_t size, unsigned depth)
+        : dir(dir), size(size), slots(depth) {
+        if (size > MAXDWORD) {
+            throw std::runtime_error("transfer size exceeds 4 GB");
+        }
+        h = CreateFile(path.c_str(), GENERIC_READ | GENERIC_WRITE, 0, NULL, OPEN_EXISTING,
+                       FILE_ATTRIBUTE_NORMAL | FILE_FLAG_OVERLAPPED, NULL);
+        if (h == INVALID_HANDLE_VALUE) {
+            throw std::runtime_error("Opening " + path + " failed: " +
+                                     get_windows_error_msg(GetLastError()));
+        }
+        for (auto& s : slots) {
+            s.buffer = _aligned_malloc(size, 4096);
+            s.ov.hEvent = CreateEvent(NULL, TRUE, FALSE, NULL);
+            if (s.buffer == nullptr || s.ov.hEvent == NULL) {
+                release();
+                throw std::runtime_error("Allocating transfer buffers failed");
+            }
+            memset(s.buffer, 0xA5, size);
+        }
+    }
+
+    ~driver_channel() {
+        // let outstanding transfers finish before their buffers are freed
+        for (auto slot : outstanding) {
+            DWORD num_bytes;
+            GetOverlappedResult(h, &slots[slot].ov, &num_bytes, TRUE);
+        }
+        release();
+    }
+
+    void submit(unsigned slot, uint64_t card_offset) override {
+        auto& s = slots[slot];
+        ResetEvent(s.ov.hEvent);
+        s.ov.Offset = static_cast<DWORD>(card_offset);
+        s.ov.OffsetHigh = static_cast<DWORD>(card_offset >> 32);
+        const BOOL ok = (dir == direction::h2c)
+            ? WriteFile(h, s.buffer, static_cast<DWORD>(size), NULL, &s.ov)
+            : ReadFile(h, s.buffer, static_cast<DWORD>(size), NULL, &s.ov);
+        if (!ok && GetLastError() != ERROR_IO_PENDING) {
+            throw std::runtime_error(std::string(dir == direction::h2c ? "WriteFile" : "ReadFile") +
+                                     " failed: " + get_windows_error_msg(GetLastError()));
+        }
+        outstanding.push_back(slot);
+    }
+
+    unsigned wait() override {
+        // the engine queue of the driver is sequential, transfers complete in submission order
+        const unsigned slot = outstanding.front();
+        outstanding.pop_front();
+        DWORD num_bytes = 0;
+        if (!GetOverlappedResult(h, &slots[slot].ov, &num_bytes, TRUE)) {
+            throw std::runtime_error("Transfer failed: " + get_windows_error_msg(GetLastError()));
+        }
+        if (num_bytes != size) {
+            throw std::runtime_error("Transfer incomplete: " + std::to_string(num_bytes) + " of " +
+                                     std::to_string(size) + " bytes");
+        }
+        return slot;
+    }
+
+private:
+    struct slot {
+        void* buffer = nullptr;
+        OVERLAPPED ov = {};
+    };
+
+    void release() {
+        for (auto& s : slots) {
+            _aligned_free(s.buffer);
+            if (s.ov.hEvent != NULL) {
+                CloseHandle(s.ov.hEvent);
+            }
+        }
+        CloseHandle(h);
+    }
+
+    HANDLE h;
+    direction dir;
+    size_t size;
+    std::vector<slot> slots;
+    std::deque<unsigned> outstanding;
+};
+
+// ============= Device =======================================================
+
+class driver_device : public bench_device {
+public:
+    driver_device() {
+        const auto dev_paths = get_device_paths(GUID_DEVINTERFACE_XDMA);
+        if (dev_paths.empty()) {
+            throw std::runtime_error("No XDMA device driver installed!");
+        }
+        base_path = dev_paths[0];
+        for (auto& handles : mode_handles) {
+            for (auto& h : handles) {
+                h = INVALID_HANDLE_VALUE;
+            }
+        }
+
+        // the driver refuses to open the nodes of engines the design does not have
+        for (unsigned d = 0; d < 2; ++d) {
+            channels[d] = 0;
+            for (unsigned ch = 0; ch < 4; ++ch) {
+                HANDLE h = CreateFile((base_path + node_name(static_cast<direction>(d), ch)).c_str(),
+                                      GENERIC_READ | GENERIC_WRITE, 0, NULL, OPEN_EXISTING,
+                                      FILE_ATTRIBUTE_NORMAL, NULL);
+                if (h == INVALID_HANDLE_VALUE) {
+                    break;
+                }
+                CloseHandle(h);
+                channels[d]++;
+            }
+        }
+    }
+
+    ~driver_device() {
+        for (auto& handles : mode_handles) {
+            for (HANDLE h : handles) {
+                if (h != INVALID_HANDLE_VALUE) {
+                    CloseHandle(h);
+                }
+            }
+        }
+    }
+
+    std::string name() const override {
+        return base_path;
+    }
+
+    unsigned num_channels(direction dir) const override {
+        return channels[static_cast<unsigned>(dir)];
+    }
+
+    void set_mode(direction dir, unsigned channel, completion_mode mode) override {
+        // The IOCTL goes to a handle which stays open, so the mode also changes while the engine
+        // has open handles - opening the node sets up the interrupt of the engine for the current
+        // mode, which would hide a driver that fails to switch it on the fly.
+        if (channel >= num_channels(dir)) {
+            throw std::runtime_error("The device has no " + node_name(dir, channel).substr(1) + " engine");
+        }
+        HANDLE& h = mode_handles[static_cast<unsigned>(dir)][channel];
+        if (h == INVALID_HANDLE_VALUE) {
+            const auto path = base_path + node_name(dir, channel);
+            h = CreateFile(path.c_str(), GENERIC_READ | GENERIC_WRITE, 0, NULL, OPEN_EXISTING,
+                           FILE_ATTRIBUTE_NORMAL, NULL);
+            if (h == INVALID_HANDLE_VALUE) {
+                throw std::runtime_error("Opening " + path + " failed: " +
+                                         get_windows_error_msg(GetLastError()));
+            }
+        }
+        UINT32 value = (mode == completion_mode::poll) ? XDMA_COMPLETION_POLL : XDMA_COMPLETION_INTERRUPT;
+        DWORD num_bytes_returned;
+        const BOOL ok = DeviceIoControl(h, IOCTL_XDMA_POLL_MODE_SET, &value, sizeof(value), NULL, 0,
+                                        &num_bytes_returned, NULL);
+        const DWORD error = GetLastError();
+        // AXI-ST c2h engines keep the installed mode, which is interrupt mode by default
+        if (!ok && !((error == ERROR_NOT_SUPPORTED) && (mode == completion_mode::interrupt))) {
+            throw std::runtime_error("IOCTL_XDMA_POLL_MODE_SET failed: " + get_windows_error_msg(error));
+        }
+    }
+
+    std::unique_ptr<bench_channel> open(direction dir, unsigned channel, size_t size,
+                                        unsigned depth) override {
+        return std::unique_ptr<bench_channel>(
+            new driver_channel(base_path + node_name(dir, channel), dir, size, depth));
+    }
+
+private:
+    std::string base_path;
+    unsigned channels[2];
+    HANDLE mode_handles[2][4];  // opened by the first set_mode() of an engine
+};
+
+std::unique_ptr<bench_device> open_device() {
+    return std::unique_ptr<bench_device>(new driver_device());
+}
+
+double process_cpu_seconds() {
+    FILETIME creation, exit, kernel, user;
+    if (!GetProcessTimes(GetCurrentProcess(), &creation, &exit, &kernel, &user)) {
+        return 0.0;
+    }
+    const auto to_seconds = [](const FILETIME& t) {
+        return ((static_cast<uint64_t>(t.dwHighDateTime) << 32) | t.dwLowDateTime) * 100e-9;
+    };
+    return to_seconds(kernel) + to_seconds(user);
+}
+
+void pin_thread(unsigned cpu) {
+    if (cpu >= 64 || SetThreadAffinityMask(GetCurrentThread(), 1ULL << cpu) == 0) {
+        throw std::runtime_error("Pinning a thread to CPU " + std::to_string(cpu) + " failed");
+    }
+}
@@ -0,0 +1,513 @@
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <mutex>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "bench_device.h"
+
+static const char* help_text =
+"xdma_bench.exe measures DMA throughput and latency over a sweep of transfer configurations.\n"
+"\n"
+"Usage: xdma_bench.exe [options]\n"
+"\n"
+"  -s <sizes>    transfer sizes in bytes, K and M suffixes allowed (default 64,256,1K,...,64M)\n"
+"                a range a-b selects every power of two from a to b\n"
+"  -q <depths>   outstanding transfers per channel (default 1,8)\n"
+"  -c <counts>   number of channels used at the same time (default 1)\n"
+"  -d <dirs>     h2c, c2h and/or bidir - h2c and c2h together (default h2c,c2h)\n"
+"  -m <modes>    int and/or poll completion (default int,poll)\n"
+"  -t <seconds>  duration of each configuration (default 1)\n"
+"  -a <address>  card address of all transfers (default 0)\n"
+"  -f <format>   table, csv or json (default table)\n"
+"  -o <file>     write the results to a file instead of stdout\n"
+"\n"
+"Lists are comma separated, every combination is measured. Each channel is driven by its own\n"
+"thread which keeps the given number of transfers outstanding. Latency is measured from\n"
+"submission to completion, so it includes the time a transfer waits behind the others.\n"
+"CPU utilization is the process CPU time divided by the run time, 100% = one core busy.\n"
+"\n"
+"The completion mode is switched with IOCTL_XDMA_POLL_MODE_SET after the channels of a\n"
+"configuration are opened, on a handle which stays open for the whole run, so the transfers\n"
+"measure an engine switched on the fly. Engines are switched back to interrupt mode when a\n"
+"sweep that used poll mode ends.\n"
+"\n"
+"Built on Linux, the tool runs against the software model of the XDMA IP (model/), which\n"
+"executes the descriptors on a thread of its own - its CPU time is included.\n";
+
+// ============= Configuration ================================================
+
+struct config {
+    direction dir;
+    bool bidir;
+    unsigned channels;
+    unsigned depth;
+    size_t size;
+    completion_mode mode;
+};
+
+struct result {
+    config cfg;
+    uint64_t ops;
+    uint64_t bytes;
+    double seconds;
+    double cpu_seconds;
+    double lat_us[5]; // mean, p50, p99, p99.9, max
+};
+
+static const size_t max_buffer_memory = 1ULL << 30; // host buffers of one configuration
+
+static std::vector<std::string> split(const std::string& s) {
+    std::vector<std::string> items;
+    std::stringstream ss(s);
+    std::string item;
+    while (std::getline(ss, item, ',')) {
+        if (!item.empty()) {
+            items.push_back(item);
+        }
+    }
+    return items;
+}
+
+static uint64_t parse_number(const std::string& s) {
+    size_t pos = 0;
+    uint64_t value = std::stoull(s, &pos, 0);
+    if (pos < s.size()) {
+        const char suffix = s[pos];
+        if (suffix == 'K' || suffix == 'k') {
+            value <<= 10;
+        } else if (suffix == 'M' || suffix == 'm') {
+            value <<= 20;
+        } else {
+            throw std::invalid_argument("invalid number " + s);
+        }
+        if (pos + 1 != s.size()) {
+            throw std::invalid_argument("invalid number " + s);
+        }
+    }
+    return value;
+}
+
+static std::vector<size_t> parse_sizes(const std::string& s) {
+    std::vector<size_t> sizes;
+    for (const auto& item : split(s)) {
+        const auto dash = item.find('-');
+        if (dash == std::string::npos) {
+            sizes.push_back(static_cast<size_t>(parse_number(item)));
+            continue;
+        }
+        const auto first = parse_number(item.substr(0, dash));
+        const auto last = parse_number(item.substr(dash + 1));
+        if (first == 0 || first > last) {
+            throw std::invalid_argument("invalid size range " + item);
+        }
+        for (uint64_t size = first; size <= last; size *= 2) {
+            sizes.push_back(static_cast<size_t>(size));
+        }
+    }
+    for (auto size : sizes) {
+        if (size == 0) {
+            throw std::invalid_argument("transfer size must not be 0");
+        }
+    }
+    return sizes;
+}
+
+static std::vector<unsigned> parse_counts(const std::string& s) {
+    std::vector<unsigned> counts;
+    for (const auto& item : split(s)) {
+        const auto value = parse_number(item);
+        if (value == 0 || value > 1024) {
+            throw std::invalid_argument("invalid count " + item);
+        }
+        counts.push_back(static_cast<unsigned>(value));
+    }
+    return counts;
+}
+
+static const char* dir_name(const config& cfg) {
+    return cfg.bidir ? "bidir" : (cfg.dir == direction::h2c ? "h2c" : "c2h");
+}
+
+static const char* mode_name(completion_mode mode) {
+    return mode == completion_mode::poll ? "poll" : "int";
+}
+
+// ============= Measurement ==================================================
+
+struct worker {
+    std::unique_ptr<bench_channel> channel;
+    unsigned depth;
+    size_t size;
+    uint64_t card_offset;
+    std::vector<uint64_t> latencies_ns;
+    std::string error;
+};
+
+// start signal and deadline shared by the workers of one configuration
+struct run_control {
+    std::mutex lock;
+    std::condition_variable cv;
+    unsigned ready = 0;
+    bool go = false;
+    std::chrono::steady_clock::time_point deadline;
+};
+
+static void run_worker(worker& w, run_control& rc) {
+    using clock = std::chrono::steady_clock;
+    try {
+        // warm-up: one round over all slots, then wait for the start signal
+        for (unsigned slot = 0; slot < w.depth; ++slot) {
+            w.channel->submit(slot, w.card_offset);
+        }
+        for (unsigned i = 0; i < w.depth; ++i) {
+            w.channel->wait();
+        }
+    } catch (const std::exception& e) {
+        w.error = e.what();
+    }
+    std::unique_lock<std::mutex> l(rc.lock);
+    rc.ready++;
+    rc.cv.notify_all();
+    rc.cv.wait(l, [&] { return rc.go; });
+    const auto deadline = rc.deadline;
+    l.unlock();
+    if (!w.error.empty()) {
+        return;
+    }
+
+    try {
+        std::vector<clock::time_point> submitted(w.depth);
+        for (unsigned slot = 0; slot < w.depth; ++slot) {
+            submitted[slot] = clock::now();
+            w.channel->submit(slot, w.card_offset);
+        }
+        unsigned outstanding = w.depth;
+        while (outstanding > 0) {
+            const unsigned slot = w.channel->wait();
+            const auto now = clock::now();
+            w.latencies_ns.push_back(static_cast<uint64_t>(
+                std::chrono::duration_cast<std::chrono::nanoseconds>(now - submitted[slot]).count()));
+            if (now < deadline) {
+                submitted[slot] = now;
+                w.channel->submit(slot, w.card_offset);
+            } else {
+                outstanding--;
+            }
+        }
+    } catch (const std::exception& e) {
+        w.error = e.what();
+    }
+}
+
+static result measure(bench_device& device, const config& cfg, double duration, uint64_t address) {
+    std::vector<worker> workers;
+    for (unsigned d = 0; d < 2; ++d) {
+        const auto dir = static_cast<direction>(d);
+        if (!cfg.bidir && dir != cfg.dir) {
+            continue;
+        }
+        for (unsigned ch = 0; ch < cfg.channels; ++ch) {
+            worker w;
+            w.channel = device.open(dir, ch, cfg.size, cfg.depth);
+            device.set_mode(dir, ch, cfg.mode); // on the open engine, see -m
+            w.depth = cfg.depth;
+            w.size = cfg.size;
+            w.card_offset = address;
+            workers.push_back(std::move(w));
+        }
+    }
+
+    run_control rc;
+    std::vector<std::thread> threads;
+    for (auto& w : workers) {
+        threads.emplace_back(run_worker, std::ref(w), std::ref(rc));
+    }
+
+    std::unique_lock<std::mutex> l(rc.lock);
+    rc.cv.wait(l, [&] { return rc.ready == workers.size(); });
+    const double cpu_start = process_cpu_seconds();
+    const auto start = std::chrono::steady_clock::now();
+    rc.deadline = start + std::chrono::duration_cast<std::chrono::steady_clock::duration>(
+        std::chrono::duration<double>(duration));
+    rc.go = true;
+    rc.cv.notify_all();
+    l.unlock();
+    for (auto& t : threads) {
+        t.join();
+    }
+    const std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+    const double cpu_seconds = process_cpu_seconds() - cpu_start;
+
+    std::vector<uint64_t> latencies;
+    for (auto& w : workers) {
+        if (!w.error.empty()) {
+            throw std::runtime_error(w.error);
+        }
+        latencies.insert(latencies.end(), w.latencies_ns.begin(), w.latencies_ns.end());
+    }
+
+    result r;
+    r.cfg = cfg;
+    r.ops = latencies.size();
+    r.bytes = r.ops * cfg.size;
+    r.seconds = elapsed.count();
+    r.cpu_seconds = cpu_seconds;
+    std::fill(std::begin(r.lat_us), std::end(r.lat_us), 0.0);
+    if (!latencies.empty()) {
+        std::sort(latencies.begin(), latencies.end());
+        uint64_t sum = 0;
+        for (auto ns : latencies) {
+            sum += ns;
+        }
+        const auto pct = [&](double p) {
+            const auto rank = static_cast<size_t>(p * static_cast<double>(latencies.size()));
+            return latencies[std::min(rank, latencies.size() - 1)] / 1000.0;
+        };
+        r.lat_us[0] = static_cast<double>(sum) / static_cast<double>(latencies.size()) / 1000.0;
+        r.lat_us[1] = pct(0.5);
+        r.lat_us[2] = pct(0.99);
+        r.lat_us[3] = pct(0.999);
+        r.lat_us[4] = latencies.back() / 1000.0;
+    }
+    return r;
+}
+
+// ============= Output =======================================================
+
+static double gbps(const result& r) {
+    return r.seconds > 0 ? static_cast<double>(r.bytes) / r.seconds / 1e9 : 0.0;
+}
+
+static double iops(const result& r) {
+    return r.seconds > 0 ? static_cast<double>(r.ops) / r.seconds : 0.0;
+}
+
+static double cpu_percent(const result& r) {
+    return r.seconds > 0 ? 100.0 * r.cpu_seconds / r.seconds : 0.0;
+}
+
+static void print_table_header(std::ostream& out) {
+    out << std::left << std::setw(6) << "dir" << std::setw(5) << "mode" << std::right
+        << std::setw(4) << "ch" << std::setw(5) << "qd" << std::setw(10) << "size"
+        << std::setw(10) << "GB/s" << std::setw(12) << "IOPS" << std::setw(8) << "cpu%"
+        << std::setw(10) << "mean us" << std::setw(10) << "p50" << std::setw(10) << "p99"
+        << std::setw(10) << "p99.9" << std::setw(10) << "max" << "\n";
+}
+
+static void print_table_row(std::ostream& out, const result& r) {
+    out << std::left << std::setw(6) << dir_name(r.cfg) << std::setw(5) << mode_name(r.cfg.mode)
+        << std::right << std::setw(4) << r.cfg.channels << std::setw(5) << r.cfg.depth
+        << std::setw(10) << r.cfg.size << std::fixed << std::setprecision(3)
+        << std::setw(10) << gbps(r) << std::setprecision(0) << std::setw(12) << iops(r)
+        << std::setprecision(1) << std::setw(8) << cpu_percent(r) << std::setprecision(2);
+    for (auto us : r.lat_us) {
+        out << std::setw(10) << us;
+    }
+    out << std::endl;
+}
+
+static void print_csv(std::ostream& out, const std::vector<result>& results) {
+    out << "dir,mode,channels,depth,size,ops,bytes,seconds,gbps,iops,cpu_percent,"
+           "lat_mean_us,lat_p50_us,lat_p99_us,lat_p999_us,lat_max_us\n";
+    out << std::setprecision(9);
+    for (const auto& r : results) {
+        out << dir_name(r.cfg) << ',' << mode_name(r.cfg.mode) << ',' << r.cfg.channels << ','
+            << r.cfg.depth << ',' << r.cfg.size << ',' << r.ops << ',' << r.bytes << ','
+            << r.seconds << ',' << gbps(r) << ',' << iops(r) << ',' << cpu_percent(r);
+        for (auto us : r.lat_us) {
+            out << ',' << us;
+        }
+        out << "\n";
+    }
+}
+
+static void print_json(std::ostream& out, const std::string& device,
+                       const std::vector<result>& results) {
+    static const char* lat_names[] = { "mean", "p50", "p99", "p99.9", "max" };
+    out << std::setprecision(9);
+    out << "{\n  \"device\": \"" << device << "\",\n  \"results\": [";
+    for (size_t i = 0; i < results.size(); ++i) {
+        const auto& r = results[i];
+        out << (i ? ",\n" : "\n") << "    {\"dir\": \"" << dir_name(r.cfg) << "\", \"mode\": \""
+            << mode_name(r.cfg.mode) << "\", \"channels\": " << r.cfg.channels
+            << ", \"depth\": " << r.cfg.depth << ", \"size\": " << r.cfg.size
+            << ", \"ops\": " << r.ops << ", \"bytes\": " << r.bytes
+            << ", \"seconds\": " << r.seconds << ", \"gbps\": " << gbps(r)
+            << ", \"iops\": " << iops(r) << ", \"cpu_percent\": " << cpu_percent(r)
+            << ", \"latency_us\": {";
+        for (unsigned j = 0; j < 5; ++j) {
+            out << (j ? ", " : "") << '"' << lat_names[j] << "\": " << r.lat_us[j];
+        }
+        out << "}}";
+    }
+    out << "\n  ]\n}\n";
+}
+
+// ============= Main =========================================================
+
+int main(int argc, char* argv[]) {
+
+    try {
+        std::vector<size_t> sizes = parse_sizes("64,256,1K,4K,16K,64K,256K,1M,4M,16M,64M");
+        std::vector<unsigned> depths = { 1, 8 };
+        std::vector<unsigned> channel_counts = { 1 };
+        std::vector<std::string> dirs = { "h2c", "c2h" };
+        std::vector<completion_mode> modes = { completion_mode::interrupt, completion_mode::poll };
+        double duration = 1.0;
+        uint64_t address = 0;
+        std::string format = "table";
+        std::string output_path;
+
+        for (int i = 1; i < argc; ++i) {
+            const std::string opt = argv[i];
+            if (opt.size() != 2 || opt[0] != '-' || i + 1 >= argc) {
+                std::cout << help_text;
+                return 0;
+            }
+            const std::string arg = argv[++i];
+            switch (opt[1]) {
+            case 's':
+                sizes = parse_sizes(arg);
+                break;
+            case 'q':
+                depths = parse_counts(arg);
+                break;
+            case 'c':
+                channel_counts = parse_counts(arg);
+                break;
+            case 'd':
+                dirs = split(arg);
+                for (const auto& d : dirs) {
+                    if (d != "h2c" && d != "c2h" && d != "bidir") {
+                        throw std::invalid_argument("invalid direction " + d);
+                    }
+                }
+                break;
+            case 'm':
+                modes.clear();
+                for (const auto& m : split(arg)) {
+                    if (m == "int") {
+                        modes.push_back(completion_mode::interrupt);
+                    } else if (m == "poll") {
+                        modes.push_back(completion_mode::poll);
+                    } else {
+                        throw std::invalid_argument("invalid completion mode " + m);
+                    }
+                }
+                break;
+            case 't':
+                duration = std::stod(arg);
+                break;
+            case 'a':
+                address = parse_number(arg);
+                break;
+            case 'f':
+                format = arg;
+                if (format != "table" && format != "csv" && format != "json") {
+                    throw std::invalid_argument("invalid output format " + format);
+                }
+                break;
+            case 'o':
+                output_path = arg;
+                break;
+            default:
+                std::cout << help_text;
+                return 0;
+            }
+        }
+
+        std::ofstream file;
+        if (!output_path.empty()) {
+            file.open(output_path);
+            if (!file) {
+                throw std::runtime_error("Opening " + output_path + " failed");
+            }
+        }
+        std::ostream& out = output_path.empty() ? std::cout : file;
+
+        auto device = open_device();
+        std::cerr << "Device: " << device->name() << " (" << device->num_channels(direction::h2c)
+                  << " H2C, " << device->num_channels(direction::c2h) << " C2H channels)\n";
+
+        std::vector<result> results;
+        bool used_poll = false;
+        if (format == "table") {
+            print_table_header(out);
+        }
+        for (const auto& d : dirs) {
+            for (auto mode : modes) {
+                for (auto channels : channel_counts) {
+                    for (auto depth : depths) {
+                        for (auto size : sizes) {
+                            config cfg;
+                            cfg.bidir = (d == "bidir");
+                            cfg.dir = (d == "c2h") ? direction::c2h : direction::h2c;
+                            cfg.channels = channels;
+                            cfg.depth = depth;
+                            cfg.size = size;
+                            cfg.mode = mode;
+                            const unsigned h2c = (cfg.bidir || cfg.dir == direction::h2c) ? channels : 0;
+                            const unsigned c2h = (cfg.bidir || cfg.dir == direction::c2h) ? channels : 0;
+                            if (h2c > device->num_channels(direction::h2c) ||
+                                c2h > device->num_channels(direction::c2h)) {
+                                continue; // not enough engines
+                            }
+                            if (static_cast<double>(size) * depth * (h2c + c2h) > max_buffer_memory) {
+                                std::cerr << "Skipping " << dir_name(cfg) << " ch=" << channels
+                                          << " qd=" << depth << " size=" << size
+                                          << ": more than 1 GB of buffers\n";
+                                continue;
+                            }
+                            used_poll = used_poll || (mode == completion_mode::poll);
+                            try {
+                                results.push_back(measure(*device, cfg, duration, address));
+                            } catch (const std::exception& e) {
+                                std::cerr << "Skipping " << dir_name(cfg) << ' ' << mode_name(mode)
+                                          << " ch=" << channels << " qd=" << depth
+                                          << " size=" << size << ": " << e.what() << "\n";
+                                continue;
+                            }
+                            if (format == "table") {
+                                print_table_row(out, results.back());
+                            }
+                        }
+                    }
+                }
+            }
+        }
+
+        if (used_poll) {
+            for (unsigned d = 0; d < 2; ++d) {
+                const auto dir = static_cast<direction>(d);
+                for (unsigned ch = 0; ch < device->num_channels(dir); ++ch) {
+                    try {
+                        device->set_mode(dir, ch, completion_mode::interrupt);
+                    } catch (const std::exception&) {
+                        // e.g. AXI-ST c2h engines keep their installed mode
+                    }
+                }
+            }
+        }
+
+        if (format == "csv") {
+            print_csv(out, results);
+        } else if (format == "json") {
+            print_json(out, device->name(), results);
+        }
+
+    } catch (const std::exception& e) {
+        std::cout << "Error: " << e.what() << '\n';
+        return -1;
+    }
+
+    return 0;
+}
@@ -142,9 +142,9 @@ public:
     void print_details();
 private:
     HANDLE control = NULL;
-    uint32_t read_register(long addr);
+    std::vector<uint32_t> read_registers(const std::vector<long>& addrs);
     void read_block(long addr, size_t size, void* buffer);
-    void print_block(long offset);
+    void print_block(long offset, uint32_t id);
     void print_channel_module(long offset);
     void print_irq_module(long module_base);
     void print_config_module(long offset);
@@ -311,8 +311,7 @@ void xdma_device::print_sgdma_common_module(long base) {
     cout << " C2H descr credit:\t0x" << get_bits(reg_at(0x20), 16, 4) << '\n';
 }
 
-void xdma_device::print_block(long base) {
-    uint32_t id = read_register(base);
+void xdma_device::print_block(long base, uint32_t id) {
     auto module_type = id_to_module(id);
     cout << to_string(module_type) << " Module\n";
 
@@ -344,21 +343,33 @@ void xdma_device::print_block(long base) {
 void xdma_device::print_details() {
     cout << std::hex;
 
+    // fetch the identifier registers of all blocks with a single request
+    std::vector<long> block_addrs;
     for (long i = 0; i < 7; ++i) {
-        print_block(i * 0x1000);
+        block_addrs.push_back(i * 0x1000);
+    }
+    auto ids = read_registers(block_addrs);
+    for (size_t i = 0; i < block_addrs.size(); ++i) {
+        print_block(block_addrs[i], ids[i]);
     }
 }
 
-uint32_t xdma_device::read_register(long addr) {
-    int value = -1;
-    size_t num_bytes_read;
-    if (INVALID_SET_FILE_POINTER == SetFilePointer(control, addr, NULL, FILE_BEGIN)) {
-        throw runtime_error("SetFilePointer failed: " + std::to_string(GetLastError()));
+std::vector<uint32_t> xdma_device::read_registers(const std::vector<long>& addrs) {
+    std::vector<XDMA_REG_OP> ops(addrs.size());
+    for (size_t i = 0; i < addrs.size(); ++i) {
+        ops[i] = { XDMA_REG_OP_READ, (UINT32)addrs[i], 0, 0 };
     }
-    if (!ReadFile(control, (LPVOID)&value, 4, (LPDWORD)&num_bytes_read, NULL)) {
-        throw runtime_error("ReadFile failed:" + std::to_string(GetLastError()));
+    DWORD size = (DWORD)(ops.size() * sizeof(XDMA_REG_OP));
+    DWORD num_bytes_returned;
+    if (!DeviceIoControl(control, IOCTL_XDMA_REGISTER_OPS, ops.data(), size, ops.data(), size,
+                         &num_bytes_returned, NULL)) {
+        throw runtime_error("DeviceIoControl failed: " + std::to_string(GetLastError()));
+    }
+    std::vector<uint32_t> values;
+    for (const auto& op : ops) {
+        values.push_back(op.value);
     }
-    return value;
+    return values;
 }
 
 void xdma_device::read_block(long addr, size_t size, void* buffer) {
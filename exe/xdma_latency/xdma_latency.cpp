@@ -0,0 +1,189 @@
+#include <iomanip>
+#include <iostream>
+#include <memory>
+#include <string>
+#include <vector>
+#include <Windows.h>
+#include <SetupAPI.h>
+#include <INITGUID.H>
+
+#include "xdma_public.h"
+
+#pragma comment(lib, "setupapi.lib")
+
+static const char* help_text =
+"xdma_latency.exe prints the interrupt path latency histograms collected by the XDMA driver.\n"
+"\n"
+"Usage: xdma_latency.exe [-r]\n"
+"\n"
+"  -r    reset all histograms after printing them\n"
+"\n"
+"For every DMA engine and user event with samples, count, mean, p50, p99, p99.9 and max are\n"
+"printed in microseconds. Percentiles are the upper bound of the histogram bucket they fall in.\n";
+
+std::string get_windows_error_msg() {
+
+    char msg_buffer[256];
+    FormatMessageA(FORMAT_MESSAGE_FROM_SYSTEM, NULL, GetLastError(),
+                   MAKELANGID(LANG_NEUTRAL, SUBLANG_DEFAULT), (LPSTR)&msg_buffer, 256, NULL);
+    return{ msg_buffer, 256 };
+}
+
+class device_file {
+public:
+    device_file(const std::string& path, DWORD accessFlags) {
+        h = CreateFile(path.c_str(), accessFlags, 0, NULL, OPEN_EXISTING,
+                       FILE_ATTRIBUTE_NORMAL, NULL);
+        if (h == INVALID_HANDLE_VALUE) {
+            throw std::runtime_error("Opening device file failed: " + get_windows_error_msg());
+        }
+    }
+
+    ~device_file() {
+        CloseHandle(h);
+    }
+
+    void ioctl(DWORD code, void* in, DWORD in_size, void* out, DWORD out_size) {
+        unsigned long num_bytes_returned;
+        if (!DeviceIoControl(h, code, in, in_size, out, out_size, &num_bytes_returned, NULL)) {
+            throw std::runtime_error("DeviceIoControl failed: " + get_windows_error_msg());
+        }
+    }
+
+private:
+    HANDLE h;
+};
+
+static std::vector<std::string> get_device_paths(GUID guid) {
+
+    auto device_info = SetupDiGetClassDevs((LPGUID)&guid, NULL, NULL, DIGCF_PRESENT | DIGCF_DEVICEINTERFACE);
+    if (device_info == INVALID_HANDLE_VALUE) {
+        throw std::runtime_error("GetDevices INVALID_HANDLE_VALUE");
+    }
+
+    SP_DEVICE_INTERFACE_DATA device_interface = { 0 };
+    device_interface.cbSize = sizeof(SP_DEVICE_INTERFACE_DATA);
+
+    // enumerate through devices
+    std::vector<std::string> device_paths;
+    for (unsigned index = 0;
+         SetupDiEnumDeviceInterfaces(device_info, NULL, &guid, index, &device_interface);
+         ++index) {
+
+        // get required buffer size
+        unsigned long detail_length = 0;
+        if (!SetupDiGetDeviceInterfaceDetail(device_info, &device_interface, NULL, 0, &detail_length, NULL) && GetLastError() != ERROR_INSUFFICIENT_BUFFER) {
+            throw std::runtime_error("SetupDiGetDeviceInterfaceDetail - get length failed");
+        }
+
+        // allocate space for device interface detail
+        auto dev_detail = reinterpret_cast<PSP_DEVICE_INTERFACE_DETAIL_DATA>(new char[detail_length]);
+        dev_detail->cbSize = sizeof(SP_DEVICE_INTERFACE_DETAIL_DATA);
+
+        // get device interface detail
+        if (!SetupDiGetDeviceInterfaceDetail(device_info, &device_interface, dev_detail, detail_length, NULL, NULL)) {
+            delete[] dev_detail;
+            throw std::runtime_error("SetupDiGetDeviceInterfaceDetail - get detail failed");
+        }
+        device_paths.emplace_back(dev_detail->DevicePath);
+        delete[] dev_detail;
+    }
+
+    SetupDiDestroyDeviceInfoList(device_info);
+
+    return device_paths;
+}
+
+// ============= Histogram Evaluation =========================================
+
+// exclusive upper bound of a histogram bucket in ticks, see XDMA_LATENCY_NUM_BUCKETS
+static uint64_t bucket_upper_bound(unsigned i) {
+    if (i < 4) {
+        return i + 1;
+    }
+    return static_cast<uint64_t>(5 + i % 4) << (i / 4 - 1);
+}
+
+static uint64_t percentile(const XDMA_LATENCY_HISTOGRAM& h, double p) {
+    const auto rank = static_cast<uint64_t>(p * static_cast<double>(h.count));
+    uint64_t cumulative = 0;
+    for (unsigned i = 0; i < XDMA_LATENCY_NUM_BUCKETS; ++i) {
+        cumulative += h.bucket[i];
+        if (cumulative > rank) {
+            return (i == XDMA_LATENCY_NUM_BUCKETS - 1) ? h.max : min(bucket_upper_bound(i), h.max);
+        }
+    }
+    return h.max;
+}
+
+static void print_histogram(const std::string& name, const XDMA_LATENCY_HISTOGRAM& h, double frequency) {
+    if (h.count == 0) {
+        return;
+    }
+    const auto us = [&](double ticks) { return ticks * 1e6 / frequency; };
+    std::cout << std::left << std::setw(28) << name << std::right
+        << std::setw(10) << h.count
+        << std::setw(10) << us(static_cast<double>(h.sum) / static_cast<double>(h.count))
+        << std::setw(10) << us(static_cast<double>(percentile(h, 0.5)))
+        << std::setw(10) << us(static_cast<double>(percentile(h, 0.99)))
+        << std::setw(10) << us(static_cast<double>(percentile(h, 0.999)))
+        << std::setw(10) << us(static_cast<double>(h.max)) << "\n";
+}
+
+int __cdecl main(int argc, char* argv[]) {
+
+    try {
+        bool reset = false;
+        if (argc == 2 && std::string(argv[1]) == "-r") {
+            reset = true;
+        } else if (argc != 1) {
+            std::cout << help_text;
+            return 0;
+        }
+
+        const auto dev_paths = get_device_paths(GUID_DEVINTERFACE_XDMA);
+        if (dev_paths.empty()) {
+            throw std::runtime_error("No XDMA device driver installed!");
+        }
+
+        // latency ioctls are accepted on every device node, the control node is always present
+        device_file control(dev_paths[0] + "\\control", GENERIC_READ | GENERIC_WRITE);
+        auto data = std::make_unique<XDMA_LATENCY_DATA>();
+        control.ioctl(IOCTL_XDMA_LATENCY_GET, NULL, 0, data.get(), sizeof(XDMA_LATENCY_DATA));
+        const auto frequency = static_cast<double>(data->frequency);
+
+        const char* engine_stages[XDMA_LATENCY_ENGINE_STAGES] = { "start->isr", "isr->dpc", "dpc->complete" };
+        const char* event_stages[XDMA_LATENCY_EVENT_STAGES] = { "isr->dpc", "handler" };
+
+        std::cout << std::fixed << std::setprecision(2);
+        std::cout << std::left << std::setw(28) << "stage [us]" << std::right
+            << std::setw(10) << "count" << std::setw(10) << "mean" << std::setw(10) << "p50"
+            << std::setw(10) << "p99" << std::setw(10) << "p99.9" << std::setw(10) << "max" << "\n";
+        for (unsigned dir = 0; dir < 2; ++dir) {
+            for (unsigned channel = 0; channel < 4; ++channel) {
+                for (unsigned stage = 0; stage < XDMA_LATENCY_ENGINE_STAGES; ++stage) {
+                    const auto name = std::string(dir == 0 ? "h2c_" : "c2h_") + std::to_string(channel)
+                        + " " + engine_stages[stage];
+                    print_histogram(name, data->engine[dir][channel][stage], frequency);
+                }
+            }
+        }
+        for (unsigned event_id = 0; event_id < XDMA_MAX_USER_EVENTS; ++event_id) {
+            for (unsigned stage = 0; stage < XDMA_LATENCY_EVENT_STAGES; ++stage) {
+                const auto name = "event_" + std::to_string(event_id) + " " + event_stages[stage];
+                print_histogram(name, data->userEvent[event_id][stage], frequency);
+            }
+        }
+
+        if (reset) {
+            control.ioctl(IOCTL_XDMA_LATENCY_RESET, NULL, 0, NULL, 0);
+            std::cout << "Histograms cleared.\n";
+        }
+
+    } catch (const std::exception& e) {
+        std::cout << "Error: " << e.what() << '\n';
+        return -1;
+    }
+
+    return 0;
+}
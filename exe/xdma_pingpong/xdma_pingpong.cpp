@@ -0,0 +1,328 @@
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include "bench_device.h"
+
+static const char* help_text =
+"xdma_pingpong.exe measures the round trip latency of small messages: a write to h2c_<channel>\n"
+"followed by a read of the same size from c2h_<channel>.\n"
+"\n"
+"Usage: xdma_pingpong.exe [options]\n"
+"\n"
+"  -s <sizes>    message sizes in bytes, K suffix allowed (default 64,256,1K,4K)\n"
+"  -m <modes>    int and/or poll completion (default int,poll)\n"
+"  -n <count>    round trips per configuration (default 1000000)\n"
+"  -c <channel>  h2c and c2h channel (default 0)\n"
+"  -a <address>  card address of the write and the read (default 0)\n"
+"  -p            post the read before the write, for a loopback design\n"
+"  -t <cpus>     pin the measuring thread to the first CPU, and the thread of the software\n"
+"                model to the second one if given\n"
+"  -o <file>     write the latency distributions as CSV\n"
+"\n"
+"Every round trip is timed on its own, the first 1000 of a configuration are not counted. The\n"
+"read is submitted when the write completed, which suits AXI-MM designs and AXI-ST loopback\n"
+"designs alike; with -p it is submitted first, so that the loopback data can go straight into\n"
+"the read buffer.\n"
+"\n"
+"The completion mode is switched with IOCTL_XDMA_POLL_MODE_SET after h2c_<channel> and\n"
+"c2h_<channel> are opened, on a handle which stays open for the whole run, and set back to\n"
+"interrupt mode at the end. AXI-ST c2h engines keep the mode the driver was installed with\n"
+"(POLL_MODE).\n"
+"\n"
+"The CSV file holds the number of round trips per latency bucket, 8 buckets per doubling of the\n"
+"latency, for every configuration.\n"
+"\n"
+"Built on Linux, the tool runs against the software model of the XDMA IP (model/), with the\n"
+"same descriptor handling as the driver, to compare the overhead of the host side.\n";
+
+// ============= Configuration ================================================
+
+struct options {
+    std::vector<size_t> sizes = { 64, 256, 1024, 4096 };
+    std::vector<completion_mode> modes = { completion_mode::interrupt, completion_mode::poll };
+    uint64_t iterations = 1000000;
+    unsigned channel = 0;
+    uint64_t address = 0;
+    bool prepost = false;
+    std::vector<unsigned> cpus;
+    std::string output_path;
+};
+
+static const unsigned warmup_iterations = 1000;
+
+static std::vector<std::string> split(const std::string& s) {
+    std::vector<std::string> items;
+    std::stringstream ss(s);
+    std::string item;
+    while (std::getline(ss, item, ',')) {
+        if (!item.empty()) {
+            items.push_back(item);
+        }
+    }
+    return items;
+}
+
+static uint64_t parse_number(const std::string& s) {
+    size_t pos = 0;
+    uint64_t value = std::stoull(s, &pos, 0);
+    if (pos < s.size()) {
+        const char suffix = s[pos];
+        if (suffix == 'K' || suffix == 'k') {
+            value <<= 10;
+        } else if (suffix == 'M' || suffix == 'm') {
+            value <<= 20;
+        } else {
+            throw std::invalid_argument("invalid number " + s);
+        }
+        if (pos + 1 != s.size()) {
+            throw std::invalid_argument("invalid number " + s);
+        }
+    }
+    return value;
+}
+
+static const char* mode_name(completion_mode mode) {
+    return mode == completion_mode::poll ? "poll" : "int";
+}
+
+// ============= Measurement ==================================================
+
+struct result {
+    size_t size;
+    completion_mode mode;
+    std::vector<uint64_t> latencies_ns; // sorted
+};
+
+static void set_modes(bench_device& device, unsigned channel, completion_mode mode) {
+    device.set_mode(direction::h2c, channel, mode);
+    try {
+        device.set_mode(direction::c2h, channel, mode);
+    } catch (const std::exception& e) {
+        // AXI-ST c2h engines keep their installed mode
+        std::cerr << "c2h_" << channel << " keeps its completion mode: " << e.what() << "\n";
+    }
+}
+
+static result measure(bench_device& device, const options& opt, size_t size, completion_mode mode) {
+    using clock = std::chrono::steady_clock;
+
+    auto h2c = device.open(direction::h2c, opt.channel, size, 1);
+    auto c2h = device.open(direction::c2h, opt.channel, size, 1);
+    set_modes(device, opt.channel, mode); // on the open engines, see the help text
+
+    result r;
+    r.size = size;
+    r.mode = mode;
+    r.latencies_ns.reserve(static_cast<size_t>(opt.iterations));
+    for (uint64_t i = 0; i < warmup_iterations + opt.iterations; ++i) {
+        const auto start = clock::now();
+        if (opt.prepost) {
+            c2h->submit(0, opt.address);
+            h2c->submit(0, opt.address);
+            h2c->wait();
+            c2h->wait();
+        } else {
+            h2c->submit(0, opt.address);
+            h2c->wait();
+            c2h->submit(0, opt.address);
+            c2h->wait();
+        }
+        const auto end = clock::now();
+        if (i >= warmup_iterations) {
+            r.latencies_ns.push_back(static_cast<uint64_t>(
+                std::chrono::duration_cast<std::chrono::nanoseconds>(end - start).count()));
+        }
+    }
+    std::sort(r.latencies_ns.begin(), r.latencies_ns.end());
+    return r;
+}
+
+// ============= Output =======================================================
+
+static double percentile_us(const result& r, double p) {
+    const auto rank = static_cast<size_t>(p / 100.0 * static_cast<double>(r.latencies_ns.size()));
+    return r.latencies_ns[std::min(rank, r.latencies_ns.size() - 1)] / 1000.0;
+}
+
+static void print_table_header(std::ostream& out) {
+    out << std::right << std::setw(6) << "size" << std::setw(6) << "mode" << std::setw(10) << "trips"
+        << std::setw(10) << "mean us" << std::setw(9) << "stddev" << std::setw(9) << "min"
+        << std::setw(9) << "p50" << std::setw(9) << "p90" << std::setw(9) << "p99" << std::setw(9)
+        << "p99.9" << std::setw(9) << "p99.99" << std::setw(10) << "max" << "\n";
+}
+
+static void print_table_row(std::ostream& out, const result& r) {
+    double sum = 0;
+    for (auto ns : r.latencies_ns) {
+        sum += ns;
+    }
+    const double mean = sum / r.latencies_ns.size();
+    double squares = 0;
+    for (auto ns : r.latencies_ns) {
+        squares += (ns - mean) * (ns - mean);
+    }
+    const double stddev = std::sqrt(squares / r.latencies_ns.size());
+
+    out << std::setw(6) << r.size << std::setw(6) << mode_name(r.mode) << std::setw(10)
+        << r.latencies_ns.size() << std::fixed << std::setprecision(2) << std::setw(10) << mean / 1000.0
+        << std::setw(9) << stddev / 1000.0 << std::setw(9) << r.latencies_ns.front() / 1000.0;
+    for (double p : { 50.0, 90.0, 99.0, 99.9, 99.99 }) {
+        out << std::setw(9) << percentile_us(r, p);
+    }
+    out << std::setw(10) << r.latencies_ns.back() / 1000.0 << std::endl;
+}
+
+// bucket of 'ns': 1 ns wide below 8 ns, above 8 buckets per power of two
+static void bucket_bounds(uint64_t ns, uint64_t* lower, uint64_t* upper) {
+    if (ns < 8) {
+        *lower = ns;
+        *upper = ns + 1;
+        return;
+    }
+    unsigned shift = 0;
+    while ((ns >> shift) >= 16) {
+        ++shift;
+    }
+    *lower = (ns >> shift) << shift;
+    *upper = *lower + (1ULL << shift);
+}
+
+static void print_distribution(std::ostream& out, const result& r) {
+    size_t i = 0;
+    while (i < r.latencies_ns.size()) {
+        uint64_t lower, upper;
+        bucket_bounds(r.latencies_ns[i], &lower, &upper);
+        size_t count = 0;
+        for (; i < r.latencies_ns.size() && r.latencies_ns[i] < upper; ++i) {
+            ++count;
+        }
+        out << r.size << ',' << mode_name(r.mode) << ',' << lower / 1000.0 << ',' << upper / 1000.0 << ','
+            << count << "\n";
+    }
+}
+
+// ============= Main =========================================================
+
+int main(int argc, char* argv[]) {
+
+    try {
+        options opt;
+        for (int i = 1; i < argc; ++i) {
+            const std::string o = argv[i];
+            if (o == "-p") {
+                opt.prepost = true;
+                continue;
+            }
+            if (o.size() != 2 || o[0] != '-' || i + 1 >= argc) {
+                std::cout << help_text;
+                return 0;
+            }
+            const std::string arg = argv[++i];
+            switch (o[1]) {
+            case 's':
+                opt.sizes.clear();
+                for (const auto& item : split(arg)) {
+                    const auto size = parse_number(item);
+                    if (size == 0) {
+                        throw std::invalid_argument("message size must not be 0");
+                    }
+                    opt.sizes.push_back(static_cast<size_t>(size));
+                }
+                break;
+            case 'm':
+                opt.modes.clear();
+                for (const auto& m : split(arg)) {
+                    if (m == "int") {
+                        opt.modes.push_back(completion_mode::interrupt);
+                    } else if (m == "poll") {
+                        opt.modes.push_back(completion_mode::poll);
+                    } else {
+                        throw std::invalid_argument("invalid completion mode " + m);
+                    }
+                }
+                break;
+            case 'n':
+                opt.iterations = parse_number(arg);
+                if (opt.iterations == 0) {
+                    throw std::invalid_argument("the number of round trips must not be 0");
+                }
+                break;
+            case 'c':
+                opt.channel = static_cast<unsigned>(parse_number(arg));
+                break;
+            case 'a':
+                opt.address = parse_number(arg);
+                break;
+            case 't':
+                opt.cpus.clear();
+                for (const auto& item : split(arg)) {
+                    opt.cpus.push_back(static_cast<unsigned>(parse_number(item)));
+                }
+                if (opt.cpus.empty() || opt.cpus.size() > 2) {
+                    throw std::invalid_argument("-t takes one or two CPUs");
+                }
+                break;
+            case 'o':
+                opt.output_path = arg;
+                break;
+            default:
+                std::cout << help_text;
+                return 0;
+            }
+        }
+
+        std::ofstream csv;
+        if (!opt.output_path.empty()) {
+            csv.open(opt.output_path);
+            if (!csv) {
+                throw std::runtime_error("Opening " + opt.output_path + " failed");
+            }
+            csv << "size,mode,lower_us,upper_us,count\n";
+        }
+
+        auto device = open_device();
+        std::cerr << "Device: " << device->name() << "\n";
+        if (opt.channel >= device->num_channels(direction::h2c) ||
+            opt.channel >= device->num_channels(direction::c2h)) {
+            throw std::runtime_error("The device has no h2c_" + std::to_string(opt.channel) + "/c2h_" +
+                                     std::to_string(opt.channel) + " pair");
+        }
+        if (!opt.cpus.empty()) {
+            pin_thread(opt.cpus[0]);
+        }
+        if (opt.cpus.size() > 1) {
+            device->pin_threads(opt.cpus[1]);
+        }
+
+        bool used_poll = false;
+        print_table_header(std::cout);
+        for (auto mode : opt.modes) {
+            used_poll = used_poll || (mode == completion_mode::poll);
+            for (auto size : opt.sizes) {
+                const result r = measure(*device, opt, size, mode);
+                print_table_row(std::cout, r);
+                if (csv.is_open()) {
+                    print_distribution(csv, r);
+                }
+            }
+        }
+
+        if (used_poll) {
+            set_modes(*device, opt.channel, completion_mode::interrupt);
+        }
+
+    } catch (const std::exception& e) {
+        std::cout << "Error: " << e.what() << '\n';
+        return -1;
+    }
+
+    return 0;
+}
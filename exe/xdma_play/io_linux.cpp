@@ -0,0 +1,99 @@
+// xdma_play I/O for Linux: the input file with O_DIRECT. There is no XDMA driver for Linux in
+// this project, so only the synthetic sink is available.
+
+#include <cerrno>
+#include <cstdlib>
+#include <cstring>
+#include <deque>
+#include <stdexcept>
+
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "play_io.h"
+
+static std::runtime_error system_error(const std::string& what) {
+    return std::runtime_error(what + ": " + std::strerror(errno));
+}
+
+class linux_file : public play_file {
+public:
+    explicit linux_file(const std::string& path) {
+        fd = open(path.c_str(), O_RDONLY | O_DIRECT);
+        if ((fd < 0) && (errno == EINVAL)) { // e.g. tmpfs, which has no direct I/O
+            fd = open(path.c_str(), O_RDONLY);
+        }
+        if (fd < 0) {
+            throw system_error("Opening " + path + " failed");
+        }
+        struct stat st;
+        if (fstat(fd, &st) != 0) {
+            close(fd);
+            throw system_error("Querying the size of " + path + " failed");
+        }
+        file_size = static_cast<uint64_t>(st.st_size);
+        posix_fadvise(fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+    }
+
+    ~linux_file() {
+        close(fd);
+    }
+
+    uint64_t size() const override {
+        return file_size;
+    }
+
+    // reads complete before submit() returns, the reader stage still overlaps them with the
+    // paced writes
+    void submit(void* buffer, size_t length, uint64_t offset) override {
+        auto p = static_cast<char*>(buffer);
+        size_t done = 0;
+        while (done < length) {
+            const ssize_t n = pread(fd, p + done, length - done, static_cast<off_t>(offset + done));
+            if (n < 0) {
+                throw system_error("Reading the file failed");
+            }
+            if (n == 0) { // end of file
+                break;
+            }
+            done += n;
+        }
+        results.push_back(done);
+    }
+
+    size_t wait() override {
+        const size_t n = results.front();
+        results.pop_front();
+        return n;
+    }
+
+private:
+    int fd;
+    uint64_t file_size;
+    std::deque<size_t> results;
+};
+
+std::unique_ptr<play_file> open_play_file(const std::string& path, unsigned) {
+    return std::unique_ptr<play_file>(new linux_file(path));
+}
+
+std::unique_ptr<play_sink> open_device_sink(unsigned, unsigned) {
+    throw std::runtime_error("Playing to h2c needs the Windows driver, use the synthetic sink (-s)");
+}
+
+void use_fine_sleep() {
+    // the sleeps of Linux are fine grained already
+}
+
+void* allocate_aligned(size_t size) {
+    void* p = nullptr;
+    if (posix_memalign(&p, play_file::sector_size, size) != 0) {
+        throw std::runtime_error("Allocating " + std::to_string(size) + " bytes failed");
+    }
+    return p;
+}
+
+void free_aligned(void* p) {
+    std::free(p);
+}
@@ -0,0 +1,255 @@
+// xdma_play I/O for the XDMA driver: an overlapped, unbuffered input file and overlapped writes
+// to h2c_<channel>.
+
+#include <deque>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#define NOMINMAX
+#include <Windows.h>
+#include <SetupAPI.h>
+#include <INITGUID.H>
+
+#include "xdma_public.h"
+#include "play_io.h"
+
+#pragma comment(lib, "setupapi.lib")
+#pragma comment(lib, "winmm.lib")
+
+static std::string get_windows_error_msg(DWORD error) {
+
+    char msg_buffer[256];
+    FormatMessageA(FORMAT_MESSAGE_FROM_SYSTEM, NULL, error,
+                   MAKELANGID(LANG_NEUTRAL, SUBLANG_DEFAULT), (LPSTR)&msg_buffer, 256, NULL);
+    return{ msg_buffer, 256 };
+}
+
+static std::vector<std::string> get_device_paths(GUID guid) {
+
+    auto device_info = SetupDiGetClassDevs((LPGUID)&guid, NULL, NULL, DIGCF_PRESENT | DIGCF_DEVICEINTERFACE);
+    if (device_info == INVALID_HANDLE_VALUE) {
+        throw std::runtime_error("GetDevices INVALID_HANDLE_VALUE");
+    }
+
+    SP_DEVICE_INTERFACE_DATA device_interface = { 0 };
+    device_interface.cbSize = sizeof(SP_DEVICE_INTERFACE_DATA);
+
+    // enumerate through devices
+    std::vector<std::string> device_paths;
+    for (unsigned index = 0;
+         SetupDiEnumDeviceInterfaces(device_info, NULL, &guid, index, &device_interface);
+         ++index) {
+
+        // get required buffer size
+        unsigned long detail_length = 0;
+        if (!SetupDiGetDeviceInterfaceDetail(device_info, &device_interface, NULL, 0, &detail_length, NULL) && GetLastError() != ERROR_INSUFFICIENT_BUFFER) {
+            throw std::runtime_error("SetupDiGetDeviceInterfaceDetail - get length failed");
+        }
+
+        // allocate space for device interface detail
+        auto dev_detail = reinterpret_cast<PSP_DEVICE_INTERFACE_DETAIL_DATA>(new char[detail_length]);
+        dev_detail->cbSize = sizeof(SP_DEVICE_INTERFACE_DETAIL_DATA);
+
+        // get device interface detail
+        if (!SetupDiGetDeviceInterfaceDetail(device_info, &device_interface, dev_detail, detail_length, NULL, NULL)) {
+            delete[] dev_detail;
+            throw std::runtime_error("SetupDiGetDeviceInterfaceDetail - get detail failed");
+        }
+        device_paths.emplace_back(dev_detail->DevicePath);
+        delete[] dev_detail;
+    }
+
+    SetupDiDestroyDeviceInfoList(device_info);
+
+    return device_paths;
+}
+
+// one OVERLAPPED per slot, completed in submission order
+class overlapped_slots {
+public:
+    explicit overlapped_slots(unsigned depth) : slots(depth) {
+        for (auto& ov : slots) {
+            ov.hEvent = CreateEvent(NULL, TRUE, FALSE, NULL);
+            if (ov.hEvent == NULL) {
+                release();
+                throw std::runtime_error("CreateEvent failed: " + get_windows_error_msg(GetLastError()));
+            }
+        }
+    }
+
+    ~overlapped_slots() {
+        release();
+    }
+
+    OVERLAPPED* prepare(unsigned slot, uint64_t offset) {
+        OVERLAPPED& ov = slots[slot];
+        ov.Internal = 0;
+        ov.InternalHigh = 0;
+        ov.Offset = static_cast<DWORD>(offset);
+        ov.OffsetHigh = static_cast<DWORD>(offset >> 32);
+        return &ov;
+    }
+
+    OVERLAPPED* get(unsigned slot) {
+        return &slots[slot];
+    }
+
+private:
+    void release() {
+        for (auto& ov : slots) {
+            if (ov.hEvent != NULL) {
+                CloseHandle(ov.hEvent);
+            }
+        }
+    }
+
+    std::vector<OVERLAPPED> slots;
+};
+
+// ============= File =========================================================
+
+class windows_file : public play_file {
+public:
+    windows_file(const std::string& path, unsigned depth) : depth(depth), slots(depth) {
+        h = CreateFile(path.c_str(), GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING,
+                       FILE_ATTRIBUTE_NORMAL | FILE_FLAG_NO_BUFFERING | FILE_FLAG_OVERLAPPED, NULL);
+        if (h == INVALID_HANDLE_VALUE) {
+            throw std::runtime_error("Opening " + path + " failed: " + get_windows_error_msg(GetLastError()));
+        }
+        LARGE_INTEGER size;
+        if (!GetFileSizeEx(h, &size)) {
+            const DWORD error = GetLastError();
+            CloseHandle(h);
+            throw std::runtime_error("Querying the size of " + path + " failed: " + get_windows_error_msg(error));
+        }
+        file_size = static_cast<uint64_t>(size.QuadPart);
+    }
+
+    ~windows_file() {
+        while (!outstanding.empty()) {
+            DWORD num_bytes;
+            GetOverlappedResult(h, slots.get(outstanding.front()), &num_bytes, TRUE);
+            outstanding.pop_front();
+        }
+        CloseHandle(h);
+    }
+
+    uint64_t size() const override {
+        return file_size;
+    }
+
+    void submit(void* buffer, size_t length, uint64_t offset) override {
+        const unsigned slot = next_slot;
+        next_slot = (next_slot + 1) % depth;
+        if (!ReadFile(h, buffer, static_cast<DWORD>(length), NULL, slots.prepare(slot, offset)) &&
+            (GetLastError() != ERROR_IO_PENDING)) {
+            throw std::runtime_error("ReadFile failed: " + get_windows_error_msg(GetLastError()));
+        }
+        outstanding.push_back(slot);
+    }
+
+    size_t wait() override {
+        const unsigned slot = outstanding.front();
+        outstanding.pop_front();
+        DWORD num_bytes = 0;
+        if (!GetOverlappedResult(h, slots.get(slot), &num_bytes, TRUE)) {
+            const DWORD error = GetLastError();
+            if (error == ERROR_HANDLE_EOF) {
+                return 0;
+            }
+            throw std::runtime_error("Reading the file failed: " + get_windows_error_msg(error));
+        }
+        return num_bytes;
+    }
+
+private:
+    HANDLE h;
+    const unsigned depth;
+    overlapped_slots slots;
+    uint64_t file_size;
+    unsigned next_slot = 0;
+    std::deque<unsigned> outstanding;
+};
+
+std::unique_ptr<play_file> open_play_file(const std::string& path, unsigned depth) {
+    return std::unique_ptr<play_file>(new windows_file(path, depth));
+}
+
+// ============= Sink =========================================================
+
+class device_sink : public play_sink {
+public:
+    device_sink(const std::string& path, unsigned depth) : depth(depth), slots(depth) {
+        h = CreateFile(path.c_str(), GENERIC_WRITE, 0, NULL, OPEN_EXISTING,
+                       FILE_ATTRIBUTE_NORMAL | FILE_FLAG_OVERLAPPED, NULL);
+        if (h == INVALID_HANDLE_VALUE) {
+            throw std::runtime_error("Opening " + path + " failed: " + get_windows_error_msg(GetLastError()));
+        }
+    }
+
+    ~device_sink() {
+        // the buffers of outstanding writes belong to the caller, let the writes end first
+        CancelIoEx(h, NULL);
+        while (!outstanding.empty()) {
+            DWORD num_bytes;
+            GetOverlappedResult(h, slots.get(outstanding.front()), &num_bytes, TRUE);
+            outstanding.pop_front();
+        }
+        CloseHandle(h);
+    }
+
+    void submit(const void* data, size_t length) override {
+        const unsigned slot = next_slot;
+        next_slot = (next_slot + 1) % depth;
+        if (!WriteFile(h, data, static_cast<DWORD>(length), NULL, slots.prepare(slot, 0)) &&
+            (GetLastError() != ERROR_IO_PENDING)) {
+            throw std::runtime_error("WriteFile failed: " + get_windows_error_msg(GetLastError()));
+        }
+        outstanding.push_back(slot);
+    }
+
+    size_t wait() override {
+        // the engine queue of the driver is sequential, writes complete in submission order
+        const unsigned slot = outstanding.front();
+        outstanding.pop_front();
+        DWORD num_bytes = 0;
+        if (!GetOverlappedResult(h, slots.get(slot), &num_bytes, TRUE)) {
+            throw std::runtime_error("Writing the stream failed: " + get_windows_error_msg(GetLastError()));
+        }
+        return num_bytes;
+    }
+
+private:
+    HANDLE h;
+    const unsigned depth;
+    overlapped_slots slots;
+    unsigned next_slot = 0;
+    std::deque<unsigned> outstanding;
+};
+
+std::unique_ptr<play_sink> open_device_sink(unsigned channel, unsigned depth) {
+    const auto device_paths = get_device_paths(GUID_DEVINTERFACE_XDMA);
+    if (device_paths.empty()) {
+        throw std::runtime_error("No XDMA device driver installed!");
+    }
+    return std::unique_ptr<play_sink>(
+        new device_sink(device_paths[0] + "\\h2c_" + std::to_string(channel), depth));
+}
+
+void use_fine_sleep() {
+    // the default timer interrupt of 15.6 ms would make every sleep of the pacing that long
+    timeBeginPeriod(1);
+}
+
+void* allocate_aligned(size_t size) {
+    void* p = _aligned_malloc(size, play_file::sector_size);
+    if (p == nullptr) {
+        throw std::runtime_error("Allocating " + std::to_string(size) + " bytes failed");
+    }
+    return p;
+}
+
+void free_aligned(void* p) {
+    _aligned_free(p);
+}
@@ -0,0 +1,60 @@
+#pragma once
+
+// I/O interfaces of xdma_play. xdma_play.cpp runs the disk reader and the paced writer against
+// them; io_windows.cpp implements the file and the h2c sink for the XDMA driver, io_linux.cpp the
+// file for Linux, and sink_synthetic.cpp a sink which needs no card.
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <string>
+
+// Input file read with unbuffered I/O. Reads start at sector aligned offsets, have a length which
+// is a multiple of the sector size and go to sector aligned buffers.
+class play_file {
+public:
+    static const size_t sector_size = 4096;  // covers 512 byte and 4K native sectors
+
+    virtual ~play_file() = default;
+
+    virtual uint64_t size() const = 0;
+
+    // start reading; a read which reaches the end of the file returns fewer bytes
+    virtual void submit(void* buffer, size_t length, uint64_t offset) = 0;
+
+    // wait for the oldest read which is still in flight and return the number of bytes read,
+    // throws if it failed
+    virtual size_t wait() = 0;
+};
+
+// Stream data sink with up to 'depth' writes outstanding, completed in submission order.
+class play_sink {
+public:
+    virtual ~play_sink() = default;
+
+    // start writing; 'data' must stay valid until the write was waited for
+    virtual void submit(const void* data, size_t length) = 0;
+
+    // wait for the oldest outstanding write and return the number of bytes written, throws if
+    // it failed
+    virtual size_t wait() = 0;
+};
+
+// the file, opened for 'depth' reads in flight
+std::unique_ptr<play_file> open_play_file(const std::string& path, unsigned depth);
+
+// h2c_<channel> of the first XDMA device, opened for 'depth' outstanding writes
+std::unique_ptr<play_sink> open_device_sink(unsigned channel, unsigned depth);
+
+// a sink which takes up to 'rate' bytes per second, 0 = as fast as possible. With 'verify' the
+// data is checked against the counter pattern (xdma_pattern.h) with 'seed', which is what
+// xdma_record records from its synthetic source.
+std::unique_ptr<play_sink> open_synthetic_sink(unsigned depth, double rate, bool verify, uint64_t seed);
+
+// let sleeps end within about a millisecond of their deadline; the pacing only spins for the
+// last part of a wait
+void use_fine_sleep();
+
+// aligned memory for DMA and unbuffered file I/O
+void* allocate_aligned(size_t size);
+void free_aligned(void* p);
@@ -0,0 +1,58 @@
+// xdma_play sink without a card: takes the data at a given rate, like an h2c engine whose stream
+// is consumed by the design at a fixed bandwidth, and optionally checks it.
+
+#include <chrono>
+#include <deque>
+#include <stdexcept>
+#include <string>
+#include <thread>
+
+#include "play_io.h"
+#include "xdma_pattern.h"
+
+class synthetic_sink : public play_sink {
+public:
+    synthetic_sink(double rate, bool verify, uint64_t seed)
+        : rate(rate), verify(verify), pattern(pattern_type::counter, seed),
+          start(std::chrono::steady_clock::now()) {
+    }
+
+    void submit(const void* data, size_t length) override {
+        requests.push_back({ data, length });
+    }
+
+    size_t wait() override {
+        const request r = requests.front();
+        requests.pop_front();
+
+        pattern_mismatch mismatch;
+        if (verify && !pattern.verify(r.data, r.length, &mismatch)) {
+            throw std::runtime_error("Data mismatch at stream offset " + std::to_string(mismatch.offset));
+        }
+        consumed += r.length;
+
+        if (rate > 0) { // the write completes when the stream took the data
+            const auto due = start + std::chrono::duration_cast<std::chrono::steady_clock::duration>(
+                                         std::chrono::duration<double>(consumed / rate));
+            std::this_thread::sleep_until(due);
+        }
+        return r.length;
+    }
+
+private:
+    struct request {
+        const void* data;
+        size_t length;
+    };
+
+    const double rate;
+    const bool verify;
+    pattern_stream pattern;
+    const std::chrono::steady_clock::time_point start;
+    std::deque<request> requests;
+    uint64_t consumed = 0;
+};
+
+std::unique_ptr<play_sink> open_synthetic_sink(unsigned, double rate, bool verify, uint64_t seed) {
+    return std::unique_ptr<play_sink>(new synthetic_sink(rate, verify, seed));
+}
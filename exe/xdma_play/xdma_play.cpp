@@ -0,0 +1,668 @@
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <csignal>
+#include <deque>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <mutex>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "play_io.h"
+#include "spsc_queue.h"
+
+static const char* help_text =
+"xdma_play.exe plays a file into an AXI-ST host-to-card stream at a controlled rate.\n"
+"\n"
+"Usage: xdma_play.exe -f <file> [options]\n"
+"\n"
+"  -f <file>     input file\n"
+"  -c <channel>  h2c channel to write (default 0)\n"
+"  -r <MB/s>     play at a fixed bandwidth\n"
+"  -i <index>    play at the times of an index file, see below\n"
+"  -l <passes>   play the file this many times, 0 = until stopped (default 1)\n"
+"  -t <seconds>  stop after this time, 0 = at the end of the file (default 0)\n"
+"  -b <size>     bytes per file read, a multiple of 4K, K and M suffixes allowed (default 4M)\n"
+"  -n <count>    read-ahead buffers in the pool (default 32)\n"
+"  -k <depth>    file reads kept in flight (default 4)\n"
+"  -w <size>     bytes per stream write at most (default 1M)\n"
+"  -q <depth>    stream writes kept outstanding (default 8)\n"
+"  -s <MB/s>     play into a synthetic sink which takes this rate instead of the card,\n"
+"                0 = unthrottled\n"
+"  -v            check the data in the synthetic sink against the stream xdma_record records\n"
+"                with -s\n"
+"\n"
+"Without -r and -i the file is played as fast as the engine takes it. A reader thread reads the\n"
+"file ahead with unbuffered I/O into a pool of buffers and hands them to the player thread\n"
+"through a lock-free queue. The player cuts them into writes, holds every write until its\n"
+"release time and keeps the given number of writes outstanding on h2c_<channel>. Playback starts\n"
+"when the pool is full.\n"
+"\n"
+"The index file of -i has one line '<time> <bytes>' per segment of the file: the microseconds\n"
+"from the start of the pass at which the segment is released, and its length. Times do not\n"
+"decrease and the lengths add up to the file size. A last line with 0 bytes sets the length of\n"
+"a pass, otherwise a repeated pass starts at the time of the last segment. Lines starting with\n"
+"# are comments.\n"
+"\n"
+"Pacing accuracy is the time by which a write was submitted after its release time, because\n"
+"the engine queue was full or the data was not read yet. Every second the throughput, the\n"
+"average and largest delay, the read-ahead level and the underruns - writes which were due\n"
+"while no data had been read - are printed; at the end the delay percentiles.\n"
+"\n"
+"The Linux build only has the synthetic sink.\n";
+
+// ============= Configuration ================================================
+
+enum class pacing { max_rate, bandwidth, timestamps };
+
+struct segment {
+    double time; // seconds from the start of the pass
+    uint64_t length;
+};
+
+struct options {
+    std::string file;
+    unsigned channel = 0;
+    pacing mode = pacing::max_rate;
+    double rate = 0; // bytes per second
+    std::string index;
+    unsigned passes = 1;
+    double seconds = 0;
+    size_t read_size = 4 << 20;
+    unsigned pool_size = 32;
+    unsigned read_depth = 4;
+    size_t write_size = 1 << 20;
+    unsigned write_depth = 8;
+    bool synthetic = false;
+    double sink_rate = 0; // bytes per second
+    bool verify = false;
+};
+
+// the seed of the synthetic source of xdma_record
+static const uint64_t synthetic_seed = 1;
+
+static uint64_t parse_number(const std::string& s) {
+    size_t pos = 0;
+    uint64_t value = std::stoull(s, &pos, 0);
+    if (pos < s.size()) {
+        const char suffix = s[pos];
+        if (suffix == 'K' || suffix == 'k') {
+            value <<= 10;
+        } else if (suffix == 'M' || suffix == 'm') {
+            value <<= 20;
+        } else {
+            throw std::invalid_argument("invalid number " + s);
+        }
+        if (pos + 1 != s.size()) {
+            throw std::invalid_argument("invalid number " + s);
+        }
+    }
+    return value;
+}
+
+static std::string format_bytes(uint64_t n) {
+    std::ostringstream ss;
+    ss << std::fixed << std::setprecision(1);
+    if (n >= (1ULL << 30)) {
+        ss << static_cast<double>(n) / (1ULL << 30) << " GiB";
+    } else if (n >= (1ULL << 20)) {
+        ss << static_cast<double>(n) / (1ULL << 20) << " MiB";
+    } else {
+        ss << n << " B";
+    }
+    return ss.str();
+}
+
+// returns the segments and the length of a pass in seconds
+static std::vector<segment> read_index(const std::string& path, uint64_t file_size, double* period) {
+    std::ifstream in(path);
+    if (!in) {
+        throw std::runtime_error("Opening " + path + " failed");
+    }
+    std::vector<segment> segments;
+    uint64_t total = 0;
+    std::string line;
+    for (unsigned number = 1; std::getline(in, line); ++number) {
+        if (line.empty() || line[0] == '#' || line.find_first_not_of(" \t\r") == std::string::npos) {
+            continue;
+        }
+        std::istringstream ss(line);
+        double time_us;
+        uint64_t length;
+        if (!(ss >> time_us >> length) || time_us < 0 ||
+            (!segments.empty() && time_us * 1e-6 < segments.back().time)) {
+            throw std::runtime_error(path + " line " + std::to_string(number) + ": invalid segment");
+        }
+        segments.push_back({ time_us * 1e-6, length });
+        total += length;
+    }
+    if (total != file_size) {
+        throw std::runtime_error("The segments of " + path + " hold " + std::to_string(total) +
+                                 " bytes, the file " + std::to_string(file_size));
+    }
+    *period = segments.back().time;
+    return segments;
+}
+
+// ============= Statistics ===================================================
+
+// delays of the writes behind their release time: 1 us buckets up to 1 ms, 100 us buckets up
+// to 1 s
+class delay_histogram {
+public:
+    delay_histogram() : buckets(1000 + 9990 + 1) {
+    }
+
+    void add(double us) {
+        buckets[bucket(us)]++;
+        count++;
+        max_us = std::max(max_us, us);
+    }
+
+    uint64_t writes() const {
+        return count;
+    }
+
+    uint64_t writes_over(double us) const {
+        uint64_t n = 0;
+        for (size_t i = bucket(us); i < buckets.size(); ++i) {
+            n += buckets[i];
+        }
+        return n;
+    }
+
+    // upper bound of the bucket holding percentile 'p', at most the largest delay
+    double percentile(double p) const {
+        const uint64_t rank = static_cast<uint64_t>(p / 100.0 * (count - 1));
+        uint64_t seen = 0;
+        for (size_t i = 0; i + 1 < buckets.size(); ++i) {
+            seen += buckets[i];
+            if (seen > rank) {
+                return std::min(i < 1000 ? i + 1.0 : 1000.0 + (i - 999) * 100.0, max_us);
+            }
+        }
+        return max_us;
+    }
+
+    double max() const {
+        return max_us;
+    }
+
+private:
+    size_t bucket(double us) const {
+        const size_t i = us < 1000 ? static_cast<size_t>(us) : 1000 + static_cast<size_t>((us - 1000) / 100);
+        return std::min(i, buckets.size() - 1);
+    }
+
+    std::vector<uint64_t> buckets;
+    uint64_t count = 0;
+    double max_us = 0;
+};
+
+// ============= Pipeline =====================================================
+
+struct filled_buffer {
+    unsigned index;
+    size_t length;
+};
+
+struct player {
+    explicit player(const options& opt)
+        : opt(opt), free_buffers(opt.pool_size), full_buffers(opt.pool_size) {
+    }
+
+    ~player() {
+        for (auto p : pool) {
+            free_aligned(p);
+        }
+    }
+
+    void fail(const std::string& what) {
+        std::lock_guard<std::mutex> lock(error_lock);
+        if (error.empty()) {
+            error = what;
+        }
+        stop = true;
+    }
+
+    const options& opt;
+    std::vector<segment> segments;
+    double period = 0;
+    std::vector<void*> pool;
+
+    // the reader takes buffers from free_buffers and hands them filled to the player through
+    // full_buffers, the player gives them back through free_buffers when their writes completed
+    spsc_queue<unsigned> free_buffers;
+    spsc_queue<filled_buffer> full_buffers;
+
+    std::atomic<bool> stop{ false };
+    std::atomic<bool> reader_done{ false };
+    std::atomic<bool> player_done{ false };
+    std::atomic<uint64_t> sent{ 0 };
+    std::atomic<uint64_t> underruns{ 0 };
+    std::atomic<uint64_t> delay_sum_ns{ 0 };
+    std::atomic<uint64_t> delay_count{ 0 };
+    std::atomic<uint64_t> delay_max_ns{ 0 };
+    delay_histogram delays; // player thread only
+    std::chrono::steady_clock::time_point start;
+    std::chrono::steady_clock::time_point end;
+
+    std::mutex error_lock;
+    std::string error;
+};
+
+static void backoff(unsigned& idle) {
+    if (++idle < 64) {
+        std::this_thread::yield();
+    } else {
+        std::this_thread::sleep_for(std::chrono::microseconds(100));
+    }
+}
+
+static void run_reader(player& p, play_file& file) {
+    const options& opt = p.opt;
+    const uint64_t size = file.size();
+    uint64_t offset = 0;
+    unsigned pass = 1;
+    std::deque<filled_buffer> in_flight;
+
+    try {
+        unsigned idle = 0;
+        while (!p.stop) {
+            unsigned index;
+            while (in_flight.size() < opt.read_depth && (offset < size || opt.passes == 0 || pass < opt.passes) &&
+                   p.free_buffers.pop(index)) {
+                if (offset == size) {
+                    offset = 0;
+                    ++pass;
+                }
+                const size_t length = static_cast<size_t>(std::min<uint64_t>(opt.read_size, size - offset));
+                // unbuffered reads are whole sectors, the last one returns the rest of the file
+                const size_t sectors = (length + play_file::sector_size - 1) & ~(play_file::sector_size - 1);
+                file.submit(p.pool[index], sectors, offset);
+                in_flight.push_back({ index, length });
+                offset += length;
+            }
+            if (in_flight.empty()) {
+                if (offset == size && opt.passes != 0 && pass == opt.passes) {
+                    break;
+                }
+                backoff(idle);
+                continue;
+            }
+            idle = 0;
+            const size_t n = file.wait();
+            const filled_buffer f = in_flight.front();
+            in_flight.pop_front();
+            if (n < f.length) {
+                throw std::runtime_error("The file got shorter while playing it");
+            }
+            p.full_buffers.push(f);
+        }
+    } catch (const std::exception& e) {
+        p.fail(e.what());
+    }
+    // the file must not write into the buffers after the player freed them
+    while (!in_flight.empty()) {
+        try {
+            file.wait();
+        } catch (const std::exception&) {
+        }
+        in_flight.pop_front();
+    }
+    p.reader_done = true;
+}
+
+// sleep until shortly before 't', then spin; returns false if playing was stopped meanwhile
+static bool wait_until(const player& p, std::chrono::steady_clock::time_point t) {
+    for (;;) {
+        const auto remaining = t - std::chrono::steady_clock::now();
+        if (remaining <= std::chrono::steady_clock::duration::zero()) {
+            return true;
+        }
+        if (p.stop) {
+            return false;
+        }
+        if (remaining > std::chrono::milliseconds(12)) {
+            std::this_thread::sleep_for(std::chrono::milliseconds(10));
+        } else if (remaining > std::chrono::milliseconds(2)) {
+            std::this_thread::sleep_for(remaining - std::chrono::milliseconds(2));
+        } else {
+            std::this_thread::yield();
+        }
+    }
+}
+
+static void run_player(player& p, play_sink& sink) {
+    using clock = std::chrono::steady_clock;
+    const options& opt = p.opt;
+
+    struct pending_write {
+        unsigned buffer;
+        size_t length;
+        bool last; // the last write from the buffer, which then goes back to the pool
+    };
+    std::deque<pending_write> outstanding;
+
+    auto complete_oldest = [&]() {
+        const pending_write w = outstanding.front();
+        outstanding.pop_front();
+        const size_t n = sink.wait();
+        if (n != w.length) {
+            throw std::runtime_error("Short write to the stream: " + std::to_string(n) + " of " +
+                                     std::to_string(w.length) + " bytes");
+        }
+        p.sent += n;
+        if (w.last) {
+            p.free_buffers.push(w.buffer);
+        }
+    };
+
+    try {
+        // start with a full read-ahead pool
+        unsigned idle = 0;
+        while (!p.stop && !p.reader_done && p.full_buffers.size() < opt.pool_size) {
+            backoff(idle);
+        }
+        p.start = clock::now();
+
+        uint64_t scheduled = 0; // bytes of all writes submitted so far
+        size_t seg = 0;
+        uint64_t seg_left = p.segments.empty() ? 0 : p.segments[0].length;
+        double pass_base = 0;
+
+        filled_buffer cur = { 0, 0 };
+        size_t pos = 0;
+        bool have = false;
+        bool starved = false;
+        while (!p.stop) {
+            // release time of the next write
+            clock::time_point release = clock::now();
+            if (opt.mode == pacing::bandwidth) {
+                release = p.start + std::chrono::duration_cast<clock::duration>(
+                                        std::chrono::duration<double>(scheduled / opt.rate));
+            } else if (opt.mode == pacing::timestamps) {
+                while (seg_left == 0) {
+                    if (++seg == p.segments.size()) {
+                        seg = 0;
+                        pass_base += p.period;
+                    }
+                    seg_left = p.segments[seg].length;
+                }
+                release = p.start + std::chrono::duration_cast<clock::duration>(
+                                        std::chrono::duration<double>(pass_base + p.segments[seg].time));
+            }
+
+            if (!have) {
+                if (!p.full_buffers.pop(cur)) {
+                    if (p.reader_done) {
+                        // the reader may have pushed between the pop and setting the flag
+                        if (!p.full_buffers.pop(cur)) {
+                            break;
+                        }
+                    } else {
+                        if (!starved && clock::now() >= release) {
+                            starved = true;
+                            p.underruns++;
+                        }
+                        if (!outstanding.empty()) {
+                            complete_oldest();
+                        } else {
+                            std::this_thread::yield();
+                        }
+                        continue;
+                    }
+                }
+                have = true;
+                starved = false;
+                pos = 0;
+            }
+
+            size_t length = std::min(cur.length - pos, opt.write_size);
+            if (opt.mode == pacing::timestamps) {
+                length = static_cast<size_t>(std::min<uint64_t>(length, seg_left));
+            }
+            if (outstanding.size() == opt.write_depth) {
+                complete_oldest();
+            }
+            if (!wait_until(p, release)) {
+                break;
+            }
+
+            const auto issued = clock::now();
+            sink.submit(static_cast<const uint8_t*>(p.pool[cur.index]) + pos, length);
+            pos += length;
+            outstanding.push_back({ cur.index, length, pos == cur.length });
+            scheduled += length;
+            if (opt.mode == pacing::timestamps) {
+                seg_left -= length;
+            }
+            if (pos == cur.length) {
+                have = false;
+            }
+
+            if (opt.mode != pacing::max_rate) {
+                const uint64_t ns = static_cast<uint64_t>(
+                    std::chrono::duration_cast<std::chrono::nanoseconds>(issued - release).count());
+                p.delays.add(ns / 1e3);
+                p.delay_sum_ns += ns;
+                p.delay_count++;
+                if (ns > p.delay_max_ns) {
+                    p.delay_max_ns = ns;
+                }
+            }
+        }
+        while (!outstanding.empty()) {
+            complete_oldest();
+        }
+        p.end = clock::now();
+    } catch (const std::exception& e) {
+        p.fail(e.what());
+        p.end = clock::now();
+        for (; !outstanding.empty(); outstanding.pop_front()) {
+            try {
+                sink.wait();
+            } catch (const std::exception&) {
+            }
+        }
+    }
+    p.player_done = true;
+}
+
+// ============= Main =========================================================
+
+static volatile std::sig_atomic_t interrupted = 0;
+
+static void on_interrupt(int) {
+    interrupted = 1;
+}
+
+int main(int argc, char* argv[]) {
+
+    try {
+        options opt;
+        for (int i = 1; i < argc; ++i) {
+            const std::string o = argv[i];
+            if (o == "-v") {
+                opt.verify = true;
+                continue;
+            }
+            if (o.size() != 2 || o[0] != '-' || i + 1 >= argc) {
+                std::cout << help_text;
+                return 0;
+            }
+            const std::string arg = argv[++i];
+            switch (o[1]) {
+            case 'f':
+                opt.file = arg;
+                break;
+            case 'c':
+                opt.channel = std::stoul(arg);
+                break;
+            case 'r':
+                opt.mode = pacing::bandwidth;
+                opt.rate = std::stod(arg) * 1e6;
+                break;
+            case 'i':
+                opt.mode = pacing::timestamps;
+                opt.index = arg;
+                break;
+            case 'l':
+                opt.passes = std::stoul(arg);
+                break;
+            case 't':
+                opt.seconds = std::stod(arg);
+                break;
+            case 'b':
+                opt.read_size = static_cast<size_t>(parse_number(arg));
+                break;
+            case 'n':
+                opt.pool_size = std::stoul(arg);
+                break;
+            case 'k':
+                opt.read_depth = std::stoul(arg);
+                break;
+            case 'w':
+                opt.write_size = static_cast<size_t>(parse_number(arg));
+                break;
+            case 'q':
+                opt.write_depth = std::stoul(arg);
+                break;
+            case 's':
+                opt.synthetic = true;
+                opt.sink_rate = std::stod(arg) * 1e6;
+                break;
+            default:
+                std::cout << help_text;
+                return 0;
+            }
+        }
+        if (opt.file.empty()) {
+            std::cout << help_text;
+            return 0;
+        }
+        if (opt.read_size == 0 || (opt.read_size % play_file::sector_size) != 0) {
+            throw std::invalid_argument("the read size must be a multiple of " +
+                                        std::to_string(play_file::sector_size));
+        }
+        if (opt.write_size == 0 || opt.pool_size == 0 || opt.read_depth == 0 || opt.write_depth == 0) {
+            throw std::invalid_argument("write size, pool size and queue depths must not be 0");
+        }
+        if (opt.mode == pacing::bandwidth && opt.rate <= 0) {
+            throw std::invalid_argument("the bandwidth of -r must be above 0");
+        }
+        if (opt.verify && (!opt.synthetic || opt.passes != 1)) {
+            throw std::invalid_argument("-v needs the synthetic sink (-s) and a single pass");
+        }
+
+        auto file = open_play_file(opt.file, opt.read_depth);
+        if (file->size() == 0) {
+            throw std::runtime_error(opt.file + " is empty");
+        }
+        player p(opt);
+        if (opt.mode == pacing::timestamps) {
+            p.segments = read_index(opt.index, file->size(), &p.period);
+        }
+        auto sink = opt.synthetic ? open_synthetic_sink(opt.write_depth, opt.sink_rate, opt.verify, synthetic_seed)
+                                  : open_device_sink(opt.channel, opt.write_depth);
+
+        for (unsigned i = 0; i < opt.pool_size; ++i) {
+            p.pool.push_back(allocate_aligned(opt.read_size));
+            p.free_buffers.push(i);
+        }
+        use_fine_sleep();
+
+        std::signal(SIGINT, on_interrupt);
+        std::cout << "Playing " << opt.file << " (" << format_bytes(file->size()) << ") to "
+                  << (opt.synthetic ? std::string("synthetic sink") : "h2c_" + std::to_string(opt.channel));
+        if (opt.mode == pacing::bandwidth) {
+            std::cout << std::fixed << std::setprecision(1) << " at " << opt.rate / 1e6 << " MB/s";
+        } else if (opt.mode == pacing::timestamps) {
+            std::cout << " at the times of " << opt.index;
+        }
+        std::cout << (opt.passes == 1 ? "" : opt.passes == 0 ? ", repeated until stopped"
+                                                             : ", " + std::to_string(opt.passes) + " passes")
+                  << "\n";
+
+        const auto start = std::chrono::steady_clock::now();
+        std::thread reader(run_reader, std::ref(p), std::ref(*file));
+        std::thread player_thread(run_player, std::ref(p), std::ref(*sink));
+
+        std::cout << std::fixed << std::setprecision(1);
+        uint64_t last_sent = 0;
+        uint64_t last_delay_sum = 0;
+        uint64_t last_delay_count = 0;
+        auto last = start;
+        for (unsigned second = 1; !p.player_done; ++second) {
+            const auto due = start + std::chrono::seconds(second);
+            while (!p.player_done && !interrupted && std::chrono::steady_clock::now() < due) {
+                std::this_thread::sleep_for(std::chrono::milliseconds(10));
+            }
+            const auto now = std::chrono::steady_clock::now();
+            const double elapsed = std::chrono::duration<double>(now - start).count();
+            if (interrupted || (opt.seconds > 0 && elapsed >= opt.seconds)) {
+                p.stop = true;
+            }
+            if (now < due) {
+                break; // ended within the second
+            }
+            const double dt = std::chrono::duration<double>(now - last).count();
+            const uint64_t sent = p.sent;
+            std::cout << "[" << std::setw(5) << second << "s]  out " << std::setw(7)
+                      << (sent - last_sent) / dt / 1e6 << " MB/s";
+            if (opt.mode != pacing::max_rate) {
+                const uint64_t delay_sum = p.delay_sum_ns;
+                const uint64_t delay_count = p.delay_count;
+                const uint64_t writes = delay_count - last_delay_count;
+                std::cout << "  late avg " << std::setw(7)
+                          << (writes > 0 ? (delay_sum - last_delay_sum) / 1e3 / writes : 0.0) << " us max "
+                          << std::setw(8) << p.delay_max_ns.exchange(0) / 1e3 << " us";
+                last_delay_sum = delay_sum;
+                last_delay_count = delay_count;
+            }
+            std::cout << "  read-ahead " << p.full_buffers.size() << "/" << opt.pool_size << "  underruns "
+                      << p.underruns << std::endl;
+            last_sent = sent;
+            last = now;
+        }
+        player_thread.join();
+        p.stop = true;
+        reader.join();
+        std::signal(SIGINT, SIG_DFL);
+
+        if (!p.error.empty()) {
+            throw std::runtime_error(p.error);
+        }
+
+        const uint64_t sent = p.sent;
+        const double seconds = std::chrono::duration<double>(p.end - p.start).count();
+        std::cout << "\nPlayed " << format_bytes(sent) << " in " << seconds << " s, "
+                  << (seconds > 0 ? sent / seconds / 1e6 : 0.0) << " MB/s";
+        if (opt.mode == pacing::bandwidth) {
+            std::cout << ", " << (seconds > 0 ? 100.0 * sent / seconds / opt.rate : 0.0) << "% of "
+                      << opt.rate / 1e6 << " MB/s";
+        }
+        std::cout << "\n";
+        if (opt.mode != pacing::max_rate && p.delays.writes() > 0) {
+            std::cout << "Pacing of " << p.delays.writes() << " writes, delay after the release time: p50 "
+                      << p.delays.percentile(50) << " us, p99 " << p.delays.percentile(99) << " us, p99.9 "
+                      << p.delays.percentile(99.9) << " us, max " << p.delays.max() << " us\n"
+                      << "Writes more than 1 ms late: " << p.delays.writes_over(1000) << "\n";
+        }
+        std::cout << "Read-ahead underruns: " << p.underruns << "\n";
+        if (opt.verify) {
+            std::cout << "Verified " << format_bytes(sent) << "\n";
+        }
+
+    } catch (const std::exception& e) {
+        std::cout << "Error: " << e.what() << "\n";
+        return -1;
+    }
+
+    return 0;
+}
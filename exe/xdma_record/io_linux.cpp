@@ -0,0 +1,85 @@
+// xdma_record I/O for Linux: the output file with O_DIRECT. There is no XDMA driver for Linux in
+// this project, so only the synthetic source is available.
+
+#include <cerrno>
+#include <cstdlib>
+#include <cstring>
+#include <stdexcept>
+
+#include <fcntl.h>
+#include <unistd.h>
+
+#include "record_io.h"
+
+static std::runtime_error system_error(const std::string& what) {
+    return std::runtime_error(what + ": " + std::strerror(errno));
+}
+
+class linux_file : public record_file {
+public:
+    linux_file(const std::string& path, uint64_t preallocate) {
+        fd = open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_DIRECT, 0644);
+        if ((fd < 0) && (errno == EINVAL)) { // e.g. tmpfs, which has no direct I/O
+            fd = open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+        }
+        if (fd < 0) {
+            throw system_error("Opening " + path + " failed");
+        }
+        // reserve the blocks but keep the size at zero, finish() sets the final size
+        if ((preallocate > 0) && (fallocate(fd, FALLOC_FL_KEEP_SIZE, 0, static_cast<off_t>(preallocate)) != 0)) {
+            close(fd);
+            throw system_error("Preallocating " + std::to_string(preallocate) + " bytes failed");
+        }
+    }
+
+    ~linux_file() {
+        close(fd);
+    }
+
+    // writes complete before submit() returns, the writer stage still overlaps them with the
+    // reader stage
+    void submit(const void* data, size_t length, uint64_t offset) override {
+        auto p = static_cast<const char*>(data);
+        while (length > 0) {
+            const ssize_t n = pwrite(fd, p, length, static_cast<off_t>(offset));
+            if (n < 0) {
+                throw system_error("Writing the file failed");
+            }
+            p += n;
+            offset += n;
+            length -= n;
+        }
+    }
+
+    void wait() override {
+    }
+
+    void finish(uint64_t size) override {
+        if (ftruncate(fd, static_cast<off_t>(size)) != 0) {
+            throw system_error("Truncating the file failed");
+        }
+    }
+
+private:
+    int fd;
+};
+
+std::unique_ptr<record_file> create_record_file(const std::string& path, uint64_t preallocate, unsigned) {
+    return std::unique_ptr<record_file>(new linux_file(path, preallocate));
+}
+
+std::unique_ptr<record_source> open_device_source(unsigned, unsigned) {
+    throw std::runtime_error("Capturing from c2h needs the Windows driver, use the synthetic source (-s)");
+}
+
+void* allocate_aligned(size_t size) {
+    void* p = nullptr;
+    if (posix_memalign(&p, record_file::sector_size, size) != 0) {
+        throw std::runtime_error("Allocating " + std::to_string(size) + " bytes failed");
+    }
+    return p;
+}
+
+void free_aligned(void* p) {
+    std::free(p);
+}
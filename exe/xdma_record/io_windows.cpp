@@ -0,0 +1,268 @@
+// xdma_record I/O for the XDMA driver: overlapped reads from c2h_<channel> and an overlapped,
+// unbuffered output file.
+
+#include <deque>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#define NOMINMAX
+#include <Windows.h>
+#include <SetupAPI.h>
+#include <INITGUID.H>
+
+#include "xdma_public.h"
+#include "record_io.h"
+
+#pragma comment(lib, "setupapi.lib")
+
+static std::string get_windows_error_msg(DWORD error) {
+
+    char msg_buffer[256];
+    FormatMessageA(FORMAT_MESSAGE_FROM_SYSTEM, NULL, error,
+                   MAKELANGID(LANG_NEUTRAL, SUBLANG_DEFAULT), (LPSTR)&msg_buffer, 256, NULL);
+    return{ msg_buffer, 256 };
+}
+
+static std::vector<std::string> get_device_paths(GUID guid) {
+
+    auto device_info = SetupDiGetClassDevs((LPGUID)&guid, NULL, NULL, DIGCF_PRESENT | DIGCF_DEVICEINTERFACE);
+    if (device_info == INVALID_HANDLE_VALUE) {
+        throw std::runtime_error("GetDevices INVALID_HANDLE_VALUE");
+    }
+
+    SP_DEVICE_INTERFACE_DATA device_interface = { 0 };
+    device_interface.cbSize = sizeof(SP_DEVICE_INTERFACE_DATA);
+
+    // enumerate through devices
+    std::vector<std::string> device_paths;
+    for (unsigned index = 0;
+         SetupDiEnumDeviceInterfaces(device_info, NULL, &guid, index, &device_interface);
+         ++index) {
+
+        // get required buffer size
+        unsigned long detail_length = 0;
+        if (!SetupDiGetDeviceInterfaceDetail(device_info, &device_interface, NULL, 0, &detail_length, NULL) && GetLastError() != ERROR_INSUFFICIENT_BUFFER) {
+            throw std::runtime_error("SetupDiGetDeviceInterfaceDetail - get length failed");
+        }
+
+        // allocate space for device interface detail
+        auto dev_detail = reinterpret_cast<PSP_DEVICE_INTERFACE_DETAIL_DATA>(new char[detail_length]);
+        dev_detail->cbSize = sizeof(SP_DEVICE_INTERFACE_DETAIL_DATA);
+
+        // get device interface detail
+        if (!SetupDiGetDeviceInterfaceDetail(device_info, &device_interface, dev_detail, detail_length, NULL, NULL)) {
+            delete[] dev_detail;
+            throw std::runtime_error("SetupDiGetDeviceInterfaceDetail - get detail failed");
+        }
+        device_paths.emplace_back(dev_detail->DevicePath);
+        delete[] dev_detail;
+    }
+
+    SetupDiDestroyDeviceInfoList(device_info);
+
+    return device_paths;
+}
+
+// one OVERLAPPED per slot, completed in submission order
+class overlapped_slots {
+public:
+    explicit overlapped_slots(unsigned depth) : slots(depth) {
+        for (auto& ov : slots) {
+            ov.hEvent = CreateEvent(NULL, TRUE, FALSE, NULL);
+            if (ov.hEvent == NULL) {
+                release();
+                throw std::runtime_error("CreateEvent failed: " + get_windows_error_msg(GetLastError()));
+            }
+        }
+    }
+
+    ~overlapped_slots() {
+        release();
+    }
+
+    OVERLAPPED* prepare(unsigned slot, uint64_t offset) {
+        OVERLAPPED& ov = slots[slot];
+        ov.Internal = 0;
+        ov.InternalHigh = 0;
+        ov.Offset = static_cast<DWORD>(offset);
+        ov.OffsetHigh = static_cast<DWORD>(offset >> 32);
+        return &ov;
+    }
+
+    OVERLAPPED* get(unsigned slot) {
+        return &slots[slot];
+    }
+
+private:
+    void release() {
+        for (auto& ov : slots) {
+            if (ov.hEvent != NULL) {
+                CloseHandle(ov.hEvent);
+            }
+        }
+    }
+
+    std::vector<OVERLAPPED> slots;
+};
+
+// ============= Source =======================================================
+
+class device_source : public record_source {
+public:
+    device_source(const std::string& path, unsigned depth) : slots(depth) {
+        h = CreateFile(path.c_str(), GENERIC_READ, 0, NULL, OPEN_EXISTING,
+                       FILE_ATTRIBUTE_NORMAL | FILE_FLAG_OVERLAPPED, NULL);
+        if (h == INVALID_HANDLE_VALUE) {
+            throw std::runtime_error("Opening " + path + " failed: " + get_windows_error_msg(GetLastError()));
+        }
+    }
+
+    ~device_source() {
+        // the buffers of outstanding reads belong to the caller, let the reads end first
+        CancelIoEx(h, NULL);
+        for (auto slot : outstanding) {
+            DWORD num_bytes;
+            GetOverlappedResult(h, slots.get(slot), &num_bytes, TRUE);
+        }
+        CloseHandle(h);
+    }
+
+    void submit(unsigned slot, void* buffer, size_t length) override {
+        if (!ReadFile(h, buffer, static_cast<DWORD>(length), NULL, slots.prepare(slot, 0)) &&
+            (GetLastError() != ERROR_IO_PENDING)) {
+            throw std::runtime_error("ReadFile failed: " + get_windows_error_msg(GetLastError()));
+        }
+        outstanding.push_back(slot);
+    }
+
+    size_t wait(unsigned* slot) override {
+        // the engine queue of the driver is sequential, reads complete in submission order
+        *slot = outstanding.front();
+        outstanding.pop_front();
+        DWORD num_bytes = 0;
+        if (!GetOverlappedResult(h, slots.get(*slot), &num_bytes, TRUE)) {
+            const DWORD error = GetLastError();
+            if (error == ERROR_OPERATION_ABORTED) {
+                return 0;
+            }
+            throw std::runtime_error("Reading the stream failed: " + get_windows_error_msg(error));
+        }
+        // a read which finds no data within the timeout of the driver completes with 0 bytes
+        return num_bytes;
+    }
+
+    void cancel() override {
+        CancelIoEx(h, NULL);
+    }
+
+private:
+    HANDLE h;
+    overlapped_slots slots;
+    std::deque<unsigned> outstanding;
+};
+
+std::unique_ptr<record_source> open_device_source(unsigned channel, unsigned depth) {
+    const auto device_paths = get_device_paths(GUID_DEVINTERFACE_XDMA);
+    if (device_paths.empty()) {
+        throw std::runtime_error("No XDMA device driver installed!");
+    }
+    return std::unique_ptr<record_source>(
+        new device_source(device_paths[0] + "\\c2h_" + std::to_string(channel), depth));
+}
+
+// ============= File =========================================================
+
+class windows_file : public record_file {
+public:
+    windows_file(const std::string& path, uint64_t preallocate, unsigned depth)
+        : depth(depth), slots(depth) {
+        h = CreateFile(path.c_str(), GENERIC_WRITE, 0, NULL, CREATE_ALWAYS,
+                       FILE_ATTRIBUTE_NORMAL | FILE_FLAG_NO_BUFFERING | FILE_FLAG_OVERLAPPED, NULL);
+        if (h == INVALID_HANDLE_VALUE) {
+            throw std::runtime_error("Opening " + path + " failed: " + get_windows_error_msg(GetLastError()));
+        }
+        // reserve the clusters without moving the end of file, finish() sets the final size
+        if (preallocate > 0) {
+            FILE_ALLOCATION_INFO info;
+            info.AllocationSize.QuadPart = static_cast<LONGLONG>(preallocate);
+            if (!SetFileInformationByHandle(h, FileAllocationInfo, &info, sizeof(info))) {
+                const DWORD error = GetLastError();
+                CloseHandle(h);
+                throw std::runtime_error("Preallocating " + std::to_string(preallocate) + " bytes failed: " +
+                                         get_windows_error_msg(error));
+            }
+        }
+    }
+
+    ~windows_file() {
+        while (!outstanding.empty()) {
+            DWORD num_bytes;
+            GetOverlappedResult(h, slots.get(outstanding.front()), &num_bytes, TRUE);
+            outstanding.pop_front();
+        }
+        CloseHandle(h);
+    }
+
+    void submit(const void* data, size_t length, uint64_t offset) override {
+        const unsigned slot = next_slot;
+        next_slot = (next_slot + 1) % depth;
+        if (!WriteFile(h, data, static_cast<DWORD>(length), NULL, slots.prepare(slot, offset)) &&
+            (GetLastError() != ERROR_IO_PENDING)) {
+            throw std::runtime_error("WriteFile failed: " + get_windows_error_msg(GetLastError()));
+        }
+        outstanding.push_back(slot);
+        lengths.push_back(length);
+    }
+
+    void wait() override {
+        const unsigned slot = outstanding.front();
+        const size_t length = lengths.front();
+        outstanding.pop_front();
+        lengths.pop_front();
+        DWORD num_bytes = 0;
+        if (!GetOverlappedResult(h, slots.get(slot), &num_bytes, TRUE)) {
+            throw std::runtime_error("Writing the file failed: " + get_windows_error_msg(GetLastError()));
+        }
+        if (num_bytes != length) {
+            throw std::runtime_error("Short write to the file: " + std::to_string(num_bytes) + " of " +
+                                     std::to_string(length) + " bytes");
+        }
+    }
+
+    void finish(uint64_t size) override {
+        while (!outstanding.empty()) {
+            wait();
+        }
+        FILE_END_OF_FILE_INFO info;
+        info.EndOfFile.QuadPart = static_cast<LONGLONG>(size);
+        if (!SetFileInformationByHandle(h, FileEndOfFileInfo, &info, sizeof(info))) {
+            throw std::runtime_error("Truncating the file failed: " + get_windows_error_msg(GetLastError()));
+        }
+    }
+
+private:
+    HANDLE h;
+    const unsigned depth;
+    overlapped_slots slots;
+    unsigned next_slot = 0;
+    std::deque<unsigned> outstanding;
+    std::deque<size_t> lengths;
+};
+
+std::unique_ptr<record_file> create_record_file(const std::string& path, uint64_t preallocate,
+                                                unsigned depth) {
+    return std::unique_ptr<record_file>(new windows_file(path, preallocate, depth));
+}
+
+void* allocate_aligned(size_t size) {
+    void* p = _aligned_malloc(size, record_file::sector_size);
+    if (p == nullptr) {
+        throw std::runtime_error("Allocating " + std::to_string(size) + " bytes failed");
+    }
+    return p;
+}
+
+void free_aligned(void* p) {
+    _aligned_free(p);
+}
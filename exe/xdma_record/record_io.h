@@ -0,0 +1,60 @@
+#pragma once
+
+// I/O interfaces of xdma_record. xdma_record.cpp runs the reader and writer stages against them;
+// io_windows.cpp implements the c2h source and the file for the XDMA driver, io_linux.cpp the
+// file for Linux, and source_synthetic.cpp a source which needs no card.
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <string>
+
+// Stream data source with up to 'depth' reads outstanding, one per request slot.
+class record_source {
+public:
+    virtual ~record_source() = default;
+
+    // start reading up to 'length' bytes into 'buffer' on request slot 'slot'
+    virtual void submit(unsigned slot, void* buffer, size_t length) = 0;
+
+    // wait for the oldest outstanding read, store its slot and return the number of bytes
+    // received. Reads which end without data return 0. Throws if a read failed.
+    virtual size_t wait(unsigned* slot) = 0;
+
+    // make all outstanding reads end as soon as possible
+    virtual void cancel() = 0;
+};
+
+// Output file written with unbuffered I/O. Writes start at sector aligned offsets, have a length
+// which is a multiple of the sector size and come from sector aligned buffers.
+class record_file {
+public:
+    static const size_t sector_size = 4096;  // covers 512 byte and 4K native sectors
+
+    virtual ~record_file() = default;
+
+    // start writing; 'data' must stay valid until the write was waited for
+    virtual void submit(const void* data, size_t length, uint64_t offset) = 0;
+
+    // wait for the oldest write which is still in flight, throws if it failed
+    virtual void wait() = 0;
+
+    // cut the file to 'size' bytes, which drops the padding of the last sector
+    virtual void finish(uint64_t size) = 0;
+};
+
+// c2h_<channel> of the first XDMA device, opened for 'depth' outstanding reads
+std::unique_ptr<record_source> open_device_source(unsigned channel, unsigned depth);
+
+// pattern data (xdma_pattern.h) in reads of random length at up to 'rate' bytes per second,
+// 0 = as fast as possible
+std::unique_ptr<record_source> open_synthetic_source(unsigned depth, double rate, uint64_t seed);
+
+// create the file; 'preallocate' bytes of disk space are reserved up front. Up to 'depth' writes
+// are in flight.
+std::unique_ptr<record_file> create_record_file(const std::string& path, uint64_t preallocate,
+                                                unsigned depth);
+
+// aligned memory for DMA and unbuffered file I/O
+void* allocate_aligned(size_t size);
+void free_aligned(void* p);
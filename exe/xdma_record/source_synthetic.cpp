@@ -0,0 +1,66 @@
+// xdma_record source without a card: pattern data in reads of random length, like the reads of an
+// AXI-ST c2h engine which return whatever the ring buffer of the driver holds.
+
+#include <chrono>
+#include <deque>
+#include <random>
+#include <thread>
+
+#include "record_io.h"
+#include "xdma_pattern.h"
+
+class synthetic_source : public record_source {
+public:
+    synthetic_source(double rate, uint64_t seed)
+        : rate(rate), pattern(pattern_type::counter, seed), rng(static_cast<unsigned>(seed)),
+          start(std::chrono::steady_clock::now()) {
+    }
+
+    void submit(unsigned slot, void* buffer, size_t length) override {
+        requests.push_back({ slot, static_cast<uint8_t*>(buffer), length });
+    }
+
+    size_t wait(unsigned* slot) override {
+        const request r = requests.front();
+        requests.pop_front();
+        *slot = r.slot;
+        if (cancelled) {
+            return 0;
+        }
+
+        // between half and all of the requested bytes
+        const size_t length = r.length - std::uniform_int_distribution<size_t>(0, r.length / 2)(rng);
+        pattern.fill(r.buffer, length);
+        produced += length;
+
+        if (rate > 0) { // the data is not there before the stream delivered it
+            const auto due = start + std::chrono::duration_cast<std::chrono::steady_clock::duration>(
+                                         std::chrono::duration<double>(produced / rate));
+            std::this_thread::sleep_until(due);
+        }
+        return length;
+    }
+
+    void cancel() override {
+        cancelled = true;
+    }
+
+private:
+    struct request {
+        unsigned slot;
+        uint8_t* buffer;
+        size_t length;
+    };
+
+    const double rate;
+    pattern_stream pattern;
+    std::mt19937 rng;
+    const std::chrono::steady_clock::time_point start;
+    std::deque<request> requests;
+    uint64_t produced = 0;
+    bool cancelled = false;
+};
+
+std::unique_ptr<record_source> open_synthetic_source(unsigned, double rate, uint64_t seed) {
+    return std::unique_ptr<record_source>(new synthetic_source(rate, seed));
+}
@@ -0,0 +1,479 @@
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <csignal>
+#include <cstring>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <mutex>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "record_io.h"
+#include "spsc_queue.h"
+#include "xdma_pattern.h"
+
+static const char* help_text =
+"xdma_record.exe captures an AXI-ST card-to-host stream to a file.\n"
+"\n"
+"Usage: xdma_record.exe -f <file> [options]\n"
+"\n"
+"  -f <file>     output file\n"
+"  -c <channel>  c2h channel to read (default 0)\n"
+"  -b <size>     bytes per read, K and M suffixes allowed (default 1M)\n"
+"  -n <count>    read buffers in the pool (default 64)\n"
+"  -q <depth>    reads kept outstanding (default 8)\n"
+"  -w <size>     bytes per file write, a multiple of 4K (default 4M)\n"
+"  -k <depth>    file writes kept in flight (default 4)\n"
+"  -a <size>     disk space to preallocate, K, M and G suffixes allowed (default 0)\n"
+"  -t <seconds>  recording time, 0 = until Ctrl+C (default 0)\n"
+"  -s <MB/s>     record from a synthetic source instead of the card, 0 = unthrottled\n"
+"  -v            verify the file against the synthetic stream when the recording ended\n"
+"\n"
+"A reader thread keeps the given number of reads outstanding on c2h_<channel>. Each read fills a\n"
+"buffer from the pool, filled buffers go to a writer thread through a lock-free queue. The writer\n"
+"packs them into blocks of the write size and writes the blocks with unbuffered I/O, so the file\n"
+"cache does not take part. When the writer falls behind and no pool buffer is free, the reader\n"
+"keeps reading into a scratch buffer so that the card does not stall; those bytes are counted as\n"
+"dropped and are not in the file.\n"
+"\n"
+"Every second the input and disk throughput, the fill level of the queue and the dropped bytes\n"
+"are printed. The queue high-water mark tells how close the pool came to running out.\n"
+"\n"
+"The synthetic source delivers the counter pattern of xdma_pattern.h in reads of random length,\n"
+"and is the only source of the Linux build.\n";
+
+// ============= Configuration ================================================
+
+struct options {
+    std::string file;
+    unsigned channel = 0;
+    size_t read_size = 1 << 20;
+    unsigned pool_size = 64;
+    unsigned read_depth = 8;
+    size_t write_size = 4 << 20;
+    unsigned write_depth = 4;
+    uint64_t preallocate = 0;
+    double seconds = 0;
+    bool synthetic = false;
+    double rate = 0; // bytes per second
+    bool verify = false;
+};
+
+static const uint64_t synthetic_seed = 1;
+
+static uint64_t parse_number(const std::string& s) {
+    size_t pos = 0;
+    uint64_t value = std::stoull(s, &pos, 0);
+    if (pos < s.size()) {
+        const char suffix = s[pos];
+        if (suffix == 'K' || suffix == 'k') {
+            value <<= 10;
+        } else if (suffix == 'M' || suffix == 'm') {
+            value <<= 20;
+        } else if (suffix == 'G' || suffix == 'g') {
+            value <<= 30;
+        } else {
+            throw std::invalid_argument("invalid number " + s);
+        }
+        if (pos + 1 != s.size()) {
+            throw std::invalid_argument("invalid number " + s);
+        }
+    }
+    return value;
+}
+
+static std::string format_bytes(uint64_t n) {
+    std::ostringstream ss;
+    ss << std::fixed << std::setprecision(1);
+    if (n >= (1ULL << 30)) {
+        ss << static_cast<double>(n) / (1ULL << 30) << " GiB";
+    } else if (n >= (1ULL << 20)) {
+        ss << static_cast<double>(n) / (1ULL << 20) << " MiB";
+    } else {
+        ss << n << " B";
+    }
+    return ss.str();
+}
+
+// ============= Pipeline =====================================================
+
+struct filled_buffer {
+    unsigned index;
+    size_t length;
+};
+
+struct recorder {
+    explicit recorder(const options& opt)
+        : opt(opt), free_buffers(opt.pool_size), full_buffers(opt.pool_size) {
+    }
+
+    ~recorder() {
+        for (auto p : pool) {
+            free_aligned(p);
+        }
+        for (auto p : blocks) {
+            free_aligned(p);
+        }
+        if (scratch != nullptr) {
+            free_aligned(scratch);
+        }
+    }
+
+    void fail(const std::string& what) {
+        std::lock_guard<std::mutex> lock(error_lock);
+        if (error.empty()) {
+            error = what;
+        }
+        stop = true;
+    }
+
+    const options& opt;
+    std::vector<void*> pool;
+    std::vector<void*> blocks;
+    void* scratch = nullptr;
+
+    // the reader takes buffers from free_buffers and hands them filled to the writer through
+    // full_buffers, the writer gives them back through free_buffers
+    spsc_queue<unsigned> free_buffers;
+    spsc_queue<filled_buffer> full_buffers;
+
+    std::atomic<bool> stop{ false };
+    std::atomic<bool> reader_done{ false };
+    std::atomic<uint64_t> received{ 0 };
+    std::atomic<uint64_t> dropped{ 0 };
+    std::atomic<uint64_t> written{ 0 };
+
+    std::mutex error_lock;
+    std::string error;
+};
+
+static void run_reader(recorder& r, record_source& source) {
+    const options& opt = r.opt;
+    std::vector<int> slot_buffer(opt.read_depth); // pool buffer of each slot, -1 = scratch
+
+    auto issue = [&](unsigned slot) {
+        unsigned index;
+        if (r.free_buffers.pop(index)) {
+            slot_buffer[slot] = static_cast<int>(index);
+            source.submit(slot, r.pool[index], opt.read_size);
+        } else { // the writer is behind, keep the stream flowing and drop the data
+            slot_buffer[slot] = -1;
+            source.submit(slot, r.scratch, opt.read_size);
+        }
+    };
+
+    unsigned outstanding = 0;
+    try {
+        for (unsigned slot = 0; slot < opt.read_depth; ++slot) {
+            issue(slot);
+            ++outstanding;
+        }
+        bool cancelled = false;
+        while (outstanding > 0) {
+            if (r.stop && !cancelled) {
+                source.cancel();
+                cancelled = true;
+            }
+            unsigned slot;
+            const size_t n = source.wait(&slot);
+            --outstanding;
+            if (slot_buffer[slot] >= 0) {
+                // empty buffers go through the writer as well, only it returns buffers to the pool
+                r.full_buffers.push({ static_cast<unsigned>(slot_buffer[slot]), n });
+                r.received += n;
+            } else {
+                r.dropped += n;
+            }
+            if (!r.stop) {
+                issue(slot);
+                ++outstanding;
+            }
+        }
+    } catch (const std::exception& e) {
+        r.fail(e.what());
+        source.cancel();
+        // the source must not write into the buffers after the recorder freed them
+        while (outstanding > 0) {
+            unsigned slot;
+            try {
+                source.wait(&slot);
+            } catch (const std::exception&) {
+            }
+            --outstanding;
+        }
+    }
+    r.reader_done = true;
+}
+
+static void run_writer(recorder& r, record_file& file) {
+    const options& opt = r.opt;
+    unsigned block = 0;
+    size_t fill = 0;
+    uint64_t offset = 0;
+    unsigned in_flight = 0;
+
+    auto write_block = [&](size_t length) {
+        file.submit(r.blocks[block], length, offset);
+        offset += length;
+        block = (block + 1) % opt.write_depth;
+        fill = 0;
+        // the next block is the oldest write when all of them are in flight
+        if (++in_flight == opt.write_depth) {
+            file.wait();
+            --in_flight;
+        }
+        r.written = offset;
+    };
+
+    try {
+        unsigned idle = 0;
+        for (;;) {
+            filled_buffer f;
+            if (!r.full_buffers.pop(f)) {
+                if (!r.reader_done) {
+                    if (++idle < 64) {
+                        std::this_thread::yield();
+                    } else {
+                        std::this_thread::sleep_for(std::chrono::microseconds(100));
+                    }
+                    continue;
+                }
+                // the reader may have pushed between the pop and setting the flag
+                if (!r.full_buffers.pop(f)) {
+                    break;
+                }
+            }
+            idle = 0;
+
+            auto p = static_cast<const uint8_t*>(r.pool[f.index]);
+            size_t left = f.length;
+            while (left > 0) {
+                const size_t n = std::min(left, opt.write_size - fill);
+                std::memcpy(static_cast<uint8_t*>(r.blocks[block]) + fill, p, n);
+                fill += n;
+                p += n;
+                left -= n;
+                if (fill == opt.write_size) {
+                    write_block(fill);
+                }
+            }
+            r.free_buffers.push(f.index);
+        }
+
+        // unbuffered writes are whole sectors, finish() cuts off the padding
+        const uint64_t size = offset + fill;
+        if (fill > 0) {
+            const size_t length = (fill + record_file::sector_size - 1) & ~(record_file::sector_size - 1);
+            std::memset(static_cast<uint8_t*>(r.blocks[block]) + fill, 0, length - fill);
+            write_block(length);
+        }
+        for (; in_flight > 0; --in_flight) {
+            file.wait();
+        }
+        file.finish(size);
+        r.written = size;
+    } catch (const std::exception& e) {
+        r.fail(e.what());
+        // keep returning buffers so that the reader can end
+        filled_buffer f;
+        while (!r.reader_done || r.full_buffers.pop(f)) {
+            if (r.full_buffers.pop(f)) {
+                r.free_buffers.push(f.index);
+            } else {
+                std::this_thread::yield();
+            }
+        }
+    }
+}
+
+// ============= Verification =================================================
+
+static bool verify_file(const options& opt) {
+    std::ifstream in(opt.file, std::ios::binary);
+    if (!in) {
+        throw std::runtime_error("Opening " + opt.file + " failed");
+    }
+    pattern_stream pattern(pattern_type::counter, synthetic_seed);
+    std::vector<char> buffer(opt.write_size);
+    while (in) {
+        in.read(buffer.data(), buffer.size());
+        const size_t n = static_cast<size_t>(in.gcount());
+        pattern_mismatch mismatch;
+        if (!pattern.verify(buffer.data(), n, &mismatch)) {
+            std::cout << "Verification failed at offset " << mismatch.offset << ": expected 0x" << std::hex
+                      << std::setw(8) << std::setfill('0') << mismatch.expected << ", got 0x" << std::setw(8)
+                      << mismatch.actual << std::dec << std::setfill(' ') << "\n";
+            return false;
+        }
+    }
+    std::cout << "Verified " << format_bytes(pattern.position()) << "\n";
+    return true;
+}
+
+// ============= Main =========================================================
+
+static volatile std::sig_atomic_t interrupted = 0;
+
+static void on_interrupt(int) {
+    interrupted = 1;
+}
+
+int main(int argc, char* argv[]) {
+
+    try {
+        options opt;
+        for (int i = 1; i < argc; ++i) {
+            const std::string o = argv[i];
+            if (o == "-v") {
+                opt.verify = true;
+                continue;
+            }
+            if (o.size() != 2 || o[0] != '-' || i + 1 >= argc) {
+                std::cout << help_text;
+                return 0;
+            }
+            const std::string arg = argv[++i];
+            switch (o[1]) {
+            case 'f':
+                opt.file = arg;
+                break;
+            case 'c':
+                opt.channel = std::stoul(arg);
+                break;
+            case 'b':
+                opt.read_size = static_cast<size_t>(parse_number(arg));
+                break;
+            case 'n':
+                opt.pool_size = std::stoul(arg);
+                break;
+            case 'q':
+                opt.read_depth = std::stoul(arg);
+                break;
+            case 'w':
+                opt.write_size = static_cast<size_t>(parse_number(arg));
+                break;
+            case 'k':
+                opt.write_depth = std::stoul(arg);
+                break;
+            case 'a':
+                opt.preallocate = parse_number(arg);
+                break;
+            case 't':
+                opt.seconds = std::stod(arg);
+                break;
+            case 's':
+                opt.synthetic = true;
+                opt.rate = std::stod(arg) * 1e6;
+                break;
+            default:
+                std::cout << help_text;
+                return 0;
+            }
+        }
+        if (opt.file.empty()) {
+            std::cout << help_text;
+            return 0;
+        }
+        if (opt.read_size == 0 || opt.pool_size == 0 || opt.read_depth == 0 || opt.write_depth == 0) {
+            throw std::invalid_argument("read size, pool size and queue depths must not be 0");
+        }
+        if (opt.write_size == 0 || (opt.write_size % record_file::sector_size) != 0) {
+            throw std::invalid_argument("the write size must be a multiple of " +
+                                        std::to_string(record_file::sector_size));
+        }
+        if (opt.verify && !opt.synthetic) {
+            throw std::invalid_argument("-v needs the synthetic source (-s)");
+        }
+
+        auto source = opt.synthetic ? open_synthetic_source(opt.read_depth, opt.rate, synthetic_seed)
+                                    : open_device_source(opt.channel, opt.read_depth);
+        auto file = create_record_file(opt.file, opt.preallocate, opt.write_depth);
+
+        recorder r(opt);
+        for (unsigned i = 0; i < opt.pool_size; ++i) {
+            r.pool.push_back(allocate_aligned(opt.read_size));
+            r.free_buffers.push(i);
+        }
+        for (unsigned i = 0; i < opt.write_depth; ++i) {
+            r.blocks.push_back(allocate_aligned(opt.write_size));
+        }
+        r.scratch = allocate_aligned(opt.read_size);
+
+        std::signal(SIGINT, on_interrupt);
+        std::cout << "Recording " << (opt.synthetic ? std::string("synthetic stream")
+                                                    : "c2h_" + std::to_string(opt.channel))
+                  << " to " << opt.file << (opt.seconds > 0 ? "" : ", Ctrl+C stops") << "\n";
+
+        const auto start = std::chrono::steady_clock::now();
+        std::thread writer(run_writer, std::ref(r), std::ref(*file));
+        std::thread reader(run_reader, std::ref(r), std::ref(*source));
+
+        std::cout << std::fixed << std::setprecision(1);
+        uint64_t last_received = 0;
+        uint64_t last_written = 0;
+        auto last = start;
+        for (unsigned second = 1; !r.stop; ++second) {
+            const auto due = start + std::chrono::seconds(second);
+            while (!r.stop && !interrupted && std::chrono::steady_clock::now() < due) {
+                std::this_thread::sleep_for(std::chrono::milliseconds(10));
+            }
+            const auto now = std::chrono::steady_clock::now();
+            const double elapsed = std::chrono::duration<double>(now - start).count();
+            if (interrupted || (opt.seconds > 0 && elapsed >= opt.seconds)) {
+                r.stop = true;
+            }
+            if (now < due) {
+                break; // stopped within the second
+            }
+            const double dt = std::chrono::duration<double>(now - last).count();
+            const uint64_t received = r.received;
+            const uint64_t written = r.written;
+            std::cout << "[" << std::setw(5) << second << "s]  in " << std::setw(7)
+                      << (received - last_received) / dt / 1e6 << " MB/s  disk " << std::setw(7)
+                      << (written - last_written) / dt / 1e6 << " MB/s  queue " << r.full_buffers.size() << "/"
+                      << opt.pool_size << " (max " << r.full_buffers.max_size() << ")  dropped "
+                      << format_bytes(r.dropped) << std::endl;
+            last_received = received;
+            last_written = written;
+            last = now;
+        }
+        reader.join();
+        writer.join();
+        const double elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+        std::signal(SIGINT, SIG_DFL);
+
+        if (!r.error.empty()) {
+            throw std::runtime_error(r.error);
+        }
+
+        const uint64_t received = r.received;
+        const uint64_t dropped = r.dropped;
+        std::cout << "\nRecorded " << format_bytes(received) << " in " << elapsed << " s, "
+                  << received / elapsed / 1e6 << " MB/s\n"
+                  << "Dropped  " << format_bytes(dropped);
+        if (received + dropped > 0) {
+            std::cout << " (" << 100.0 * dropped / (received + dropped) << "% of the stream)";
+        }
+        std::cout << "\nQueue high-water mark " << r.full_buffers.max_size() << " of " << opt.pool_size
+                  << " buffers\n";
+
+        if (opt.verify) {
+            if (dropped > 0) {
+                std::cout << "Verification skipped, the file has gaps where data was dropped\n";
+            } else if (!verify_file(opt)) {
+                return -1;
+            }
+        }
+
+    } catch (const std::exception& e) {
+        std::cout << "Error: " << e.what() << "\n";
+        return -1;
+    }
+
+    return 0;
+}
@@ -12,6 +12,8 @@
 
 #pragma comment(lib, "setupapi.lib")
 
+#define UNBUFFERED_ALIGNMENT    (4096)  // unbuffered file I/O, covers 512 byte and 4K native sectors
+
 enum Direction {
     C2H, //client to host - read
     H2C	 // host to client - write
@@ -27,9 +29,15 @@ typedef struct {
     enum Direction direction;
     size_t alignment;
     BOOL binary;
+    ULONGLONG length;       // -l, the transfer size of the streaming mode may exceed 4 GB
+    BOOL stream;
+    DWORD chunk_size;
+    DWORD num_buffers;
+    BOOL unbuffered;
+    BOOL mapped;
 } Options;
 
-static Options options = { FALSE, NULL, NULL, NULL, 0, 0, C2H, 0, FALSE };
+static Options options = { FALSE, NULL, NULL, NULL, { 0 }, 0, C2H, 0, FALSE, 0, FALSE, 4 * 1024 * 1024, 2, FALSE, FALSE };
 
 static int verbose_msg(const char* const fmt, ...) {
     int ret = 0;
@@ -184,6 +192,11 @@ static void usage(const char* const exe_name) {
     printf("            -f use contents of file as input or write output into file.\n");
     printf("            -l length of data to read/write (default: 4 bytes or whole file if '-f' flag is used)\n");
     printf("            -v more verbose output\n");
+    printf("            -s stream the file given with '-f' to/from the device in chunks (AXI-MM)\n");
+    printf("            -c chunk size of the streaming mode (default: 4 MB)\n");
+    printf("            -n number of chunk buffers in flight, at least 2 (default: 2)\n");
+    printf("            -u unbuffered file I/O in streaming mode, chunk size must be a multiple of 4 KB\n");
+    printf("            -m memory-mapped file I/O in streaming mode, chunk size must be a multiple of 64 KB\n");
     printf("- DATA :    Space separated bytes (big endian) in decimal or hex, \n");
     printf("            e.g.: 17 34 51 68\n");
     printf("            or:   0x11 0x22 0x33 0x44\n");
@@ -234,7 +247,30 @@ static int parse(int argc, char* argv[]) {
                 break;
             case 'l':
                 argidx++;
-                options.size = strtoul(argv[argidx],  NULL, 0);
+                options.length = strtoull(argv[argidx], NULL, 0);
+                options.size = (DWORD)options.length;
+                argidx++;
+                break;
+            case 's':
+                options.stream = TRUE;
+                argidx++;
+                break;
+            case 'c':
+                argidx++;
+                options.chunk_size = strtoul(argv[argidx], NULL, 0);
+                argidx++;
+                break;
+            case 'n':
+                argidx++;
+                options.num_buffers = strtoul(argv[argidx], NULL, 0);
+                argidx++;
+                break;
+            case 'u':
+                options.unbuffered = TRUE;
+                argidx++;
+                break;
+            case 'm':
+                options.mapped = TRUE;
                 argidx++;
                 break;
             case 'a':
@@ -250,6 +286,24 @@ static int parse(int argc, char* argv[]) {
 
     }
 
+    if (options.stream) {
+        if (!options.file || (argidx != argc) || (options.num_buffers < 2) || (options.chunk_size == 0) ||
+            (options.unbuffered && options.mapped) ||
+            (options.unbuffered && (options.chunk_size % UNBUFFERED_ALIGNMENT != 0)) ||
+            (options.unbuffered && (options.alignment % UNBUFFERED_ALIGNMENT != 0)) ||
+            ((options.direction == C2H) && (options.length == 0))) {
+            fprintf(stderr, "Error: invalid streaming options\n\n");
+            usage(argv[0]);
+            return 0;
+        }
+        return 1;
+    }
+    if (options.length > MAXDWORD) {
+        fprintf(stderr, "Error: transfers above 4 GB need the streaming mode (-s)\n\n");
+        usage(argv[0]);
+        return 0;
+    }
+
     /* check if arguments left */
     if (argidx != argc) {
         if (options.direction == H2C) {
@@ -267,6 +321,271 @@ static int parse(int argc, char* argv[]) {
     return 1;
 }
 
+// ============= streaming mode ===============================================
+//
+// The file is moved in chunks through 'num_buffers' host buffers. Reads from the source (file or
+// device) and writes to the sink run as overlapped requests, so while the device transfers one
+// chunk the file system already reads or writes the neighbouring chunks. In memory-mapped mode
+// the device transfers directly from/to views of the file, and the memory manager pages the
+// file in and out.
+
+typedef struct {
+    OVERLAPPED ov;
+    HANDLE pending;     // handle of the request in flight, NULL if none
+    BYTE* data;
+} Slot;
+
+static BOOL start_io(HANDLE h, BOOL write, Slot* slot, ULONGLONG offset, DWORD length) {
+    slot->ov.Internal = 0;
+    slot->ov.InternalHigh = 0;
+    slot->ov.Offset = (DWORD)offset;
+    slot->ov.OffsetHigh = (DWORD)(offset >> 32);
+    BOOL ok = write ? WriteFile(h, slot->data, length, NULL, &slot->ov)
+                    : ReadFile(h, slot->data, length, NULL, &slot->ov);
+    if (!ok && (GetLastError() != ERROR_IO_PENDING)) {
+        fprintf(stderr, "%s at offset 0x%llX failed with Win32 error code: %ld\n",
+                write ? "WriteFile" : "ReadFile", offset, GetLastError());
+        return FALSE;
+    }
+    slot->pending = h;
+    return TRUE;
+}
+
+static BOOL finish_io(Slot* slot, DWORD expected) {
+    DWORD transferred = 0;
+    BOOL ok = GetOverlappedResult(slot->pending, &slot->ov, &transferred, TRUE);
+    slot->pending = NULL;
+    if (!ok) {
+        fprintf(stderr, "Transfer failed with Win32 error code: %ld\n", GetLastError());
+        return FALSE;
+    }
+    if (transferred < expected) {
+        fprintf(stderr, "Short transfer: %lu of %lu bytes\n", transferred, expected);
+        return FALSE;
+    }
+    return TRUE;
+}
+
+// wait for all requests in flight, e.g. before their buffers are freed after an error
+static void drain_slots(Slot* slots, DWORD num_slots) {
+    for (DWORD i = 0; i < num_slots; i++) {
+        if (slots[i].pending) {
+            CancelIoEx(slots[i].pending, &slots[i].ov);
+            DWORD transferred;
+            GetOverlappedResult(slots[i].pending, &slots[i].ov, &transferred, TRUE);
+            slots[i].pending = NULL;
+        }
+    }
+}
+
+static Slot* create_slots(DWORD num_slots, BOOL allocate) {
+    Slot* slots = (Slot*)calloc(num_slots, sizeof(Slot));
+    if (!slots) {
+        return NULL;
+    }
+    for (DWORD i = 0; i < num_slots; i++) {
+        slots[i].ov.hEvent = CreateEvent(NULL, TRUE, FALSE, NULL);
+        if (allocate) {
+            slots[i].data = allocate_buffer(options.chunk_size, options.alignment);
+        }
+        if (!slots[i].ov.hEvent || (allocate && !slots[i].data)) {
+            fprintf(stderr, "Error allocating %lu chunk buffers of %lu bytes\n", num_slots, options.chunk_size);
+            for (DWORD j = 0; j <= i; j++) {
+                if (slots[j].ov.hEvent) CloseHandle(slots[j].ov.hEvent);
+                if (slots[j].data) _aligned_free(slots[j].data);
+            }
+            free(slots);
+            return NULL;
+        }
+    }
+    return slots;
+}
+
+static void destroy_slots(Slot* slots, DWORD num_slots) {
+    drain_slots(slots, num_slots);
+    for (DWORD i = 0; i < num_slots; i++) {
+        CloseHandle(slots[i].ov.hEvent);
+        if (slots[i].data && !options.mapped) _aligned_free(slots[i].data);
+    }
+    free(slots);
+}
+
+// copy 'total' bytes from 'src' at 'src_base' to 'dst' at 'dst_base' through the chunk buffers.
+// Slot k % n carries chunk k: it is read from the source, written to the sink and, once that
+// write is done, refilled with chunk k + n.
+static BOOL stream_buffered(HANDLE src, ULONGLONG src_base, BOOL src_is_file,
+                            HANDLE dst, ULONGLONG dst_base, BOOL dst_is_file, ULONGLONG total) {
+    const DWORD n = options.num_buffers;
+    const ULONGLONG chunk = options.chunk_size;
+    const ULONGLONG num_chunks = (total + chunk - 1) / chunk;
+    Slot* slots = create_slots(n, TRUE);
+    if (!slots) {
+        return FALSE;
+    }
+
+#define CHUNK_LENGTH(k)     ((DWORD)min(chunk, total - (k) * chunk))
+    // unbuffered file I/O transfers whole sectors, the sink file is truncated at the end
+#define IO_LENGTH(k, is_file) \
+    (((is_file) && options.unbuffered) ? (CHUNK_LENGTH(k) + UNBUFFERED_ALIGNMENT - 1) & ~(UNBUFFERED_ALIGNMENT - 1) \
+                                       : CHUNK_LENGTH(k))
+
+    BOOL ok = TRUE;
+    for (ULONGLONG k = 0; ok && (k < min(n, num_chunks)); k++) {
+        ok = start_io(src, FALSE, &slots[k], src_base + k * chunk, IO_LENGTH(k, src_is_file));
+    }
+    for (ULONGLONG k = 0; ok && (k < num_chunks); k++) {
+        Slot* slot = &slots[k % n];
+        ok = finish_io(slot, CHUNK_LENGTH(k)) &&
+             start_io(dst, TRUE, slot, dst_base + k * chunk, IO_LENGTH(k, dst_is_file));
+        if (ok && (k > 0)) {
+            Slot* previous = &slots[(k - 1) % n];
+            ok = finish_io(previous, CHUNK_LENGTH(k - 1));
+            if (ok && (k - 1 + n < num_chunks)) {
+                ok = start_io(src, FALSE, previous, src_base + (k - 1 + n) * chunk, IO_LENGTH(k - 1 + n, src_is_file));
+            }
+        }
+        verbose_msg("chunk %llu of %llu\n", k + 1, num_chunks);
+    }
+    if (ok && (num_chunks > 0)) {
+        ok = finish_io(&slots[(num_chunks - 1) % n], CHUNK_LENGTH(num_chunks - 1));
+    }
+#undef IO_LENGTH
+#undef CHUNK_LENGTH
+
+    destroy_slots(slots, n);
+    return ok;
+}
+
+// move 'total' bytes between the file and the device through views of 'chunk_size' bytes;
+// up to 'num_buffers' views are mapped while their transfers are in flight
+static BOOL stream_mapped(HANDLE file, HANDLE device, ULONGLONG address, ULONGLONG total) {
+    const BOOL h2c = (options.direction == H2C);
+    const DWORD n = options.num_buffers;
+    const ULONGLONG chunk = options.chunk_size;
+    const ULONGLONG num_chunks = (total + chunk - 1) / chunk;
+
+    SYSTEM_INFO sys_info;
+    GetSystemInfo(&sys_info);
+    if (chunk % sys_info.dwAllocationGranularity != 0) {
+        fprintf(stderr, "Chunk size must be a multiple of %lu bytes in memory-mapped mode\n",
+                sys_info.dwAllocationGranularity);
+        return FALSE;
+    }
+
+    // for c2h the mapping extends the file to 'total' bytes
+    HANDLE mapping = CreateFileMapping(file, NULL, h2c ? PAGE_READONLY : PAGE_READWRITE,
+                                       (DWORD)(total >> 32), (DWORD)total, NULL);
+    if (!mapping) {
+        fprintf(stderr, "CreateFileMapping failed with Win32 error code: %ld\n", GetLastError());
+        return FALSE;
+    }
+    Slot* slots = create_slots(n, FALSE);
+    if (!slots) {
+        CloseHandle(mapping);
+        return FALSE;
+    }
+
+    BOOL ok = TRUE;
+    for (ULONGLONG k = 0; ok && (k < num_chunks); k++) {
+        Slot* slot = &slots[k % n];
+        const DWORD length = (DWORD)min(chunk, total - k * chunk);
+        if (slot->data) { // chunk k - n
+            ok = finish_io(slot, (DWORD)chunk);
+            UnmapViewOfFile(slot->data);
+            slot->data = NULL;
+            if (!ok) {
+                break;
+            }
+        }
+        slot->data = (BYTE*)MapViewOfFile(mapping, h2c ? FILE_MAP_READ : FILE_MAP_WRITE,
+                                          (DWORD)((k * chunk) >> 32), (DWORD)(k * chunk), length);
+        if (!slot->data) {
+            fprintf(stderr, "MapViewOfFile failed with Win32 error code: %ld\n", GetLastError());
+            ok = FALSE;
+            break;
+        }
+        ok = start_io(device, h2c, slot, address + k * chunk, length);
+        verbose_msg("chunk %llu of %llu\n", k + 1, num_chunks);
+    }
+    for (ULONGLONG k = (num_chunks > n) ? num_chunks - n : 0; k < num_chunks; k++) {
+        Slot* slot = &slots[k % n];
+        if (slot->pending) {
+            ok = finish_io(slot, (DWORD)min(chunk, total - k * chunk)) && ok;
+        }
+    }
+
+    drain_slots(slots, n);
+    for (DWORD i = 0; i < n; i++) {
+        if (slots[i].data) UnmapViewOfFile(slots[i].data);
+    }
+    destroy_slots(slots, n);
+    CloseHandle(mapping);
+    return ok;
+}
+
+static int stream_file(HANDLE device, const char* device_path) {
+    const BOOL h2c = (options.direction == H2C);
+    DWORD flags = options.mapped ? FILE_ATTRIBUTE_NORMAL : FILE_FLAG_OVERLAPPED | FILE_FLAG_SEQUENTIAL_SCAN;
+    if (options.unbuffered) {
+        flags |= FILE_FLAG_NO_BUFFERING;
+    }
+    HANDLE file = CreateFile(options.file, h2c ? GENERIC_READ : GENERIC_READ | GENERIC_WRITE,
+                             h2c ? FILE_SHARE_READ : 0, NULL, h2c ? OPEN_EXISTING : CREATE_ALWAYS,
+                             flags, NULL);
+    if (file == INVALID_HANDLE_VALUE) {
+        fprintf(stderr, "Could not open file <%s>, win32 error code: %ld\n", options.file, GetLastError());
+        return -1;
+    }
+
+    ULONGLONG total = options.length;
+    if (h2c) {
+        LARGE_INTEGER file_size;
+        GetFileSizeEx(file, &file_size);
+        if ((total == 0) || (total > (ULONGLONG)file_size.QuadPart)) {
+            total = file_size.QuadPart;
+        }
+    } else if (!options.mapped) {
+        // reserve the whole file up front instead of growing it with every chunk
+        LARGE_INTEGER file_size;
+        file_size.QuadPart = total;
+        SetFilePointerEx(file, file_size, NULL, FILE_BEGIN);
+        SetEndOfFile(file);
+    }
+    printf("Streaming %llu bytes %s %s in %lu byte chunks, %lu buffers, %s file I/O\n", total,
+           h2c ? "to" : "from", device_path, options.chunk_size, options.num_buffers,
+           options.mapped ? "memory-mapped" : options.unbuffered ? "unbuffered" : "buffered");
+
+    LARGE_INTEGER start;
+    LARGE_INTEGER stop;
+    LARGE_INTEGER freq;
+    QueryPerformanceFrequency(&freq);
+    QueryPerformanceCounter(&start);
+    BOOL ok;
+    if (options.mapped) {
+        ok = (total == 0) || stream_mapped(file, device, options.address.QuadPart, total);
+    } else if (h2c) {
+        ok = stream_buffered(file, 0, TRUE, device, options.address.QuadPart, FALSE, total);
+    } else {
+        ok = stream_buffered(device, options.address.QuadPart, FALSE, file, 0, TRUE, total);
+    }
+    QueryPerformanceCounter(&stop);
+
+    if (ok && !h2c && options.unbuffered) { // cut off the padding of the last sector
+        LARGE_INTEGER file_size;
+        file_size.QuadPart = total;
+        ok = SetFilePointerEx(file, file_size, NULL, FILE_BEGIN) && SetEndOfFile(file);
+    }
+    CloseHandle(file);
+    if (!ok) {
+        return -1;
+    }
+
+    double time_sec = (unsigned long long)(stop.QuadPart - start.QuadPart) / (double)freq.QuadPart;
+    printf("%llu bytes %s in %fs, %.1f MB/s\n", total, h2c ? "written" : "received", time_sec,
+           (time_sec > 0) ? total / time_sec / 1e6 : 0.0);
+    return 0;
+}
+
 int __cdecl main(int argc, char* argv[]) {
 
     int status = -1;
@@ -292,13 +611,19 @@ int __cdecl main(int argc, char* argv[]) {
     strcat_s(device_path, sizeof device_path, options.device);
     verbose_msg("Device node: %s\n", options.device);
 
-    // open device file
-    HANDLE device = CreateFile(device_path, GENERIC_READ | GENERIC_WRITE, 0, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+    // open device file, the streaming mode passes the device offset of every chunk in its OVERLAPPED
+    HANDLE device = CreateFile(device_path, GENERIC_READ | GENERIC_WRITE, 0, NULL, OPEN_EXISTING,
+                               options.stream ? FILE_FLAG_OVERLAPPED : FILE_ATTRIBUTE_NORMAL, NULL);
     if (device == INVALID_HANDLE_VALUE) {
         fprintf(stderr, "Error opening device, win32 error code: %ld\n", GetLastError());
         goto Exit;
     }
 
+    if (options.stream) {
+        status = stream_file(device, device_path);
+        goto CleanupDevice;
+    }
+
     // set file pointer to offset of target address within PCIe BAR
     if (INVALID_SET_FILE_POINTER == SetFilePointerEx(device, options.address, NULL, FILE_BEGIN)) {
         fprintf(stderr, "Error setting file pointer, win32 error code: %ld\n", GetLastError());
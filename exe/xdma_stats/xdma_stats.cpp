@@ -0,0 +1,189 @@
+#include <iomanip>
+#include <iostream>
+#include <memory>
+#include <string>
+#include <vector>
+#include <Windows.h>
+#include <SetupAPI.h>
+#include <INITGUID.H>
+
+#include "xdma_public.h"
+
+#pragma comment(lib, "setupapi.lib")
+
+static const char* help_text =
+"xdma_stats.exe prints the event counters the XDMA driver keeps for every DMA engine.\n"
+"\n"
+"Usage: xdma_stats.exe [-c]\n"
+"\n"
+"  -c    clear the counters while reading them\n"
+"\n"
+"Engines which have not counted anything are skipped. Error counts are broken down by the bit\n"
+"of the engine status register which was set.\n";
+
+std::string get_windows_error_msg() {
+
+    char msg_buffer[256];
+    FormatMessageA(FORMAT_MESSAGE_FROM_SYSTEM, NULL, GetLastError(),
+                   MAKELANGID(LANG_NEUTRAL, SUBLANG_DEFAULT), (LPSTR)&msg_buffer, 256, NULL);
+    return{ msg_buffer, 256 };
+}
+
+class device_file {
+public:
+    device_file(const std::string& path, DWORD accessFlags) {
+        h = CreateFile(path.c_str(), accessFlags, 0, NULL, OPEN_EXISTING,
+                       FILE_ATTRIBUTE_NORMAL, NULL);
+        if (h == INVALID_HANDLE_VALUE) {
+            throw std::runtime_error("Opening device file failed: " + get_windows_error_msg());
+        }
+    }
+
+    ~device_file() {
+        CloseHandle(h);
+    }
+
+    void ioctl(DWORD code, void* in, DWORD in_size, void* out, DWORD out_size) {
+        unsigned long num_bytes_returned;
+        if (!DeviceIoControl(h, code, in, in_size, out, out_size, &num_bytes_returned, NULL)) {
+            throw std::runtime_error("DeviceIoControl failed: " + get_windows_error_msg());
+        }
+    }
+
+private:
+    HANDLE h;
+};
+
+static std::vector<std::string> get_device_paths(GUID guid) {
+
+    auto device_info = SetupDiGetClassDevs((LPGUID)&guid, NULL, NULL, DIGCF_PRESENT | DIGCF_DEVICEINTERFACE);
+    if (device_info == INVALID_HANDLE_VALUE) {
+        throw std::runtime_error("GetDevices INVALID_HANDLE_VALUE");
+    }
+
+    SP_DEVICE_INTERFACE_DATA device_interface = { 0 };
+    device_interface.cbSize = sizeof(SP_DEVICE_INTERFACE_DATA);
+
+    // enumerate through devices
+    std::vector<std::string> device_paths;
+    for (unsigned index = 0;
+         SetupDiEnumDeviceInterfaces(device_info, NULL, &guid, index, &device_interface);
+         ++index) {
+
+        // get required buffer size
+        unsigned long detail_length = 0;
+        if (!SetupDiGetDeviceInterfaceDetail(device_info, &device_interface, NULL, 0, &detail_length, NULL) && GetLastError() != ERROR_INSUFFICIENT_BUFFER) {
+            throw std::runtime_error("SetupDiGetDeviceInterfaceDetail - get length failed");
+        }
+
+        // allocate space for device interface detail
+        auto dev_detail = reinterpret_cast<PSP_DEVICE_INTERFACE_DETAIL_DATA>(new char[detail_length]);
+        dev_detail->cbSize = sizeof(SP_DEVICE_INTERFACE_DETAIL_DATA);
+
+        // get device interface detail
+        if (!SetupDiGetDeviceInterfaceDetail(device_info, &device_interface, dev_detail, detail_length, NULL, NULL)) {
+            delete[] dev_detail;
+            throw std::runtime_error("SetupDiGetDeviceInterfaceDetail - get detail failed");
+        }
+        device_paths.emplace_back(dev_detail->DevicePath);
+        delete[] dev_detail;
+    }
+
+    SetupDiDestroyDeviceInfoList(device_info);
+
+    return device_paths;
+}
+
+// ============= Counter Printing =============================================
+
+static const char* status_bit_name(unsigned bit) {
+    if (bit >= 9 && bit <= 13) {
+        return "read_error";
+    }
+    if (bit >= 19 && bit <= 23) {
+        return "descriptor_error";
+    }
+    switch (bit) {
+    case 1: return "descriptor_stopped";
+    case 2: return "descriptor_completed";
+    case 3: return "align_mismatch";
+    case 4: return "magic_stopped";
+    case 5: return "fetch_stopped";
+    case 6: return "idle_stopped";
+    default: return "";
+    }
+}
+
+static bool is_empty(const XDMA_ENGINE_STATS& s) {
+    const auto counters = reinterpret_cast<const uint64_t*>(&s);
+    for (size_t i = 0; i < sizeof(XDMA_ENGINE_STATS) / sizeof(uint64_t); ++i) {
+        if (counters[i] != 0) {
+            return false;
+        }
+    }
+    return true;
+}
+
+static void print_counter(const std::string& name, uint64_t value) {
+    std::cout << "  " << std::left << std::setw(36) << name << std::right << std::setw(20) << value << "\n";
+}
+
+static void print_engine(const std::string& name, const XDMA_ENGINE_STATS& s) {
+    if (is_empty(s)) {
+        return;
+    }
+    std::cout << name << "\n";
+    print_counter("bytes", s.numBytes);
+    print_counter("requests", s.numRequests);
+    print_counter("descriptors", s.numDescriptors);
+    print_counter("interrupts", s.numInterrupts);
+    print_counter("poll iterations", s.numPolls);
+    print_counter("misaligned descriptors", s.numMisaligned);
+    print_counter("ring credits returned", s.numCredits);
+    print_counter("errors", s.numErrors);
+    for (unsigned bit = 0; bit < 32; ++bit) {
+        if (s.statusBits[bit] != 0) {
+            print_counter("  status bit " + std::to_string(bit) + " " + status_bit_name(bit), s.statusBits[bit]);
+        }
+    }
+}
+
+int __cdecl main(int argc, char* argv[]) {
+
+    try {
+        uint32_t flags = 0;
+        if (argc == 2 && std::string(argv[1]) == "-c") {
+            flags = XDMA_STATS_CLEAR;
+        } else if (argc != 1) {
+            std::cout << help_text;
+            return 0;
+        }
+
+        const auto dev_paths = get_device_paths(GUID_DEVINTERFACE_XDMA);
+        if (dev_paths.empty()) {
+            throw std::runtime_error("No XDMA device driver installed!");
+        }
+
+        // the statistics ioctl is accepted on every device node, the control node is always present
+        device_file control(dev_paths[0] + "\\control", GENERIC_READ | GENERIC_WRITE);
+        auto data = std::make_unique<XDMA_STATS_DATA>();
+        control.ioctl(IOCTL_XDMA_STATS_GET, &flags, sizeof(flags), data.get(), sizeof(XDMA_STATS_DATA));
+
+        for (unsigned dir = 0; dir < 2; ++dir) {
+            for (unsigned channel = 0; channel < 4; ++channel) {
+                print_engine(std::string(dir == 0 ? "h2c_" : "c2h_") + std::to_string(channel),
+                             data->engine[dir][channel]);
+            }
+        }
+
+        if (flags & XDMA_STATS_CLEAR) {
+            std::cout << "Counters cleared.\n";
+        }
+
+    } catch (const std::exception& e) {
+        std::cout << "Error: " << e.what() << '\n';
+        return -1;
+    }
+
+    return 0;
+}
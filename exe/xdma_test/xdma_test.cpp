@@ -1,8 +1,14 @@
 #include <array>
 #include <algorithm>
+#include <atomic>
+#include <chrono>
 #include <iostream>
 #include <iomanip>
+#include <memory>
+#include <mutex>
 #include <numeric>
+#include <random>
+#include <sstream>
 #include <string>
 #include <system_error>
 #include <thread>
@@ -14,9 +20,24 @@
 #include <INITGUID.H>
 
 #include "xdma_public.h"
+#include "xdma_pattern.h"
 
 #pragma comment(lib, "setupapi.lib")
 
+static const char* help_text =
+"xdma_test.exe transfers 4 KB on every present H2C/C2H channel pair and verifies the data.\n"
+"\n"
+"Usage: xdma_test.exe\n"
+"       xdma_test.exe -s [-b size[:max_size]] [-t seconds] [-p pattern] [-a address]\n"
+"\n"
+"  -s    stress mode: drive all channel pairs concurrently and verify the data continuously\n"
+"  -b    bytes per transfer, a random multiple of 4 in [size, max_size] if a range is given\n"
+"        (default 4096)\n"
+"  -t    run time in seconds (default 10)\n"
+"  -p    data pattern: counter, prbs or stamp (default counter), see xdma_pattern.h\n"
+"  -a    AXI-MM only: card address of channel 0, channel n uses address + n * max_size\n"
+"        (default 0)\n";
+
 // ============= Static Utility Functions =====================================
 
 static std::vector<std::string> get_device_paths(GUID guid) {
@@ -142,7 +163,7 @@ bool xdma_device::is_axi_st() {
     return is_bit_set(read_register(0x0), 15);
 }
 
-// ======================= main ===============================================
+// ======================= basic test =========================================
 
 static constexpr size_t dma_block_size = 0x1000; // 4kB
 static constexpr size_t array_size = dma_block_size / sizeof(uint32_t);
@@ -172,7 +193,299 @@ void do_transfers_in_sequence(unsigned index, device_file& h2c, device_file& c2h
     c2h.read(c2h_data.data(), c2h_data.size() * sizeof(uint32_t));
 }
 
-int __cdecl main() {
+// ======================= stress mode ========================================
+
+struct stress_options {
+    size_t min_size = dma_block_size;
+    size_t max_size = dma_block_size;
+    double seconds = 10.0;
+    pattern_type pattern = pattern_type::counter;
+    long address = 0;
+};
+
+// the data stream of 'channel'; channels get different data so that transfers delivered to the
+// wrong channel are detected as well
+static pattern_stream channel_stream(const stress_options& opt, unsigned channel) {
+    return pattern_stream(opt.pattern, static_cast<uint64_t>(channel) << 28);
+}
+
+// compare received data with the next bytes of 'expected'
+static void check_data(pattern_stream& expected, unsigned channel, const void* data, size_t length) {
+    pattern_mismatch mismatch;
+    if (!expected.verify(data, length, &mismatch)) {
+        std::ostringstream msg;
+        msg << "c2h_" << channel << " data mismatch at stream offset " << mismatch.offset
+            << ": expected 0x" << std::hex << mismatch.expected << ", got 0x" << mismatch.actual;
+        throw std::runtime_error(msg.str());
+    }
+}
+
+struct aligned_buffer_deleter {
+    void operator()(uint32_t* p) const { _aligned_free(p); }
+};
+using aligned_buffer = std::unique_ptr<uint32_t[], aligned_buffer_deleter>;
+
+static aligned_buffer allocate_buffer(size_t size) {
+    aligned_buffer buffer(static_cast<uint32_t*>(_aligned_malloc(size, 4096)));
+    if (!buffer) {
+        throw std::runtime_error("Allocating " + std::to_string(size) + " byte buffer failed");
+    }
+    return buffer;
+}
+
+// one H2C/C2H channel pair under load
+struct stress_channel {
+    stress_channel(const std::string& device_path, unsigned index)
+        : index(index),
+          h2c(device_path + "\\h2c_" + std::to_string(index), GENERIC_WRITE),
+          c2h(device_path + "\\c2h_" + std::to_string(index), GENERIC_READ) {
+    }
+
+    bool present() const {
+        return (h2c.h != INVALID_HANDLE_VALUE) && (c2h.h != INVALID_HANDLE_VALUE);
+    }
+
+    const unsigned index;
+    device_file h2c;
+    device_file c2h;
+    std::atomic<uint64_t> h2c_bytes{ 0 };
+    std::atomic<uint64_t> c2h_bytes{ 0 };
+    std::atomic<bool> h2c_done{ false };
+    std::mutex error_lock;
+    std::string error;
+};
+
+class transfer_sizes {
+public:
+    transfer_sizes(const stress_options& opt, unsigned seed)
+        : engine(seed), words(opt.min_size / 4, opt.max_size / 4) {
+    }
+    size_t next() {
+        return words(engine) * sizeof(uint32_t);
+    }
+private:
+    std::mt19937 engine;
+    std::uniform_int_distribution<size_t> words;
+};
+
+// AXI-MM: write a block to the card region of the channel and read it back
+static void stress_memory_mapped(stress_channel& ch, const stress_options& opt, const std::atomic<bool>& stop) {
+    auto write_data = allocate_buffer(opt.max_size);
+    auto read_data = allocate_buffer(opt.max_size);
+    transfer_sizes sizes(opt, ch.index);
+    const long address = opt.address + static_cast<long>(ch.index * opt.max_size);
+    pattern_stream source = channel_stream(opt, ch.index);
+    pattern_stream expected = channel_stream(opt, ch.index);
+
+    while (!stop) {
+        const size_t size = sizes.next();
+        source.fill(write_data.get(), size);
+        ch.h2c.seek(address);
+        if (ch.h2c.write(write_data.get(), size) != size) {
+            throw std::runtime_error("h2c_" + std::to_string(ch.index) + " short write");
+        }
+        ch.h2c_bytes += size;
+
+        memset(read_data.get(), 0, size);
+        ch.c2h.seek(address);
+        const size_t num_bytes = ch.c2h.read(read_data.get(), size);
+        if (num_bytes != size) {
+            throw std::runtime_error("c2h_" + std::to_string(ch.index) + " short read");
+        }
+        check_data(expected, ch.index, read_data.get(), size);
+        ch.c2h_bytes += size;
+    }
+}
+
+// AXI-ST: the writer keeps the stream going until the run time is over
+static void stress_stream_h2c(stress_channel& ch, const stress_options& opt, const std::atomic<bool>& stop) {
+    auto data = allocate_buffer(opt.max_size);
+    transfer_sizes sizes(opt, ch.index);
+    pattern_stream source = channel_stream(opt, ch.index);
+    while (!stop) {
+        const size_t size = sizes.next();
+        source.fill(data.get(), size);
+        if (ch.h2c.write(data.get(), size) != size) {
+            throw std::runtime_error("h2c_" + std::to_string(ch.index) + " short write");
+        }
+        ch.h2c_bytes += size;
+    }
+}
+
+// AXI-ST: the reader verifies everything the writer sent. Reads which time out in the
+// driver return zero bytes, which is only an error once the writer is done.
+static void stress_stream_c2h(stress_channel& ch, const stress_options& opt) {
+    auto data = allocate_buffer(opt.max_size);
+    pattern_stream expected = channel_stream(opt, ch.index);
+    for (;;) {
+        const bool writer_done = ch.h2c_done;
+        if (writer_done && (expected.position() >= ch.h2c_bytes)) {
+            break;
+        }
+        const size_t num_bytes = ch.c2h.read(data.get(), opt.max_size);
+        if ((num_bytes == 0) && writer_done) {
+            throw std::runtime_error("c2h_" + std::to_string(ch.index) + " lost data: received " +
+                                     std::to_string(expected.position()) + " of " +
+                                     std::to_string(ch.h2c_bytes) + " bytes");
+        }
+        check_data(expected, ch.index, data.get(), num_bytes);
+        ch.c2h_bytes += num_bytes;
+    }
+}
+
+// run 'fn' and keep the first error of the channel, any error ends the whole test
+template <typename Fn>
+static std::thread start_worker(stress_channel& ch, std::atomic<bool>& stop, Fn fn) {
+    return std::thread([&ch, &stop, fn]() {
+        try {
+            fn();
+        } catch (const std::exception& e) {
+            std::lock_guard<std::mutex> guard(ch.error_lock);
+            if (ch.error.empty()) {
+                ch.error = e.what();
+            }
+            stop = true;
+        }
+    });
+}
+
+static double megabytes_per_second(uint64_t bytes, double seconds) {
+    return seconds > 0 ? bytes / seconds / 1e6 : 0.0;
+}
+
+static int run_stress(const std::string& device_path, bool axi_st, const stress_options& opt) {
+
+    std::vector<std::unique_ptr<stress_channel>> channels;
+    for (unsigned i = 0; i < 4; i++) {
+        std::unique_ptr<stress_channel> ch(new stress_channel(device_path, i));
+        if (ch->present()) {
+            channels.push_back(std::move(ch));
+        }
+    }
+    if (channels.empty()) {
+        throw std::runtime_error("Failure! No DMA channels found!");
+    }
+
+    std::cout << "Stressing " << channels.size() << " channel pair(s) with " << opt.min_size;
+    if (opt.max_size != opt.min_size) {
+        std::cout << " to " << opt.max_size;
+    }
+    std::cout << " byte transfers for " << opt.seconds << "s\n";
+    std::cout << std::fixed << std::setprecision(1);
+
+    using clock = std::chrono::steady_clock;
+    const auto start = clock::now();
+    const auto deadline = start + std::chrono::duration_cast<clock::duration>(std::chrono::duration<double>(opt.seconds));
+    std::atomic<bool> stop{ false };
+
+    std::vector<std::thread> writers;
+    std::vector<std::thread> readers;
+    for (auto& p : channels) {
+        stress_channel& ch = *p;
+        if (axi_st) {
+            writers.push_back(start_worker(ch, stop, [&ch, &opt, &stop]() {
+                stress_stream_h2c(ch, opt, stop);
+            }));
+            readers.push_back(start_worker(ch, stop, [&ch, &opt]() { stress_stream_c2h(ch, opt); }));
+        } else {
+            writers.push_back(start_worker(ch, stop, [&ch, &opt, &stop]() {
+                stress_memory_mapped(ch, opt, stop);
+            }));
+        }
+    }
+
+    // aggregate bandwidth of every second while the workers run
+    uint64_t last_bytes = 0;
+    auto last = start;
+    while (!stop && clock::now() < deadline) {
+        std::this_thread::sleep_for(std::chrono::milliseconds(100));
+        const auto now = clock::now();
+        if (now - last >= std::chrono::seconds(1)) {
+            uint64_t bytes = 0;
+            for (auto& ch : channels) {
+                bytes += ch->h2c_bytes + ch->c2h_bytes;
+            }
+            std::cout << "[" << std::setw(5) << std::chrono::duration<double>(now - start).count() << "s]  "
+                      << std::setw(8) << megabytes_per_second(bytes - last_bytes, std::chrono::duration<double>(now - last).count())
+                      << " MB/s aggregate\n";
+            last_bytes = bytes;
+            last = now;
+        }
+    }
+    stop = true;
+    for (size_t i = 0; i < writers.size(); i++) {
+        writers[i].join();
+        channels[i]->h2c_done = true;
+    }
+    for (auto& t : readers) {
+        t.join();
+    }
+    const double elapsed = std::chrono::duration<double>(clock::now() - start).count();
+
+    bool failed = false;
+    uint64_t total_h2c = 0;
+    uint64_t total_c2h = 0;
+    std::cout << "channel      h2c MB/s     c2h MB/s\n";
+    for (auto& ch : channels) {
+        std::cout << "   " << ch->index << "     " << std::setw(9) << megabytes_per_second(ch->h2c_bytes, elapsed)
+                  << "    " << std::setw(9) << megabytes_per_second(ch->c2h_bytes, elapsed) << "\n";
+        total_h2c += ch->h2c_bytes;
+        total_c2h += ch->c2h_bytes;
+        if (!ch->error.empty()) {
+            std::cout << "   " << ch->error << "\n";
+            failed = true;
+        }
+    }
+    std::cout << " total    " << std::setw(9) << megabytes_per_second(total_h2c, elapsed)
+              << "    " << std::setw(9) << megabytes_per_second(total_c2h, elapsed) << "\n";
+
+    std::cout << (failed ? "Failure!\n" : "Success!\n");
+    return failed ? -1 : 0;
+}
+
+static bool parse_stress_options(int argc, char* argv[], stress_options& opt) {
+    for (int i = 2; i < argc; ++i) {
+        const std::string arg = argv[i];
+        const bool has_value = (i + 1 < argc);
+        if (arg == "-b" && has_value) {
+            const std::string value = argv[++i];
+            const auto colon = value.find(':');
+            opt.min_size = std::stoul(value.substr(0, colon), nullptr, 0);
+            opt.max_size = (colon == std::string::npos) ? opt.min_size
+                                                         : std::stoul(value.substr(colon + 1), nullptr, 0);
+        } else if (arg == "-t" && has_value) {
+            opt.seconds = std::stod(argv[++i]);
+        } else if (arg == "-a" && has_value) {
+            opt.address = std::stol(argv[++i], nullptr, 0);
+        } else if (arg == "-p" && has_value) {
+            const std::string name = argv[++i];
+            if (name == "counter") {
+                opt.pattern = pattern_type::counter;
+            } else if (name == "prbs") {
+                opt.pattern = pattern_type::prbs;
+            } else if (name == "stamp") {
+                opt.pattern = pattern_type::stamp;
+            } else {
+                return false;
+            }
+        } else {
+            return false;
+        }
+    }
+    return (opt.min_size >= sizeof(uint32_t)) && (opt.min_size <= opt.max_size) &&
+           (opt.max_size <= MAXDWORD) && (opt.min_size % 4 == 0) && (opt.max_size % 4 == 0);
+}
+
+// ======================= main ===============================================
+
+int __cdecl main(int argc, char* argv[]) {
+
+    stress_options stress;
+    const bool stress_mode = (argc > 1) && (std::string(argv[1]) == "-s");
+    if ((argc > 1) && (!stress_mode || !parse_stress_options(argc, argv, stress))) {
+        std::cout << help_text;
+        return 0;
+    }
 
     alignas(32) std::array<uint32_t, array_size> write_data;
     alignas(32) std::array<uint32_t, array_size> read_data = { { 0 } };
@@ -191,6 +504,10 @@ int __cdecl main() {
             std::cout << "Detected XDMA AXI-MM design.\n";
         }
 
+        if (stress_mode) {
+            return run_stress(device_paths.front(), xdma.is_axi_st(), stress);
+        }
+
         unsigned channels_found = 0;
         for (unsigned i = 0; i < 4; i++) {
             device_file h2c(device_paths[0] + "\\h2c_" + std::to_string(i), GENERIC_WRITE);
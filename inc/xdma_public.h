@@ -43,6 +43,8 @@ DEFINE_GUID(GUID_DEVINTERFACE_XDMA,
 #define	XDMA_FILE_EVENT_13	L"\\event_13"
 #define	XDMA_FILE_EVENT_14	L"\\event_14"
 #define	XDMA_FILE_EVENT_15	L"\\event_15"
+#define	XDMA_FILE_EVENTS	L"\\events"
+#define	XDMA_FILE_QUEUE		L"\\queue"
 
 #define	XDMA_FILE_H2C_0		L"\\h2c_0"
 #define	XDMA_FILE_H2C_1		L"\\h2c_1"
@@ -62,6 +64,52 @@ DEFINE_GUID(GUID_DEVINTERFACE_XDMA,
 #define IOCTL_XDMA_PERF_GET     XDMA_IOCTL(0x3)
 #define IOCTL_XDMA_ADDRMODE_GET XDMA_IOCTL(0x4)
 #define IOCTL_XDMA_ADDRMODE_SET XDMA_IOCTL(0x5)
+#define IOCTL_XDMA_EVENTS_SET_MASK  XDMA_IOCTL(0x6)
+#define IOCTL_XDMA_TRIGGER_ARM      XDMA_IOCTL(0x7)
+#define IOCTL_XDMA_TRIGGER_DISARM   XDMA_IOCTL(0x8)
+#define IOCTL_XDMA_LATENCY_GET      XDMA_IOCTL(0x9)
+#define IOCTL_XDMA_LATENCY_RESET    XDMA_IOCTL(0xA)
+#define IOCTL_XDMA_BATCH_SET        XDMA_IOCTL(0xB)
+#define IOCTL_XDMA_REGISTER_OPS     XDMA_IOCTL(0xC)
+#define IOCTL_XDMA_BAR_MAP          XDMA_IOCTL(0xD)
+#define IOCTL_XDMA_BAR_UNMAP        XDMA_IOCTL(0xE)
+#define IOCTL_XDMA_PIO_SET_WIDTH    XDMA_IOCTL(0xF)
+#define IOCTL_XDMA_PIO_STATS_GET    XDMA_IOCTL(0x10)
+#define IOCTL_XDMA_REGISTER_WAIT    XDMA_IOCTL(0x11)
+#define IOCTL_XDMA_QUEUE_SETUP      XDMA_IOCTL(0x12)
+#define IOCTL_XDMA_QUEUE_DOORBELL   XDMA_IOCTL(0x13)
+#define IOCTL_XDMA_BUFFER_REGISTER  XDMA_IOCTL(0x14)
+#define IOCTL_XDMA_BUFFER_DEREGISTER XDMA_IOCTL(0x15)
+#define IOCTL_XDMA_BUFFER_TRANSFER  XDMA_IOCTL(0x16)
+#define IOCTL_XDMA_PROGRAM_CREATE   XDMA_IOCTL(0x17)
+#define IOCTL_XDMA_PROGRAM_DELETE   XDMA_IOCTL(0x18)
+#define IOCTL_XDMA_PROGRAM_LAUNCH   XDMA_IOCTL(0x19)
+#define IOCTL_XDMA_DESC_BYPASS_SET  XDMA_IOCTL(0x1A)
+#define IOCTL_XDMA_CROSSOVER_GET    XDMA_IOCTL(0x1B)
+#define IOCTL_XDMA_CROSSOVER_SET    XDMA_IOCTL(0x1C)
+#define IOCTL_XDMA_STATS_GET        XDMA_IOCTL(0x1D)
+#define IOCTL_XDMA_POLL_MODE_SET    XDMA_IOCTL(0x1E)
+
+#define XDMA_MAX_USER_EVENTS    (16)
+#define XDMA_BATCH_MAX_REQUESTS (64)
+#define XDMA_MAX_REG_OPS        (1024)
+#define XDMA_MAX_BAR_MAPPINGS   (4)
+#define XDMA_REG_WAIT_MAX_SPIN_US       (1000)
+#define XDMA_REG_WAIT_MAX_TIMEOUT_US    (10000000)
+#define XDMA_QUEUE_MAX_ENTRIES  (4096)
+#define XDMA_QUEUE_MAX_BUFFERS  (64)
+#define XDMA_MAX_REGISTERED_BUFFERS (32)
+#define XDMA_MAX_PROGRAMS       (16)
+
+// descriptor bypass: the user design accepts the descriptors of engine XDMA_QUEUE_ENGINE(dir, ch)
+// at bypass BAR offset DESC_BYPASS_OFFSET + XDMA_QUEUE_ENGINE(dir, ch) * XDMA_DESC_BYPASS_STRIDE
+#define XDMA_DESC_BYPASS_STRIDE (0x100)
+#define XDMA_DESC_BYPASS_MAX_DESCRIPTORS (XDMA_DESC_BYPASS_STRIDE / 32) // per transfer
+
+// PIO/DMA crossover: PIO_CROSSOVER_THRESHOLD = XDMA_CROSSOVER_AUTO measures it at start-up
+#define XDMA_CROSSOVER_AUTO             (0xFFFFFFFF)
+#define XDMA_CROSSOVER_MAX_THRESHOLD    (64 * 1024)
+#define XDMA_CROSSOVER_PROBE_BYTES      (256)   // transfer size of the start-up measurement
 
 // structure for IOCTL_XDMA_PERF_GET
 typedef struct {
@@ -70,5 +118,258 @@ typedef struct {
     UINT64 pendingCount;
 }XDMA_PERF_DATA;
 
+// structure returned by ReadFile() on the 'events' device node. The set of events to wait on is
+// selected with IOCTL_XDMA_EVENTS_SET_MASK (input: UINT32 bitmask, bit n = event_n)
+typedef struct {
+    UINT32 firedMask;                           // bit n set if event_n fired since the last read
+    UINT32 reserved;
+    UINT64 frequency;                           // timestamp ticks per second
+    UINT32 count[XDMA_MAX_USER_EVENTS];         // number of times each event fired since last read
+    UINT64 timestamp[XDMA_MAX_USER_EVENTS];     // tick count of the latest occurrence of each event
+}XDMA_EVENTS_DATA;
+
+#define XDMA_TRIGGER_AUTO_REARM     (1 << 0)    // stay armed after the transfer has been started
+
+// structure for IOCTL_XDMA_TRIGGER_ARM on a h2c_* or c2h_* device node (memory mapped engines only)
+// While armed, a ReadFile()/WriteFile() on the node is held in the driver with its DMA transfer
+// (buffer, length and device offset) already prepared, and the transfer is started directly from
+// the interrupt DPC of user event 'eventId'. The request completes through the normal read/write
+// path. Without XDMA_TRIGGER_AUTO_REARM the trigger disarms after it started one transfer.
+typedef struct {
+    UINT32 eventId;                             // user event index (0-15)
+    UINT32 flags;                               // XDMA_TRIGGER_*
+}XDMA_TRIGGER;
+
+// structure for IOCTL_XDMA_BATCH_SET on a h2c_* or c2h_* device node (not on AXI-ST c2h engines)
+// With a threshold > 0 the descriptors of up to 'threshold' consecutive ReadFile()/WriteFile()
+// requests are chained and only the last one raises an interrupt. A burst shorter than the
+// threshold is started when the holdoff time expires. Requests complete in submission order.
+// Requires interrupt mode, can only be changed while no transfers are outstanding on the engine
+// and limits each request to 8 MB.
+typedef struct {
+    UINT32 threshold;                           // requests per interrupt (max XDMA_BATCH_MAX_REQUESTS), 0 = off
+    UINT32 holdoffUs;                           // max wait for more requests, 0 = default, see README
+}XDMA_BATCH_CONFIG;
+
+// UINT32 input of IOCTL_XDMA_POLL_MODE_SET on a h2c_* or c2h_* device node (not on AXI-ST c2h
+// engines). Overrides the POLL_MODE driver parameter for the engine until the driver is reloaded.
+// Runs in order with the read/write requests of the node and fails while the engine is used by a
+// submission queue, a registered buffer transfer or program, or - for polling - while batching is
+// enabled or an event trigger is armed.
+#define XDMA_COMPLETION_INTERRUPT   (0)
+#define XDMA_COMPLETION_POLL        (1)
+
+#define XDMA_REG_OP_READ            (0)     // value = *offset
+#define XDMA_REG_OP_WRITE           (1)     // *offset = value
+#define XDMA_REG_OP_RMW             (2)     // *offset = (*offset & ~mask) | (value & mask), value = old
+#define XDMA_REG_OP_WRITE_READBACK  (3)     // *offset = value, value = *offset
+
+// element of the array passed to IOCTL_XDMA_REGISTER_OPS on the 'user' or 'control' device node
+// The operations are executed in array order on 32-bit registers of the node's BAR. The input
+// buffer holds 1 to XDMA_MAX_REG_OPS operations, the output buffer is either empty or receives
+// the same array with 'value' updated by the read operations. Nothing is executed if any
+// operation is invalid.
+typedef struct {
+    UINT32 op;                                  // XDMA_REG_OP_*
+    UINT32 offset;                              // byte offset into the BAR, 4-byte aligned
+    UINT32 value;
+    UINT32 mask;                                // bits modified by XDMA_REG_OP_RMW
+}XDMA_REG_OP;
+
+// structure for IOCTL_XDMA_REGISTER_WAIT on the 'user' or 'control' device node
+// Waits until (register & mask) == value. The register is polled continuously for 'spinUs' (at
+// most XDMA_REG_WAIT_MAX_SPIN_US), then once per system timer tick until 'timeoutUs' (at most
+// XDMA_REG_WAIT_MAX_TIMEOUT_US) have passed. The same structure is returned with the results.
+typedef struct {
+    UINT32 offset;                              // byte offset into the BAR, 4-byte aligned
+    UINT32 mask;
+    UINT32 value;
+    UINT32 spinUs;                              // busy polling time before sleeping
+    UINT32 timeoutUs;                           // total wait time, 0 = check once
+    UINT32 result;                              // out: last value read from the register
+    UINT32 met;                                 // out: 1 if the condition was met, 0 on timeout
+    UINT32 reserved;
+    UINT64 elapsedNs;                           // out: time from the first to the last read
+}XDMA_REG_WAIT;
+
+// structure for IOCTL_XDMA_BAR_MAP and IOCTL_XDMA_BAR_UNMAP on the 'user' device node
+// IOCTL_XDMA_BAR_MAP maps a window of the user BAR uncached into the calling process and returns
+// its address. The window must lie within the range enabled by the USER_BAR_MAP_OFFSET and
+// USER_BAR_MAP_LENGTH driver parameters (mapping is disabled by default). Up to
+// XDMA_MAX_BAR_MAPPINGS windows can be mapped per open file, they are unmapped by
+// IOCTL_XDMA_BAR_UNMAP (input: 'address') or when the file is closed.
+typedef struct {
+    UINT32 offset;                              // byte offset into the BAR, page aligned
+    UINT32 length;                              // bytes to map, rounded up to whole pages
+    UINT64 address;                             // user space address of the mapped window
+}XDMA_BAR_MAPPING;
+
+// IOCTL_XDMA_PIO_SET_WIDTH on the 'bypass' device node selects the store width used by WriteFile()
+// (input: UINT32 4, 8, 16 or 32 bytes, default 4). Writes whose offset and length are multiples of
+// the width are done with aligned stores of that width followed by a store fence, all others in
+// 32-bit units or smaller. 8, 16 and 32 byte stores are only supported on x64, 32 byte stores
+// require AVX.
+
+// structure for IOCTL_XDMA_PIO_STATS_GET on the 'bypass' device node, counts all writes on the file
+typedef struct {
+    UINT64 frequency;                           // timestamp ticks per second
+    UINT64 numWrites;                           // number of WriteFile() requests
+    UINT64 numBytes;                            // bytes written
+    UINT64 ticks;                               // ticks spent storing to the BAR
+    UINT32 width;                               // current store width in bytes
+    UINT32 writeCombined;                       // 1 if the BAR is mapped write-combined
+}XDMA_PIO_STATS;
+
+// ---- submission/completion queues on the 'queue' device node, see README ----
+
+#define XDMA_QUEUE_ENGINE(dir, channel) ((dir) * 4 + (channel)) // dir: 0 = H2C, 1 = C2H
+#define XDMA_QUEUE_NEED_DOORBELL    (1 << 0)    // driver stopped consuming, ring the doorbell
+
+// start of the shared ring memory, followed by numEntries XDMA_SQE and numEntries XDMA_CQE.
+// Indices are free running, entry = ring[index % numEntries].
+typedef struct {
+    volatile UINT32 sqHead;                     // driver: next submission entry to consume
+    volatile UINT32 sqTail;                     // application: one past the last posted entry
+    volatile UINT32 cqHead;                     // application: next completion entry to consume
+    volatile UINT32 cqTail;                     // driver: one past the last posted completion
+    volatile UINT32 flags;                      // driver: XDMA_QUEUE_*
+    UINT32 reserved[3];
+}XDMA_QUEUE_HEADER;
+
+// submission queue entry - one DMA transfer
+typedef struct {
+    UINT64 userData;                            // copied into the completion entry
+    UINT64 deviceOffset;                        // card address
+    UINT32 engine;                              // XDMA_QUEUE_ENGINE(dir, channel)
+    UINT32 buffer;                              // index of the registered host buffer
+    UINT32 bufferOffset;                        // byte offset into the host buffer
+    UINT32 length;                              // bytes to transfer (max. 8 MB)
+}XDMA_SQE;
+
+// completion queue entry
+typedef struct {
+    UINT64 userData;                            // from the submission entry
+    INT32 status;                               // NTSTATUS of the transfer
+    UINT32 length;                              // bytes transferred
+}XDMA_CQE;
+
+typedef struct {
+    UINT64 address;                             // user space address of the buffer
+    UINT32 length;                              // bytes
+    UINT32 reserved;
+}XDMA_QUEUE_BUFFER;
+
+// structure for IOCTL_XDMA_QUEUE_SETUP on the 'queue' device node. The ring memory and the buffers
+// stay locked in memory until the file is closed. The engines selected by 'engineMask' are used
+// exclusively by the queue, ReadFile()/WriteFile() on their device nodes fails meanwhile.
+typedef struct {
+    UINT64 ringAddress;                         // user space address of the shared ring memory
+    UINT32 numEntries;                          // entries per ring, power of 2, max. XDMA_QUEUE_MAX_ENTRIES
+    UINT32 engineMask;                          // bit XDMA_QUEUE_ENGINE(dir, channel) set = engine used
+    UINT32 numBuffers;                          // registered host buffers
+    UINT32 reserved;
+    XDMA_QUEUE_BUFFER buffers[XDMA_QUEUE_MAX_BUFFERS];
+}XDMA_QUEUE_SETUP;
+
+// structure for IOCTL_XDMA_BUFFER_REGISTER on a 'h2c_*'/'c2h_*' device node. The buffer stays locked
+// and mapped for DMA until IOCTL_XDMA_BUFFER_DEREGISTER or until the file is closed.
+typedef struct {
+    UINT64 address;                             // user space address of the buffer
+    UINT32 length;                              // bytes
+    UINT32 handle;                              // out: handle for the other buffer IOCTLs
+}XDMA_BUFFER_REGISTER;
+
+// input and output of IOCTL_XDMA_BUFFER_TRANSFER on the node the buffer was registered on
+typedef struct {
+    UINT32 handle;                              // from IOCTL_XDMA_BUFFER_REGISTER
+    UINT32 offset;                              // byte offset into the registered buffer
+    UINT32 length;                              // bytes to transfer (max. 8 MB)
+    UINT32 transferred;                         // out: bytes transferred
+    UINT64 deviceOffset;                        // card address
+}XDMA_BUFFER_TRANSFER;
+
+// input and output of IOCTL_XDMA_PROGRAM_CREATE: compiles a transfer from a registered buffer into
+// a descriptor program which is started with IOCTL_XDMA_PROGRAM_LAUNCH. The buffer cannot be
+// deregistered while programs use it.
+typedef struct {
+    UINT32 handle;                              // registered buffer
+    UINT32 offset;                              // byte offset into the registered buffer
+    UINT32 length;                              // bytes to transfer (max. 8 MB)
+    UINT32 program;                             // out: program id for launch/delete
+    UINT64 deviceOffset;                        // card address
+}XDMA_PROGRAM_CREATE;
+
+// input and output of IOCTL_XDMA_PROGRAM_LAUNCH
+typedef struct {
+    UINT32 program;                             // from IOCTL_XDMA_PROGRAM_CREATE
+    UINT32 transferred;                         // out: bytes transferred
+}XDMA_PROGRAM_LAUNCH;
+
+// structure for IOCTL_XDMA_CROSSOVER_GET and IOCTL_XDMA_CROSSOVER_SET, supported on all device nodes.
+// Reads and writes on the h2c_*/c2h_* nodes of up to threshold[dir] bytes are served by PIO through
+// the bypass BAR while the engine has no other request queued. SET only changes 'threshold'.
+typedef struct {
+    UINT64 windowBase;                          // card address at bypass BAR offset 0
+    UINT32 windowLength;                        // 0 = no PIO window, the thresholds have no effect
+    UINT32 threshold[2];                        // [0=H2C,1=C2H] max. bytes served by PIO, 0 = DMA only
+    UINT32 reserved;
+    UINT64 frequency;                           // timestamp ticks per second
+    UINT64 dmaTicks;                            // fastest DMA read of XDMA_CROSSOVER_PROBE_BYTES,
+    UINT64 pioTicks;                            //  fastest PIO read of the same, 0 = not calibrated
+}XDMA_CROSSOVER;
+
+// optional UINT32 input of IOCTL_XDMA_STATS_GET
+#define XDMA_STATS_CLEAR    (1)     // return the counters and set them to zero in one step
+
+// event counters of a DMA engine since the driver was loaded or they were cleared
+typedef struct {
+    UINT64 numBytes;                            // bytes of completed transfers
+    UINT64 numRequests;                         // completed read/write requests and direct transfers
+    UINT64 numDescriptors;                      // descriptors handed to the engine
+    UINT64 numInterrupts;                       // engine interrupts serviced
+    UINT64 numPolls;                            // poll mode iterations waiting for completion
+    UINT64 numMisaligned;                       // descriptors violating the alignment requirements
+    UINT64 numErrors;                           // status reads with an error bit set
+    UINT64 numCredits;                          // descriptor credits returned to a streaming c2h ring
+    UINT64 statusBits[32];                      // status reads with error bit n set, see numErrors
+}XDMA_ENGINE_STATS;
+
+// structure for IOCTL_XDMA_STATS_GET, supported on all device nodes
+typedef struct {
+    XDMA_ENGINE_STATS engine[2][4];             // [0=H2C,1=C2H][channel]
+}XDMA_STATS_DATA;
+
+// interrupt path stages measured for each DMA engine. The arrival of the MSI itself is not visible
+// to software, it is contained in XDMA_LATENCY_START_TO_ISR together with the transfer time.
+#define XDMA_LATENCY_START_TO_ISR       (0)     // engine started -> interrupt service routine
+#define XDMA_LATENCY_ISR_TO_DPC         (1)     // interrupt service routine -> DPC
+#define XDMA_LATENCY_DPC_TO_COMPLETE    (2)     // DPC -> WdfRequestComplete()
+#define XDMA_LATENCY_ENGINE_STAGES      (3)
+
+// interrupt path stages measured for each user event
+#define XDMA_LATENCY_EVENT_ISR_TO_DPC   (0)     // interrupt service routine -> DPC
+#define XDMA_LATENCY_EVENT_HANDLER      (1)     // time spent in the event handler within the DPC
+#define XDMA_LATENCY_EVENT_STAGES       (2)
+
+// Log-scale histogram of timestamp ticks with 4 linear sub-buckets per power of two:
+// bucket i < 4 counts samples of i ticks, bucket i >= 4 counts samples in the range
+// [(4 + i % 4) << (i / 4 - 1), (5 + i % 4) << (i / 4 - 1)). The last bucket also counts all
+// larger samples.
+#define XDMA_LATENCY_NUM_BUCKETS        (96)
+
+typedef struct {
+    UINT64 count;                               // number of samples
+    UINT64 sum;                                 // sum of all samples in ticks
+    UINT64 max;                                 // largest sample in ticks
+    UINT64 bucket[XDMA_LATENCY_NUM_BUCKETS];
+}XDMA_LATENCY_HISTOGRAM;
+
+// structure for IOCTL_XDMA_LATENCY_GET, supported on all device nodes
+typedef struct {
+    UINT64 frequency;                           // timestamp ticks per second
+    XDMA_LATENCY_HISTOGRAM engine[2][4][XDMA_LATENCY_ENGINE_STAGES]; // [0=H2C,1=C2H][channel][stage]
+    XDMA_LATENCY_HISTOGRAM userEvent[XDMA_MAX_USER_EVENTS][XDMA_LATENCY_EVENT_STAGES];
+}XDMA_LATENCY_DATA;
+
 #endif/*__XDMA_WINDOWS_H__*/
 
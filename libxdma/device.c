@@ -121,6 +121,7 @@ static NTSTATUS MapBARs(IN PXDMA_DEVICE xdma, IN WDFCMRESLIST ResourcesTranslate
 
         if (resource->Type == CmResourceTypeMemory) {
             xdma->barLength[xdma->numBars] = resource->u.Memory.Length;
+            xdma->barPhysAddr[xdma->numBars] = resource->u.Memory.Start;
             xdma->bar[xdma->numBars] = MmMapIoSpace(resource->u.Memory.Start,
                                                     resource->u.Memory.Length, MmNonCached);
             if (xdma->bar[xdma->numBars] == NULL) {
@@ -179,6 +180,26 @@ static NTSTATUS IdentifyBars(IN PXDMA_DEVICE xdma) {
     return STATUS_SUCCESS;
 }
 
+// Replace the uncached mapping of the bypass BAR by a write-combined one. Descriptors written to
+// the bypass BAR can then be merged into large PCIe write TLPs by the CPU.
+static void MapBypassBARWriteCombined(IN PXDMA_DEVICE xdma) {
+    const LONG idx = xdma->bypassBarIdx;
+    if (!xdma->bypassWriteCombined || (idx < 0)) {
+        xdma->bypassWriteCombined = FALSE;
+        return;
+    }
+
+    MmUnmapIoSpace(xdma->bar[idx], xdma->barLength[idx]);
+    xdma->bar[idx] = MmMapIoSpace(xdma->barPhysAddr[idx], xdma->barLength[idx], MmWriteCombined);
+    if (xdma->bar[idx] == NULL) {
+        TraceWarning(DBG_INIT, "write-combined mapping of BAR%d failed, using uncached mapping", idx);
+        xdma->bypassWriteCombined = FALSE;
+        xdma->bar[idx] = MmMapIoSpace(xdma->barPhysAddr[idx], xdma->barLength[idx], MmNonCached);
+    }
+    TraceInfo(DBG_INIT, "bypass BAR%d mapped at 0x%08p, write-combined=%u",
+              idx, xdma->bar[idx], xdma->bypassWriteCombined);
+}
+
 // Get the config, interrupt and sgdma module register offsets
 static void GetRegisterModules(IN PXDMA_DEVICE xdma) {
     PUCHAR configBarAddr = (PUCHAR)xdma->bar[xdma->configBarIdx];
@@ -214,6 +235,12 @@ NTSTATUS XDMA_DeviceOpen(WDFDEVICE wdfDevice,
         return status;
     }
 
+    MapBypassBARWriteCombined(xdma);
+    if ((xdma->bypassBarIdx >= 0) && (xdma->bar[xdma->bypassBarIdx] == NULL)) {
+        TraceError(DBG_INIT, "MmMapIoSpace returned NULL! for bypass BAR");
+        return STATUS_DEVICE_CONFIGURATION_ERROR;
+    }
+
     // get the module offsets in config BAR
     GetRegisterModules(xdma);
 
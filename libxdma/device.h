@@ -44,6 +44,7 @@ typedef struct XDMA_EVENT_T {
     PFN_XDMA_USER_WORK work; // user callback 
     void* userData; // custom user data. will be passed into work callback function
     WDFINTERRUPT irq; //wdf interrupt handle
+    XDMA_EVENT_LATENCY latency; // interrupt path timing
 } XDMA_EVENT;
 
 /// The XDMA device context
@@ -55,10 +56,13 @@ typedef struct XDMA_DEVICE_T {
     // PCIe BAR access
     UINT numBars;
     PVOID bar[XDMA_MAX_NUM_BARS]; // kernel virtual address of BAR
+    PHYSICAL_ADDRESS barPhysAddr[XDMA_MAX_NUM_BARS];
     ULONG barLength[XDMA_MAX_NUM_BARS];
     ULONG configBarIdx;
     LONG userBarIdx;
     LONG bypassBarIdx;
+    BOOLEAN bypassWriteCombined; // map the bypass BAR write-combined. set before XDMA_DeviceOpen(),
+                                 // cleared if the mapping could not be created
     volatile XDMA_CONFIG_REGS *configRegs;
     volatile XDMA_IRQ_REGS *interruptRegs;
     volatile XDMA_SGDMA_COMMON_REGS * sgdmaRegs;
@@ -73,6 +77,8 @@ typedef struct XDMA_DEVICE_T {
 
     // user events
     XDMA_EVENT userEvents[XDMA_MAX_USER_IRQ];
+    ULONG dedicatedUserEvents;  // events which get their own MSI-X vector first if vectors are
+                                // scarce (bit n = event n). set before XDMA_DeviceOpen()
 
 } XDMA_DEVICE, *PXDMA_DEVICE;
 
@@ -0,0 +1,240 @@
+/*
+* XDMA Descriptor and Ring Core
+* =============================
+*
+* Copyright 2017 Xilinx Inc.
+*
+* Description:
+* ------------
+* OS independent part of the DMA engine logic. See dma_core.h
+*
+* References:
+* -----------
+*	[1] pg195-pcie-dma.pdf - DMA/Bridge Subsystem for PCI Express v4.0 - Product Guide
+*/
+
+// ========================= include dependencies =================================================
+
+#include "dma_core.h"
+
+// ========================= helpers ==============================================================
+
+static UINT64 SgAddress(const XDMA_SG_VIEW* sgList, UINT32 index) {
+    const unsigned char* element = (const unsigned char*)sgList->elements + index * sgList->stride;
+    return *(const UINT64*)element;
+}
+
+static UINT32 SgLength(const XDMA_SG_VIEW* sgList, UINT32 index) {
+    const unsigned char* element = (const unsigned char*)sgList->elements + index * sgList->stride;
+    return *(const UINT32*)(element + sizeof(UINT64));
+}
+
+// ========================= descriptors ==========================================================
+
+BOOLEAN DescriptorIsAligned(const XDMA_DESC_PARAMS* params, const DMA_DESCRIPTOR* descriptor)
+// For alignment requirements see product guide [1] page 23 table 2-9
+{
+    if (params->fixedAddress) {
+        const UINT32 addrMask = params->dataPathBytes - 1;
+        // todo length alignment requirement??
+        return (descriptor->dstAddrLo & addrMask) == (descriptor->srcAddrLo & addrMask);
+    }
+
+    // incremental address mode
+    return ((descriptor->dstAddrLo % params->alignAddr) == 0) &&
+           ((descriptor->numBytes % params->alignLength) == 0) &&
+           ((descriptor->srcAddrLo % params->alignAddr) == 0);
+}
+
+UINT32 DescriptorBuildList(const XDMA_DESC_PARAMS* params, DMA_DESCRIPTOR* descriptor,
+                           UINT64 descBusAddr, UINT64 deviceOffset, BOOLEAN toDevice,
+                           const XDMA_SG_VIEW* sgList, UINT32* numMisaligned)
+{
+    const UINT32 numElements = sgList->numElements;
+    UINT32 numBytes = 0;
+
+    *numMisaligned = 0;
+    for (UINT32 i = 0; i < numElements; i++) {
+        const UINT64 hostAddr = SgAddress(sgList, i);
+        const UINT32 length = SgLength(sgList, i);
+        DMA_DESCRIPTOR* desc = &descriptor[i];
+
+        desc->control = XDMA_DESC_MAGIC;
+        desc->numBytes = length;
+        if (toDevice) { // source is host memory
+            desc->srcAddrLo = (UINT32)LIMIT_TO_32(hostAddr);
+            desc->srcAddrHi = (UINT32)(hostAddr >> 32);
+            desc->dstAddrLo = (UINT32)LIMIT_TO_32(deviceOffset);
+            desc->dstAddrHi = (UINT32)(deviceOffset >> 32);
+        } else { // destination is host memory
+            desc->srcAddrLo = (UINT32)LIMIT_TO_32(deviceOffset);
+            desc->srcAddrHi = (UINT32)(deviceOffset >> 32);
+            desc->dstAddrLo = (UINT32)LIMIT_TO_32(hostAddr);
+            desc->dstAddrHi = (UINT32)(hostAddr >> 32);
+        }
+
+        // next descriptor bus address
+        descBusAddr += sizeof(DMA_DESCRIPTOR);
+
+        if ((i + 1) < numElements) { // non-last descriptor(s)
+            desc->nextLo = (UINT32)LIMIT_TO_32(descBusAddr);
+            desc->nextHi = (UINT32)(descBusAddr >> 32);
+        } else { // last descriptor - stop engine and request an interrupt from the engine
+            desc->nextLo = 0;
+            desc->nextHi = 0;
+            desc->control |= (XDMA_DESC_STOP_BIT | XDMA_DESC_COMPLETED_BIT);
+            if (params->streaming) {
+                desc->control |= XDMA_DESC_EOP_BIT;
+            }
+        }
+        if (!params->fixedAddress) { // incremental address mode
+            deviceOffset += length;
+        }
+        numBytes += length;
+
+        if (!DescriptorIsAligned(params, desc)) {
+            (*numMisaligned)++;
+        }
+    }
+    return numBytes;
+}
+
+UINT32 DescriptorOptimizeList(const XDMA_DESC_PARAMS* params, DMA_DESCRIPTOR* descriptor,
+                              UINT32 numDescriptors, UINT32 firstDescLo)
+    // Optimize descriptors for PCIe block fetches.
+    // Multiple descriptors which reside in host memory can be fetched in a single PCIe transaction
+    // by the device. This is achieved as follows:
+    //      - For the first fetch, the number of additional (adjacent) descriptors to fetch is
+    //        specified by writing to the firstDescAdj register - returned for the list starting at
+    //        bus address 'firstDescLo'.
+    //      - For subsequent fetches, the last descriptor of the previous fetch specifies the number of
+    //        additional (adjacent) descriptors in the control->nextAdj field
+    // There are several factors which limit the amount of descriptors which can be fetched together:
+    //      1. The PCIe Max Read Request Size
+    //      2. The physical address of the descriptors within a block must not cross a 4K address
+    //         boundary
+    //      3. The number of descriptors remaining in the transfer
+{
+    const UINT32 adjMax = params->mrrsBytes / sizeof(DMA_DESCRIPTOR) - 1;
+    const UINT32 adjTotal = numDescriptors - 1;
+    const UINT32 adjTo4k = (0x1000 - (firstDescLo & 0xFFF)) / sizeof(DMA_DESCRIPTOR) - 1;
+
+    // the number of adjacent descriptors for the first fetch
+    UINT32 firstAdj = adjTotal < adjMax ? adjTotal : adjMax;
+    firstAdj = adjTo4k < firstAdj ? adjTo4k : firstAdj;
+
+    // set the number of adjacent descriptors for subsequent fetches
+    UINT32 nextAdjMax = adjMax - 1;
+    for (UINT32 i = 0; i < numDescriptors; i++) {
+        // if not last desc then get total desc adj to next desc, else last desc has no next desc
+        const UINT32 nextAdjTotal = (i != adjTotal) ? adjTotal - (i + 1) : 0;
+        const UINT32 nextAdjTo4k = (0x1000 - (descriptor[i].nextLo & 0xFFF)) /
+                                   sizeof(DMA_DESCRIPTOR) - 1;
+
+        UINT32 nextAdj = nextAdjTotal < nextAdjMax ? nextAdjTotal : nextAdjMax;
+        if (nextAdj > nextAdjTo4k) {
+            nextAdj = nextAdjTo4k;
+        }
+
+        descriptor[i].control |= (nextAdj << XDMA_DESC_NEXT_ADJ_SHIFT);
+
+        // update current max adj count for this block
+        if (nextAdjMax != 0) {
+            nextAdjMax--;
+        } else { // wrap-around
+            nextAdjMax = adjMax;
+        }
+    }
+    return firstAdj;
+}
+
+// ========================= streaming ring =======================================================
+
+void RingBuildDescriptors(DMA_DESCRIPTOR* descriptor, UINT64 descBusAddr, UINT64 resultBusAddr,
+                          UINT32 numBlocks, UINT32 blockSize)
+{
+    const UINT64 firstDescBusAddr = descBusAddr;
+
+    for (UINT32 i = 0; i < numBlocks; ++i) {
+        descriptor[i].control = (XDMA_DESC_MAGIC | XDMA_DESC_EOP_BIT | XDMA_DESC_COMPLETED_BIT);
+        descriptor[i].numBytes = blockSize;
+
+        // source address are unused, will be overwritten by hardware with dma result
+        descriptor[i].srcAddrLo = (UINT32)LIMIT_TO_32(resultBusAddr);
+        descriptor[i].srcAddrHi = (UINT32)(resultBusAddr >> 32);
+        resultBusAddr += sizeof(DMA_RESULT);
+
+        // next descriptor bus address, the last one points back to the first
+        descBusAddr = ((i + 1) < numBlocks) ? descBusAddr + sizeof(DMA_DESCRIPTOR) : firstDescBusAddr;
+        descriptor[i].nextLo = (UINT32)LIMIT_TO_32(descBusAddr);
+        descriptor[i].nextHi = (UINT32)(descBusAddr >> 32);
+    }
+}
+
+UINT32 RingAdvance(UINT32 index, UINT32 numBlocks) {
+    return (index == numBlocks - 1) ? 0 : index + 1; // wrap-around or normal increment
+}
+
+UINT32 RingCollectResults(DMA_RESULT* results, UINT32* tail, UINT32 numBlocks)
+{
+    UINT32 eopCount = 0;
+    UINT32 index = *tail;
+
+    for (; results[index].status; index = RingAdvance(index, numBlocks)) {
+        if (results[index].status & XDMA_RESULT_EOP_BIT) {
+            eopCount++;
+        }
+        results[index].status = 0; // mark current dma result as processed
+    }
+    *tail = index;
+    return eopCount;
+}
+
+BOOLEAN RingConsume(DMA_RESULT* results, UINT32* head, UINT32 tail, UINT32 numBlocks,
+                    size_t length, XDMA_RING_COPY copy, void* context, size_t* numBytes,
+                    UINT32* numBlocksConsumed)
+{
+    UINT32 index = *head;
+    size_t offset = 0;
+    BOOLEAN ok = TRUE;
+
+    *numBlocksConsumed = 0;
+    while ((index != tail) && (offset < length)) {
+
+        // limit to the remaining buffer size
+        size_t numBytesReceived = results[index].length;
+        if (numBytesReceived == 0) {
+            break;
+        } else if (numBytesReceived > length - offset) {
+            numBytesReceived = length - offset;
+        }
+
+        if (!copy(context, index, offset, numBytesReceived)) {
+            ok = FALSE;
+            break;
+        }
+
+        (*numBlocksConsumed)++;
+        offset += numBytesReceived;
+        results[index].length = 0;
+        index = RingAdvance(index, numBlocks);
+    }
+
+    *head = index;
+    *numBytes = offset;
+    return ok;
+}
+
+// ========================= writeback ============================================================
+
+XDMA_WB_STATE WritebackCheck(UINT32 completedDescCount, UINT32 expected)
+{
+    if (completedDescCount & XDMA_WB_ERR_MASK) {
+        return XDMA_WB_ERROR;
+    }
+    completedDescCount &= XDMA_WB_COUNT_MASK;
+    if (completedDescCount > expected) {
+        return XDMA_WB_ERROR;
+    }
+    return (completedDescCount == expected) ? XDMA_WB_DONE : XDMA_WB_PENDING;
+}
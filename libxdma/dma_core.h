@@ -0,0 +1,127 @@
+/*
+* XDMA Descriptor and Ring Core
+* =============================
+*
+* Copyright 2017 Xilinx Inc.
+*
+* Description:
+* ------------
+* OS independent part of the DMA engine logic: descriptor list construction, alignment checks,
+* descriptor block fetch optimization, streaming ring accounting and writeback parsing.
+* Nothing in here touches registers, allocates memory or depends on WDF - dma_engine.c calls these
+* functions with the buffers and addresses it owns. The same code builds with gcc/clang on Linux,
+* where it is benchmarked against the software model of the IP (see model/).
+*
+* References:
+* -----------
+*	[1] pg195-pcie-dma.pdf - DMA/Bridge Subsystem for PCI Express v4.0 - Product Guide
+*/
+
+#pragma once
+
+// ========================= include dependencies =================================================
+
+#ifdef _KERNEL_MODE
+#include <ntdef.h>
+#else
+#include <stddef.h>
+#include <stdint.h>
+typedef uint32_t UINT32;
+typedef uint64_t UINT64;
+typedef unsigned char BOOLEAN;
+#ifndef TRUE
+#define TRUE    (1)
+#define FALSE   (0)
+#endif
+#endif
+
+#include "reg.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// ========================= type declarations ====================================================
+
+/// Engine properties the descriptor construction depends on
+typedef struct {
+    BOOLEAN streaming;      // AXI-ST engine: the last descriptor of a transfer carries EOP
+    BOOLEAN fixedAddress;   // non-incremental card address
+    UINT32 alignAddr;       // address alignment in bytes, from the engine alignments register
+    UINT32 alignLength;     // length granularity in bytes
+    UINT32 dataPathBytes;   // data path width, the address alignment in fixed address mode
+    UINT32 mrrsBytes;       // PCIe max read request size, limits descriptor block fetches
+} XDMA_DESC_PARAMS;
+
+/// Scatter-gather element for callers without a list type of their own
+typedef struct {
+    UINT64 address;
+    UINT32 length;
+    UINT32 reserved;
+} XDMA_SG_ELEMENT;
+
+/// Read-only view of a scatter-gather list. Every element starts with a 64-bit bus address followed
+/// by a 32-bit length and elements are 'stride' bytes apart. SCATTER_GATHER_ELEMENT has this layout,
+/// so the driver passes its lists without copying them.
+typedef struct {
+    const void* elements;
+    size_t stride;
+    UINT32 numElements;
+} XDMA_SG_VIEW;
+
+/// State of a poll mode writeback compared to the expected number of completed descriptors
+typedef enum {
+    XDMA_WB_PENDING,    // descriptors still outstanding
+    XDMA_WB_DONE,       // all expected descriptors completed
+    XDMA_WB_ERROR,      // error bit set, or more descriptors completed than expected
+} XDMA_WB_STATE;
+
+/// Called by RingConsume() for every ring block to copy out. Returns FALSE if the copy failed.
+typedef BOOLEAN (*XDMA_RING_COPY)(void* context, UINT32 block, size_t offset, size_t length);
+
+// ========================= function declarations ================================================
+
+/// Fill a linked list of descriptors for a scatter-gather list, starting at 'descriptor' which has
+/// the bus address 'descBusAddr'. The last descriptor stops the engine and requests an interrupt.
+/// Misaligned descriptors are built anyway and counted in '*numMisaligned'.
+/// returns the number of bytes described
+UINT32 DescriptorBuildList(const XDMA_DESC_PARAMS* params, DMA_DESCRIPTOR* descriptor,
+                           UINT64 descBusAddr, UINT64 deviceOffset, BOOLEAN toDevice,
+                           const XDMA_SG_VIEW* sgList, UINT32* numMisaligned);
+
+/// Check a descriptor against the alignment requirements of the engine [1] table 2-9
+BOOLEAN DescriptorIsAligned(const XDMA_DESC_PARAMS* params, const DMA_DESCRIPTOR* descriptor);
+
+/// Set the nextAdj fields of a descriptor list starting at bus address 'firstDescLo' so the engine
+/// fetches as many descriptors per PCIe read request as allowed.
+/// returns the value for the firstDescAdj register
+UINT32 DescriptorOptimizeList(const XDMA_DESC_PARAMS* params, DMA_DESCRIPTOR* descriptor,
+                              UINT32 numDescriptors, UINT32 firstDescLo);
+
+/// Fill a circular descriptor list for a streaming C2H ring of 'numBlocks' blocks. Descriptor i
+/// writes its DMA_RESULT to 'resultBusAddr' + i * sizeof(DMA_RESULT); the destination addresses of
+/// the blocks are left to the caller.
+void RingBuildDescriptors(DMA_DESCRIPTOR* descriptor, UINT64 descBusAddr, UINT64 resultBusAddr,
+                          UINT32 numBlocks, UINT32 blockSize);
+
+/// Next ring index after 'index'
+UINT32 RingAdvance(UINT32 index, UINT32 numBlocks);
+
+/// Take the DMA results the engine wrote since 'tail' and advance 'tail' past them.
+/// returns the number of completed packets (results with EOP)
+UINT32 RingCollectResults(DMA_RESULT* results, UINT32* tail, UINT32 numBlocks);
+
+/// Copy up to 'length' bytes of received data from the ring blocks between 'head' and 'tail' and
+/// advance 'head' past the consumed blocks. A block is consumed completely even if only part of
+/// it fits. Returns FALSE if 'copy' failed; '*numBytes' and '*numBlocksConsumed' (the descriptor
+/// credits to return to the engine) are valid in either case.
+BOOLEAN RingConsume(DMA_RESULT* results, UINT32* head, UINT32 tail, UINT32 numBlocks,
+                    size_t length, XDMA_RING_COPY copy, void* context, size_t* numBytes,
+                    UINT32* numBlocksConsumed);
+
+/// Compare a poll mode writeback value to the number of descriptors the transfer has
+XDMA_WB_STATE WritebackCheck(UINT32 completedDescCount, UINT32 expected);
+
+#ifdef __cplusplus
+}
+#endif
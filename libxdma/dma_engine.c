@@ -20,6 +20,7 @@
 #include "device.h"
 #include "interrupt.h"
 #include "dma_engine.h"
+#include "dma_core.h"
 #include "trace.h"
 
 #ifdef DBG
@@ -31,9 +32,13 @@
 // ========================= constants ============================================================
 
 #define XDMA_ENG_IRQ_NUM        (1)
-#define XDMA_DESC_MAGIC         (0xAD4B0000)
-#define XDMA_WB_COUNT_MASK      (0x00ffffffUL)
-#define XDMA_WB_ERR_MASK        (BIT_N(31))
+
+// ========================= type declarations ====================================================
+
+typedef struct {
+    XDMA_ENGINE* engine;
+} BATCH_TIMER_CONTEXT;
+WDF_DECLARE_CONTEXT_TYPE_WITH_NAME(BATCH_TIMER_CONTEXT, GetBatchTimerContext)
 
 // ========================= static function declarations =========================================
 
@@ -44,8 +49,12 @@ static NTSTATUS EngineCreateRingBuffer(IN XDMA_ENGINE* engine);
 static void EngineConfigureInterrupt(IN OUT XDMA_ENGINE *engine, IN UINT index);
 static void EngineProcessTransfer(IN XDMA_ENGINE *engine);
 static UINT EngineProcessRing(IN XDMA_ENGINE *engine);
-static void EngineRingAdvance(UINT* index);
 static NTSTATUS EngineCreatePollWriteBackBuffer(IN OUT XDMA_ENGINE *engine);
+static NTSTATUS EngineCreateBatch(IN OUT XDMA_ENGINE *engine);
+static void EngineProcessBatch(IN XDMA_ENGINE *engine);
+static VOID EngineBatchLaunch(IN XDMA_ENGINE *engine);
+static void EngineProcessDirect(IN XDMA_ENGINE *engine);
+EVT_WDF_TIMER EvtBatchWatchdog;
 
 // Mark these functions as pageable code
 #ifdef ALLOC_PRAGMA
@@ -62,7 +71,7 @@ static NTSTATUS EngineCreatePollWriteBackBuffer(IN OUT XDMA_ENGINE *engine);
 
 static NTSTATUS EngineCreateDescriptorBuffer(IN OUT XDMA_ENGINE *engine) {
     // allocate host-side buffer for descriptors
-    SIZE_T bufferSize = (XDMA_MAX_TRANSFER_SIZE / PAGE_SIZE + 2) * sizeof(DMA_DESCRIPTOR);
+    SIZE_T bufferSize = XDMA_MAX_DESCRIPTORS * sizeof(DMA_DESCRIPTOR);
 
     NTSTATUS status = WdfCommonBufferCreate(engine->parentDevice->dmaEnabler, bufferSize,
                                             WDF_NO_OBJECT_ATTRIBUTES, &engine->descBuffer);
@@ -95,6 +104,9 @@ static void EngineConfigureInterrupt(IN OUT XDMA_ENGINE *engine, IN UINT index)
     if (engine->parentDevice->channelInterrupts[index] != NULL) {
         PIRQ_CONTEXT irqContext = GetIrqContext(engine->parentDevice->channelInterrupts[index]);
         irqContext->engine = engine;
+        engine->irq = engine->parentDevice->channelInterrupts[index];
+    } else {
+        engine->irq = engine->parentDevice->lineInterrupt;
     }
 
     // enable interrupts
@@ -153,6 +165,9 @@ static void EngineProcessTransfer(IN XDMA_ENGINE *engine)
             if (!NT_SUCCESS(status)) {
                 TraceError(DBG_DMA, "WdfDmaTransactionRelease failed: %!STATUS!", status);
             }
+            EngineLatencyComplete(engine);
+            EngineStatsAdd(engine, numRequests, 1);
+            EngineStatsAdd(engine, numBytes, bytesTransferred);
             WdfRequestCompleteWithInformation(request, status, bytesTransferred);
         }
         break;
@@ -198,85 +213,32 @@ static void DumpDescriptor(IN const DMA_DESCRIPTOR* const desc) {
 #endif
 }
 
-static BOOLEAN DescriptorIsAligned(IN XDMA_ENGINE *engine, IN DMA_DESCRIPTOR *desc)
-// For alignment requirements see product guide [1] page 23 table 2-9
+static void EngineDescParams(IN XDMA_ENGINE *engine, OUT XDMA_DESC_PARAMS *params)
+// engine properties for the descriptor functions of dma_core.c
 {
-    if (engine->addressMode == AddressMode_Fixed) {
-        const UINT32 dataPathWidth = (1 << (6 + engine->parentDevice->configRegs->pcieWidth)) / 8;
-        const UINT32 addrMask = dataPathWidth - 1;
-
-        if ((desc->dstAddrLo & addrMask) != (desc->srcAddrLo & addrMask) != 0) {
-            TraceError(DBG_DESC, "misalignment detected! dataWidth=%u, src=0x%08llx, dst=0x%08llx, bytes=%llu",
-                       dataPathWidth, desc->srcAddrLo, desc->dstAddrLo, desc->numBytes);
-            return FALSE;
-        }
-        // todo length alignment requirement??
-
-    } else { // AddressMode_Contiguous (i.e. incremental mode)
-        BOOLEAN dstAddrMisaligned = (desc->dstAddrLo % engine->alignAddr) != 0;
-        BOOLEAN lengthMisaligned = (desc->numBytes % engine->alignLength) != 0;
-        BOOLEAN srcAddrMisaligned = (desc->srcAddrLo % engine->alignAddr) != 0;
-
-        if (dstAddrMisaligned || lengthMisaligned || srcAddrMisaligned) {
-            TraceVerbose(DBG_DESC, "descriptor alignments: src=0x%08llx, dst=0x%08llx, bytes=%llu",
-                         desc->srcAddrLo, desc->dstAddrLo, desc->numBytes);
-            TraceError(DBG_DESC, "misalignment detected! src?=%u dst?=%u length?=%u",
-                       srcAddrMisaligned, dstAddrMisaligned, lengthMisaligned);
-            return FALSE;
-        }
-    }
-    return TRUE;
+    params->streaming = (engine->type == EngineType_ST);
+    params->fixedAddress = (engine->addressMode == AddressMode_Fixed);
+    params->alignAddr = engine->alignAddr;
+    params->alignLength = engine->alignLength;
+    params->dataPathBytes = engine->dataPathBytes;
+    params->mrrsBytes = engine->mrrsBytes;
+}
+
+static ULONG OptimizeDescriptorList(IN XDMA_ENGINE *engine, IN DMA_DESCRIPTOR * const desc,
+                                    IN const ULONG numDesc, IN const ULONG firstDescLo)
+// set up PCIe block fetches of the descriptor list, returns the firstDescAdj register value
+{
+    XDMA_DESC_PARAMS params;
+    EngineDescParams(engine, &params);
+    return DescriptorOptimizeList(&params, desc, numDesc, firstDescLo);
 }
 
 static void OptimizeDescriptors(IN XDMA_ENGINE *engine, IN DMA_DESCRIPTOR * const desc,
                                 IN const ULONG numDesc)
-    // Optimize descriptors for PCIe block fetches.
-    // Multiple descriptors which reside in host memory can be fetched in a single PCIe transaction
-    // by the device. This is achieved as follows:
-    //      - For the first fetch, the number of additional (adjacent) descriptors to fetch is 
-    //        specified by writing to engine->sgdma->firstDescAdj register. 
-    //      - For subsequent fetches, the last descriptor of the previous fetch specifies the number of
-    //        additional (adjacent) descriptors in the control->nextAdj field 
-    // There are several factors which limit the amount of descriptors which can be fetched together:
-    //      1. The PCIe Max Read Request Size
-    //      2. The physical address of the descriptors within a block must not cross a 4K address 
-    //         boundary
-    //      3. The number of descriptors remaining in the transfer
+// optimize a descriptor list starting at the engine's first descriptor address
 {
-    const ULONG mrrsBytes = 1 << (engine->parentDevice->configRegs->pcieMRRS + 7);
-    const ULONG adjMax = mrrsBytes / sizeof(DMA_DESCRIPTOR) - 1;
-    const ULONG adjTotal = numDesc - 1;
-    const ULONG adjTo4k = (0x1000 - (engine->sgdma->firstDescLo & 0xFFF)) / sizeof(DMA_DESCRIPTOR) - 1;
-
-    // set the number of adjacent descriptors for the first fetch
-    ULONG firstAdj = adjTotal < adjMax ? adjTotal : adjMax;
-    engine->sgdma->firstDescAdj = adjTo4k < firstAdj ? adjTo4k : firstAdj;
-    //TraceVerbose(DBG_DMA, "first: PA=%04u, this4k=%04u, total=%04u, thisBlock=%04u",
-    //             engine->sgdma->firstDescLo & 0xFFF, adjTo4k, adjTotal, engine->sgdma->firstDescAdj);
-
-    // set the number of adjacent descriptors for subsequent fetches
-    ULONG nextAdjMax = adjMax - 1;
-    for (UINT i = 0; i < numDesc; i++) {
-        // if not last desc then get total desc adj to next desc, else last desc has no next desc
-        const ULONG nextAdjTotal = (i != adjTotal) ? adjTotal - (i + 1) : 0;
-        const ULONG nextAdjTo4k = (0x1000 - (desc[i].nextLo & 0xFFF)) / sizeof(DMA_DESCRIPTOR) - 1;
-
-        ULONG nextAdj = nextAdjTotal < nextAdjMax ? nextAdjTotal : nextAdjMax;
-        if (nextAdj > nextAdjTo4k) {
-            nextAdj = nextAdjTo4k;
-        }
-
-        desc[i].control |= (nextAdj << 8);
-        //TraceVerbose(DBG_DMA, "next: PA=%04u, this4k=%04u, total=%04u, thisBlock=%04u",
-        //             desc[i].nextLo & 0xFFF, nextAdjTo4k, nextAdjTotal, nextAdj);
-
-        // update current max adj count for this block
-        if (nextAdjMax != 0) {
-            nextAdjMax--;
-        } else { // wrap-around
-            nextAdjMax = adjMax;
-        }
-    }
+    engine->sgdma->firstDescAdj = OptimizeDescriptorList(engine, desc, numDesc,
+                                                         engine->sgdma->firstDescLo);
 }
 
 static BOOLEAN EngineExists(PXDMA_DEVICE xdma, DirToDev dir, ULONG channel) {
@@ -347,6 +309,11 @@ static NTSTATUS EngineCreate(PXDMA_DEVICE xdma, XDMA_ENGINE* engine, DirToDev di
         TraceInfo(DBG_INIT, "creditModeEnable=0x%x", engine->parentDevice->sgdmaRegs->creditModeEnable);
     } else {
         engine->work = EngineProcessTransfer;
+        status = EngineCreateBatch(engine);
+        if (!NT_SUCCESS(status)) {
+            TraceError(DBG_INIT, "EngineCreateBatch() failed: %!STATUS!", status);
+            return status;
+        }
     }
 
     engine->enabled = TRUE;
@@ -371,6 +338,11 @@ static void EngineGetAlignments(IN OUT XDMA_ENGINE *engine) {
         engine->alignAddrBits = 64;
     }
 
+    // link parameters the descriptor lists depend on, read once instead of on every transfer
+    volatile XDMA_CONFIG_REGS* configRegs = engine->parentDevice->configRegs;
+    engine->dataPathBytes = (1 << (6 + configRegs->pcieWidth)) / 8;
+    engine->mrrsBytes = 1 << (configRegs->pcieMRRS + 7);
+
     TraceVerbose(DBG_INIT, "engine[%u][%u] alignments: bytes=%u, granularity=%u, addrBits=%u",
                  engine->channel, engine->dir, engine->alignAddr, engine->alignLength, engine->alignAddrBits);
 
@@ -389,6 +361,17 @@ static UINT32 EngineStatus(IN XDMA_ENGINE *engine, IN BOOLEAN clear)
         status = engine->regs->status;
     }
 
+    // counted even with tracing disabled
+    const UINT32 errors = status & (XDMA_STAT_EXPECTED_ZERO & ~XDMA_BUSY_BIT);
+    if (errors != 0) {
+        EngineStatsAdd(engine, numErrors, 1);
+        for (ULONG bit = 0; bit < ARRAYSIZE(engine->stats.statusBits); bit++) {
+            if (errors & (1UL << bit)) {
+                EngineStatsAdd(engine, statusBits[bit], 1);
+            }
+        }
+    }
+
     TraceInfo(DBG_DMA, "%s_%u status=0x%08x (%s%s%s%s%s%s%s%s%s)",
               DirectionToString(engine->dir), engine->channel, status,
               (status & XDMA_BUSY_BIT) ? "BUSY " : "IDLE ",
@@ -404,13 +387,40 @@ static UINT32 EngineStatus(IN XDMA_ENGINE *engine, IN BOOLEAN clear)
     return status;
 }
 
-BOOLEAN XDMA_EngineProgramDma(IN WDFDMATRANSACTION Transaction, IN WDFDEVICE Device,
-                              IN WDFCONTEXT context, IN WDF_DMA_DIRECTION Direction,
-                              IN PSCATTER_GATHER_LIST SgList)
-    // this programs the engine to start a dma transfer
+// the scatter-gather lists of WDF are passed to dma_core.c as they are, see XDMA_SG_VIEW
+C_ASSERT(FIELD_OFFSET(SCATTER_GATHER_ELEMENT, Length) == sizeof(UINT64));
+
+static ULONG EngineBuildDescriptors(IN XDMA_ENGINE *engine, IN DMA_DESCRIPTOR *descriptor,
+                                    IN PHYSICAL_ADDRESS descBufferLA, IN LONGLONG deviceOffset,
+                                    IN WDF_DMA_DIRECTION Direction, IN PSCATTER_GATHER_LIST SgList)
+// fill a linked list of descriptors for the scatter-gather list, starting at 'descriptor' which
+// has the bus address 'descBufferLA'. The last descriptor stops the engine and requests an
+// interrupt. returns the number of bytes described
 {
-    UNREFERENCED_PARAMETER(Device);
+    XDMA_DESC_PARAMS params;
+    EngineDescParams(engine, &params);
+    XDMA_SG_VIEW sgView;
+    sgView.elements = SgList->Elements;
+    sgView.stride = sizeof(SCATTER_GATHER_ELEMENT);
+    sgView.numElements = SgList->NumberOfElements;
+    UINT32 numMisaligned = 0;
+
+    const ULONG numBytes = DescriptorBuildList(&params, descriptor, descBufferLA.QuadPart,
+                                               deviceOffset,
+                                               Direction == WdfDmaDirectionWriteToDevice,
+                                               &sgView, &numMisaligned);
+    if (numMisaligned != 0) {
+        TraceWarning(DBG_DMA, "Error: %u of %u descriptors are not aligned (addr=%u, length=%u)",
+                     numMisaligned, SgList->NumberOfElements, engine->alignAddr,
+                     engine->alignLength);
+        EngineStatsAdd(engine, numMisaligned, numMisaligned);
+    }
+    return numBytes;
+}
 
+static LONGLONG RequestDeviceOffset(IN WDFDMATRANSACTION Transaction, IN WDF_DMA_DIRECTION Direction)
+// device address of the (remaining part of the) transfer, taken from the file offset of the request
+{
     WDFREQUEST request = WdfDmaTransactionGetRequest(Transaction);
     WDF_REQUEST_PARAMETERS params;
     WDF_REQUEST_PARAMETERS_INIT(&params);
@@ -419,62 +429,79 @@ BOOLEAN XDMA_EngineProgramDma(IN WDFDMATRANSACTION Transaction, IN WDFDEVICE Dev
         (SIZE_T)params.Parameters.Write.DeviceOffset :
         (SIZE_T)params.Parameters.Read.DeviceOffset;
 
+    // offset into the transaction (if it is split)
+    return deviceOffset + WdfDmaTransactionGetBytesTransferred(Transaction);
+}
+
+static BOOLEAN EngineBypassDescriptors(IN XDMA_ENGINE *engine, IN LONGLONG deviceOffset,
+                                       IN WDF_DMA_DIRECTION Direction, IN PSCATTER_GATHER_LIST SgList)
+// Start the transfer by writing its descriptors into the descriptor bypass window of the engine.
+// returns FALSE if the transfer is not eligible and has to use the descriptor list
+{
+    if ((engine->descBypassThreshold == 0) ||
+        (SgList->NumberOfElements > XDMA_DESC_BYPASS_MAX_DESCRIPTORS)) {
+        return FALSE;
+    }
+    ULONG length = 0;
+    for (ULONG i = 0; i < SgList->NumberOfElements; i++) {
+        length += SgList->Elements[i].Length;
+    }
+    if (length > engine->descBypassThreshold) {
+        return FALSE;
+    }
+
+    DMA_DESCRIPTOR descriptor[XDMA_DESC_BYPASS_MAX_DESCRIPTORS];
+    PHYSICAL_ADDRESS noLink = { 0 };
+    EngineBuildDescriptors(engine, descriptor, noLink, deviceOffset, Direction, SgList);
+
+    TraceVerbose(DBG_DMA, "%s_%u bypassing %u descriptors, %u bytes",
+                 DirectionToString(engine->dir), engine->channel, SgList->NumberOfElements, length);
+
+    if (engine->poll) {
+        engine->numDescriptors = SgList->NumberOfElements;
+    }
+
+    // the engine accepts bypass descriptors while running
+    engine->latency.startTime = LatencyTimestamp();
+    EngineStart(engine);
+
+    const ULONG descWords = sizeof(DMA_DESCRIPTOR) / sizeof(ULONG);
+    volatile ULONG* window = (volatile ULONG*)engine->descBypassWindow;
+    for (ULONG i = 0; i < SgList->NumberOfElements; i++) {
+        descriptor[i].nextLo = 0; // not fetched, never followed
+        descriptor[i].nextHi = 0;
+        WRITE_REGISTER_BUFFER_ULONG(window + i * descWords, (PULONG)&descriptor[i], descWords);
+    }
+
+    MemoryBarrier(); // also drains write-combining buffers
+    return TRUE;
+}
+
+BOOLEAN XDMA_EngineProgramDma(IN WDFDMATRANSACTION Transaction, IN WDFDEVICE Device,
+                              IN WDFCONTEXT context, IN WDF_DMA_DIRECTION Direction,
+                              IN PSCATTER_GATHER_LIST SgList)
+    // this programs the engine to start a dma transfer
+{
+    UNREFERENCED_PARAMETER(Device);
+
+    LONGLONG deviceOffset = RequestDeviceOffset(Transaction, Direction);
+
     // get virtual and physical pointers to descriptor buffer
     XDMA_ENGINE * engine = (XDMA_ENGINE*)context;
     DMA_DESCRIPTOR *descriptor = (DMA_DESCRIPTOR*)WdfCommonBufferGetAlignedVirtualAddress(engine->descBuffer);
     PHYSICAL_ADDRESS descBufferLA = WdfCommonBufferGetAlignedLogicalAddress(engine->descBuffer);
 
-    // offset into the transaction (if it is split)
-    deviceOffset += WdfDmaTransactionGetBytesTransferred(Transaction);
-
     TraceVerbose(DBG_DMA, "device addr=%lld, num descriptors=%d",
                  deviceOffset, SgList->NumberOfElements);
+    EngineStatsAdd(engine, numDescriptors, SgList->NumberOfElements);
 
-    for (ULONG i = 0; i < SgList->NumberOfElements; i++) {
-        descriptor[i].control = XDMA_DESC_MAGIC;
-        descriptor[i].numBytes = SgList->Elements[i].Length;
-        ULONG hostAddrLo = SgList->Elements[i].Address.LowPart;
-        LONG hostAddrHi = SgList->Elements[i].Address.HighPart;
-        if (Direction == WdfDmaDirectionWriteToDevice) {
-            // source is host memory
-            descriptor[i].srcAddrLo = hostAddrLo;
-            descriptor[i].srcAddrHi = hostAddrHi;
-            descriptor[i].dstAddrLo = LIMIT_TO_32(deviceOffset);
-            descriptor[i].dstAddrHi = LIMIT_TO_32(deviceOffset >> 32);
-        } else {
-            // destination is host memory
-            descriptor[i].srcAddrLo = LIMIT_TO_32(deviceOffset);
-            descriptor[i].srcAddrHi = LIMIT_TO_32(deviceOffset >> 32);
-            descriptor[i].dstAddrLo = hostAddrLo;
-            descriptor[i].dstAddrHi = hostAddrHi;
-        }
-
-        // next descriptor bus address 
-        descBufferLA.QuadPart += sizeof(DMA_DESCRIPTOR);
-
-        // non-last descriptor(s)? 
-        if ((i + 1) < SgList->NumberOfElements) {
-            descriptor[i].nextLo = descBufferLA.LowPart;
-            descriptor[i].nextHi = descBufferLA.HighPart;
-        } else { // last descriptor
-            descriptor[i].nextLo = 0;
-            descriptor[i].nextHi = 0;
-            // stop engine and request an interrupt from the engine
-            descriptor[i].control |= (XDMA_DESC_STOP_BIT | XDMA_DESC_COMPLETED_BIT);
-            if (engine->type == EngineType_ST) {
-                descriptor[i].control |= XDMA_DESC_EOP_BIT;
-                TraceVerbose(DBG_DMA, "descriptor[i].control=0x%08x", descriptor[i].control);
-            }
-        }
-        if (engine->addressMode == AddressMode_Contiguous) { // incremental address mode
-            deviceOffset += SgList->Elements[i].Length;
-        }
-
-        if (FALSE == DescriptorIsAligned(engine, &(descriptor[i]))) {
-            TraceWarning(DBG_DMA, "Error: Dma Transfer is not aligned");
-        }
+    // small transfers skip the descriptor fetch from host memory
+    if (EngineBypassDescriptors(engine, deviceOffset, Direction, SgList)) {
+        return TRUE;
     }
 
+    EngineBuildDescriptors(engine, descriptor, descBufferLA, deviceOffset, Direction, SgList);
+
     OptimizeDescriptors(engine, descriptor, SgList->NumberOfElements);
 
     for (ULONG i = 0; i < SgList->NumberOfElements; i++) {
@@ -488,6 +515,7 @@ BOOLEAN XDMA_EngineProgramDma(IN WDFDMATRANSACTION Transaction, IN WDFDEVICE Dev
     MemoryBarrier();
 
     // start the engine
+    engine->latency.startTime = LatencyTimestamp();
     EngineStart(engine);
 
     MemoryBarrier();
@@ -643,14 +671,7 @@ static UINT EngineProcessRing(IN XDMA_ENGINE *engine) {
               DirectionToString(engine->dir), engine->channel, head, tail, eopCount,
               engine->sgdma->descCredits);
 
-    for (; results[tail].status; EngineRingAdvance(&tail)) {
-
-        if (results[tail].status & XDMA_RESULT_EOP_BIT) {
-            eopCount++;
-        }
-
-        results[tail].status = 0; // mark current dma result as processed
-    }
+    eopCount = RingCollectResults(results, &tail, XDMA_RING_NUM_BLOCKS);
 
     TraceInfo(DBG_DMA, "%s_%u ring head=%u, tail=%u, eop=%u, credits=%u",
               DirectionToString(engine->dir), engine->channel, head, tail, eopCount,
@@ -683,41 +704,27 @@ static void EngineRingProgramDma(IN XDMA_ENGINE* engine) {
 
     // get virtual and physical pointers to descriptor buffer
     DMA_DESCRIPTOR *descriptor = (DMA_DESCRIPTOR*)WdfCommonBufferGetAlignedVirtualAddress(engine->descBuffer);
-    PHYSICAL_ADDRESS nextDescLA = WdfCommonBufferGetAlignedLogicalAddress(engine->descBuffer);
+    PHYSICAL_ADDRESS descBufferLA = WdfCommonBufferGetAlignedLogicalAddress(engine->descBuffer);
 
     // get physical address to dma result buffer
     PHYSICAL_ADDRESS resultBufferLA = WdfCommonBufferGetAlignedLogicalAddress(engine->ring.results);
 
-    // fill descriptors 
+    // fill descriptors, the destination is one page of host memory per descriptor
+    RingBuildDescriptors(descriptor, descBufferLA.QuadPart, resultBufferLA.QuadPart,
+                         XDMA_RING_NUM_BLOCKS, XDMA_RING_BLOCK_SIZE);
+    XDMA_DESC_PARAMS params;
+    EngineDescParams(engine, &params);
     for (ULONG i = 0; i < XDMA_RING_NUM_BLOCKS; ++i) {
-        descriptor[i].control = (XDMA_DESC_MAGIC | XDMA_DESC_EOP_BIT | XDMA_DESC_COMPLETED_BIT);
-        descriptor[i].numBytes = XDMA_RING_BLOCK_SIZE;
-
-        // source address are unused, will be overwritten by hardware with dma result
-        descriptor[i].srcAddrLo = resultBufferLA.LowPart;
-        descriptor[i].srcAddrHi = resultBufferLA.HighPart;
-        resultBufferLA.QuadPart += sizeof(DMA_RESULT);
-
-        // destination is host memory
         PHYSICAL_ADDRESS dst = MmGetPhysicalAddress(MmGetMdlVirtualAddress(engine->ring.mdl[i]));
         descriptor[i].dstAddrLo = dst.LowPart;
         descriptor[i].dstAddrHi = dst.HighPart;
 
-        // next descriptor bus address 
-        nextDescLA.QuadPart += sizeof(DMA_DESCRIPTOR);
-        descriptor[i].nextLo = nextDescLA.LowPart;
-        descriptor[i].nextHi = nextDescLA.HighPart;
-
-        if (FALSE == DescriptorIsAligned(engine, descriptor)) {
+        if (FALSE == DescriptorIsAligned(&params, &descriptor[i])) {
             TraceWarning(DBG_DMA, "Error: Dma Transfer is not aligned");
+            EngineStatsAdd(engine, numMisaligned, 1);
         }
     }
-
-    // make the discriptor list circular
-    nextDescLA = WdfCommonBufferGetAlignedLogicalAddress(engine->descBuffer);
     DMA_DESCRIPTOR* last = &descriptor[XDMA_RING_NUM_BLOCKS - 1];
-    last->nextLo = nextDescLA.LowPart;
-    last->nextHi = nextDescLA.HighPart;
 
     // Optimize for PCIe fetches
     OptimizeDescriptors(engine, descriptor, XDMA_RING_NUM_BLOCKS);
@@ -756,14 +763,6 @@ static void EngineClearDmaResults(IN XDMA_ENGINE *engine) {
     }
 }
 
-static void EngineRingAdvance(UINT* index) {
-    if (*index == XDMA_RING_NUM_BLOCKS - 1) { // wrap-around
-        *index = 0;
-    } else { // normal increment
-        ++(*index);
-    }
-}
-
 void EngineRingSetup(IN XDMA_ENGINE *engine) {
     engine->ring.head = 0;
     engine->ring.tail = 0;
@@ -778,6 +777,25 @@ void EngineRingTeardown(IN XDMA_ENGINE *engine) {
     engine->ring.tail = 0;
 }
 
+typedef struct {
+    XDMA_ENGINE* engine;
+    WDFMEMORY outputMem;
+    NTSTATUS status;
+} RING_COPY_CONTEXT;
+
+static BOOLEAN EngineRingCopyBlock(void* context, UINT32 block, size_t offset, size_t length)
+// RingConsume() callback - copy received data of one ring block to the output memory
+{
+    RING_COPY_CONTEXT* copy = (RING_COPY_CONTEXT*)context;
+    PVOID rxBufferVa = MmGetMdlVirtualAddress(copy->engine->ring.mdl[block]);
+    copy->status = WdfMemoryCopyFromBuffer(copy->outputMem, offset, rxBufferVa, length);
+    if (!NT_SUCCESS(copy->status)) {
+        TraceError(DBG_DMA, "WdfMemoryCopyFromBuffer failed: %!STATUS!", copy->status);
+        return FALSE;
+    }
+    return TRUE;
+}
+
 NTSTATUS EngineRingCopyBytesToMemory(IN XDMA_ENGINE *engine, WDFMEMORY outputMem, 
                                    size_t length, LARGE_INTEGER timeout, size_t* bytesRead ) {
     NTSTATUS status = 0;
@@ -794,9 +812,6 @@ NTSTATUS EngineRingCopyBytesToMemory(IN XDMA_ENGINE *engine, WDFMEMORY outputMem
     }
 
     DMA_RESULT* results = (DMA_RESULT*)WdfCommonBufferGetAlignedVirtualAddress(engine->ring.results);
-    size_t offset = 0;
-    UINT32 numDescProcessed = 0;
-    size_t numBytesRemaining = length;
     WdfSpinLockAcquire(engine->ring.lock);
     UINT head = engine->ring.head;
     UINT tail = engine->ring.tail;
@@ -805,33 +820,15 @@ NTSTATUS EngineRingCopyBytesToMemory(IN XDMA_ENGINE *engine, WDFMEMORY outputMem
     TraceVerbose(DBG_DMA, "%s_%u head=%u, tail=%u, credits=%u",
                  DirectionToString(engine->dir), engine->channel, head, tail, engine->sgdma->descCredits);
 
-    while ((head != tail) && numBytesRemaining) {
-
-        // get dma ring buffer address and bytes transferred
-        PVOID rxBufferVa = MmGetMdlVirtualAddress(engine->ring.mdl[head]);
-        size_t numBytesReceived = results[head].length;
-
-        // limit buffer size
-        if (numBytesReceived > numBytesRemaining) {
-            numBytesReceived = numBytesRemaining;
-        } else if (numBytesReceived == 0) {
-            KeClearEvent(&engine->ring.completionSignal);
-            break;
-        }
-
-        // copy to user
-        status = WdfMemoryCopyFromBuffer(outputMem, offset, rxBufferVa, numBytesReceived);
-        if (!NT_SUCCESS(status)) {
-            TraceError(DBG_DMA, "WdfMemoryCopyFromBuffer failed: %!STATUS!", status);
-            goto ErrorExit;
-        }
-
-        numDescProcessed++;
-        offset += numBytesReceived;
-        numBytesRemaining -= numBytesReceived;
-
-        results[head].length = 0;
-        EngineRingAdvance(&head);
+    RING_COPY_CONTEXT copy;
+    copy.engine = engine;
+    copy.outputMem = outputMem;
+    copy.status = STATUS_SUCCESS;
+    UINT32 numDescProcessed = 0;
+    if (!RingConsume(results, &head, tail, XDMA_RING_NUM_BLOCKS, length, EngineRingCopyBlock, &copy,
+                     bytesRead, &numDescProcessed)) {
+        status = copy.status;
+        goto ErrorExit;
     }
 
     if (results[head].length == 0) {
@@ -843,7 +840,9 @@ NTSTATUS EngineRingCopyBytesToMemory(IN XDMA_ENGINE *engine, WDFMEMORY outputMem
     engine->sgdma->descCredits = numDescProcessed;
     WdfSpinLockRelease(engine->ring.lock);
 
-    *bytesRead = length - numBytesRemaining;
+    EngineStatsAdd(engine, numRequests, 1);
+    EngineStatsAdd(engine, numBytes, *bytesRead);
+    EngineStatsAdd(engine, numCredits, numDescProcessed);
 
     TraceVerbose(DBG_DMA, "%s_%u read %lluB available,  head=%u, tail=%u, credits=%u",
                  DirectionToString(engine->dir), engine->channel, *bytesRead, head, tail,
@@ -879,25 +878,24 @@ static NTSTATUS EngineCreatePollWriteBackBuffer(IN OUT XDMA_ENGINE *engine) {
 
 NTSTATUS EnginePollTransfer(IN XDMA_ENGINE* engine) {
 
-    XDMA_POLL_WB* writeback_data = (XDMA_POLL_WB*)WdfCommonBufferGetAlignedVirtualAddress(engine->pollWbBuffer);
+    volatile XDMA_POLL_WB* writeback_data = (XDMA_POLL_WB*)WdfCommonBufferGetAlignedVirtualAddress(engine->pollWbBuffer);
     const ULONG expected = engine->numDescriptors;
-    volatile ULONG actual = 0;
+    XDMA_WB_STATE state;
+    ULONG64 numPolls = 0;
 
     do {
-        actual = writeback_data->completedDescCount;
-
-        if (actual & XDMA_WB_ERR_MASK) {
-            TraceError(DBG_DMA, "error on writeback %u", actual);
-            return STATUS_INTERNAL_ERROR;
-        }
-        actual &= XDMA_WB_COUNT_MASK;
-
-        if (actual > expected) {
-            actual = expected | XDMA_WB_ERR_MASK;
-        }
-    } while (expected != actual);
+        numPolls++;
+        state = WritebackCheck(writeback_data->completedDescCount, expected);
+    } while (state == XDMA_WB_PENDING);
+    EngineStatsAdd(engine, numPolls, numPolls);
+
+    if (state == XDMA_WB_ERROR) {
+        TraceError(DBG_DMA, "error on writeback 0x%08x, expected %u",
+                   writeback_data->completedDescCount, expected);
+        return STATUS_INTERNAL_ERROR;
+    }
 
-    TraceVerbose(DBG_DMA, "%u descriptors completed", actual);
+    TraceVerbose(DBG_DMA, "%u descriptors completed", expected);
 
     EngineProcessTransfer(engine);
 
@@ -927,12 +925,498 @@ NTSTATUS EnginePollRing(IN XDMA_ENGINE* engine) {
         }
 
     } while (!eopCount);
+    EngineStatsAdd(engine, numPolls, tryCount);
 
     TraceVerbose(DBG_DMA, "complete=%u, eop=%u, tryCount=%u", completed, eopCount, tryCount);
 
     return STATUS_SUCCESS;
 }
 
+// ========================= batched transfers ====================================================
+
+static NTSTATUS EngineCreateBatch(IN OUT XDMA_ENGINE *engine) {
+
+    XDMA_BATCH* batch = &engine->batch;
+
+    // requests wait in a manual queue for the next batch - cancellation is handled by the framework
+    WDF_IO_QUEUE_CONFIG queueConfig;
+    WDF_IO_QUEUE_CONFIG_INIT(&queueConfig, WdfIoQueueDispatchManual);
+    NTSTATUS status = WdfIoQueueCreate(engine->parentDevice->wdfDevice, &queueConfig,
+                                       WDF_NO_OBJECT_ATTRIBUTES, &batch->pending);
+    if (!NT_SUCCESS(status)) {
+        TraceError(DBG_INIT, "WdfIoQueueCreate failed: %!STATUS!", status);
+        return status;
+    }
+
+    WDF_TIMER_CONFIG timerConfig;
+    WDF_TIMER_CONFIG_INIT(&timerConfig, EvtBatchWatchdog);
+    timerConfig.AutomaticSerialization = FALSE;
+    WDF_OBJECT_ATTRIBUTES attribs;
+    WDF_OBJECT_ATTRIBUTES_INIT_CONTEXT_TYPE(&attribs, BATCH_TIMER_CONTEXT);
+    attribs.ParentObject = batch->pending;
+    status = WdfTimerCreate(&timerConfig, &attribs, &batch->watchdog);
+    if (!NT_SUCCESS(status)) {
+        TraceError(DBG_INIT, "WdfTimerCreate failed: %!STATUS!", status);
+        return status;
+    }
+    GetBatchTimerContext(batch->watchdog)->engine = engine;
+
+    WDF_OBJECT_ATTRIBUTES_INIT(&attribs);
+    attribs.ParentObject = batch->pending;
+    status = WdfSpinLockCreate(&attribs, &batch->lock);
+    if (!NT_SUCCESS(status)) {
+        TraceError(DBG_INIT, "WdfSpinLockCreate failed: %!STATUS!", status);
+        return status;
+    }
+
+    // one transaction per request of a batch
+    for (UINT i = 0; i < XDMA_BATCH_MAX_REQUESTS; ++i) {
+        status = WdfDmaTransactionCreate(engine->parentDevice->dmaEnabler, WDF_NO_OBJECT_ATTRIBUTES,
+                                         &batch->transaction[i]);
+        if (!NT_SUCCESS(status)) {
+            TraceError(DBG_INIT, "WdfDmaTransactionCreate() failed: %!STATUS!", status);
+            return status;
+        }
+    }
+
+    batch->holdoff = XDMA_BATCH_DEFAULT_HOLDOFF_US;
+    return status;
+}
+
+static ULONG RequestMaxDescriptors(IN WDFREQUEST request)
+// worst case number of descriptors for the request, i.e. one per page plus unaligned start/end
+{
+    WDF_REQUEST_PARAMETERS params;
+    WDF_REQUEST_PARAMETERS_INIT(&params);
+    WdfRequestGetParameters(request, &params);
+    const size_t length = (params.Type == WdfRequestTypeWrite) ?
+        params.Parameters.Write.Length : params.Parameters.Read.Length;
+    return (length > XDMA_MAX_TRANSFER_SIZE) ? MAXULONG : (ULONG)(length / PAGE_SIZE) + 2;
+}
+
+static VOID EngineBatchStart(IN XDMA_ENGINE* engine)
+// all requests of the batch are in the descriptor chain - start the engine
+{
+    XDMA_BATCH* batch = &engine->batch;
+    DMA_DESCRIPTOR* descriptor = (DMA_DESCRIPTOR*)WdfCommonBufferGetAlignedVirtualAddress(engine->descBuffer);
+    OptimizeDescriptors(engine, descriptor, batch->numDescriptors);
+
+    TraceInfo(DBG_DMA, "%s_%u starting batch of %u requests, %u descriptors",
+              DirectionToString(engine->dir), engine->channel, batch->numRequests,
+              batch->numDescriptors);
+    EngineStatsAdd(engine, numDescriptors, batch->numDescriptors);
+
+    MemoryBarrier();
+
+    // start the engine
+    engine->latency.startTime = LatencyTimestamp();
+    EngineStart(engine);
+
+    MemoryBarrier();
+}
+
+static BOOLEAN EngineBatchProgramDma(IN WDFDMATRANSACTION Transaction, IN WDFDEVICE Device,
+                                     IN WDFCONTEXT context, IN WDF_DMA_DIRECTION Direction,
+                                     IN PSCATTER_GATHER_LIST SgList)
+// append the descriptors of one request to the batch under construction. The framework may call
+// this from within WdfDmaTransactionExecute() or later, so the last call of a batch - or
+// EngineBatchBuild(), whichever finishes last - starts the engine.
+{
+    UNREFERENCED_PARAMETER(Device);
+
+    XDMA_ENGINE* engine = (XDMA_ENGINE*)context;
+    XDMA_BATCH* batch = &engine->batch;
+
+    WdfSpinLockAcquire(batch->lock);
+    ULONG index = 0;
+    while ((index < batch->numRequests) && (batch->transaction[index] != Transaction)) {
+        index++;
+    }
+    ASSERT(index < batch->numRequests);
+
+    DMA_DESCRIPTOR* descriptor = (DMA_DESCRIPTOR*)WdfCommonBufferGetAlignedVirtualAddress(engine->descBuffer);
+    PHYSICAL_ADDRESS descBufferLA = WdfCommonBufferGetAlignedLogicalAddress(engine->descBuffer);
+    descBufferLA.QuadPart += batch->numDescriptors * sizeof(DMA_DESCRIPTOR);
+
+    // link the previous request to this one, only the last request stops the engine and interrupts
+    if (batch->numDescriptors > 0) {
+        DMA_DESCRIPTOR* previous = &descriptor[batch->numDescriptors - 1];
+        previous->control &= ~(XDMA_DESC_STOP_BIT | XDMA_DESC_COMPLETED_BIT);
+        previous->nextLo = descBufferLA.LowPart;
+        previous->nextHi = descBufferLA.HighPart;
+    }
+
+    // requests are chained in the order of these calls, lastDesc is the position in the chain
+    batch->numBytes[index] = EngineBuildDescriptors(engine, &descriptor[batch->numDescriptors],
+                                                    descBufferLA,
+                                                    RequestDeviceOffset(Transaction, Direction),
+                                                    Direction, SgList);
+    batch->numDescriptors += SgList->NumberOfElements;
+    batch->lastDesc[index] = batch->numDescriptors;
+    const BOOLEAN last = (--batch->programming == 0);
+    WdfSpinLockRelease(batch->lock);
+
+    TraceVerbose(DBG_DMA, "%s_%u batch request %u: %u bytes, descriptors up to %u",
+                 DirectionToString(engine->dir), engine->channel, index, batch->numBytes[index],
+                 batch->lastDesc[index]);
+
+    if (last) {
+        EngineBatchStart(engine);
+    }
+    return TRUE;
+}
+
+static BOOLEAN EngineBatchBuild(IN XDMA_ENGINE* engine)
+// move up to 'threshold' pending requests into one descriptor chain and start the engine.
+// Called with batch->busy set, which gives exclusive access to the batch in flight.
+// returns FALSE (and clears batch->busy) if no request could be added
+{
+    XDMA_BATCH* batch = &engine->batch;
+    const WDF_DMA_DIRECTION direction = (engine->dir == H2C) ?
+        WdfDmaDirectionWriteToDevice : WdfDmaDirectionReadFromDevice;
+    ULONG maxDescriptors = 0;
+
+    // the reference of the build itself keeps the engine from being started by the callbacks
+    WdfSpinLockAcquire(batch->lock);
+    batch->numRequests = 0;
+    batch->numDescriptors = 0;
+    batch->programming = 1;
+    WdfSpinLockRelease(batch->lock);
+
+    while (batch->numRequests < batch->threshold) {
+        WDFREQUEST request;
+        NTSTATUS status = WdfIoQueueRetrieveNextRequest(batch->pending, &request);
+        if (!NT_SUCCESS(status)) { // STATUS_NO_MORE_ENTRIES
+            break;
+        }
+
+        // the whole batch must fit into the descriptor buffer
+        const ULONG requestDescriptors = RequestMaxDescriptors(request);
+        if (requestDescriptors > XDMA_MAX_DESCRIPTORS - maxDescriptors) {
+            if (batch->numRequests == 0) {
+                TraceError(DBG_DMA, "Error: batched requests are limited to %u bytes",
+                           XDMA_MAX_TRANSFER_SIZE);
+                WdfRequestComplete(request, STATUS_INVALID_BUFFER_SIZE);
+                continue;
+            }
+            status = WdfRequestRequeue(request); // first request of the next batch
+            if (!NT_SUCCESS(status)) {
+                TraceError(DBG_DMA, "WdfRequestRequeue failed: %!STATUS!", status);
+                WdfRequestComplete(request, status);
+            }
+            break;
+        }
+
+        const ULONG index = batch->numRequests;
+        WDFDMATRANSACTION transaction = batch->transaction[index];
+        status = WdfDmaTransactionInitializeUsingRequest(transaction, request, EngineBatchProgramDma,
+                                                         direction);
+        if (!NT_SUCCESS(status)) {
+            TraceError(DBG_DMA, "WdfDmaTransactionInitializeUsingRequest failed: %!STATUS!", status);
+            WdfRequestComplete(request, status);
+            continue;
+        }
+
+        WdfSpinLockAcquire(batch->lock);
+        batch->numRequests++;
+        batch->programming++;
+        WdfSpinLockRelease(batch->lock);
+
+        status = WdfDmaTransactionExecute(transaction, engine);
+        if (!NT_SUCCESS(status)) {
+            // EngineBatchProgramDma was not called and will not be for this transaction
+            TraceError(DBG_DMA, "WdfDmaTransactionExecute failed: %!STATUS!", status);
+            WdfSpinLockAcquire(batch->lock);
+            batch->numRequests--;
+            batch->programming--;
+            WdfSpinLockRelease(batch->lock);
+            WdfDmaTransactionRelease(transaction);
+            WdfRequestComplete(request, status);
+            continue;
+        }
+        maxDescriptors += requestDescriptors;
+    }
+
+    WdfSpinLockAcquire(batch->lock);
+    const BOOLEAN empty = (batch->numRequests == 0);
+    const BOOLEAN last = (--batch->programming == 0);
+    if (empty) {
+        batch->busy = FALSE;
+    }
+    WdfSpinLockRelease(batch->lock);
+
+    if (empty) {
+        return FALSE;
+    }
+    // otherwise the last outstanding EngineBatchProgramDma starts the engine
+    if (last) {
+        EngineBatchStart(engine);
+    }
+    return TRUE;
+}
+
+static VOID EngineBatchLaunch(IN XDMA_ENGINE* engine)
+// start the next batch if the engine is idle and either enough requests are pending or the
+// holdoff time of the oldest pending request has passed
+{
+    XDMA_BATCH* batch = &engine->batch;
+
+    do {
+        ULONG pendingCount = 0;
+        WdfIoQueueGetState(batch->pending, &pendingCount, NULL);
+        if (pendingCount == 0) {
+            return;
+        }
+
+        WdfSpinLockAcquire(batch->lock);
+        if ((pendingCount < batch->threshold) && !batch->expired) {
+            // short burst so far - wait for more requests, but no longer than the holdoff time
+            if (!batch->watchdogArmed) {
+                batch->watchdogArmed = TRUE;
+                WdfTimerStart(batch->watchdog, WDF_REL_TIMEOUT_IN_US(batch->holdoff));
+            }
+            WdfSpinLockRelease(batch->lock);
+            return;
+        }
+        if (batch->busy) {
+            // completion of the batch in flight launches the next one
+            WdfSpinLockRelease(batch->lock);
+            return;
+        }
+        batch->busy = TRUE;
+        batch->expired = FALSE;
+        if (batch->watchdogArmed) {
+            // a watchdog callback which is already running finds the engine busy and returns
+            WdfTimerStop(batch->watchdog, FALSE);
+            batch->watchdogArmed = FALSE;
+        }
+        WdfSpinLockRelease(batch->lock);
+
+    } while (!EngineBatchBuild(engine)); // nothing could be added - check again
+}
+
+VOID EvtBatchWatchdog(IN WDFTIMER timer) {
+    XDMA_ENGINE* engine = GetBatchTimerContext(timer)->engine;
+
+    WdfSpinLockAcquire(engine->batch.lock);
+    engine->batch.watchdogArmed = FALSE;
+    engine->batch.expired = TRUE;
+    WdfSpinLockRelease(engine->batch.lock);
+
+    TraceVerbose(DBG_DMA, "%s_%u batch holdoff expired",
+                 DirectionToString(engine->dir), engine->channel);
+    EngineBatchLaunch(engine);
+}
+
+static void EngineProcessBatch(IN XDMA_ENGINE *engine)
+// retire, in submission order, every request of the batch whose descriptors the engine completed
+{
+    XDMA_BATCH* batch = &engine->batch;
+
+    if (batch->numRequests == 0) {
+        TraceInfo(DBG_DMA, "Interrupt but no batch pending?");
+        return;
+    }
+
+    // read and clear engine status 
+    const UINT32 engineStatus = EngineStatus(engine, TRUE);
+    const ULONG completedDescCount = engine->regs->completedDescCount;
+
+    EngineStop(engine);
+
+    if ((engineStatus & XDMA_STAT_EXPECTED_ZERO) != XDMA_ENGINE_STOPPED_OK) {
+        TraceError(DBG_DMA, "Unexpected engine status 0x%08x, %u of %u descriptors completed",
+                   engineStatus, completedDescCount, batch->numDescriptors);
+    }
+
+    EngineLatencyComplete(engine);
+    ULONG64 numBytes = 0;
+    for (ULONG i = 0; i < batch->numRequests; ++i) {
+        WDFDMATRANSACTION transaction = batch->transaction[i];
+        WDFREQUEST request = WdfDmaTransactionGetRequest(transaction);
+        const BOOLEAN covered = completedDescCount >= batch->lastDesc[i];
+        const size_t bytesTransferred = covered ? batch->numBytes[i] : 0;
+
+        NTSTATUS status;
+        WdfDmaTransactionDmaCompletedFinal(transaction, bytesTransferred, &status);
+        if (!covered) {
+            status = STATUS_INTERNAL_ERROR;
+        }
+        numBytes += bytesTransferred;
+        WdfDmaTransactionRelease(transaction);
+        WdfRequestCompleteWithInformation(request, status, bytesTransferred);
+    }
+    EngineStatsAdd(engine, numRequests, batch->numRequests);
+    EngineStatsAdd(engine, numBytes, numBytes);
+
+    TraceInfo(DBG_DMA, "%s_%u batch of %u requests retired",
+              DirectionToString(engine->dir), engine->channel, batch->numRequests);
+
+    // clear the used part of the descriptor buffer
+    DMA_DESCRIPTOR* descriptor = (DMA_DESCRIPTOR*)WdfCommonBufferGetAlignedVirtualAddress(engine->descBuffer);
+    RtlZeroMemory(descriptor, batch->numDescriptors * sizeof(DMA_DESCRIPTOR));
+    batch->numRequests = 0;
+    batch->numDescriptors = 0;
+
+    WdfSpinLockAcquire(batch->lock);
+    batch->busy = FALSE;
+    WdfSpinLockRelease(batch->lock);
+
+    EngineBatchLaunch(engine);
+}
+
+NTSTATUS EngineBatchSubmit(IN XDMA_ENGINE* engine, IN WDFREQUEST request) {
+
+    NTSTATUS status = WdfRequestForwardToIoQueue(request, engine->batch.pending);
+    if (!NT_SUCCESS(status)) {
+        TraceError(DBG_DMA, "WdfRequestForwardToIoQueue failed: %!STATUS!", status);
+        return status;
+    }
+    EngineBatchLaunch(engine);
+    return status;
+}
+
+// ========================= direct transfers =====================================================
+
+static VOID EngineRestoreFirstDescriptor(IN XDMA_ENGINE* engine)
+// the read/write request path expects the engine to fetch from its own descriptor buffer
+{
+    PHYSICAL_ADDRESS descBufferLA = WdfCommonBufferGetAlignedLogicalAddress(engine->descBuffer);
+    engine->sgdma->firstDescLo = descBufferLA.LowPart;
+    engine->sgdma->firstDescHi = descBufferLA.HighPart;
+}
+
+VOID EngineDirectStart(IN XDMA_ENGINE* engine, IN PSCATTER_GATHER_LIST SgList,
+                       IN LONGLONG deviceOffset) {
+
+    ASSERT(engine->direct.done != NULL);
+    const WDF_DMA_DIRECTION direction = (engine->dir == H2C) ?
+        WdfDmaDirectionWriteToDevice : WdfDmaDirectionReadFromDevice;
+    DMA_DESCRIPTOR* descriptor = (DMA_DESCRIPTOR*)WdfCommonBufferGetAlignedVirtualAddress(engine->descBuffer);
+    PHYSICAL_ADDRESS descBufferLA = WdfCommonBufferGetAlignedLogicalAddress(engine->descBuffer);
+
+    engine->direct.numBytes = EngineBuildDescriptors(engine, descriptor, descBufferLA, deviceOffset,
+                                                     direction, SgList);
+    engine->direct.numDescriptors = SgList->NumberOfElements;
+    engine->direct.persistent = FALSE;
+    EngineStatsAdd(engine, numDescriptors, SgList->NumberOfElements);
+    OptimizeDescriptors(engine, descriptor, SgList->NumberOfElements);
+
+    TraceVerbose(DBG_DMA, "%s_%u direct transfer of %u bytes, %u descriptors",
+                 DirectionToString(engine->dir), engine->channel, engine->direct.numBytes,
+                 engine->direct.numDescriptors);
+
+    MemoryBarrier();
+
+    // start the engine
+    engine->latency.startTime = LatencyTimestamp();
+    EngineStart(engine);
+
+    MemoryBarrier();
+}
+
+static void EngineProcessDirect(IN XDMA_ENGINE *engine)
+// completion of a transfer started by EngineDirectStart()
+{
+    if (engine->direct.numDescriptors == 0) {
+        TraceInfo(DBG_DMA, "Interrupt but no direct transfer pending?");
+        return;
+    }
+
+    // read and clear engine status 
+    const UINT32 engineStatus = EngineStatus(engine, TRUE);
+    EngineStop(engine);
+
+    NTSTATUS status = STATUS_SUCCESS;
+    ULONG numBytes = engine->direct.numBytes;
+    if ((engineStatus & XDMA_STAT_EXPECTED_ZERO) != XDMA_ENGINE_STOPPED_OK) {
+        TraceError(DBG_DMA, "Unexpected engine status 0x%08x", engineStatus);
+        status = STATUS_INTERNAL_ERROR;
+        numBytes = 0;
+    }
+    EngineLatencyComplete(engine);
+
+    if (engine->direct.persistent) {
+        // program descriptors stay as they are, point the engine back to its own buffer
+        EngineRestoreFirstDescriptor(engine);
+        engine->direct.persistent = FALSE;
+    } else {
+        // clear the used part of the descriptor buffer
+        DMA_DESCRIPTOR* descriptor = (DMA_DESCRIPTOR*)WdfCommonBufferGetAlignedVirtualAddress(engine->descBuffer);
+        RtlZeroMemory(descriptor, engine->direct.numDescriptors * sizeof(DMA_DESCRIPTOR));
+    }
+    engine->direct.numDescriptors = 0;
+    EngineStatsAdd(engine, numRequests, 1);
+    EngineStatsAdd(engine, numBytes, numBytes);
+
+    // the owner may start the next transfer from within the callback
+    engine->direct.done(engine, engine->direct.context, status, numBytes);
+}
+
+NTSTATUS EngineProgramCompile(IN XDMA_ENGINE* engine, IN PSCATTER_GATHER_LIST SgList,
+                              IN LONGLONG deviceOffset, OUT XDMA_PROGRAM* program) {
+
+    PAGED_CODE();
+    RtlZeroMemory(program, sizeof(XDMA_PROGRAM));
+    if ((SgList->NumberOfElements == 0) || (SgList->NumberOfElements > XDMA_MAX_DESCRIPTORS)) {
+        TraceError(DBG_DMA, "Error: %u scatter-gather elements", SgList->NumberOfElements);
+        return STATUS_INVALID_PARAMETER;
+    }
+
+    NTSTATUS status = WdfCommonBufferCreate(engine->parentDevice->dmaEnabler,
+                                            SgList->NumberOfElements * sizeof(DMA_DESCRIPTOR),
+                                            WDF_NO_OBJECT_ATTRIBUTES, &program->descBuffer);
+    if (!NT_SUCCESS(status)) {
+        TraceError(DBG_DMA, "WdfCommonBufferCreate failed: %!STATUS!", status);
+        program->descBuffer = NULL;
+        return status;
+    }
+
+    const WDF_DMA_DIRECTION direction = (engine->dir == H2C) ?
+        WdfDmaDirectionWriteToDevice : WdfDmaDirectionReadFromDevice;
+    DMA_DESCRIPTOR* descriptor = (DMA_DESCRIPTOR*)WdfCommonBufferGetAlignedVirtualAddress(program->descBuffer);
+    program->firstDesc = WdfCommonBufferGetAlignedLogicalAddress(program->descBuffer);
+    program->numBytes = EngineBuildDescriptors(engine, descriptor, program->firstDesc, deviceOffset,
+                                               direction, SgList);
+    program->numDescriptors = SgList->NumberOfElements;
+    program->firstDescAdj = OptimizeDescriptorList(engine, descriptor, program->numDescriptors,
+                                                   program->firstDesc.LowPart);
+
+    TraceInfo(DBG_DMA, "%s_%u program of %u bytes, %u descriptors at 0x%llx",
+              DirectionToString(engine->dir), engine->channel, program->numBytes,
+              program->numDescriptors, program->firstDesc.QuadPart);
+    for (ULONG i = 0; i < program->numDescriptors; i++) {
+        DumpDescriptor(&(descriptor[i]));
+    }
+    return STATUS_SUCCESS;
+}
+
+VOID EngineProgramDelete(IN XDMA_PROGRAM* program) {
+    if (program->descBuffer != NULL) {
+        WdfObjectDelete(program->descBuffer);
+        program->descBuffer = NULL;
+    }
+}
+
+VOID EngineProgramLaunch(IN XDMA_ENGINE* engine, IN XDMA_PROGRAM* program) {
+
+    ASSERT(engine->direct.done != NULL);
+    engine->direct.numBytes = program->numBytes;
+    engine->direct.numDescriptors = program->numDescriptors;
+    engine->direct.persistent = TRUE;
+    EngineStatsAdd(engine, numDescriptors, program->numDescriptors);
+
+    // the descriptors are ready - only point the engine at them
+    engine->sgdma->firstDescLo = program->firstDesc.LowPart;
+    engine->sgdma->firstDescHi = program->firstDesc.HighPart;
+    engine->sgdma->firstDescAdj = program->firstDescAdj;
+
+    MemoryBarrier();
+
+    engine->latency.startTime = LatencyTimestamp();
+    EngineStart(engine);
+}
+
 //========================= performance counters interface ========================================
 
 void EngineStartPerf(IN XDMA_ENGINE* engine) {
@@ -973,4 +1457,201 @@ void XDMA_EngineSetPollMode(XDMA_ENGINE* engine, BOOLEAN pollMode) {
         }
         engine->poll = pollMode;
     }
+}
+
+NTSTATUS XDMA_EngineChangePollMode(XDMA_ENGINE* engine, BOOLEAN pollMode) {
+
+    EXPECT(engine != NULL);
+    XDMA_BATCH* batch = &engine->batch;
+
+    if (!engine->enabled || (batch->pending == NULL)) {
+        TraceError(DBG_DMA, "Error: poll mode cannot be changed on streaming C2H engines");
+        return STATUS_NOT_SUPPORTED;
+    }
+
+    NTSTATUS status = STATUS_SUCCESS;
+    ULONG pendingCount = 0;
+    WdfIoQueueGetState(batch->pending, &pendingCount, NULL);
+
+    // batches and direct transfers complete on the engine interrupt - they check engine->poll
+    // under the same lock
+    WdfSpinLockAcquire(batch->lock);
+    if (batch->busy || (pendingCount != 0) || (engine->direct.done != NULL) ||
+        (WdfDmaTransactionGetRequest(engine->dmaTransaction) != NULL)) {
+        status = STATUS_DEVICE_BUSY;
+    } else if (pollMode && (batch->threshold != 0)) {
+        status = STATUS_INVALID_DEVICE_STATE;
+    } else if (engine->poll != pollMode) {
+        XDMA_EngineSetPollMode(engine, pollMode);
+        // the channel interrupt was set up for the old mode when the device node was opened. The
+        // interrupt lock keeps the toggle apart from the ISR/DPC, which mask and unmask it too.
+        WdfInterruptAcquireLock(engine->irq);
+        if (pollMode) {
+            EngineDisableInterrupt(engine);
+        } else {
+            EngineEnableInterrupt(engine);
+        }
+        WdfInterruptReleaseLock(engine->irq);
+    }
+    WdfSpinLockRelease(batch->lock);
+
+    TraceInfo(DBG_DMA, "%s_%u pollMode=%u: %!STATUS!",
+              DirectionToString(engine->dir), engine->channel, pollMode, status);
+    return status;
+}
+
+NTSTATUS XDMA_EngineSetBatchMode(XDMA_ENGINE* engine, ULONG threshold, ULONG holdoffUs) {
+
+    EXPECT(engine != NULL);
+    XDMA_BATCH* batch = &engine->batch;
+
+    if (!engine->enabled || (batch->pending == NULL)) {
+        TraceError(DBG_DMA, "Error: batching is not supported on streaming C2H engines");
+        return STATUS_NOT_SUPPORTED;
+    }
+    if (threshold > XDMA_BATCH_MAX_REQUESTS) {
+        TraceError(DBG_DMA, "Error: batch threshold %u exceeds %u", threshold, XDMA_BATCH_MAX_REQUESTS);
+        return STATUS_INVALID_PARAMETER;
+    }
+
+    NTSTATUS status = STATUS_SUCCESS;
+    ULONG pendingCount = 0;
+    WdfIoQueueGetState(batch->pending, &pendingCount, NULL);
+
+    WdfSpinLockAcquire(batch->lock);
+    if (engine->poll && (threshold != 0)) { // batches complete on the engine interrupt
+        TraceError(DBG_DMA, "Error: batching is not supported in poll mode");
+        status = STATUS_NOT_SUPPORTED;
+    } else if (batch->busy || (pendingCount != 0) || (engine->direct.done != NULL) ||
+        (WdfDmaTransactionGetRequest(engine->dmaTransaction) != NULL)) {
+        status = STATUS_DEVICE_BUSY;
+    } else {
+        batch->threshold = threshold;
+        batch->holdoff = (holdoffUs != 0) ? holdoffUs : XDMA_BATCH_DEFAULT_HOLDOFF_US;
+        engine->work = (threshold != 0) ? EngineProcessBatch : EngineProcessTransfer;
+    }
+    WdfSpinLockRelease(batch->lock);
+
+    TraceInfo(DBG_DMA, "%s_%u batch threshold=%u, holdoff=%uus: %!STATUS!",
+              DirectionToString(engine->dir), engine->channel, threshold, batch->holdoff, status);
+    return status;
+}
+
+NTSTATUS XDMA_EngineClaimDirect(XDMA_ENGINE* engine, PFN_XDMA_DIRECT_DONE done, PVOID context) {
+
+    EXPECT(engine != NULL);
+    XDMA_BATCH* batch = &engine->batch;
+
+    if (!engine->enabled || (batch->pending == NULL)) {
+        TraceError(DBG_DMA, "Error: direct transfers are not supported on streaming C2H engines");
+        return STATUS_NOT_SUPPORTED;
+    }
+
+    NTSTATUS status = STATUS_SUCCESS;
+    ULONG pendingCount = 0;
+    WdfIoQueueGetState(batch->pending, &pendingCount, NULL);
+
+    WdfSpinLockAcquire(batch->lock);
+    if (engine->poll) { // direct transfers complete on the engine interrupt
+        TraceError(DBG_DMA, "Error: direct transfers are not supported in poll mode");
+        status = STATUS_NOT_SUPPORTED;
+    } else if ((engine->direct.done != NULL) || (batch->threshold != 0) || batch->busy ||
+        (pendingCount != 0) || (WdfDmaTransactionGetRequest(engine->dmaTransaction) != NULL)) {
+        status = STATUS_DEVICE_BUSY;
+    } else {
+        engine->direct.context = context;
+        engine->direct.numDescriptors = 0;
+        engine->direct.done = done;
+        engine->work = EngineProcessDirect;
+    }
+    WdfSpinLockRelease(batch->lock);
+
+    TraceInfo(DBG_DMA, "%s_%u claim for direct transfers: %!STATUS!",
+              DirectionToString(engine->dir), engine->channel, status);
+    return status;
+}
+
+VOID XDMA_EngineReleaseDirect(XDMA_ENGINE* engine) {
+
+    EXPECT(engine != NULL);
+    ASSERT(engine->direct.numDescriptors == 0);
+
+    // a program may have been stopped before its completion was processed
+    EngineRestoreFirstDescriptor(engine);
+    engine->direct.persistent = FALSE;
+
+    WdfSpinLockAcquire(engine->batch.lock);
+    engine->work = EngineProcessTransfer;
+    engine->direct.done = NULL;
+    engine->direct.context = NULL;
+    WdfSpinLockRelease(engine->batch.lock);
+
+    TraceInfo(DBG_DMA, "%s_%u released from direct transfers",
+              DirectionToString(engine->dir), engine->channel);
+}
+
+NTSTATUS XDMA_DescriptorBypassSetup(PXDMA_DEVICE xdma, ULONG offset) {
+
+    EXPECT(xdma != NULL);
+    if ((xdma->bypassBarIdx < 0) || (xdma->bar[xdma->bypassBarIdx] == NULL)) {
+        TraceError(DBG_DMA, "Error: descriptor bypass needs the bypass BAR");
+        return STATUS_NOT_SUPPORTED;
+    }
+    const ULONG windowsLength = XDMA_NUM_DIRECTIONS * XDMA_MAX_NUM_CHANNELS * XDMA_DESC_BYPASS_STRIDE;
+    if (((ULONGLONG)offset + windowsLength > xdma->barLength[xdma->bypassBarIdx]) ||
+        ((offset % sizeof(ULONG)) != 0)) {
+        TraceError(DBG_DMA, "Error: descriptor bypass windows at 0x%x exceed the bypass BAR (%u bytes)",
+                   offset, xdma->barLength[xdma->bypassBarIdx]);
+        return STATUS_INVALID_PARAMETER;
+    }
+
+    PUCHAR windows = (PUCHAR)xdma->bar[xdma->bypassBarIdx] + offset;
+    for (UINT dir = H2C; dir < XDMA_NUM_DIRECTIONS; dir++) {
+        for (ULONG ch = 0; ch < XDMA_MAX_NUM_CHANNELS; ch++) {
+            XDMA_ENGINE* engine = &(xdma->engines[ch][dir]);
+            const ULONG index = dir * XDMA_MAX_NUM_CHANNELS + ch;
+            engine->descBypassWindow = (volatile UINT32*)(windows + index * XDMA_DESC_BYPASS_STRIDE);
+            engine->descBypassThreshold = 0;
+        }
+    }
+    TraceInfo(DBG_DMA, "descriptor bypass windows at bypass BAR offset 0x%x", offset);
+    return STATUS_SUCCESS;
+}
+
+NTSTATUS XDMA_EngineSetDescriptorBypass(XDMA_ENGINE* engine, ULONG threshold) {
+
+    EXPECT(engine != NULL);
+    if (!engine->enabled || (engine->descBypassWindow == NULL) ||
+        ((engine->type == EngineType_ST) && (engine->dir == C2H))) {
+        TraceError(DBG_DMA, "Error: descriptor bypass not available on %s_%u",
+                   DirectionToString(engine->dir), engine->channel);
+        return STATUS_NOT_SUPPORTED;
+    }
+    engine->descBypassThreshold = threshold;
+    TraceInfo(DBG_DMA, "%s_%u descriptor bypass threshold=%u bytes",
+              DirectionToString(engine->dir), engine->channel, threshold);
+    return STATUS_SUCCESS;
+}
+
+// ========================= event counters =======================================================
+
+void XDMA_StatsGet(PXDMA_DEVICE xdma, XDMA_STATS_DATA* data, BOOLEAN clear) {
+    EXPECT(xdma != NULL);
+    EXPECT(data != NULL);
+
+    // the counters are plain UINT64s - read (and clear) them one by one with interlocked operations
+    const ULONG numCounters = sizeof(XDMA_ENGINE_STATS) / sizeof(LONG64);
+    for (UINT dir = H2C; dir < XDMA_NUM_DIRECTIONS; dir++) {
+        for (UINT ch = 0; ch < XDMA_MAX_NUM_CHANNELS; ch++) {
+            volatile LONG64* counters = (volatile LONG64*)&xdma->engines[ch][dir].stats;
+            UINT64* result = (UINT64*)&data->engine[dir][ch];
+            for (ULONG i = 0; i < numCounters; i++) {
+                result[i] = clear ? InterlockedExchange64(&counters[i], 0) :
+                                    InterlockedCompareExchange64(&counters[i], 0, 0);
+            }
+        }
+    }
+    if (clear) {
+        TraceInfo(DBG_DMA, "engine counters cleared");
+    }
 }
\ No newline at end of file
@@ -21,6 +21,7 @@
 #include <wdf.h>
 #include "reg.h"
 #include "xdma_public.h"
+#include "latency.h"
 
 // ========================= constants ============================================================
 
@@ -30,6 +31,8 @@
 #define XDMA_RING_NUM_BLOCKS    (258U)
 #define XDMA_RING_BLOCK_SIZE    (PAGE_SIZE)
 #define XDMA_MAX_TRANSFER_SIZE  (8UL * 1024UL * 1024UL)
+#define XDMA_MAX_DESCRIPTORS    (XDMA_MAX_TRANSFER_SIZE / PAGE_SIZE + 2)
+#define XDMA_BATCH_DEFAULT_HOLDOFF_US   (1000U)
 
 // ========================= forward declarations =================================================
 
@@ -56,6 +59,50 @@ typedef struct XDMA_RING_T {
     KEVENT completionSignal;
 }XDMA_RING, *PXDMA_RING;
 
+/// Completion coalescing state of an engine - see XDMA_EngineSetBatchMode()
+typedef struct XDMA_BATCH_T {
+    ULONG threshold;            // max requests per interrupt, 0 = batching disabled
+    ULONG holdoff;              // max time in us a short burst waits for more requests
+    WDFQUEUE pending;           // manual queue of requests waiting for the next batch
+    WDFTIMER watchdog;          // starts a short burst after 'holdoff'
+    WDFSPINLOCK lock;           // protects the flags below
+    BOOLEAN busy;               // a batch is being built or in flight
+    BOOLEAN watchdogArmed;
+    BOOLEAN expired;            // holdoff passed, start whatever is pending
+    ULONG programming;          // EngineBatchProgramDma calls the batch still waits for, +1 while
+                                // it is being built
+    // batch in flight - owned by whoever set 'busy'
+    ULONG numRequests;
+    ULONG numDescriptors;
+    WDFDMATRANSACTION transaction[XDMA_BATCH_MAX_REQUESTS];
+    ULONG lastDesc[XDMA_BATCH_MAX_REQUESTS];   // descriptor count up to and including request i
+    ULONG numBytes[XDMA_BATCH_MAX_REQUESTS];
+} XDMA_BATCH;
+
+/// completion callback of a transfer started by EngineDirectStart(), called from the engine DPC
+typedef VOID(*PFN_XDMA_DIRECT_DONE)(IN struct XDMA_ENGINE_T *engine, IN PVOID context,
+                                    IN NTSTATUS status, IN ULONG numBytes);
+
+/// Owner of an engine which transfers data outside of the WDF request path - see
+/// XDMA_EngineClaimDirect()
+typedef struct XDMA_DIRECT_T {
+    PFN_XDMA_DIRECT_DONE done;  // NULL while the engine is not claimed
+    PVOID context;              // passed to 'done'
+    ULONG numDescriptors;       // transfer in flight
+    ULONG numBytes;
+    BOOLEAN persistent;         // transfer in flight is an XDMA_PROGRAM, keep its descriptors
+} XDMA_DIRECT;
+
+/// A transfer compiled once into a descriptor list of its own, which can be started any number of
+/// times without touching the descriptors again - see EngineProgramCompile()
+typedef struct XDMA_PROGRAM_T {
+    WDFCOMMONBUFFER descBuffer; // NULL if not compiled
+    PHYSICAL_ADDRESS firstDesc; // bus address of the first descriptor
+    ULONG firstDescAdj;         // adjacent descriptors of the first fetch
+    ULONG numDescriptors;
+    ULONG numBytes;
+} XDMA_PROGRAM;
+
 /// engine specific work to perform after dma transfer completion is detected
 typedef VOID(*PFN_XDMA_ENGINE_WORK)(IN struct XDMA_ENGINE_T *engine);
 
@@ -88,9 +135,12 @@ typedef struct XDMA_ENGINE_T {
 
     // engine configuration
     UINT32 irqBitMask;
+    WDFINTERRUPT irq;           // dedicated channel interrupt, or the shared one serving the engine
     UINT32 alignAddr;
     UINT32 alignLength;
     UINT32 alignAddrBits;
+    UINT32 dataPathBytes;       // from config block pcieWidth
+    UINT32 mrrsBytes;           // from config block pcieMRRS, max. bytes of a descriptor fetch
     DWORD channel;
     DirToDev dir;               // data flow direction (H2C or C2H)
     BOOLEAN enabled;
@@ -109,46 +159,27 @@ typedef struct XDMA_ENGINE_T {
     ULONG poll;
     WDFCOMMONBUFFER pollWbBuffer; // buffer for holding poll mode descriptor writeback data
     ULONG numDescriptors; // keep count of descriptors in transfer for poll mode
+
+    // completion coalescing
+    XDMA_BATCH batch;
+
+    // transfers outside the WDF request path
+    XDMA_DIRECT direct;
+
+    // descriptor bypass - small transfers push their descriptors through the bypass BAR
+    volatile UINT32* descBypassWindow;  // NULL if not available
+    ULONG descBypassThreshold;          // max. bytes of a bypassed transfer, 0 = off
+
+    // interrupt path timing
+    XDMA_ENGINE_LATENCY latency;
+
+    // event counters, only changed with interlocked operations - see EngineStatsAdd()
+    XDMA_ENGINE_STATS stats;
 } XDMA_ENGINE;
 
-#pragma pack(1)
-
-/// \brief Descriptor for a single contiguous memory block transfer.
-///
-/// Multiple descriptors are linked a 'next' pointer. An additional extra adjacent number gives the 
-/// amount of subsequent contiguous descriptors. The descriptors are in root complex memory, and the
-/// bytes in the 32-bit words must be in little-endian byte ordering.
-typedef struct xdma_descriptor_t {
-    UINT32 control;
-    UINT32 numBytes;  // transfer length in bytes
-    UINT32 srcAddrLo; // source address (low 32-bit)
-    UINT32 srcAddrHi; // source address (high 32-bit)
-    UINT32 dstAddrLo; // destination address (low 32-bit)
-    UINT32 dstAddrHi; // destination address (high 32-bit)
-                      // next descriptor in the single-linked list of descriptors, 
-                      // this is the bus address of the next descriptor in the root complex memory.
-    UINT32 nextLo;    // next desc address (low 32-bit)
-    UINT32 nextHi;    // next desc address (high 32-bit)
-} DMA_DESCRIPTOR;
-
-/// Result buffer of the streaming DMA operation. 
-/// The XDMA IP core writes the result of the DMA transfer to the host memory
-typedef struct {
-    UINT32 status;
-    UINT32 length;
-    UINT32 reserved_1[6]; // padding
-} DMA_RESULT;
-
-/// \brief Structure for polled mode descriptor writeback
-///
-/// XDMA IP core writes number of completed descriptors to this memory, which the driver can then
-/// poll to detect transfer completion
-typedef struct {
-    UINT32 completedDescCount;
-    UINT32 reserved_1[7];
-} XDMA_POLL_WB;
-
-#pragma pack()
+/// Add to an event counter of the engine. Interlocked, so it may be used from any context
+#define EngineStatsAdd(engine, counter, value) \
+    InterlockedAdd64((volatile LONG64*)&(engine)->stats.counter, (LONG64)(value))
 
 // ========================= function declarations ================================================
 
@@ -193,6 +224,26 @@ VOID EngineGetPerf(IN XDMA_ENGINE* engine, OUT XDMA_PERF_DATA* perfData);
 /// Stringify the Engine direction (H2C/C2H)
 char* DirectionToString(DirToDev dir);
 
+/// Add a read/write request to the next batched transfer of the engine. see XDMA_EngineSetBatchMode
+NTSTATUS EngineBatchSubmit(IN XDMA_ENGINE* engine, IN WDFREQUEST request);
+
+/// Start a transfer of the scatter-gather list on an engine claimed with XDMA_EngineClaimDirect().
+/// The engine must be idle, completion is reported through the claim's callback
+VOID EngineDirectStart(IN XDMA_ENGINE* engine, IN PSCATTER_GATHER_LIST SgList,
+                       IN LONGLONG deviceOffset);
+
+/// Build the descriptors of a transfer of the scatter-gather list into a new common buffer.
+/// The list must stay mapped as long as the program exists. PASSIVE_LEVEL only
+NTSTATUS EngineProgramCompile(IN XDMA_ENGINE* engine, IN PSCATTER_GATHER_LIST SgList,
+                              IN LONGLONG deviceOffset, OUT XDMA_PROGRAM* program);
+
+/// Release the descriptor buffer of a program which is not running
+VOID EngineProgramDelete(IN XDMA_PROGRAM* program);
+
+/// Start a compiled program on an engine claimed with XDMA_EngineClaimDirect(). The engine must be
+/// idle, completion is reported through the claim's callback
+VOID EngineProgramLaunch(IN XDMA_ENGINE* engine, IN XDMA_PROGRAM* program);
+
 /// Copy data from the ring buffer directly into a WDFMEMORY object
 NTSTATUS EngineRingCopyBytesToMemory(IN XDMA_ENGINE *engine, WDFMEMORY outputMem,
                                      size_t length, LARGE_INTEGER timeout, size_t* bytesRead);
\ No newline at end of file
@@ -77,7 +77,7 @@ static NTSTATUS SetupUserInterrupt(IN PXDMA_DEVICE xdma, IN ULONG index,
     }
 
     PIRQ_CONTEXT irqContext = GetIrqContext(xdma->userEvents[index].irq);
-    irqContext->eventId = index; // msg Id = irq index = event id
+    irqContext->eventId = index; // differs from the message id with partial MSI-X
     irqContext->regs = xdma->interruptRegs;
     irqContext->xdma = xdma;
     return status;
@@ -128,6 +128,8 @@ static NTSTATUS SetupDeviceInterrupt(IN PXDMA_DEVICE xdma, IN PCM_PARTIAL_RESOUR
     PIRQ_CONTEXT irqContext = GetIrqContext(xdma->lineInterrupt);
     irqContext->xdma = xdma;
     irqContext->regs = xdma->interruptRegs;
+    irqContext->channelMask = 0xFFFFFFFFUL; // all sources unless some get a dedicated vector
+    irqContext->userMask = 0xFFFFFFFFUL;
     return status;
 }
 
@@ -231,6 +233,90 @@ static NTSTATUS SetupMsixInterrupts(IN PXDMA_DEVICE xdma, IN WDFCMRESLIST Resour
     return status;
 }
 
+static NTSTATUS SetupPartialMsixInterrupts(IN PXDMA_DEVICE xdma, IN WDFCMRESLIST ResourcesRaw,
+                                           IN WDFCMRESLIST ResourcesTranslated)
+// Fewer MSI-X vectors than interrupt sources. Vector 0 is shared by all sources (see 
+// EvtInterruptIsr), the remaining vectors are handed out as dedicated vectors - first to the user
+// events selected by xdma->dedicatedUserEvents in ascending order, then to the dma channels.
+// Sources which do not get a vector of their own stay on the shared vector.
+{
+    PCM_PARTIAL_RESOURCE_DESCRIPTOR resource;
+    PCM_PARTIAL_RESOURCE_DESCRIPTOR resourceRaw;
+    NTSTATUS status = STATUS_SUCCESS;
+    ULONG numResources = WdfCmResourceListGetCount(ResourcesTranslated);
+    UINT32 userVectors[XDMA_MAX_USER_IRQ] = { 0 }; // msg id of each source, default shared
+    UINT32 channelVectors[XDMA_MAX_CHAN_IRQ] = { 0 };
+    UINT32 sharedUserMask = 0xFFFFFFFFUL;
+    UINT32 sharedChannelMask = 0xFFFFFFFFUL;
+    ULONG interruptCount = 0;
+    ULONG nextEvent = 0;
+    ULONG nextChannel = 0;
+
+    ASSERT(xdma->interruptRegs != NULL);
+
+    for (UINT i = 0; i < numResources; i++) {
+
+        resource = WdfCmResourceListGetDescriptor(ResourcesTranslated, i);
+        resourceRaw = WdfCmResourceListGetDescriptor(ResourcesRaw, i);
+
+        if (resource->Type != CmResourceTypeInterrupt) {
+            continue;
+        }
+
+        if (interruptCount == 0) { // shared vector
+            status = SetupDeviceInterrupt(xdma, resourceRaw, resource);
+        } else {
+            // next critical user event without a vector?
+            while ((nextEvent < XDMA_MAX_USER_IRQ) && !(xdma->dedicatedUserEvents & BIT_N(nextEvent))) {
+                nextEvent++;
+            }
+            if (nextEvent < XDMA_MAX_USER_IRQ) {
+                status = SetupUserInterrupt(xdma, nextEvent, resourceRaw, resource);
+                userVectors[nextEvent] = interruptCount;
+                sharedUserMask &= ~BIT_N(nextEvent);
+                TraceInfo(DBG_INIT, "event_%u has dedicated msg id %u", nextEvent, interruptCount);
+                nextEvent++;
+            } else if (nextChannel < XDMA_MAX_CHAN_IRQ) {
+                status = SetupChannelInterrupt(xdma, nextChannel, resourceRaw, resource);
+                channelVectors[nextChannel] = interruptCount;
+                sharedChannelMask &= ~BIT_N(nextChannel);
+                TraceInfo(DBG_INIT, "channel irq %u has dedicated msg id %u", nextChannel, interruptCount);
+                nextChannel++;
+            } else {
+                break; // every source has its own vector
+            }
+        }
+        if (!NT_SUCCESS(status)) {
+            TraceError(DBG_INIT, "Error in setup device interrupt: %!STATUS!", status);
+            return status;
+        }
+
+        ++interruptCount;
+    }
+
+    // the shared vector only services sources without a dedicated vector
+    PIRQ_CONTEXT irqContext = GetIrqContext(xdma->lineInterrupt);
+    irqContext->userMask = sharedUserMask;
+    irqContext->channelMask = sharedChannelMask;
+    TraceInfo(DBG_INIT, "%u msi-x vectors, shared vector services user=0x%04X channel=0x%02X",
+              interruptCount, sharedUserMask & 0xFFFF, sharedChannelMask & 0xFF);
+
+    xdma->interruptRegs->userVector[0] = BuildVectorReg(userVectors[0], userVectors[1],
+                                                        userVectors[2], userVectors[3]);
+    xdma->interruptRegs->userVector[1] = BuildVectorReg(userVectors[4], userVectors[5],
+                                                        userVectors[6], userVectors[7]);
+    xdma->interruptRegs->userVector[2] = BuildVectorReg(userVectors[8], userVectors[9],
+                                                        userVectors[10], userVectors[11]);
+    xdma->interruptRegs->userVector[3] = BuildVectorReg(userVectors[12], userVectors[13],
+                                                        userVectors[14], userVectors[15]);
+    xdma->interruptRegs->channelVector[0] = BuildVectorReg(channelVectors[0], channelVectors[1],
+                                                           channelVectors[2], channelVectors[3]);
+    xdma->interruptRegs->channelVector[1] = BuildVectorReg(channelVectors[4], channelVectors[5],
+                                                           channelVectors[6], channelVectors[7]);
+
+    return status;
+}
+
 static NTSTATUS SetupMultiMsiInterrupts(IN PXDMA_DEVICE xdma, IN WDFCMRESLIST ResourcesRaw,
                                         IN WDFCMRESLIST ResourcesTranslated, IN USHORT numVectors) {
     PCM_PARTIAL_RESOURCE_DESCRIPTOR resource;
@@ -313,9 +399,9 @@ NTSTATUS EvtInterruptEnable(IN WDFINTERRUPT Interrupt, IN WDFDEVICE device) {
     IRQ_CONTEXT* irq = GetIrqContext(Interrupt);
     EXPECT(irq != NULL);
     EXPECT(irq->regs != NULL);
-    irq->regs->channelIntEnableW1S = 0xFFFFFFFFUL;
-    irq->regs->userIntEnableW1S = 0xFFFFFFFFUL;
-    TraceVerbose(DBG_IRQ, "enabled ALL interrupts");
+    irq->regs->channelIntEnableW1S = irq->channelMask;
+    irq->regs->userIntEnableW1S = irq->userMask;
+    TraceVerbose(DBG_IRQ, "enabled interrupts channel=0x%08X user=0x%08X", irq->channelMask, irq->userMask);
     return STATUS_SUCCESS;
 }
 
@@ -324,9 +410,9 @@ NTSTATUS EvtInterruptDisable(IN WDFINTERRUPT Interrupt, IN WDFDEVICE device) {
     IRQ_CONTEXT* irq = GetIrqContext(Interrupt);
     EXPECT(irq != NULL);
     EXPECT(irq->regs != NULL);
-    irq->regs->channelIntEnableW1C = 0xFFFFFFFFUL;
-    irq->regs->userIntEnableW1C = 0xFFFFFFFFUL;
-    TraceVerbose(DBG_IRQ, "disabled ALL interrupts");
+    irq->regs->channelIntEnableW1C = irq->channelMask;
+    irq->regs->userIntEnableW1C = irq->userMask;
+    TraceVerbose(DBG_IRQ, "disabled interrupts channel=0x%08X user=0x%08X", irq->channelMask, irq->userMask);
     return STATUS_SUCCESS;
 }
 
@@ -336,6 +422,7 @@ BOOLEAN EvtInterruptIsr(IN WDFINTERRUPT Interrupt, IN ULONG MessageID)
     PIRQ_CONTEXT irq = GetIrqContext(Interrupt);
     UINT32 chIrq = 0;
     UINT32 userIrq = 0;
+    const LONGLONG isrTime = LatencyTimestamp();
 
     TraceInfo(DBG_IRQ, "irq messageId = %u", MessageID);
 
@@ -343,8 +430,8 @@ BOOLEAN EvtInterruptIsr(IN WDFINTERRUPT Interrupt, IN ULONG MessageID)
     EXPECT(irq->regs != NULL);
 
     // read channel interrupt request registers
-    // channel interrupt(s) requested?
-    chIrq = irq->regs->channelIntRequest;
+    // channel interrupt(s) requested? - ignore those with a dedicated vector
+    chIrq = irq->regs->channelIntRequest & irq->channelMask;
     TraceVerbose(DBG_IRQ, "chan EN=0x%08X RQ=0x%08X PE=0x%08X",
                  irq->regs->channelIntEnable, irq->regs->channelIntRequest, irq->regs->channelIntPending);
     if (chIrq) {
@@ -354,7 +441,7 @@ BOOLEAN EvtInterruptIsr(IN WDFINTERRUPT Interrupt, IN ULONG MessageID)
 
     // read user interrupts that are pending in the controller - flushes previous write
     // user interrupt(s) requested?
-    userIrq = irq->regs->userIntRequest;
+    userIrq = irq->regs->userIntRequest & irq->userMask;
     TraceVerbose(DBG_IRQ, "user EN=0x%08X RQ=0x%08X PE=0x%08X",
                  irq->regs->userIntEnable, irq->regs->userIntRequest, irq->regs->userIntPending);
     if (userIrq) {
@@ -368,6 +455,21 @@ BOOLEAN EvtInterruptIsr(IN WDFINTERRUPT Interrupt, IN ULONG MessageID)
         return FALSE;
     }
 
+    // timestamp the fired engines and events for the latency statistics
+    for (UINT dir = H2C; dir < 2; dir++) { // 0=H2C, 1=C2H
+        for (UINT channel = 0; channel < XDMA_MAX_NUM_CHANNELS; channel++) {
+            XDMA_ENGINE* engine = &irq->xdma->engines[channel][dir];
+            if (engine->enabled && (chIrq & engine->irqBitMask)) {
+                engine->latency.isrTime = isrTime;
+            }
+        }
+    }
+    for (UINT i = 0; i < XDMA_MAX_USER_IRQ; ++i) {
+        if (userIrq & BIT_N(i)) {
+            irq->xdma->userEvents[i].latency.isrTime = isrTime;
+        }
+    }
+
     // schedule deferred work
     WdfInterruptQueueDpcForIsr(Interrupt);
     return TRUE;
@@ -387,6 +489,8 @@ VOID EvtInterruptDpc(IN WDFINTERRUPT interrupt, IN WDFOBJECT device)
             if (engine->enabled && (irq->channelIrqPending & engine->irqBitMask)) {
                 TraceInfo(DBG_IRQ, "%s_%u servicing interrupt", DirectionToString(dir), channel);
                 ASSERT(engine->work != NULL);
+                EngineLatencyDpc(engine);
+                EngineStatsAdd(engine, numInterrupts, 1);
                 engine->work(engine);
             }
         }
@@ -397,8 +501,10 @@ VOID EvtInterruptDpc(IN WDFINTERRUPT interrupt, IN WDFOBJECT device)
     for (UINT i = 0; i < XDMA_MAX_USER_IRQ; ++i) {
         XDMA_EVENT* userEvent = &irq->xdma->userEvents[i];
         if (irq->userIrqPending & BIT_N(i)) {
+            const LONGLONG dpcTime = EventLatencyDpc(userEvent);
             if (userEvent->work != NULL) {
                 userEvent->work(i, userEvent->userData);
+                EventLatencyHandlerDone(userEvent, dpcTime);
             }
         }
     }
@@ -449,6 +555,7 @@ BOOLEAN EvtChannelInterruptIsr(IN WDFINTERRUPT Interrupt, IN ULONG MessageID)
     PIRQ_CONTEXT irq = GetIrqContext(Interrupt);
 
     EXPECT(irq != NULL);
+    irq->engine->latency.isrTime = LatencyTimestamp();
 
     TraceVerbose(DBG_IRQ, "%s_%u interrupt occurred! messageId=%u",
                  DirectionToString(irq->engine->dir), irq->engine->channel, MessageID);
@@ -465,6 +572,8 @@ VOID EvtChannelInterruptDpc(IN WDFINTERRUPT interrupt, IN WDFOBJECT device)
     PIRQ_CONTEXT irq = GetIrqContext(interrupt);
 
     // do engine specific work (either EngineProcessTransfer (MM) or EngineProcessRing (ST))
+    EngineLatencyDpc(irq->engine);
+    EngineStatsAdd(irq->engine, numInterrupts, 1);
     irq->engine->work(irq->engine);
 
     // reenable interrupt for this dma engine
@@ -478,7 +587,7 @@ NTSTATUS EvtUserInterruptEnable(IN WDFINTERRUPT Interrupt, IN WDFDEVICE device)
     PIRQ_CONTEXT irq = GetIrqContext(Interrupt);
     EXPECT(irq != NULL);
     EXPECT(irq->regs != NULL);
-    irq->regs->userIntEnableW1S = BIT_N(irq->eventId); // message id and event id are same
+    irq->regs->userIntEnableW1S = BIT_N(irq->eventId);
     TraceInfo(DBG_IRQ, "event_%u enabled interrupt", irq->eventId);
     return STATUS_SUCCESS;
 }
@@ -488,18 +597,22 @@ NTSTATUS EvtUserInterruptDisable(IN WDFINTERRUPT Interrupt, IN WDFDEVICE device)
     PIRQ_CONTEXT irq = GetIrqContext(Interrupt);
     EXPECT(irq != NULL);
     EXPECT(irq->regs != NULL);
-    irq->regs->userIntEnableW1C = BIT_N(irq->eventId); // message id and event id are same
+    irq->regs->userIntEnableW1C = BIT_N(irq->eventId);
     TraceInfo(DBG_IRQ, "event_%u disabled interrupt", irq->eventId);
     return STATUS_SUCCESS;
 }
 
 BOOLEAN EvtUserInterruptIsr(IN WDFINTERRUPT Interrupt, IN ULONG MessageID) {
-    TraceInfo(DBG_IRQ, "event_%u occurred!", MessageID);
+    UNREFERENCED_PARAMETER(MessageID);
+    const LONGLONG isrTime = LatencyTimestamp();
     IRQ_CONTEXT* irq = GetIrqContext(Interrupt);
     EXPECT(irq != NULL);
     EXPECT(irq->regs != NULL);
-    // disable user event interrupt
-    irq->regs->userIntEnableW1C = BIT_N(MessageID); // message id and event id are same
+    TraceInfo(DBG_IRQ, "event_%u occurred!", irq->eventId);
+    irq->xdma->userEvents[irq->eventId].latency.isrTime = isrTime;
+    // disable user event interrupt - a dedicated event vector need not have the event id as its
+    // message id, see SetupPartialMsixInterrupts
+    irq->regs->userIntEnableW1C = BIT_N(irq->eventId);
     return WdfInterruptQueueDpcForIsr(Interrupt); // schedule deferred work;
 }
 
@@ -512,10 +625,11 @@ VOID EvtUserInterruptDpc(IN WDFINTERRUPT interrupt, IN WDFOBJECT device)
     XDMA_EVENT* userEvent = &irq->xdma->userEvents[irq->eventId];
     EXPECT(userEvent != NULL);
 
-    // message id and event id are same
+    const LONGLONG dpcTime = EventLatencyDpc(userEvent);
     if (userEvent->work != NULL) {
         TraceInfo(DBG_IRQ, "event_%d executing work handler", irq->eventId);
         userEvent->work(irq->eventId, userEvent->userData);
+        EventLatencyHandlerDone(userEvent, dpcTime);
     }
 
     // reenable interrupt
@@ -546,6 +660,8 @@ NTSTATUS SetupInterrupts(IN PXDMA_DEVICE xdma,
     TraceVerbose(DBG_INIT, "xdma->numIrqResources=%u", numIrqResources);
     if (numIrqResources >= XDMA_MAX_NUM_IRQ) { // msi-x
         status = SetupMsixInterrupts(xdma, ResourcesRaw, ResourcesTranslated);
+    } else if ((numIrqResources > 1) && (xdma->dedicatedUserEvents != 0)) { // msi-x, not enough vectors
+        status = SetupPartialMsixInterrupts(xdma, ResourcesRaw, ResourcesTranslated);
     } else if (numMsiVectors >= XDMA_MAX_NUM_IRQ) { //multi-message MSI with enough contiguous vectors
         status = SetupMultiMsiInterrupts(xdma, ResourcesRaw, ResourcesTranslated, numMsiVectors);
     } else { // Line or single-message MSI
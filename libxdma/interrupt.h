@@ -27,6 +27,8 @@ typedef struct _IRQ_CONTEXT {
     ULONG eventId;
     UINT32 channelIrqPending; // channel irq that have fired
     UINT32 userIrqPending; // user event irq that have fired
+    UINT32 channelMask; // channel irq serviced by this interrupt (shared interrupt only)
+    UINT32 userMask; // user event irq serviced by this interrupt (shared interrupt only)
     XDMA_ENGINE* engine;
     volatile XDMA_IRQ_REGS* regs;
     PXDMA_DEVICE xdma;
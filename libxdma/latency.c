@@ -0,0 +1,151 @@
+/*
+* XDMA Interrupt Path Latency Statistics
+* ===============================
+*
+* Copyright 2017 Xilinx Inc.
+* Copyright 2010-2012 Sidebranch
+* Copyright 2010-2012 Leon Woestenberg <leon@sidebranch.com>
+*
+* Maintainer:
+* -----------
+* Alexander Hornburg <alexande@xilinx.com>
+*
+* Description:
+* ------------
+* Timestamps are taken with KeQueryPerformanceCounter() at the interrupt service routine, the DPC
+* and the request completion of each engine and user event. The intervals between them are
+* collected in log-scale histograms (see XDMA_LATENCY_HISTOGRAM in xdma_public.h) which are read
+* and cleared through IOCTL_XDMA_LATENCY_GET and IOCTL_XDMA_LATENCY_RESET.
+*/
+
+// ========================= include dependencies =================================================
+
+#include "device.h"
+#include "latency.h"
+#include "xdma.h"
+
+#include "trace.h"
+#ifdef DBG
+// The trace message header (.tmh) file must be included in a source file before any WPP macro 
+// calls and after defining a WPP_CONTROL_GUIDS macro (defined in trace.h). see trace.h
+#include "latency.tmh"
+#endif
+
+// ========================= static functions =====================================================
+
+static ULONG MostSignificantBit(UINT64 value)
+// index of the highest bit set. value must not be 0
+{
+    ULONG index;
+    if (value >> 32) {
+        _BitScanReverse(&index, (ULONG)(value >> 32));
+        return index + 32;
+    }
+    _BitScanReverse(&index, (ULONG)value);
+    return index;
+}
+
+static ULONG LatencyBucket(UINT64 ticks)
+// bucket layout, see XDMA_LATENCY_NUM_BUCKETS in xdma_public.h
+{
+    if (ticks < 4) {
+        return (ULONG)ticks;
+    }
+    const ULONG msb = MostSignificantBit(ticks);
+    const ULONG bucket = ((msb - 1) * 4) + (ULONG)((ticks >> (msb - 2)) & 0x3);
+    return bucket < XDMA_LATENCY_NUM_BUCKETS ? bucket : XDMA_LATENCY_NUM_BUCKETS - 1;
+}
+
+// ========================= internal api implementation ==========================================
+
+VOID LatencyRecord(IN OUT XDMA_LATENCY_HISTOGRAM* histogram, IN LONGLONG ticks) {
+    if (ticks < 0) { // timestamp taken before a reset of the counter
+        return;
+    }
+    histogram->count++;
+    histogram->sum += ticks;
+    if ((UINT64)ticks > histogram->max) {
+        histogram->max = ticks;
+    }
+    histogram->bucket[LatencyBucket(ticks)]++;
+}
+
+VOID EngineLatencyDpc(IN XDMA_ENGINE* engine) {
+    XDMA_ENGINE_LATENCY* latency = &engine->latency;
+
+    latency->dpcTime = LatencyTimestamp();
+    if (latency->isrTime != 0) {
+        LatencyRecord(&latency->stage[XDMA_LATENCY_ISR_TO_DPC], latency->dpcTime - latency->isrTime);
+        if (latency->startTime != 0) {
+            LatencyRecord(&latency->stage[XDMA_LATENCY_START_TO_ISR],
+                          latency->isrTime - latency->startTime);
+        }
+    }
+    latency->startTime = 0;
+    latency->isrTime = 0;
+}
+
+VOID EngineLatencyComplete(IN XDMA_ENGINE* engine) {
+    XDMA_ENGINE_LATENCY* latency = &engine->latency;
+
+    if (latency->dpcTime != 0) { // not completed from a DPC in poll mode
+        LatencyRecord(&latency->stage[XDMA_LATENCY_DPC_TO_COMPLETE],
+                      LatencyTimestamp() - latency->dpcTime);
+        latency->dpcTime = 0;
+    }
+}
+
+LONGLONG EventLatencyDpc(IN XDMA_EVENT* userEvent) {
+    XDMA_EVENT_LATENCY* latency = &userEvent->latency;
+
+    LONGLONG dpcTime = LatencyTimestamp();
+    if (latency->isrTime != 0) {
+        LatencyRecord(&latency->stage[XDMA_LATENCY_EVENT_ISR_TO_DPC], dpcTime - latency->isrTime);
+        latency->isrTime = 0;
+    }
+    return dpcTime;
+}
+
+VOID EventLatencyHandlerDone(IN XDMA_EVENT* userEvent, IN LONGLONG dpcTime) {
+    LatencyRecord(&userEvent->latency.stage[XDMA_LATENCY_EVENT_HANDLER],
+                  LatencyTimestamp() - dpcTime);
+}
+
+// ============================== public api implementation =======================================
+
+void XDMA_LatencyGet(PXDMA_DEVICE xdma, XDMA_LATENCY_DATA* data) {
+    EXPECT(xdma != NULL);
+    EXPECT(data != NULL);
+
+    LARGE_INTEGER frequency;
+    KeQueryPerformanceCounter(&frequency);
+    data->frequency = frequency.QuadPart;
+
+    for (UINT dir = H2C; dir < XDMA_NUM_DIRECTIONS; dir++) {
+        for (UINT ch = 0; ch < XDMA_MAX_NUM_CHANNELS; ch++) {
+            RtlCopyMemory(data->engine[dir][ch], xdma->engines[ch][dir].latency.stage,
+                          sizeof(data->engine[dir][ch]));
+        }
+    }
+    for (UINT i = 0; i < XDMA_MAX_USER_IRQ; i++) {
+        RtlCopyMemory(data->userEvent[i], xdma->userEvents[i].latency.stage,
+                      sizeof(data->userEvent[i]));
+    }
+}
+
+void XDMA_LatencyReset(PXDMA_DEVICE xdma) {
+    EXPECT(xdma != NULL);
+
+    // a sample recorded concurrently by a DPC may be lost or partially cleared
+    for (UINT dir = H2C; dir < XDMA_NUM_DIRECTIONS; dir++) {
+        for (UINT ch = 0; ch < XDMA_MAX_NUM_CHANNELS; ch++) {
+            XDMA_ENGINE_LATENCY* latency = &xdma->engines[ch][dir].latency;
+            RtlZeroMemory(latency->stage, sizeof(latency->stage));
+        }
+    }
+    for (UINT i = 0; i < XDMA_MAX_USER_IRQ; i++) {
+        XDMA_EVENT_LATENCY* latency = &xdma->userEvents[i].latency;
+        RtlZeroMemory(latency->stage, sizeof(latency->stage));
+    }
+    TraceInfo(DBG_IRQ, "latency histograms cleared");
+}
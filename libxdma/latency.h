@@ -0,0 +1,60 @@
+/*
+* XDMA Interrupt Path Latency Statistics
+* ===============================
+*
+* Copyright 2017 Xilinx Inc.
+* Copyright 2010-2012 Sidebranch
+* Copyright 2010-2012 Leon Woestenberg <leon@sidebranch.com>
+*
+* Maintainer:
+* -----------
+* Alexander Hornburg <alexande@xilinx.com>
+*
+*/
+
+#pragma once
+
+// ========================= include dependencies =================================================
+
+#include <ntddk.h>
+#include "xdma_public.h"
+
+// ========================= type declarations ====================================================
+
+struct XDMA_ENGINE_T;
+struct XDMA_EVENT_T;
+
+/// Interrupt path timestamps and histograms of a DMA engine. timestamps are 0 when not taken
+typedef struct XDMA_ENGINE_LATENCY_T {
+    LONGLONG startTime;     // engine started
+    LONGLONG isrTime;       // interrupt service routine entered
+    LONGLONG dpcTime;       // deferred procedure call entered
+    XDMA_LATENCY_HISTOGRAM stage[XDMA_LATENCY_ENGINE_STAGES];
+} XDMA_ENGINE_LATENCY;
+
+/// Interrupt path timestamps and histograms of a user event
+typedef struct XDMA_EVENT_LATENCY_T {
+    LONGLONG isrTime;       // interrupt service routine entered
+    XDMA_LATENCY_HISTOGRAM stage[XDMA_LATENCY_EVENT_STAGES];
+} XDMA_EVENT_LATENCY;
+
+// ========================= function declarations ================================================
+
+/// Current time in performance counter ticks
+#define LatencyTimestamp() (KeQueryPerformanceCounter(NULL).QuadPart)
+
+/// Add a sample to a histogram.
+/// Not synchronized - a histogram is only updated from the DPC of its engine or event
+VOID LatencyRecord(IN OUT XDMA_LATENCY_HISTOGRAM* histogram, IN LONGLONG ticks);
+
+/// Record the ISR stages of an engine on entry of its DPC
+VOID EngineLatencyDpc(IN struct XDMA_ENGINE_T* engine);
+
+/// Record the DPC to completion stage of an engine right before its request is completed
+VOID EngineLatencyComplete(IN struct XDMA_ENGINE_T* engine);
+
+/// Record the ISR to DPC stage of a user event on entry of its DPC. returns the DPC timestamp
+LONGLONG EventLatencyDpc(IN struct XDMA_EVENT_T* userEvent);
+
+/// Record the duration of the event handler, given the DPC timestamp from EventLatencyDpc
+VOID EventLatencyHandlerDone(IN struct XDMA_EVENT_T* userEvent, IN LONGLONG dpcTime);
@@ -87,8 +87,17 @@
 #define XDMA_DESC_STOP_BIT                  (BIT_N(0))
 #define XDMA_DESC_COMPLETED_BIT             (BIT_N(1))
 #define XDMA_DESC_EOP_BIT                   (BIT_N(4))
+#define XDMA_DESC_MAGIC                     (0xAD4B0000UL)
+#define XDMA_DESC_NEXT_ADJ_SHIFT            (8)
+#define XDMA_DESC_NEXT_ADJ_MASK             (0x3FUL)
 
+// bits of the streaming C2H result written back to host memory
 #define XDMA_RESULT_EOP_BIT                 (BIT_N(0))
+#define XDMA_RESULT_MAGIC                   (0x52B40000UL)
+
+// bits of the poll mode writeback
+#define XDMA_WB_COUNT_MASK                  (0x00ffffffUL)
+#define XDMA_WB_ERR_MASK                    (1UL << 31)
 
 // Engine performance control register bits
 #define XDMA_PERF_RUN                       BIT_N(0)
@@ -199,6 +208,41 @@ typedef struct {
     UINT32 creditModeEnableW1C; // 0x28
 } XDMA_SGDMA_COMMON_REGS, *PXDMA_SGDMA_COMMON_REGS;
 
+/// \brief Descriptor for a single contiguous memory block transfer.
+///
+/// Multiple descriptors are linked a 'next' pointer. An additional extra adjacent number gives the 
+/// amount of subsequent contiguous descriptors. The descriptors are in root complex memory, and the
+/// bytes in the 32-bit words must be in little-endian byte ordering.
+typedef struct xdma_descriptor_t {
+    UINT32 control;
+    UINT32 numBytes;  // transfer length in bytes
+    UINT32 srcAddrLo; // source address (low 32-bit)
+    UINT32 srcAddrHi; // source address (high 32-bit)
+    UINT32 dstAddrLo; // destination address (low 32-bit)
+    UINT32 dstAddrHi; // destination address (high 32-bit)
+                      // next descriptor in the single-linked list of descriptors, 
+                      // this is the bus address of the next descriptor in the root complex memory.
+    UINT32 nextLo;    // next desc address (low 32-bit)
+    UINT32 nextHi;    // next desc address (high 32-bit)
+} DMA_DESCRIPTOR;
+
+/// Result buffer of the streaming DMA operation. 
+/// The XDMA IP core writes the result of the DMA transfer to the host memory
+typedef struct {
+    UINT32 status;
+    UINT32 length;
+    UINT32 reserved_1[6]; // padding
+} DMA_RESULT;
+
+/// \brief Structure for polled mode descriptor writeback
+///
+/// XDMA IP core writes number of completed descriptors to this memory, which the driver can then
+/// poll to detect transfer completion
+typedef struct {
+    UINT32 completedDescCount;
+    UINT32 reserved_1[7];
+} XDMA_POLL_WB;
+
 #pragma pack()
 
 
@@ -97,4 +97,93 @@ EVT_WDF_PROGRAM_DMA XDMA_EngineProgramDma;
  * \param engine        [IN]        The DMA engine context
  * \param pollMode      [IN]        true = use polling, false = use interrupts
  */
-void XDMA_EngineSetPollMode(XDMA_ENGINE* engine, BOOLEAN pollMode);
\ No newline at end of file
+void XDMA_EngineSetPollMode(XDMA_ENGINE* engine, BOOLEAN pollMode);
+
+/**
+ * \brief Switch an idle DMA engine between polling and interrupts at runtime.
+ *        Callers must make sure no read/write request is dispatched to the engine meanwhile.
+ * \param engine        [IN]        The DMA engine context
+ * \param pollMode      [IN]        true = use polling, false = use interrupts
+ * \return STATUS_SUCCESS on successful completion. STATUS_DEVICE_BUSY while transfers are
+ *         outstanding or the engine is claimed for direct transfers, STATUS_INVALID_DEVICE_STATE
+ *         when enabling polling with batching enabled, STATUS_NOT_SUPPORTED on streaming C2H
+ *         engines.
+ */
+NTSTATUS XDMA_EngineChangePollMode(XDMA_ENGINE* engine, BOOLEAN pollMode);
+
+/**
+ * \brief Coalesce the completion interrupts of consecutive transfers on a DMA engine.
+ *        With a threshold > 0, requests handed to EngineBatchSubmit() are chained into one 
+ *        descriptor list of up to 'threshold' requests which raises a single interrupt. A shorter
+ *        burst is started once 'holdoffUs' passed since its first request.
+ *        Callers must make sure no read/write request is dispatched to the engine meanwhile.
+ * \param engine        [IN]        The DMA engine context
+ * \param threshold     [IN]        Max number of requests per interrupt, 0 = disable batching
+ * \param holdoffUs     [IN]        Max time a request waits for others, 0 = default
+ * \return STATUS_SUCCESS on successful completion. STATUS_DEVICE_BUSY while transfers are 
+ *         outstanding, STATUS_NOT_SUPPORTED in poll mode or on streaming C2H engines.
+ */
+NTSTATUS XDMA_EngineSetBatchMode(XDMA_ENGINE* engine, ULONG threshold, ULONG holdoffUs);
+
+/**
+ * \brief Locate the descriptor bypass windows of all engines in the bypass BAR. The user design
+ *        must forward descriptors written there to the descriptor bypass port of the engine.
+ * \param xdma          [IN]        The XDMA device context
+ * \param offset        [IN]        Bypass BAR offset of the window of engine h2c_0
+ * \return STATUS_SUCCESS on successful completion. STATUS_NOT_SUPPORTED without bypass BAR,
+ *         STATUS_INVALID_PARAMETER if the windows do not fit into it.
+ */
+NTSTATUS XDMA_DescriptorBypassSetup(PXDMA_DEVICE xdma, ULONG offset);
+
+/**
+ * \brief Send read/write requests of up to 'threshold' bytes through the descriptor bypass window
+ *        instead of the descriptor list in host memory, which saves the descriptor fetch.
+ * \param engine        [IN]        The DMA engine context
+ * \param threshold     [IN]        Max bytes of a bypassed transfer, 0 = always use the list
+ * \return STATUS_SUCCESS on successful completion. STATUS_NOT_SUPPORTED without a window or on
+ *         streaming C2H engines.
+ */
+NTSTATUS XDMA_EngineSetDescriptorBypass(XDMA_ENGINE* engine, ULONG threshold);
+
+/**
+ * \brief Take exclusive ownership of a DMA engine for transfers which are not backed by a WDF
+ *        request. Transfers are started with EngineDirectStart() and their completion is reported
+ *        by calling 'done' from the engine DPC. Read/write requests must not be sent to the
+ *        engine while it is claimed; a caller which cannot rule them out has to check
+ *        engine->direct.done and set up its transaction under engine->batch.lock.
+ * \param engine        [IN]        The DMA engine context
+ * \param done          [IN]        Completion callback
+ * \param context       [IN]        Passed to the completion callback
+ * \return STATUS_SUCCESS on successful completion. STATUS_DEVICE_BUSY while transfers are 
+ *         outstanding, batching is enabled or the engine is claimed already, STATUS_NOT_SUPPORTED
+ *         in poll mode or on streaming C2H engines.
+ */
+NTSTATUS XDMA_EngineClaimDirect(XDMA_ENGINE* engine, PFN_XDMA_DIRECT_DONE done, PVOID context);
+
+/**
+ * \brief Return an engine claimed with XDMA_EngineClaimDirect() to the read/write request path.
+ *        No direct transfer may be in flight.
+ * \param engine        [IN]        The DMA engine context
+ */
+VOID XDMA_EngineReleaseDirect(XDMA_ENGINE* engine);
+
+/**
+ * \brief Get the interrupt path latency histograms of all DMA engines and user events.
+ * \param xdma          [IN]        The XDMA device context
+ * \param data          [OUT]       Histograms and the frequency of their timestamp ticks
+ */
+void XDMA_LatencyGet(PXDMA_DEVICE xdma, XDMA_LATENCY_DATA* data);
+
+/**
+ * \brief Clear the interrupt path latency histograms of all DMA engines and user events.
+ * \param xdma          [IN]        The XDMA device context
+ */
+void XDMA_LatencyReset(PXDMA_DEVICE xdma);
+
+/**
+ * \brief Get the event counters of all DMA engines.
+ * \param xdma          [IN]        The XDMA device context
+ * \param data          [OUT]       Counters indexed by direction and channel
+ * \param clear         [IN]        Set each counter to zero as it is read, no event is lost
+ */
+void XDMA_StatsGet(PXDMA_DEVICE xdma, XDMA_STATS_DATA* data, BOOLEAN clear);
\ No newline at end of file
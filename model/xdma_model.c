@@ -0,0 +1,880 @@
+/*
+* XDMA Software Model
+* ===============================
+*
+* Copyright 2017 Xilinx Inc.
+*
+* Description:
+* ------------
+* Register level model of the XDMA IP. See xdma_model.h
+*
+* References:
+* -----------
+*	[1] pg195-pcie-dma.pdf - DMA/Bridge Subsystem for PCI Express v4.0 - Product Guide
+*/
+
+// ========================= include dependencies =================================================
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "xdma_model.h"
+
+// reg.h is shared with the driver and uses the Windows fixed width type names
+typedef uint32_t UINT32;
+#include "reg.h"
+
+// ========================= constants ============================================================
+
+#define MODEL_VERSION           (0x06UL)    // IP version reported in the block identifiers
+#define MODEL_MAX_BURST         (4096)      // descriptors per engine per xdma_model_run()
+#define MODEL_MAX_CREDITS       (0x3FFUL)
+#define MODEL_MAX_LENGTH        (0x0FFFFFFFUL)
+
+#define ENGINE_REG(reg)         offsetof(XDMA_ENGINE_REGS, reg)
+#define IRQ_REG(reg)            offsetof(XDMA_IRQ_REGS, reg)
+#define CONFIG_REG(reg)         offsetof(XDMA_CONFIG_REGS, reg)
+#define SGDMA_REG(reg)          offsetof(XDMA_SGDMA_REGS, reg)
+#define COMMON_REG(reg)         offsetof(XDMA_SGDMA_COMMON_REGS, reg)
+
+// status bits which are cleared by reading statusRC or writing 1 to status
+#define STATUS_CLEARABLE        (0x00FFFFFEUL)
+
+// status bits which stop the engine with an error
+#define STATUS_ERRORS           (XDMA_MAGIC_STOPPED_BIT | XDMA_FETCH_STOPPED_BIT | \
+                                 XDMA_ALIGN_MISMATCH_BIT | XDMA_STAT_READ_ERROR | \
+                                 (0x1fUL * BIT_N(14)) | XDMA_STAT_DESCRIPTOR_ERROR)
+
+// error bit reported when the data phase of a descriptor fails
+#define STATUS_READ_ERROR       (BIT_N(9))          // host memory read failed (H2C)
+#define STATUS_WRITE_ERROR      (BIT_N(14))         // host memory write failed (C2H)
+#define STATUS_DESC_ERROR       (BIT_N(19))         // descriptor fetch failed
+#define STATUS_CARD_ERROR       (BIT_N(20))         // card memory address out of range
+
+// ========================= type definitions =====================================================
+
+typedef struct {
+    int present;
+    XDMA_MODEL_DIR dir;
+    unsigned channel;
+    unsigned irqBit;        // bit in the channel interrupt request/enable registers
+
+    // engine registers
+    uint32_t control;
+    uint32_t status;        // without BUSY, see 'busy'
+    uint32_t completedDescCount;
+    uint32_t pollModeWbLo;
+    uint32_t pollModeWbHi;
+    uint32_t intEnableMask;
+    uint32_t perfCtrl;
+    uint64_t perfCyc;
+    uint64_t perfDat;
+
+    // SGDMA registers
+    uint32_t firstDescLo;
+    uint32_t firstDescHi;
+    uint32_t firstDescAdj;
+    uint32_t descCredits;
+
+    // descriptor fetch state
+    int busy;
+    uint64_t descAddr;      // bus address of the next descriptor to process
+    uint32_t blockLeft;     // descriptors left in the current fetch block
+    int fetchPending;       // next descriptor starts a new fetch block
+
+    XDMA_MODEL_STREAM stream;
+    void* streamContext;
+    XDMA_MODEL_STATS stats;
+} MODEL_ENGINE;
+
+struct xdma_model {
+    XDMA_MODEL_CONFIG config;
+    uint8_t* cardMemory;
+    MODEL_ENGINE engines[2][XDMA_MODEL_MAX_CHANNELS];
+
+    // IRQ block
+    uint32_t userIntEnable;
+    uint32_t channelIntEnable;
+    uint32_t userIntRequest;
+    uint32_t userVector[4];
+    uint32_t channelVector[2];
+    uint32_t signalledChannel;  // pending bits reported to the irq callback
+    uint32_t signalledUser;
+    XDMA_MODEL_IRQ irq;
+    void* irqContext;
+    int inIrq;
+
+    // config block, indexed by register offset / 4
+    uint32_t configRegs[sizeof(XDMA_CONFIG_REGS) / sizeof(uint32_t)];
+
+    // SGDMA common block
+    uint32_t sgdmaControl;
+    uint32_t creditModeEnable;
+};
+
+// ========================= bus access ===========================================================
+
+static void* MapBus(XDMA_MODEL* model, uint64_t busAddr, size_t length)
+{
+    if (model->config.mapBus != NULL) {
+        return model->config.mapBus(model->config.mapBusContext, busAddr, length);
+    }
+    return (busAddr == 0) ? NULL : (void*)(uintptr_t)busAddr;
+}
+
+static int CardRange(XDMA_MODEL* model, uint64_t cardAddr, size_t length)
+{
+    return (cardAddr <= model->config.cardMemorySize) &&
+           (length <= model->config.cardMemorySize - cardAddr);
+}
+
+// ========================= interrupts ===========================================================
+
+static uint32_t ChannelIntRequest(XDMA_MODEL* model)
+// an engine requests an interrupt while a status bit is set which is enabled in intEnableMask
+{
+    uint32_t request = 0;
+    for (unsigned dir = 0; dir < 2; dir++) {
+        for (unsigned ch = 0; ch < XDMA_MODEL_MAX_CHANNELS; ch++) {
+            const MODEL_ENGINE* engine = &model->engines[dir][ch];
+            if (engine->present && (engine->status & engine->intEnableMask & STATUS_CLEARABLE)) {
+                request |= 1UL << engine->irqBit;
+            }
+        }
+    }
+    return request;
+}
+
+static void UpdateIrq(XDMA_MODEL* model)
+{
+    if (model->inIrq) {
+        return; // re-evaluated when the callback returns
+    }
+    model->inIrq = 1;
+    for (;;) {
+        const uint32_t channelPending = ChannelIntRequest(model) & model->channelIntEnable;
+        const uint32_t userPending = model->userIntRequest & model->userIntEnable;
+        const int raised = (channelPending & ~model->signalledChannel) ||
+                           (userPending & ~model->signalledUser);
+        model->signalledChannel = channelPending;
+        model->signalledUser = userPending;
+        if (!raised || (model->irq == NULL)) {
+            break;
+        }
+        model->irq(model->irqContext, channelPending, userPending);
+    }
+    model->inIrq = 0;
+}
+
+// ========================= engine execution =====================================================
+
+static void EngineStart(XDMA_MODEL* model, MODEL_ENGINE* engine)
+{
+    (void)model;
+    engine->status &= ~XDMA_IDLE_STOPPED_BIT;
+    engine->completedDescCount = 0;
+    engine->descAddr = ((uint64_t)engine->firstDescHi << 32) | engine->firstDescLo;
+    engine->blockLeft = (engine->firstDescAdj & XDMA_DESC_NEXT_ADJ_MASK) + 1;
+    engine->fetchPending = 1;
+    engine->busy = 1;
+}
+
+static void EngineHalt(MODEL_ENGINE* engine, uint32_t statusBits)
+{
+    engine->status |= statusBits;
+    engine->busy = 0;
+}
+
+static void SetControl(XDMA_MODEL* model, MODEL_ENGINE* engine, uint32_t value)
+{
+    const uint32_t old = engine->control;
+    engine->control = value & ~XDMA_CTRL_RST;
+    if (!(old & XDMA_CTRL_RUN_BIT) && (value & XDMA_CTRL_RUN_BIT)) {
+        EngineStart(model, engine);
+    } else if ((old & XDMA_CTRL_RUN_BIT) && !(value & XDMA_CTRL_RUN_BIT)) {
+        EngineHalt(engine, XDMA_IDLE_STOPPED_BIT);
+    }
+}
+
+static void Writeback(XDMA_MODEL* model, MODEL_ENGINE* engine, uint32_t flags)
+// poll mode: write the completed descriptor count to host memory, 'flags' = XDMA_WB_ERR_MASK when
+// the engine stopped on an error
+{
+    const uint64_t wbAddr = ((uint64_t)engine->pollModeWbHi << 32) | engine->pollModeWbLo;
+    XDMA_POLL_WB* wb = (XDMA_POLL_WB*)MapBus(model, wbAddr, sizeof(XDMA_POLL_WB));
+    if (wb == NULL) {
+        EngineHalt(engine, STATUS_WRITE_ERROR);
+        return;
+    }
+    wb->completedDescCount = (engine->completedDescCount & XDMA_WB_COUNT_MASK) | flags;
+    engine->stats.numWritebacks++;
+}
+
+static int FetchBlock(XDMA_MODEL* model, MODEL_ENGINE* engine)
+// check a descriptor block fetch against the limits the hardware requires from the driver
+{
+    const uint32_t mrrsBytes = 128UL << model->configRegs[CONFIG_REG(pcieMRRS) / 4];
+    const uint64_t blockBytes = (uint64_t)engine->blockLeft * sizeof(DMA_DESCRIPTOR);
+    if (((engine->descAddr & 0xFFF) + blockBytes > 0x1000) || (blockBytes > mrrsBytes) ||
+        (engine->descAddr & (sizeof(DMA_DESCRIPTOR) - 1))) {
+        return 0;
+    }
+    engine->stats.numFetches++;
+    engine->fetchPending = 0;
+    return 1;
+}
+
+static int Aligned(XDMA_MODEL* model, uint64_t src, uint64_t dst, uint32_t length)
+{
+    const uint32_t addrAlign = (model->config.alignments >> 16) & 0xFF;
+    const uint32_t granularity = (model->config.alignments >> 8) & 0xFF;
+    if ((addrAlign > 1) && ((src % addrAlign) || (dst % addrAlign))) {
+        return 0;
+    }
+    return (granularity <= 1) || !(length % granularity);
+}
+
+static void CopyNonIncremental(uint8_t* dst, const uint8_t* src, size_t length, size_t beat,
+                               int fixedDst)
+// non-incremental addressing: the card side address repeats every data beat
+{
+    for (size_t offset = 0; offset < length; offset += beat) {
+        const size_t n = (length - offset < beat) ? length - offset : beat;
+        memcpy(fixedDst ? dst : dst + offset, fixedDst ? src + offset : src, n);
+    }
+}
+
+static int ProcessData(XDMA_MODEL* model, MODEL_ENGINE* engine, const DMA_DESCRIPTOR* desc,
+                       uint32_t* moved)
+// returns 0 if the engine stalled without consuming the descriptor
+{
+    const uint64_t src = ((uint64_t)desc->srcAddrHi << 32) | desc->srcAddrLo;
+    const uint64_t dst = ((uint64_t)desc->dstAddrHi << 32) | desc->dstAddrLo;
+    const uint32_t length = desc->numBytes & MODEL_MAX_LENGTH;
+    const size_t beat = 8UL << model->configRegs[CONFIG_REG(pcieWidth) / 4];
+    const int nonIncr = (engine->control & XDMA_CTRL_NON_INCR_ADDR) != 0;
+    int eop = (desc->control & XDMA_DESC_EOP_BIT) != 0;
+
+    *moved = 0;
+    if (!model->config.streaming && !Aligned(model, src, dst, length)) {
+        EngineHalt(engine, XDMA_ALIGN_MISMATCH_BIT);
+        return 1;
+    }
+
+    if (engine->dir == XDMA_MODEL_H2C) {
+        const uint8_t* host = (const uint8_t*)MapBus(model, src, length);
+        if ((host == NULL) && length) {
+            EngineHalt(engine, STATUS_READ_ERROR);
+            return 1;
+        }
+        if (model->config.streaming) {
+            if (engine->stream != NULL) {
+                if (length && !engine->stream(engine->streamContext, engine->channel,
+                                              (void*)host, length, &eop)) {
+                    return 0;
+                }
+            }
+        } else {
+            if (!CardRange(model, dst, nonIncr ? (length < beat ? length : beat) : length)) {
+                EngineHalt(engine, STATUS_CARD_ERROR);
+                return 1;
+            }
+            if (nonIncr) {
+                CopyNonIncremental(model->cardMemory + dst, host, length, beat, 1);
+            } else if (length) {
+                memcpy(model->cardMemory + dst, host, length);
+            }
+        }
+        *moved = length;
+        return 1;
+    }
+
+    uint8_t* host = (uint8_t*)MapBus(model, dst, length);
+    if ((host == NULL) && length) {
+        EngineHalt(engine, STATUS_WRITE_ERROR);
+        return 1;
+    }
+    if (model->config.streaming) {
+        // the source address of a C2H streaming descriptor points to its DMA_RESULT
+        DMA_RESULT* result = (DMA_RESULT*)MapBus(model, src, sizeof(DMA_RESULT));
+        size_t produced = 0;
+        eop = 0;
+        if (result == NULL) {
+            EngineHalt(engine, STATUS_WRITE_ERROR);
+            return 1;
+        }
+        if (engine->stream != NULL) {
+            produced = engine->stream(engine->streamContext, engine->channel, host, length, &eop);
+        }
+        if (!produced && !eop) {
+            return 0;
+        }
+        result->length = (uint32_t)produced;
+        result->status = XDMA_RESULT_MAGIC | (eop ? XDMA_RESULT_EOP_BIT : 0);
+        engine->stats.numWritebacks++;
+        *moved = (uint32_t)produced;
+    } else {
+        if (!CardRange(model, src, nonIncr ? (length < beat ? length : beat) : length)) {
+            EngineHalt(engine, STATUS_CARD_ERROR);
+            return 1;
+        }
+        if (nonIncr) {
+            CopyNonIncremental(host, model->cardMemory + src, length, beat, 0);
+        } else if (length) {
+            memcpy(host, model->cardMemory + src, length);
+        }
+        *moved = length;
+    }
+    return 1;
+}
+
+static size_t EngineRun(XDMA_MODEL* model, MODEL_ENGINE* engine)
+{
+    const int creditMode = (model->creditModeEnable >> (engine->channel + 16 * engine->dir)) & 1;
+    const size_t beat = 8UL << model->configRegs[CONFIG_REG(pcieWidth) / 4];
+    size_t numProcessed = 0;
+
+    while (engine->busy && (numProcessed < MODEL_MAX_BURST)) {
+
+        if (creditMode && (engine->descCredits == 0)) {
+            engine->stats.numStalls++;
+            break;
+        }
+        if (engine->fetchPending && !FetchBlock(model, engine)) {
+            EngineHalt(engine, STATUS_DESC_ERROR);
+            break;
+        }
+        const DMA_DESCRIPTOR* fetched = (const DMA_DESCRIPTOR*)MapBus(model, engine->descAddr,
+                                                                      sizeof(DMA_DESCRIPTOR));
+        if (fetched == NULL) {
+            EngineHalt(engine, STATUS_DESC_ERROR);
+            break;
+        }
+        const DMA_DESCRIPTOR desc = *fetched;
+        if ((desc.control & 0xFFFF0000UL) != XDMA_DESC_MAGIC) {
+            EngineHalt(engine, XDMA_MAGIC_STOPPED_BIT);
+            break;
+        }
+
+        uint32_t moved;
+        if (!ProcessData(model, engine, &desc, &moved)) {
+            engine->stats.numStalls++;
+            break;
+        }
+        if (!engine->busy) { // data phase failed
+            break;
+        }
+
+        numProcessed++;
+        engine->completedDescCount++;
+        engine->stats.numDescriptors++;
+        engine->stats.numBytes += moved;
+        if (creditMode) {
+            engine->descCredits--;
+        }
+        if (engine->perfCtrl & XDMA_PERF_RUN) {
+            const uint64_t beats = (moved + beat - 1) / beat;
+            engine->perfDat += beats;
+            engine->perfCyc += beats + 1; // one cycle descriptor overhead
+        }
+
+        if (desc.control & XDMA_DESC_COMPLETED_BIT) {
+            engine->status |= XDMA_DESCRIPTOR_COMPLETED_BIT;
+        }
+        if ((engine->control & XDMA_CTRL_POLL_MODE) &&
+            (desc.control & (XDMA_DESC_COMPLETED_BIT | XDMA_DESC_STOP_BIT))) {
+            Writeback(model, engine, 0);
+        }
+        if (desc.control & XDMA_DESC_STOP_BIT) {
+            EngineHalt(engine, XDMA_DESCRIPTOR_STOPPED_BIT);
+            break;
+        }
+
+        // descriptors of one fetch block are adjacent, the hardware only follows the next pointer
+        // of the last descriptor in the block, which also gives the size of the next block
+        const uint64_t next = ((uint64_t)desc.nextHi << 32) | desc.nextLo;
+        if (--engine->blockLeft == 0) {
+            engine->descAddr = next;
+            engine->blockLeft = ((desc.control >> XDMA_DESC_NEXT_ADJ_SHIFT) &
+                                 XDMA_DESC_NEXT_ADJ_MASK) + 1;
+            engine->fetchPending = 1;
+        } else {
+            engine->descAddr += sizeof(DMA_DESCRIPTOR);
+            if (next != engine->descAddr) {
+                engine->stats.numAdjMismatches++;
+            }
+        }
+    }
+    if (!engine->busy && (engine->status & STATUS_ERRORS) &&
+        (engine->control & XDMA_CTRL_POLL_MODE)) {
+        Writeback(model, engine, XDMA_WB_ERR_MASK);
+    }
+    return numProcessed;
+}
+
+size_t xdma_model_run(XDMA_MODEL* model)
+{
+    size_t numProcessed = 0;
+    for (unsigned dir = 0; dir < 2; dir++) {
+        for (unsigned ch = 0; ch < XDMA_MODEL_MAX_CHANNELS; ch++) {
+            MODEL_ENGINE* engine = &model->engines[dir][ch];
+            if (engine->present && engine->busy) {
+                numProcessed += EngineRun(model, engine);
+            }
+        }
+    }
+    UpdateIrq(model);
+    return numProcessed;
+}
+
+// ========================= register blocks ======================================================
+
+static uint32_t BlockId(uint32_t target, unsigned channel, int streaming)
+{
+    return XDMA_ID | (target << 16) | (streaming ? XDMA_ID_ST_BIT : 0) | (channel << 8) |
+           MODEL_VERSION;
+}
+
+static uint32_t EngineRead(XDMA_MODEL* model, MODEL_ENGINE* engine, uint32_t reg)
+{
+    uint32_t value;
+    switch (reg) {
+    case ENGINE_REG(identifier):
+        return BlockId(engine->dir, engine->channel, model->config.streaming);
+    case ENGINE_REG(control):
+    case ENGINE_REG(controlW1S):
+    case ENGINE_REG(controlW1C):
+        return engine->control;
+    case ENGINE_REG(status):
+        return engine->status | (engine->busy ? XDMA_BUSY_BIT : 0);
+    case ENGINE_REG(statusRC):
+        value = engine->status | (engine->busy ? XDMA_BUSY_BIT : 0);
+        engine->status &= ~STATUS_CLEARABLE;
+        UpdateIrq(model);
+        return value;
+    case ENGINE_REG(completedDescCount):
+        return engine->completedDescCount;
+    case ENGINE_REG(alignments):
+        return model->config.alignments;
+    case ENGINE_REG(pollModeWbLo):
+        return engine->pollModeWbLo;
+    case ENGINE_REG(pollModeWbHi):
+        return engine->pollModeWbHi;
+    case ENGINE_REG(intEnableMask):
+    case ENGINE_REG(intEnableMaskW1S):
+    case ENGINE_REG(intEnableMaskW1C):
+        return engine->intEnableMask;
+    case ENGINE_REG(perfCtrl):
+        return engine->perfCtrl;
+    case ENGINE_REG(perfCycLo):
+        return (uint32_t)engine->perfCyc;
+    case ENGINE_REG(perfCycHi):
+        return (uint32_t)(engine->perfCyc >> 32);
+    case ENGINE_REG(perfDatLo):
+        return (uint32_t)engine->perfDat;
+    case ENGINE_REG(perfDatHi):
+        return (uint32_t)(engine->perfDat >> 32);
+    default:
+        return 0;
+    }
+}
+
+static void EngineWrite(XDMA_MODEL* model, MODEL_ENGINE* engine, uint32_t reg, uint32_t value)
+{
+    switch (reg) {
+    case ENGINE_REG(control):
+        SetControl(model, engine, value);
+        break;
+    case ENGINE_REG(controlW1S):
+        SetControl(model, engine, engine->control | value);
+        break;
+    case ENGINE_REG(controlW1C):
+        SetControl(model, engine, engine->control & ~value);
+        break;
+    case ENGINE_REG(status): // write 1 to clear
+        engine->status &= ~(value & STATUS_CLEARABLE);
+        break;
+    case ENGINE_REG(pollModeWbLo):
+        engine->pollModeWbLo = value;
+        break;
+    case ENGINE_REG(pollModeWbHi):
+        engine->pollModeWbHi = value;
+        break;
+    case ENGINE_REG(intEnableMask):
+        engine->intEnableMask = value;
+        break;
+    case ENGINE_REG(intEnableMaskW1S):
+        engine->intEnableMask |= value;
+        break;
+    case ENGINE_REG(intEnableMaskW1C):
+        engine->intEnableMask &= ~value;
+        break;
+    case ENGINE_REG(perfCtrl):
+        if (value & XDMA_PERF_CLEAR) {
+            engine->perfCyc = 0;
+            engine->perfDat = 0;
+        }
+        engine->perfCtrl = value & (XDMA_PERF_RUN | XDMA_PERF_AUTO);
+        break;
+    default:
+        return;
+    }
+    UpdateIrq(model);
+}
+
+static uint32_t SgdmaRead(XDMA_MODEL* model, MODEL_ENGINE* engine, uint32_t reg)
+{
+    switch (reg) {
+    case SGDMA_REG(identifier):
+        return BlockId(4 + engine->dir, engine->channel, model->config.streaming);
+    case SGDMA_REG(firstDescLo):
+        return engine->firstDescLo;
+    case SGDMA_REG(firstDescHi):
+        return engine->firstDescHi;
+    case SGDMA_REG(firstDescAdj):
+        return engine->firstDescAdj;
+    case SGDMA_REG(descCredits):
+        return engine->descCredits;
+    default:
+        return 0;
+    }
+}
+
+static void SgdmaWrite(MODEL_ENGINE* engine, uint32_t reg, uint32_t value)
+{
+    switch (reg) {
+    case SGDMA_REG(firstDescLo):
+        engine->firstDescLo = value;
+        break;
+    case SGDMA_REG(firstDescHi):
+        engine->firstDescHi = value;
+        break;
+    case SGDMA_REG(firstDescAdj):
+        engine->firstDescAdj = value & XDMA_DESC_NEXT_ADJ_MASK;
+        break;
+    case SGDMA_REG(descCredits): // writes add credits
+        engine->descCredits += value & MODEL_MAX_CREDITS;
+        if (engine->descCredits > MODEL_MAX_CREDITS) {
+            engine->descCredits = MODEL_MAX_CREDITS;
+        }
+        break;
+    default:
+        break;
+    }
+}
+
+static uint32_t IrqRead(XDMA_MODEL* model, uint32_t reg)
+{
+    switch (reg) {
+    case IRQ_REG(identifier):
+        return BlockId(2, 0, 0);
+    case IRQ_REG(userIntEnable):
+    case IRQ_REG(userIntEnableW1S):
+    case IRQ_REG(userIntEnableW1C):
+        return model->userIntEnable;
+    case IRQ_REG(channelIntEnable):
+    case IRQ_REG(channelIntEnableW1S):
+    case IRQ_REG(channelIntEnableW1C):
+        return model->channelIntEnable;
+    case IRQ_REG(userIntRequest):
+        return model->userIntRequest;
+    case IRQ_REG(channelIntRequest):
+        return ChannelIntRequest(model);
+    case IRQ_REG(userIntPending):
+        return model->userIntRequest & model->userIntEnable;
+    case IRQ_REG(channelIntPending):
+        return ChannelIntRequest(model) & model->channelIntEnable;
+    default:
+        if ((reg >= IRQ_REG(userVector)) && (reg < IRQ_REG(userVector) + sizeof(model->userVector))) {
+            return model->userVector[(reg - IRQ_REG(userVector)) / 4];
+        }
+        if ((reg >= IRQ_REG(channelVector)) &&
+            (reg < IRQ_REG(channelVector) + sizeof(model->channelVector))) {
+            return model->channelVector[(reg - IRQ_REG(channelVector)) / 4];
+        }
+        return 0;
+    }
+}
+
+static void IrqWrite(XDMA_MODEL* model, uint32_t reg, uint32_t value)
+{
+    switch (reg) {
+    case IRQ_REG(userIntEnable):
+        model->userIntEnable = value;
+        break;
+    case IRQ_REG(userIntEnableW1S):
+        model->userIntEnable |= value;
+        break;
+    case IRQ_REG(userIntEnableW1C):
+        model->userIntEnable &= ~value;
+        break;
+    case IRQ_REG(channelIntEnable):
+        model->channelIntEnable = value;
+        break;
+    case IRQ_REG(channelIntEnableW1S):
+        model->channelIntEnable |= value;
+        break;
+    case IRQ_REG(channelIntEnableW1C):
+        model->channelIntEnable &= ~value;
+        break;
+    default:
+        if ((reg >= IRQ_REG(userVector)) && (reg < IRQ_REG(userVector) + sizeof(model->userVector))) {
+            model->userVector[(reg - IRQ_REG(userVector)) / 4] = value;
+        } else if ((reg >= IRQ_REG(channelVector)) &&
+                   (reg < IRQ_REG(channelVector) + sizeof(model->channelVector))) {
+            model->channelVector[(reg - IRQ_REG(channelVector)) / 4] = value;
+        }
+        return;
+    }
+    UpdateIrq(model);
+}
+
+static uint32_t CommonRead(XDMA_MODEL* model, uint32_t reg)
+{
+    switch (reg) {
+    case COMMON_REG(identifier):
+        return BlockId(6, 0, 0);
+    case COMMON_REG(control):
+    case COMMON_REG(controlW1S):
+    case COMMON_REG(controlW1C):
+        return model->sgdmaControl;
+    case COMMON_REG(creditModeEnable):
+    case COMMON_REG(creditModeEnableW1S):
+    case COMMON_REG(creditModeEnableW1C):
+        return model->creditModeEnable;
+    default:
+        return 0;
+    }
+}
+
+static void CommonWrite(XDMA_MODEL* model, uint32_t reg, uint32_t value)
+{
+    switch (reg) {
+    case COMMON_REG(control):
+        model->sgdmaControl = value;
+        break;
+    case COMMON_REG(controlW1S):
+        model->sgdmaControl |= value;
+        break;
+    case COMMON_REG(controlW1C):
+        model->sgdmaControl &= ~value;
+        break;
+    case COMMON_REG(creditModeEnable):
+        model->creditModeEnable = value;
+        break;
+    case COMMON_REG(creditModeEnableW1S):
+        model->creditModeEnable |= value;
+        break;
+    case COMMON_REG(creditModeEnableW1C):
+        model->creditModeEnable &= ~value;
+        break;
+    default:
+        break;
+    }
+}
+
+static MODEL_ENGINE* LookupEngine(XDMA_MODEL* model, unsigned dir, uint32_t offset)
+{
+    const unsigned ch = (offset / ENGINE_OFFSET) & 0xF;
+    if (ch >= XDMA_MODEL_MAX_CHANNELS || !model->engines[dir][ch].present) {
+        return NULL;
+    }
+    return &model->engines[dir][ch];
+}
+
+uint32_t xdma_model_read32(XDMA_MODEL* model, uint32_t offset)
+{
+    const uint32_t block = (offset % XDMA_MODEL_BAR_SIZE) / BLOCK_OFFSET;
+    const uint32_t reg = offset % ENGINE_OFFSET;
+    MODEL_ENGINE* engine;
+
+    if (offset & 3) {
+        return 0;
+    }
+    switch (block) {
+    case 0:
+    case 1:
+        engine = LookupEngine(model, block, offset);
+        return engine ? EngineRead(model, engine, reg) : 0;
+    case 2:
+        return IrqRead(model, offset % BLOCK_OFFSET);
+    case 3:
+        if (offset % BLOCK_OFFSET == CONFIG_REG(identifier)) {
+            return BlockId(3, 0, 0);
+        }
+        return (offset % BLOCK_OFFSET < sizeof(XDMA_CONFIG_REGS)) ?
+            model->configRegs[(offset % BLOCK_OFFSET) / 4] : 0;
+    case 4:
+    case 5:
+        engine = LookupEngine(model, block - 4, offset);
+        return engine ? SgdmaRead(model, engine, reg) : 0;
+    case 6:
+        return CommonRead(model, offset % BLOCK_OFFSET);
+    default:
+        return 0;
+    }
+}
+
+void xdma_model_write32(XDMA_MODEL* model, uint32_t offset, uint32_t value)
+{
+    const uint32_t block = (offset % XDMA_MODEL_BAR_SIZE) / BLOCK_OFFSET;
+    const uint32_t reg = offset % ENGINE_OFFSET;
+    MODEL_ENGINE* engine;
+
+    if (offset & 3) {
+        return;
+    }
+    switch (block) {
+    case 0:
+    case 1:
+        engine = LookupEngine(model, block, offset);
+        if (engine != NULL) {
+            EngineWrite(model, engine, reg, value);
+        }
+        break;
+    case 2:
+        IrqWrite(model, offset % BLOCK_OFFSET, value);
+        break;
+    case 3:
+        // everything but the identifier and the link status (MPS, MRRS, width) is writable
+        switch (offset % BLOCK_OFFSET) {
+        case CONFIG_REG(identifier):
+        case CONFIG_REG(busDev):
+        case CONFIG_REG(pcieMPS):
+        case CONFIG_REG(pcieMRRS):
+        case CONFIG_REG(pcieWidth):
+            break;
+        default:
+            if (offset % BLOCK_OFFSET < sizeof(XDMA_CONFIG_REGS)) {
+                model->configRegs[(offset % BLOCK_OFFSET) / 4] = value;
+            }
+            break;
+        }
+        break;
+    case 4:
+    case 5:
+        engine = LookupEngine(model, block - 4, offset);
+        if (engine != NULL) {
+            SgdmaWrite(engine, reg, value);
+        }
+        break;
+    case 6:
+        CommonWrite(model, offset % BLOCK_OFFSET, value);
+        break;
+    default:
+        break;
+    }
+}
+
+// ========================= model management =====================================================
+
+void xdma_model_config_init(XDMA_MODEL_CONFIG* config)
+{
+    memset(config, 0, sizeof(*config));
+    config->numH2C = XDMA_MODEL_MAX_CHANNELS;
+    config->numC2H = XDMA_MODEL_MAX_CHANNELS;
+    config->cardMemorySize = 64UL * 1024UL * 1024UL;
+    config->alignments = (1UL << 16) | (1UL << 8) | 64UL;
+    config->pcieMPS = 0;  // 128 bytes
+    config->pcieMRRS = 2; // 512 bytes
+    config->pcieWidth = 1; // 128 bit
+}
+
+XDMA_MODEL* xdma_model_create(const XDMA_MODEL_CONFIG* config)
+{
+    if ((config->numH2C > XDMA_MODEL_MAX_CHANNELS) || (config->numC2H > XDMA_MODEL_MAX_CHANNELS) ||
+        (config->pcieMRRS > 5) || (config->pcieWidth > 3)) {
+        return NULL;
+    }
+
+    XDMA_MODEL* model = (XDMA_MODEL*)calloc(1, sizeof(XDMA_MODEL));
+    if (model == NULL) {
+        return NULL;
+    }
+    model->config = *config;
+    if (!config->streaming && config->cardMemorySize) {
+        model->cardMemory = (uint8_t*)calloc(1, config->cardMemorySize);
+        if (model->cardMemory == NULL) {
+            free(model);
+            return NULL;
+        }
+    } else {
+        model->config.cardMemorySize = 0;
+    }
+
+    // channel interrupt bits are assigned to the present engines in order, H2C first
+    unsigned irqBit = 0;
+    for (unsigned dir = 0; dir < 2; dir++) {
+        const unsigned numChannels = (dir == XDMA_MODEL_H2C) ? config->numH2C : config->numC2H;
+        for (unsigned ch = 0; ch < numChannels; ch++) {
+            MODEL_ENGINE* engine = &model->engines[dir][ch];
+            engine->present = 1;
+            engine->dir = (XDMA_MODEL_DIR)dir;
+            engine->channel = ch;
+            engine->irqBit = irqBit++;
+        }
+    }
+    model->configRegs[CONFIG_REG(pcieMPS) / 4] = config->pcieMPS;
+    model->configRegs[CONFIG_REG(pcieMRRS) / 4] = config->pcieMRRS;
+    model->configRegs[CONFIG_REG(pcieWidth) / 4] = config->pcieWidth;
+    model->configRegs[CONFIG_REG(msiEnable) / 4] = 1;
+    return model;
+}
+
+void xdma_model_destroy(XDMA_MODEL* model)
+{
+    if (model != NULL) {
+        free(model->cardMemory);
+        free(model);
+    }
+}
+
+uint8_t* xdma_model_card_memory(XDMA_MODEL* model, size_t* size)
+{
+    if (size != NULL) {
+        *size = model->config.cardMemorySize;
+    }
+    return model->cardMemory;
+}
+
+void xdma_model_set_stream(XDMA_MODEL* model, XDMA_MODEL_DIR dir, unsigned channel,
+                           XDMA_MODEL_STREAM stream, void* context)
+{
+    if (channel < XDMA_MODEL_MAX_CHANNELS) {
+        model->engines[dir][channel].stream = stream;
+        model->engines[dir][channel].streamContext = context;
+    }
+}
+
+void xdma_model_set_irq(XDMA_MODEL* model, XDMA_MODEL_IRQ irq, void* context)
+{
+    model->irq = irq;
+    model->irqContext = context;
+    UpdateIrq(model);
+}
+
+void xdma_model_user_irq(XDMA_MODEL* model, unsigned id, int asserted)
+{
+    if (id >= 16) {
+        return;
+    }
+    if (asserted) {
+        model->userIntRequest |= 1UL << id;
+    } else {
+        model->userIntRequest &= ~(1UL << id);
+    }
+    UpdateIrq(model);
+}
+
+void xdma_model_get_stats(XDMA_MODEL* model, XDMA_MODEL_DIR dir, unsigned channel,
+                          XDMA_MODEL_STATS* stats, int clear)
+{
+    if (channel >= XDMA_MODEL_MAX_CHANNELS) {
+        memset(stats, 0, sizeof(*stats));
+        return;
+    }
+    *stats = model->engines[dir][channel].stats;
+    if (clear) {
+        memset(&model->engines[dir][channel].stats, 0, sizeof(XDMA_MODEL_STATS));
+    }
+}
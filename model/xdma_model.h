@@ -0,0 +1,129 @@
+/*
+* XDMA Software Model
+* ===============================
+*
+* Copyright 2017 Xilinx Inc.
+*
+* Description:
+* ------------
+* Register level model of the XDMA IP for host-side testing and benchmarking without a card.
+* The model implements the register blocks of libxdma/reg.h (engine, SGDMA, SGDMA common, IRQ and
+* config) and executes descriptor chains which reside in host memory, moving data between host
+* buffers and a simulated card memory (AXI-MM) or user supplied stream callbacks (AXI-ST).
+*
+* The model is not clocked. Register accesses take effect immediately, but started engines only
+* make progress in xdma_model_run(), which makes every run deterministic. The model is not thread
+* safe - callers serialize all calls on one model instance.
+*
+* References:
+* -----------
+*	[1] pg195-pcie-dma.pdf - DMA/Bridge Subsystem for PCI Express v4.0 - Product Guide
+*/
+
+#pragma once
+
+// ========================= include dependencies =================================================
+
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// ========================= declarations =========================================================
+
+#define XDMA_MODEL_MAX_CHANNELS     (4)
+#define XDMA_MODEL_BAR_SIZE         (0x10000)   // size of the config BAR decoded by the model
+
+typedef enum {
+    XDMA_MODEL_H2C = 0,
+    XDMA_MODEL_C2H = 1,
+} XDMA_MODEL_DIR;
+
+typedef struct xdma_model XDMA_MODEL;
+
+/// Translate a bus address found in a descriptor into a host pointer valid for 'length' bytes.
+/// Returns NULL if the range is not mapped, which the model reports as a read/write error.
+typedef void* (*XDMA_MODEL_MAP_BUS)(void* context, uint64_t busAddr, size_t length);
+
+/// AXI-ST data callback of a channel.
+/// - H2C: the sink consumes 'length' bytes of 'data'; '*eop' is set if the descriptor had EOP set.
+///        Returns the number of bytes accepted; 0 stalls the engine until the next run.
+/// - C2H: the source fills up to 'length' bytes of 'data' and sets '*eop' at the end of a packet.
+///        Returns the number of bytes produced; 0 without eop stalls the engine until the next run.
+typedef size_t (*XDMA_MODEL_STREAM)(void* context, unsigned channel, void* data, size_t length,
+                                    int* eop);
+
+/// Interrupt callback. Called from the model whenever a channel or user interrupt becomes pending
+/// (request and enable both set); the arguments are the channelIntPending/userIntPending values.
+/// Registers may be accessed from the callback.
+typedef void (*XDMA_MODEL_IRQ)(void* context, uint32_t channelPending, uint32_t userPending);
+
+typedef struct {
+    unsigned numH2C;            // number of H2C channels, 0..4
+    unsigned numC2H;            // number of C2H channels, 0..4
+    int streaming;              // AXI-ST instead of AXI-MM user interface
+    size_t cardMemorySize;      // size of the simulated AXI-MM card memory in bytes
+    uint32_t alignments;        // engine alignments register: addr align, length granularity, bits
+    uint32_t pcieMPS;           // config block pcieMPS: 128 << mps bytes
+    uint32_t pcieMRRS;          // config block pcieMRRS: 128 << mrrs bytes max descriptor fetch
+    uint32_t pcieWidth;         // config block pcieWidth: 64 << width bit data path
+    XDMA_MODEL_MAP_BUS mapBus;  // bus address translation, NULL = bus address is a host pointer
+    void* mapBusContext;
+} XDMA_MODEL_CONFIG;
+
+/// Event counters of one engine, for checking and benchmarking the descriptor handling of a driver
+typedef struct {
+    uint64_t numDescriptors;    // descriptors processed
+    uint64_t numFetches;        // descriptor block fetches, 1 + nextAdj descriptors each
+    uint64_t numBytes;          // data bytes moved
+    uint64_t numAdjMismatches;  // descriptors whose next pointer disagreed with the fetch block
+    uint64_t numStalls;         // runs in which the engine waited for credits or stream data
+    uint64_t numWritebacks;     // poll mode and stream result writebacks
+} XDMA_MODEL_STATS;
+
+// ========================= function declarations ================================================
+
+/// Fill a configuration with defaults: 4 H2C/4 C2H AXI-MM channels, 64MB card memory, no alignment
+/// requirements, 512 byte MRRS, 128 bit data path and identity bus addresses
+void xdma_model_config_init(XDMA_MODEL_CONFIG* config);
+
+/// Create a model in its reset state. Returns NULL on invalid configuration or out of memory
+XDMA_MODEL* xdma_model_create(const XDMA_MODEL_CONFIG* config);
+
+void xdma_model_destroy(XDMA_MODEL* model);
+
+/// Read a 32-bit register at a byte offset into the config BAR, with the side effects of the IP
+/// (e.g. statusRC clears the engine status). Unimplemented offsets read as zero.
+uint32_t xdma_model_read32(XDMA_MODEL* model, uint32_t offset);
+
+/// Write a 32-bit register at a byte offset into the config BAR, with the side effects of the IP
+/// (W1S/W1C mirrors, engine start/stop, descriptor credits). Writes to read-only or unimplemented
+/// offsets are ignored.
+void xdma_model_write32(XDMA_MODEL* model, uint32_t offset, uint32_t value);
+
+/// Let all running engines process descriptors until they stop, fail, stall or reach a burst limit.
+/// Returns the number of descriptors processed; 0 means no engine could make progress.
+size_t xdma_model_run(XDMA_MODEL* model);
+
+/// Simulated AXI-MM card memory
+uint8_t* xdma_model_card_memory(XDMA_MODEL* model, size_t* size);
+
+/// Set the AXI-ST data callback of a channel. Without a callback H2C data is discarded and C2H
+/// engines stall.
+void xdma_model_set_stream(XDMA_MODEL* model, XDMA_MODEL_DIR dir, unsigned channel,
+                           XDMA_MODEL_STREAM stream, void* context);
+
+void xdma_model_set_irq(XDMA_MODEL* model, XDMA_MODEL_IRQ irq, void* context);
+
+/// Drive a user interrupt line of the user logic. The request stays set until cleared.
+void xdma_model_user_irq(XDMA_MODEL* model, unsigned id, int asserted);
+
+/// Read (and optionally clear) the event counters of an engine
+void xdma_model_get_stats(XDMA_MODEL* model, XDMA_MODEL_DIR dir, unsigned channel,
+                          XDMA_MODEL_STATS* stats, int clear);
+
+#ifdef __cplusplus
+}
+#endif
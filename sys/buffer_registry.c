@@ -0,0 +1,532 @@
+/*
+* XDMA Registered User Buffers
+* ===============================
+*
+* Copyright 2017 Xilinx Inc.
+*
+* Description:
+* ------------
+* A ReadFile()/WriteFile() transfer probes and locks the user buffer and builds a new
+* scatter-gather list every time. A registered buffer is locked once and its scatter-gather list
+* is kept until the buffer is deregistered, a transfer only slices the cached list and starts the
+* engine through the direct transfer interface of libxdma (see XDMA_EngineClaimDirect).
+*
+* Transfers which are repeated unchanged can be compiled into a descriptor program once (see
+* EngineProgramCompile), launching it then only points the engine at the program's descriptors.
+*
+* Transfers and launches are requests forwarded to the sequential engine queue, so there is at
+* most one transfer per engine and registry in flight.
+*/
+
+// ========================= include dependencies =================================================
+
+#include "driver.h"
+#include "dma_engine.h"
+#include "xdma_public.h"
+#include "buffer_registry.h"
+
+#include "trace.h"
+#ifdef DBG
+// The trace message header (.tmh) file must be included in a source file before any WPP macro
+// calls and after defining a WPP_CONTROL_GUIDS macro (defined in trace.h). see trace.h
+#include "buffer_registry.tmh"
+#endif
+
+// ========================= definitions ==========================================================
+
+#define BUFFER_REGISTRY_POOL_TAG        ('RmdX')
+#define BUFFER_REGISTRY_DRAIN_TIMEOUT_MS (5000)
+
+typedef struct _REGISTERED_BUFFER {
+    PMDL mdl;                       // NULL if the slot is free
+    ULONG length;
+    PSCATTER_GATHER_LIST sgList;    // whole buffer, held until deregistration
+    PSCATTER_GATHER_LIST slice;     // part of sgList used by the current transfer
+    volatile LONG inUse;            // transfers in flight
+    ULONG numPrograms;              // programs compiled from this buffer
+} REGISTERED_BUFFER;
+
+typedef struct _REGISTRY_PROGRAM {
+    XDMA_PROGRAM program;           // program.descBuffer is NULL if the slot is free
+    REGISTERED_BUFFER* buffer;
+    volatile LONG inUse;            // launches in flight
+} REGISTRY_PROGRAM;
+
+struct _BUFFER_REGISTRY {
+    XDMA_ENGINE* engine;
+    PDMA_ADAPTER adapter;           // WDM adapter of the engine's transfer direction
+    PDEVICE_OBJECT deviceObject;
+    BOOLEAN writeToDevice;
+    KSPIN_LOCK lock;                // protects the buffer and program slots
+    REGISTERED_BUFFER buffers[XDMA_MAX_REGISTERED_BUFFERS];
+    REGISTRY_PROGRAM programs[XDMA_MAX_PROGRAMS];
+    WDFREQUEST request;             // transfer in flight
+    KEVENT idle;                    // signaled while no transfer is in flight
+    REGISTERED_BUFFER* active;
+    REGISTRY_PROGRAM* activeProgram; // NULL unless the transfer in flight is a launch
+};
+
+typedef struct _SG_LIST_WAIT {
+    PSCATTER_GATHER_LIST sgList;
+    KEVENT done;
+} SG_LIST_WAIT;
+
+// ========================= helpers ==============================================================
+
+static VOID RegistryListReady(IN PDEVICE_OBJECT deviceObject, IN PIRP irp,
+                              IN PSCATTER_GATHER_LIST sgList, IN PVOID context)
+// DRIVER_LIST_CONTROL - keep the list, it is put back on deregistration
+{
+    UNREFERENCED_PARAMETER(deviceObject);
+    UNREFERENCED_PARAMETER(irp);
+    SG_LIST_WAIT* wait = (SG_LIST_WAIT*)context;
+    wait->sgList = sgList;
+    KeSetEvent(&wait->done, IO_NO_INCREMENT, FALSE);
+}
+
+static VOID RegistryFreeBuffer(IN BUFFER_REGISTRY* registry, IN REGISTERED_BUFFER* buffer)
+// buffer is detached from the registry and not in use
+{
+    if (buffer->sgList != NULL) {
+        KIRQL irql;
+        KeRaiseIrql(DISPATCH_LEVEL, &irql);
+        registry->adapter->DmaOperations->PutScatterGatherList(registry->adapter, buffer->sgList,
+                                                               registry->writeToDevice);
+        KeLowerIrql(irql);
+        buffer->sgList = NULL;
+    }
+    if (buffer->slice != NULL) {
+        ExFreePoolWithTag(buffer->slice, BUFFER_REGISTRY_POOL_TAG);
+        buffer->slice = NULL;
+    }
+    if (buffer->mdl != NULL) {
+        MmUnlockPages(buffer->mdl);
+        IoFreeMdl(buffer->mdl);
+        buffer->mdl = NULL;
+    }
+}
+
+static VOID RegistrySlice(IN PSCATTER_GATHER_LIST src, OUT PSCATTER_GATHER_LIST dst,
+                          IN ULONG offset, IN ULONG length)
+// describe bytes [offset, offset + length) of the buffer mapped by 'src' in 'dst'
+{
+    ULONG n = 0;
+
+    for (ULONG i = 0; (i < src->NumberOfElements) && (length != 0); i++) {
+        const ULONG elementLength = src->Elements[i].Length;
+        if (offset >= elementLength) {
+            offset -= elementLength;
+            continue;
+        }
+        const ULONG chunk = min(elementLength - offset, length);
+        dst->Elements[n].Address.QuadPart = src->Elements[i].Address.QuadPart + offset;
+        dst->Elements[n].Length = chunk;
+        dst->Elements[n].Reserved = 0;
+        n++;
+        length -= chunk;
+        offset = 0;
+    }
+    dst->NumberOfElements = n;
+    dst->Reserved = 0;
+}
+
+static VOID RegistryTransferDone(IN XDMA_ENGINE* engine, IN PVOID context, IN NTSTATUS status,
+                                 IN ULONG numBytes)
+// PFN_XDMA_DIRECT_DONE, called from the engine DPC
+{
+    BUFFER_REGISTRY* registry = (BUFFER_REGISTRY*)context;
+    WDFREQUEST request = registry->request;
+    REGISTERED_BUFFER* buffer = registry->active;
+    REGISTRY_PROGRAM* program = registry->activeProgram;
+    registry->request = NULL;
+    registry->active = NULL;
+    registry->activeProgram = NULL;
+
+    // give the engine back to the queue before the next request is dispatched
+    XDMA_EngineReleaseDirect(engine);
+    InterlockedDecrement(&buffer->inUse);
+    if (program != NULL) {
+        InterlockedDecrement(&program->inUse);
+    }
+    // last access to the registry, BufferRegistryDestroy may free it from here on
+    KeSetEvent(&registry->idle, IO_NO_INCREMENT, FALSE);
+
+    size_t information = 0;
+    if (program != NULL) {
+        XDMA_PROGRAM_LAUNCH* params = NULL;
+        if (NT_SUCCESS(WdfRequestRetrieveOutputBuffer(request, sizeof(XDMA_PROGRAM_LAUNCH),
+                                                      (PVOID*)&params, NULL))) {
+            params->transferred = numBytes;
+            information = sizeof(XDMA_PROGRAM_LAUNCH);
+        }
+    } else {
+        XDMA_BUFFER_TRANSFER* params = NULL;
+        if (NT_SUCCESS(WdfRequestRetrieveOutputBuffer(request, sizeof(XDMA_BUFFER_TRANSFER),
+                                                      (PVOID*)&params, NULL))) {
+            params->transferred = numBytes;
+            information = sizeof(XDMA_BUFFER_TRANSFER);
+        }
+    }
+    WdfRequestCompleteWithInformation(request, status, information);
+}
+
+// ========================= public interface =====================================================
+
+NTSTATUS BufferRegistryCreate(IN DeviceContext* ctx, IN XDMA_ENGINE* engine,
+                              OUT BUFFER_REGISTRY** result) {
+
+    BUFFER_REGISTRY* registry = (BUFFER_REGISTRY*)ExAllocatePoolWithTag(NonPagedPoolNx,
+                                                                        sizeof(BUFFER_REGISTRY),
+                                                                        BUFFER_REGISTRY_POOL_TAG);
+    if (registry == NULL) {
+        return STATUS_INSUFFICIENT_RESOURCES;
+    }
+    RtlZeroMemory(registry, sizeof(BUFFER_REGISTRY));
+    registry->engine = engine;
+    registry->writeToDevice = (engine->dir == H2C);
+    registry->adapter = WdfDmaEnablerWdmGetDmaAdapter(ctx->xdma.dmaEnabler, registry->writeToDevice ?
+                                                      WdfDmaDirectionWriteToDevice :
+                                                      WdfDmaDirectionReadFromDevice);
+    registry->deviceObject = WdfDeviceWdmGetDeviceObject(ctx->xdma.wdfDevice);
+    KeInitializeSpinLock(&registry->lock);
+    KeInitializeEvent(&registry->idle, NotificationEvent, TRUE);
+
+    *result = registry;
+    return STATUS_SUCCESS;
+}
+
+NTSTATUS BufferRegistryAdd(IN BUFFER_REGISTRY* registry, IN UINT64 address, IN ULONG length,
+                           OUT ULONG* handle) {
+
+    if (length == 0) {
+        TraceError(DBG_IO, "Error: cannot register an empty buffer");
+        return STATUS_INVALID_PARAMETER;
+    }
+
+    REGISTERED_BUFFER buffer = { 0 };
+    buffer.length = length;
+    NTSTATUS status = STATUS_SUCCESS;
+
+    // lock the pages of the calling process
+    buffer.mdl = IoAllocateMdl((PVOID)(ULONG_PTR)address, length, FALSE, FALSE, NULL);
+    if (buffer.mdl == NULL) {
+        TraceError(DBG_IO, "IoAllocateMdl failed for %u bytes at 0x%llx", length, address);
+        return STATUS_INSUFFICIENT_RESOURCES;
+    }
+    __try {
+        MmProbeAndLockPages(buffer.mdl, UserMode, registry->writeToDevice ? IoReadAccess : IoWriteAccess);
+    } __except (EXCEPTION_EXECUTE_HANDLER) {
+        status = GetExceptionCode();
+    }
+    if (!NT_SUCCESS(status)) {
+        TraceError(DBG_IO, "MmProbeAndLockPages failed for 0x%llx: %!STATUS!", address, status);
+        IoFreeMdl(buffer.mdl);
+        return status;
+    }
+
+    // map the whole buffer for DMA once
+    SG_LIST_WAIT wait;
+    wait.sgList = NULL;
+    KeInitializeEvent(&wait.done, NotificationEvent, FALSE);
+    KIRQL irql;
+    KeRaiseIrql(DISPATCH_LEVEL, &irql);
+    status = registry->adapter->DmaOperations->GetScatterGatherList(registry->adapter,
+                                                                    registry->deviceObject,
+                                                                    buffer.mdl,
+                                                                    MmGetMdlVirtualAddress(buffer.mdl),
+                                                                    length, RegistryListReady,
+                                                                    &wait, registry->writeToDevice);
+    KeLowerIrql(irql);
+    if (!NT_SUCCESS(status)) {
+        TraceError(DBG_IO, "GetScatterGatherList failed: %!STATUS!", status);
+        goto ErrExit;
+    }
+    KeWaitForSingleObject(&wait.done, Executive, KernelMode, FALSE, NULL);
+    buffer.sgList = wait.sgList;
+
+    // room for the largest slice - a transfer never has more elements than the whole buffer
+    const ULONG numElements = min(buffer.sgList->NumberOfElements, XDMA_MAX_DESCRIPTORS);
+    buffer.slice = (PSCATTER_GATHER_LIST)ExAllocatePoolWithTag(NonPagedPoolNx,
+                                                               FIELD_OFFSET(SCATTER_GATHER_LIST, Elements[numElements]),
+                                                               BUFFER_REGISTRY_POOL_TAG);
+    if (buffer.slice == NULL) {
+        status = STATUS_INSUFFICIENT_RESOURCES;
+        goto ErrExit;
+    }
+
+    // find a free slot
+    status = STATUS_INSUFFICIENT_RESOURCES;
+    KeAcquireSpinLock(&registry->lock, &irql);
+    for (ULONG i = 0; i < XDMA_MAX_REGISTERED_BUFFERS; i++) {
+        if (registry->buffers[i].mdl == NULL) {
+            registry->buffers[i] = buffer;
+            *handle = i;
+            status = STATUS_SUCCESS;
+            break;
+        }
+    }
+    KeReleaseSpinLock(&registry->lock, irql);
+    if (!NT_SUCCESS(status)) {
+        TraceError(DBG_IO, "Error: all %u buffer slots in use", XDMA_MAX_REGISTERED_BUFFERS);
+        goto ErrExit;
+    }
+
+    TraceInfo(DBG_IO, "%s_%u registered buffer %u: %u bytes, %u elements",
+              DirectionToString(registry->engine->dir), registry->engine->channel, *handle,
+              length, buffer.sgList->NumberOfElements);
+    return STATUS_SUCCESS;
+
+ErrExit:
+    RegistryFreeBuffer(registry, &buffer);
+    return status;
+}
+
+NTSTATUS BufferRegistryRemove(IN BUFFER_REGISTRY* registry, IN ULONG handle) {
+
+    if (handle >= XDMA_MAX_REGISTERED_BUFFERS) {
+        return STATUS_INVALID_HANDLE;
+    }
+
+    REGISTERED_BUFFER buffer = { 0 };
+    NTSTATUS status = STATUS_SUCCESS;
+    KIRQL irql;
+    KeAcquireSpinLock(&registry->lock, &irql);
+    if (registry->buffers[handle].mdl == NULL) {
+        status = STATUS_INVALID_HANDLE;
+    } else if ((registry->buffers[handle].inUse != 0) || (registry->buffers[handle].numPrograms != 0)) {
+        status = STATUS_DEVICE_BUSY;
+    } else {
+        buffer = registry->buffers[handle];
+        RtlZeroMemory(&registry->buffers[handle], sizeof(REGISTERED_BUFFER));
+    }
+    KeReleaseSpinLock(&registry->lock, irql);
+
+    if (NT_SUCCESS(status)) {
+        RegistryFreeBuffer(registry, &buffer);
+    }
+    TraceInfo(DBG_IO, "%s_%u deregister buffer %u: %!STATUS!",
+              DirectionToString(registry->engine->dir), registry->engine->channel, handle, status);
+    return status;
+}
+
+NTSTATUS BufferRegistryStartTransfer(IN BUFFER_REGISTRY* registry, IN WDFREQUEST request,
+                                     IN XDMA_BUFFER_TRANSFER* params) {
+
+    if ((params->handle >= XDMA_MAX_REGISTERED_BUFFERS) || (params->length == 0) ||
+        (params->length > XDMA_MAX_TRANSFER_SIZE)) {
+        TraceError(DBG_IO, "Error: invalid handle %u or length %u", params->handle, params->length);
+        return STATUS_INVALID_PARAMETER;
+    }
+
+    REGISTERED_BUFFER* buffer = &registry->buffers[params->handle];
+    NTSTATUS status = STATUS_SUCCESS;
+    KIRQL irql;
+    KeAcquireSpinLock(&registry->lock, &irql);
+    if (buffer->mdl == NULL) {
+        status = STATUS_INVALID_HANDLE;
+    } else if ((UINT64)params->offset + params->length > buffer->length) {
+        status = STATUS_INVALID_PARAMETER;
+    } else {
+        InterlockedIncrement(&buffer->inUse); // keeps the buffer registered
+    }
+    KeReleaseSpinLock(&registry->lock, irql);
+    if (!NT_SUCCESS(status)) {
+        TraceError(DBG_IO, "Error: buffer %u, offset %u, length %u: %!STATUS!",
+                   params->handle, params->offset, params->length, status);
+        return status;
+    }
+
+    RegistrySlice(buffer->sgList, buffer->slice, params->offset, params->length);
+    registry->request = request;
+    registry->active = buffer;
+    KeClearEvent(&registry->idle);
+
+    // the engine queue is sequential, the engine is idle unless claimed by a submission queue
+    status = XDMA_EngineClaimDirect(registry->engine, RegistryTransferDone, registry);
+    if (!NT_SUCCESS(status)) {
+        registry->request = NULL;
+        registry->active = NULL;
+        InterlockedDecrement(&buffer->inUse);
+        KeSetEvent(&registry->idle, IO_NO_INCREMENT, FALSE);
+        return status;
+    }
+    EngineDirectStart(registry->engine, buffer->slice, (LONGLONG)params->deviceOffset);
+    return STATUS_SUCCESS;
+}
+
+NTSTATUS BufferRegistryCompile(IN BUFFER_REGISTRY* registry, IN XDMA_PROGRAM_CREATE* params,
+                               OUT ULONG* programId) {
+
+    if ((params->handle >= XDMA_MAX_REGISTERED_BUFFERS) || (params->length == 0) ||
+        (params->length > XDMA_MAX_TRANSFER_SIZE)) {
+        TraceError(DBG_IO, "Error: invalid handle %u or length %u", params->handle, params->length);
+        return STATUS_INVALID_PARAMETER;
+    }
+
+    REGISTERED_BUFFER* buffer = &registry->buffers[params->handle];
+    NTSTATUS status = STATUS_SUCCESS;
+    KIRQL irql;
+    KeAcquireSpinLock(&registry->lock, &irql);
+    if (buffer->mdl == NULL) {
+        status = STATUS_INVALID_HANDLE;
+    } else if ((UINT64)params->offset + params->length > buffer->length) {
+        status = STATUS_INVALID_PARAMETER;
+    } else {
+        buffer->numPrograms++; // keeps the buffer registered
+    }
+    KeReleaseSpinLock(&registry->lock, irql);
+    if (!NT_SUCCESS(status)) {
+        TraceError(DBG_IO, "Error: buffer %u, offset %u, length %u: %!STATUS!",
+                   params->handle, params->offset, params->length, status);
+        return status;
+    }
+
+    // the buffer's own slice may be used by a transfer right now
+    const ULONG numElements = buffer->sgList->NumberOfElements;
+    PSCATTER_GATHER_LIST slice = (PSCATTER_GATHER_LIST)ExAllocatePoolWithTag(NonPagedPoolNx,
+                                                                             FIELD_OFFSET(SCATTER_GATHER_LIST, Elements[numElements]),
+                                                                             BUFFER_REGISTRY_POOL_TAG);
+    REGISTRY_PROGRAM entry = { 0 };
+    if (slice == NULL) {
+        status = STATUS_INSUFFICIENT_RESOURCES;
+        goto ErrExit;
+    }
+    RegistrySlice(buffer->sgList, slice, params->offset, params->length);
+    status = EngineProgramCompile(registry->engine, slice, (LONGLONG)params->deviceOffset,
+                                  &entry.program);
+    ExFreePoolWithTag(slice, BUFFER_REGISTRY_POOL_TAG);
+    if (!NT_SUCCESS(status)) {
+        goto ErrExit;
+    }
+    entry.buffer = buffer;
+
+    // find a free slot
+    status = STATUS_INSUFFICIENT_RESOURCES;
+    KeAcquireSpinLock(&registry->lock, &irql);
+    for (ULONG i = 0; i < XDMA_MAX_PROGRAMS; i++) {
+        if (registry->programs[i].program.descBuffer == NULL) {
+            registry->programs[i] = entry;
+            *programId = i;
+            status = STATUS_SUCCESS;
+            break;
+        }
+    }
+    KeReleaseSpinLock(&registry->lock, irql);
+    if (!NT_SUCCESS(status)) {
+        TraceError(DBG_IO, "Error: all %u program slots in use", XDMA_MAX_PROGRAMS);
+        EngineProgramDelete(&entry.program);
+        goto ErrExit;
+    }
+    return STATUS_SUCCESS;
+
+ErrExit:
+    KeAcquireSpinLock(&registry->lock, &irql);
+    buffer->numPrograms--;
+    KeReleaseSpinLock(&registry->lock, irql);
+    return status;
+}
+
+NTSTATUS BufferRegistryDeleteProgram(IN BUFFER_REGISTRY* registry, IN ULONG programId) {
+
+    if (programId >= XDMA_MAX_PROGRAMS) {
+        return STATUS_INVALID_HANDLE;
+    }
+
+    REGISTRY_PROGRAM entry = { 0 };
+    NTSTATUS status = STATUS_SUCCESS;
+    KIRQL irql;
+    KeAcquireSpinLock(&registry->lock, &irql);
+    if (registry->programs[programId].program.descBuffer == NULL) {
+        status = STATUS_INVALID_HANDLE;
+    } else if (registry->programs[programId].inUse != 0) {
+        status = STATUS_DEVICE_BUSY;
+    } else {
+        entry = registry->programs[programId];
+        entry.buffer->numPrograms--;
+        RtlZeroMemory(&registry->programs[programId], sizeof(REGISTRY_PROGRAM));
+    }
+    KeReleaseSpinLock(&registry->lock, irql);
+
+    if (NT_SUCCESS(status)) {
+        EngineProgramDelete(&entry.program);
+    }
+    TraceInfo(DBG_IO, "%s_%u delete program %u: %!STATUS!",
+              DirectionToString(registry->engine->dir), registry->engine->channel, programId, status);
+    return status;
+}
+
+NTSTATUS BufferRegistryLaunch(IN BUFFER_REGISTRY* registry, IN WDFREQUEST request,
+                              IN ULONG programId) {
+
+    if (programId >= XDMA_MAX_PROGRAMS) {
+        return STATUS_INVALID_HANDLE;
+    }
+
+    REGISTRY_PROGRAM* program = &registry->programs[programId];
+    NTSTATUS status = STATUS_SUCCESS;
+    KIRQL irql;
+    KeAcquireSpinLock(&registry->lock, &irql);
+    if (program->program.descBuffer == NULL) {
+        status = STATUS_INVALID_HANDLE;
+    } else {
+        InterlockedIncrement(&program->inUse); // keeps program and buffer in place
+        InterlockedIncrement(&program->buffer->inUse);
+    }
+    KeReleaseSpinLock(&registry->lock, irql);
+    if (!NT_SUCCESS(status)) {
+        TraceError(DBG_IO, "Error: no program %u", programId);
+        return status;
+    }
+
+    registry->request = request;
+    registry->active = program->buffer;
+    registry->activeProgram = program;
+    KeClearEvent(&registry->idle);
+
+    status = XDMA_EngineClaimDirect(registry->engine, RegistryTransferDone, registry);
+    if (!NT_SUCCESS(status)) {
+        registry->request = NULL;
+        registry->active = NULL;
+        registry->activeProgram = NULL;
+        InterlockedDecrement(&program->buffer->inUse);
+        InterlockedDecrement(&program->inUse);
+        KeSetEvent(&registry->idle, IO_NO_INCREMENT, FALSE);
+        return status;
+    }
+    EngineProgramLaunch(registry->engine, &program->program);
+    return STATUS_SUCCESS;
+}
+
+VOID BufferRegistryDestroy(IN BUFFER_REGISTRY* registry) {
+
+    // a transfer of this file may still be in flight
+    LARGE_INTEGER timeout;
+    timeout.QuadPart = WDF_REL_TIMEOUT_IN_MS(BUFFER_REGISTRY_DRAIN_TIMEOUT_MS);
+    if (KeWaitForSingleObject(&registry->idle, Executive, KernelMode, FALSE, &timeout) == STATUS_TIMEOUT) {
+        TraceError(DBG_IO, "Error: transfer did not complete, stopping %s_%u",
+                   DirectionToString(registry->engine->dir), registry->engine->channel);
+        EngineStop(registry->engine);
+        registry->engine->direct.numDescriptors = 0;
+        KeFlushQueuedDpcs(); // a completion racing with the timeout has finished now
+        if (registry->request != NULL) {
+            WDFREQUEST request = registry->request;
+            InterlockedDecrement(&registry->active->inUse);
+            if (registry->activeProgram != NULL) {
+                InterlockedDecrement(&registry->activeProgram->inUse);
+            }
+            registry->request = NULL;
+            registry->active = NULL;
+            registry->activeProgram = NULL;
+            XDMA_EngineReleaseDirect(registry->engine);
+            WdfRequestComplete(request, STATUS_IO_TIMEOUT);
+        }
+    }
+
+    for (ULONG i = 0; i < XDMA_MAX_PROGRAMS; i++) {
+        EngineProgramDelete(&registry->programs[i].program);
+    }
+    for (ULONG i = 0; i < XDMA_MAX_REGISTERED_BUFFERS; i++) {
+        RegistryFreeBuffer(registry, &registry->buffers[i]);
+    }
+    ExFreePoolWithTag(registry, BUFFER_REGISTRY_POOL_TAG);
+}
@@ -0,0 +1,59 @@
+/*
+* XDMA Registered User Buffers
+* ===============================
+*
+* Copyright 2017 Xilinx Inc.
+*
+* Description:
+* ------------
+* User buffers which are locked and mapped for DMA once and then used by any number of transfers
+* on the engine of the device file they were registered on - see IOCTL_XDMA_BUFFER_REGISTER.
+* Transfers which never change can be compiled into descriptor programs - see
+* IOCTL_XDMA_PROGRAM_CREATE.
+*/
+
+#pragma once
+
+// ========================= include dependencies =================================================
+
+#include <ntddk.h>
+#include <wdf.h>
+
+#include "driver.h"
+#include "xdma_public.h"
+
+// ========================= declarations =========================================================
+
+typedef struct _BUFFER_REGISTRY BUFFER_REGISTRY;
+
+/// Create an empty registry for transfers on 'engine'.
+NTSTATUS BufferRegistryCreate(IN DeviceContext* ctx, IN XDMA_ENGINE* engine,
+                              OUT BUFFER_REGISTRY** registry);
+
+/// Lock and map a buffer of the calling process. Must be called in the context of that process at
+/// PASSIVE_LEVEL.
+NTSTATUS BufferRegistryAdd(IN BUFFER_REGISTRY* registry, IN UINT64 address, IN ULONG length,
+                           OUT ULONG* handle);
+
+/// Release a registered buffer. Fails with STATUS_DEVICE_BUSY while a transfer uses it.
+NTSTATUS BufferRegistryRemove(IN BUFFER_REGISTRY* registry, IN ULONG handle);
+
+/// Start the transfer of a request from the engine queue. On success the request is completed
+/// from the engine DPC.
+NTSTATUS BufferRegistryStartTransfer(IN BUFFER_REGISTRY* registry, IN WDFREQUEST request,
+                                     IN XDMA_BUFFER_TRANSFER* params);
+
+/// Compile a transfer from a registered buffer into a descriptor program. PASSIVE_LEVEL only.
+NTSTATUS BufferRegistryCompile(IN BUFFER_REGISTRY* registry, IN XDMA_PROGRAM_CREATE* params,
+                               OUT ULONG* programId);
+
+/// Release a program. Fails with STATUS_DEVICE_BUSY while it is running. PASSIVE_LEVEL only.
+NTSTATUS BufferRegistryDeleteProgram(IN BUFFER_REGISTRY* registry, IN ULONG programId);
+
+/// Start a program for a request from the engine queue. On success the request is completed from
+/// the engine DPC.
+NTSTATUS BufferRegistryLaunch(IN BUFFER_REGISTRY* registry, IN WDFREQUEST request,
+                              IN ULONG programId);
+
+/// Wait for a transfer in flight and release all programs and buffers.
+VOID BufferRegistryDestroy(IN BUFFER_REGISTRY* registry);
@@ -0,0 +1,268 @@
+/*
+* XDMA PIO/DMA Crossover
+* ===============================
+*
+* Copyright 2017 Xilinx Inc.
+*
+* Description:
+* ------------
+* A DMA transfer has a fixed cost - building descriptors, starting the engine, the descriptor
+* fetch and the completion interrupt - which PIO does not have. Up to some transfer size it is
+* therefore faster to copy the data through a BAR window on the same card address space. The
+* window is the bypass BAR, mapped to the card address PIO_WINDOW_BASE by the user design.
+*
+* The crossover size is either configured (PIO_CROSSOVER_THRESHOLD) or measured once when the
+* device first enters D0: the fastest of a few interrupt driven DMA reads of
+* XDMA_CROSSOVER_PROBE_BYTES against the fastest PIO read of the same size. The measurement
+* only reads from the card. It is the lower bound of the DMA path, so the result favours DMA.
+* PIO writes are posted and cheaper than reads, the read crossover is used for both directions.
+*/
+
+// ========================= include dependencies =================================================
+
+#include "driver.h"
+#include "dma_engine.h"
+#include "xdma_public.h"
+#include "crossover.h"
+
+#include "trace.h"
+#ifdef DBG
+// The trace message header (.tmh) file must be included in a source file before any WPP macro
+// calls and after defining a WPP_CONTROL_GUIDS macro (defined in trace.h). see trace.h
+#include "crossover.tmh"
+#endif
+
+// ========================= definitions ==========================================================
+
+#define CROSSOVER_ROUNDS        (16)
+#define CROSSOVER_TIMEOUT_MS    (100)
+
+typedef struct _CROSSOVER_PROBE {
+    KEVENT done;
+    NTSTATUS status;
+    LONGLONG endTime;           // timestamp in the engine DPC
+} CROSSOVER_PROBE;
+
+static ULONG CrossoverLimit(ULONG threshold) {
+    // whole ULONG accesses only
+    return min(threshold, XDMA_CROSSOVER_MAX_THRESHOLD) & ~(ULONG)(sizeof(ULONG) - 1);
+}
+
+VOID CrossoverSetup(IN DeviceContext* ctx, IN ULONG windowBase, IN ULONG threshold) {
+
+    PXDMA_DEVICE xdma = &ctx->xdma;
+    PIO_CROSSOVER* crossover = &ctx->crossover;
+    RtlZeroMemory(crossover, sizeof(PIO_CROSSOVER));
+
+    if (windowBase == MAXULONG) {
+        return; // no PIO window, all transfers use DMA
+    }
+    if ((xdma->bypassBarIdx < 0) || (xdma->bar[xdma->bypassBarIdx] == NULL)) {
+        TraceError(DBG_INIT, "Error: the PIO window needs the bypass BAR");
+        return;
+    }
+
+    crossover->window = (PUCHAR)xdma->bar[xdma->bypassBarIdx];
+    crossover->windowLength = xdma->barLength[xdma->bypassBarIdx];
+    crossover->windowBase = windowBase;
+    if (threshold == XDMA_CROSSOVER_AUTO) {
+        crossover->calibrate = TRUE;
+    } else {
+        crossover->threshold[H2C] = CrossoverLimit(threshold);
+        crossover->threshold[C2H] = CrossoverLimit(threshold);
+    }
+    TraceInfo(DBG_INIT, "PIO window at card address 0x%llx, %u bytes, threshold %u%s",
+              crossover->windowBase, crossover->windowLength, crossover->threshold[H2C],
+              crossover->calibrate ? " (calibrate)" : "");
+}
+
+static VOID CrossoverProbeDone(IN XDMA_ENGINE* engine, IN PVOID context, IN NTSTATUS status,
+                               IN ULONG numBytes) {
+    UNREFERENCED_PARAMETER(engine);
+    UNREFERENCED_PARAMETER(numBytes);
+    CROSSOVER_PROBE* probe = (CROSSOVER_PROBE*)context;
+    probe->endTime = LatencyTimestamp();
+    probe->status = status;
+    KeSetEvent(&probe->done, IO_NO_INCREMENT, FALSE);
+}
+
+static LONGLONG CrossoverMeasureDma(IN DeviceContext* ctx, IN XDMA_ENGINE* engine)
+// fastest DMA read of XDMA_CROSSOVER_PROBE_BYTES from the window base, 0 on failure
+{
+    LONGLONG best = 0;
+    CROSSOVER_PROBE probe;
+    KeInitializeEvent(&probe.done, SynchronizationEvent, FALSE);
+
+    WDFCOMMONBUFFER buffer = NULL;
+    NTSTATUS status = WdfCommonBufferCreate(ctx->xdma.dmaEnabler, PAGE_SIZE,
+                                            WDF_NO_OBJECT_ATTRIBUTES, &buffer);
+    if (!NT_SUCCESS(status)) {
+        TraceError(DBG_INIT, "WdfCommonBufferCreate failed: %!STATUS!", status);
+        return 0;
+    }
+    SCATTER_GATHER_LIST sgList;
+    RtlZeroMemory(&sgList, sizeof(sgList));
+    sgList.NumberOfElements = 1;
+    sgList.Elements[0].Address = WdfCommonBufferGetAlignedLogicalAddress(buffer);
+    sgList.Elements[0].Length = XDMA_CROSSOVER_PROBE_BYTES;
+
+    status = XDMA_EngineClaimDirect(engine, CrossoverProbeDone, &probe);
+    if (!NT_SUCCESS(status)) {
+        WdfObjectDelete(buffer);
+        return 0;
+    }
+    EngineEnableInterrupt(engine);
+
+    for (ULONG i = 0; i < CROSSOVER_ROUNDS; i++) {
+        probe.status = STATUS_PENDING;
+        const LONGLONG start = LatencyTimestamp();
+        EngineDirectStart(engine, &sgList, (LONGLONG)ctx->crossover.windowBase);
+
+        LARGE_INTEGER timeout;
+        timeout.QuadPart = WDF_REL_TIMEOUT_IN_MS(CROSSOVER_TIMEOUT_MS);
+        if (KeWaitForSingleObject(&probe.done, Executive, KernelMode, FALSE, &timeout) == STATUS_TIMEOUT) {
+            TraceError(DBG_INIT, "Error: %s_%u probe transfer timed out",
+                       DirectionToString(engine->dir), engine->channel);
+            EngineStop(engine);
+            engine->direct.numDescriptors = 0;
+            // a completion racing with the timeout has finished once all queued DPCs ran
+            KeFlushQueuedDpcs();
+            best = 0;
+            break;
+        }
+        if (!NT_SUCCESS(probe.status)) {
+            TraceError(DBG_INIT, "Error: probe transfer failed: %!STATUS!", probe.status);
+            best = 0;
+            break;
+        }
+        const LONGLONG ticks = probe.endTime - start;
+        if ((best == 0) || (ticks < best)) {
+            best = ticks;
+        }
+    }
+
+    EngineDisableInterrupt(engine);
+    XDMA_EngineReleaseDirect(engine);
+    WdfObjectDelete(buffer);
+    return best;
+}
+
+static LONGLONG CrossoverMeasurePio(IN PIO_CROSSOVER* crossover)
+// fastest PIO read of XDMA_CROSSOVER_PROBE_BYTES from the window base
+{
+    ULONG data[XDMA_CROSSOVER_PROBE_BYTES / sizeof(ULONG)];
+    LONGLONG best = 0;
+    for (ULONG i = 0; i < CROSSOVER_ROUNDS; i++) {
+        const LONGLONG start = LatencyTimestamp();
+        READ_REGISTER_BUFFER_ULONG((volatile ULONG*)crossover->window, data, ARRAYSIZE(data));
+        const LONGLONG ticks = LatencyTimestamp() - start;
+        if ((best == 0) || (ticks < best)) {
+            best = max(ticks, 1);
+        }
+    }
+    return best;
+}
+
+VOID CrossoverCalibrate(IN DeviceContext* ctx) {
+
+    PAGED_CODE();
+    PIO_CROSSOVER* crossover = &ctx->crossover;
+    if (!crossover->calibrate) {
+        return;
+    }
+    crossover->calibrate = FALSE; // once, the result holds across power transitions
+    if (crossover->windowLength < XDMA_CROSSOVER_PROBE_BYTES) {
+        TraceError(DBG_INIT, "Error: PIO window too small for calibration");
+        return;
+    }
+
+    // any memory mapped c2h engine reads the same card address space
+    XDMA_ENGINE* engine = NULL;
+    for (ULONG ch = 0; ch < XDMA_MAX_NUM_CHANNELS; ch++) {
+        XDMA_ENGINE* candidate = &(ctx->xdma.engines[ch][C2H]);
+        if (candidate->enabled && (candidate->type == EngineType_MM) && !candidate->poll &&
+            (candidate->addressMode == AddressMode_Contiguous)) {
+            engine = candidate;
+            break;
+        }
+    }
+    if (engine == NULL) {
+        TraceError(DBG_INIT, "Error: no interrupt driven memory mapped c2h engine to calibrate with");
+        return;
+    }
+
+    const LONGLONG dmaTicks = CrossoverMeasureDma(ctx, engine);
+    const LONGLONG pioTicks = CrossoverMeasurePio(crossover);
+    if ((dmaTicks <= 0) || (pioTicks <= 0)) {
+        TraceError(DBG_INIT, "Error: calibration failed, all transfers use DMA");
+        return;
+    }
+
+    const ULONGLONG bytes = (ULONGLONG)dmaTicks * XDMA_CROSSOVER_PROBE_BYTES / (ULONGLONG)pioTicks;
+    const ULONG threshold = CrossoverLimit((ULONG)min(bytes, MAXULONG));
+    crossover->dmaTicks = dmaTicks;
+    crossover->pioTicks = pioTicks;
+    crossover->threshold[H2C] = threshold;
+    crossover->threshold[C2H] = threshold;
+    TraceInfo(DBG_INIT, "%s_%u %u bytes: DMA %lld ticks, PIO %lld ticks, threshold %u bytes",
+              DirectionToString(engine->dir), engine->channel, XDMA_CROSSOVER_PROBE_BYTES,
+              dmaTicks, pioTicks, threshold);
+}
+
+PUCHAR CrossoverSelectPio(IN DeviceContext* ctx, IN XDMA_ENGINE* engine, IN LONGLONG deviceOffset,
+                          IN size_t length) {
+
+    PIO_CROSSOVER* crossover = &ctx->crossover;
+    if ((crossover->window == NULL) || (length == 0) || (length > crossover->threshold[engine->dir]) ||
+        (engine->type != EngineType_MM) || (engine->addressMode != AddressMode_Contiguous)) {
+        return NULL;
+    }
+    if (((ULONGLONG)deviceOffset % sizeof(ULONG) != 0) || (length % sizeof(ULONG) != 0) ||
+        ((ULONGLONG)deviceOffset < crossover->windowBase) ||
+        ((ULONGLONG)deviceOffset - crossover->windowBase + length > crossover->windowLength)) {
+        return NULL;
+    }
+
+    // called from the sequential engine queue, so the DMA requests dispatched before this one have
+    // completed and the order with them is kept. Batched requests complete after leaving the
+    // queue, which is why batching engines - like claimed and armed ones - always use DMA
+    if ((engine->direct.done != NULL) || (engine->batch.threshold != 0) ||
+        ctx->engineTriggers[engine->dir][engine->channel].armed) {
+        return NULL;
+    }
+    return crossover->window + ((ULONGLONG)deviceOffset - crossover->windowBase);
+}
+
+VOID CrossoverGet(IN DeviceContext* ctx, OUT XDMA_CROSSOVER* crossover) {
+    RtlZeroMemory(crossover, sizeof(XDMA_CROSSOVER));
+    if (ctx->crossover.window != NULL) {
+        crossover->windowBase = ctx->crossover.windowBase;
+        crossover->windowLength = ctx->crossover.windowLength;
+    }
+    crossover->threshold[H2C] = ctx->crossover.threshold[H2C];
+    crossover->threshold[C2H] = ctx->crossover.threshold[C2H];
+    LARGE_INTEGER frequency;
+    KeQueryPerformanceCounter(&frequency);
+    crossover->frequency = frequency.QuadPart;
+    crossover->dmaTicks = ctx->crossover.dmaTicks;
+    crossover->pioTicks = ctx->crossover.pioTicks;
+}
+
+NTSTATUS CrossoverSet(IN DeviceContext* ctx, IN const XDMA_CROSSOVER* crossover) {
+    if (ctx->crossover.window == NULL) {
+        TraceError(DBG_IO, "Error: no PIO window, see PIO_WINDOW_BASE");
+        return STATUS_NOT_SUPPORTED;
+    }
+    for (UINT dir = H2C; dir < XDMA_NUM_DIRECTIONS; dir++) {
+        if (crossover->threshold[dir] != CrossoverLimit(crossover->threshold[dir])) {
+            TraceError(DBG_IO, "Error: threshold %u is not a multiple of 4 up to %u",
+                       crossover->threshold[dir], XDMA_CROSSOVER_MAX_THRESHOLD);
+            return STATUS_INVALID_PARAMETER;
+        }
+    }
+    ctx->crossover.threshold[H2C] = crossover->threshold[H2C];
+    ctx->crossover.threshold[C2H] = crossover->threshold[C2H];
+    TraceInfo(DBG_IO, "PIO threshold h2c=%u c2h=%u bytes", crossover->threshold[H2C],
+              crossover->threshold[C2H]);
+    return STATUS_SUCCESS;
+}
@@ -0,0 +1,40 @@
+/*
+* XDMA PIO/DMA Crossover
+* ===============================
+*
+* Copyright 2017 Xilinx Inc.
+*
+* Description:
+* ------------
+* Small reads and writes on the DMA device nodes are served with PIO through the bypass BAR when
+* that is faster than setting up a DMA transfer - see IOCTL_XDMA_CROSSOVER_GET.
+*/
+
+#pragma once
+
+// ========================= include dependencies =================================================
+
+#include <ntddk.h>
+#include <wdf.h>
+
+#include "driver.h"
+
+// ========================= declarations =========================================================
+
+/// Locate the PIO window. 'windowBase' is the card address at bypass BAR offset 0, 'threshold'
+/// the max. bytes served by PIO or XDMA_CROSSOVER_AUTO to measure it in CrossoverCalibrate().
+VOID CrossoverSetup(IN DeviceContext* ctx, IN ULONG windowBase, IN ULONG threshold);
+
+/// Measure the crossover once if requested by CrossoverSetup(). PASSIVE_LEVEL, interrupts enabled.
+VOID CrossoverCalibrate(IN DeviceContext* ctx);
+
+/// Check whether a read/write of the engine should use PIO. Called from the engine queue. Returns
+/// the BAR address of 'deviceOffset' if so, NULL if the request has to use DMA.
+PUCHAR CrossoverSelectPio(IN DeviceContext* ctx, IN XDMA_ENGINE* engine, IN LONGLONG deviceOffset,
+                          IN size_t length);
+
+/// Current window, thresholds and calibration results for IOCTL_XDMA_CROSSOVER_GET
+VOID CrossoverGet(IN DeviceContext* ctx, OUT XDMA_CROSSOVER* crossover);
+
+/// Change the thresholds, IOCTL_XDMA_CROSSOVER_SET
+NTSTATUS CrossoverSet(IN DeviceContext* ctx, IN const XDMA_CROSSOVER* crossover);
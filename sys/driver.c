@@ -23,6 +23,7 @@
 
 #include "driver.h"
 #include "file_io.h"
+#include "crossover.h"
 #include "trace.h"
 
 #ifdef DBG
@@ -40,6 +41,7 @@ EVT_WDF_DRIVER_DEVICE_ADD           EvtDeviceAdd;
 EVT_WDF_DEVICE_CONTEXT_CLEANUP      EvtDeviceCleanup;
 EVT_WDF_DEVICE_PREPARE_HARDWARE     EvtDevicePrepareHardware;
 EVT_WDF_DEVICE_RELEASE_HARDWARE     EvtDeviceReleaseHardware;
+EVT_WDF_DEVICE_D0_ENTRY_POST_INTERRUPTS_ENABLED EvtDeviceD0EntryPostInterruptsEnabled;
 
 static NTSTATUS EngineCreateQueue(WDFDEVICE device, XDMA_ENGINE* engine, WDFQUEUE* queue);
 
@@ -50,6 +52,7 @@ static NTSTATUS EngineCreateQueue(WDFDEVICE device, XDMA_ENGINE* engine, WDFQUEU
 #pragma alloc_text (PAGE, EvtDeviceAdd)
 #pragma alloc_text (PAGE, EvtDevicePrepareHardware)
 #pragma alloc_text (PAGE, EvtDeviceReleaseHardware)
+#pragma alloc_text (PAGE, EvtDeviceD0EntryPostInterruptsEnabled)
 #pragma alloc_text (PAGE, EngineCreateQueue)
 #endif
 
@@ -57,13 +60,13 @@ static NTSTATUS EngineCreateQueue(WDFDEVICE device, XDMA_ENGINE* engine, WDFQUEU
 
 const char * const dateTimeStr = "Built " __DATE__ ", " __TIME__ ".";
 
-// Get the driver parameter for POLL_MODE from the Windows registry 
-static NTSTATUS GetPollModeParameter(IN PULONG pollMode) {
+// Get a driver parameter (e.g. POLL_MODE) from the Windows registry 
+static NTSTATUS GetDriverParameter(IN PCUNICODE_STRING valueName, IN PULONG value) {
     WDFDRIVER driver = WdfGetDriver();
     WDFKEY key;
     NTSTATUS status = WdfDriverOpenParametersRegistryKey(driver, STANDARD_RIGHTS_ALL,
                                                          WDF_NO_OBJECT_ATTRIBUTES, &key);
-    ULONG tracepollmode;
+    ULONG traceValue;
     
     if (!NT_SUCCESS(status)) {
         TraceError(DBG_INIT, "WdfDriverOpenParametersRegistryKey failed: %!STATUS!", status);
@@ -71,17 +74,15 @@ static NTSTATUS GetPollModeParameter(IN PULONG pollMode) {
         return status;
     }
 
-    DECLARE_CONST_UNICODE_STRING(valueName, L"POLL_MODE");
-
-    status = WdfRegistryQueryULong(key, &valueName, pollMode);
+    status = WdfRegistryQueryULong(key, valueName, value);
     if (!NT_SUCCESS(status)) {
-        TraceError(DBG_INIT, "WdfRegistryQueryULong failed: %!STATUS!", status);
+        TraceError(DBG_INIT, "WdfRegistryQueryULong(%wZ) failed: %!STATUS!", valueName, status);
         WdfRegistryClose(key);
         return status;
     }
 
-    tracepollmode = *pollMode;
-    TraceVerbose(DBG_INIT, "pollMode=%u", tracepollmode);
+    traceValue = *value;
+    TraceVerbose(DBG_INIT, "%wZ=%u", valueName, traceValue);
 
     WdfRegistryClose(key);
     return status;
@@ -145,6 +146,7 @@ NTSTATUS EvtDeviceAdd(IN WDFDRIVER Driver, IN PWDFDEVICE_INIT DeviceInit) {
     WDF_PNPPOWER_EVENT_CALLBACKS_INIT(&PnpPowerCallbacks);
     PnpPowerCallbacks.EvtDevicePrepareHardware = EvtDevicePrepareHardware;
     PnpPowerCallbacks.EvtDeviceReleaseHardware = EvtDeviceReleaseHardware;
+    PnpPowerCallbacks.EvtDeviceD0EntryPostInterruptsEnabled = EvtDeviceD0EntryPostInterruptsEnabled;
     WdfDeviceInitSetPnpPowerEventCallbacks(DeviceInit, &PnpPowerCallbacks);
 
     WDF_POWER_POLICY_EVENT_CALLBACKS powerPolicyCallbacks;
@@ -160,6 +162,9 @@ NTSTATUS EvtDeviceAdd(IN WDFDRIVER Driver, IN PWDFDEVICE_INIT DeviceInit) {
     WDF_OBJECT_ATTRIBUTES_SET_CONTEXT_TYPE(&fileAttributes, FILE_CONTEXT);
     WdfDeviceInitSetFileObjectConfig(DeviceInit, &fileConfig, &fileAttributes);
 
+    // user BAR mappings must be created in the context of the requesting process
+    WdfDeviceInitSetIoInCallerContextCallback(DeviceInit, EvtIoInCallerContext);
+
     // Specify the context type and size for the device we are about to create.
     WDF_OBJECT_ATTRIBUTES deviceAttributes;
     WDF_OBJECT_ATTRIBUTES_INIT_CONTEXT_TYPE(&deviceAttributes, DeviceContext);
@@ -174,6 +179,18 @@ NTSTATUS EvtDeviceAdd(IN WDFDRIVER Driver, IN PWDFDEVICE_INIT DeviceInit) {
         return status;
     }
 
+    // list of open 'events' device files, walked by HandleUserEvent()
+    DeviceContext* ctx = GetDeviceContext(device);
+    InitializeListHead(&ctx->eventWaiters);
+    WDF_OBJECT_ATTRIBUTES lockAttributes;
+    WDF_OBJECT_ATTRIBUTES_INIT(&lockAttributes);
+    lockAttributes.ParentObject = device;
+    status = WdfSpinLockCreate(&lockAttributes, &ctx->eventWaitersLock);
+    if (!NT_SUCCESS(status)) {
+        TraceError(DBG_INIT, "WdfSpinLockCreate failed: %!STATUS!", status);
+        return status;
+    }
+
     // Create a user-space device interface
     status = WdfDeviceCreateDeviceInterface(device, (LPGUID)&GUID_DEVINTERFACE_XDMA, NULL);
     if (!NT_SUCCESS(status)) {
@@ -215,6 +232,31 @@ NTSTATUS EvtDevicePrepareHardware(IN WDFDEVICE device, IN WDFCMRESLIST Resources
 
     DeviceContext* ctx = GetDeviceContext(device);
     PXDMA_DEVICE xdma = &(ctx->xdma);
+
+    // user events which get their own MSI-X vector when there are not enough for all sources
+    DECLARE_CONST_UNICODE_STRING(dedicatedMaskName, L"USER_EVENT_DEDICATED_MASK");
+    xdma->dedicatedUserEvents = 0;
+    if (!NT_SUCCESS(GetDriverParameter(&dedicatedMaskName, &xdma->dedicatedUserEvents))) {
+        xdma->dedicatedUserEvents = 0; // optional parameter, default is a single shared vector
+    }
+
+    // window of the user BAR which applications may map into their address space
+    DECLARE_CONST_UNICODE_STRING(mapOffsetName, L"USER_BAR_MAP_OFFSET");
+    DECLARE_CONST_UNICODE_STRING(mapLengthName, L"USER_BAR_MAP_LENGTH");
+    if (!NT_SUCCESS(GetDriverParameter(&mapOffsetName, &ctx->userMapOffset)) ||
+        !NT_SUCCESS(GetDriverParameter(&mapLengthName, &ctx->userMapLength))) {
+        ctx->userMapOffset = 0; // optional parameters, default is no mapping
+        ctx->userMapLength = 0;
+    }
+
+    // bypass BAR write-combined instead of uncached
+    DECLARE_CONST_UNICODE_STRING(writeCombineName, L"BYPASS_WRITE_COMBINE");
+    ULONG writeCombine = 0;
+    if (!NT_SUCCESS(GetDriverParameter(&writeCombineName, &writeCombine))) {
+        writeCombine = 0; // optional parameter, default is uncached
+    }
+    xdma->bypassWriteCombined = writeCombine != 0;
+
     NTSTATUS status = XDMA_DeviceOpen(device, xdma, Resources, ResourcesTranslated);
     if (!NT_SUCCESS(status)) {
         TraceError(DBG_INIT, "XDMA_DeviceOpen failed: %!STATUS!", status);
@@ -223,9 +265,10 @@ NTSTATUS EvtDevicePrepareHardware(IN WDFDEVICE device, IN WDFCMRESLIST Resources
 
     // get poll mode parameter and configure engines as poll mode if needed
     ULONG pollMode = 0;
-    status = GetPollModeParameter(&pollMode);
+    DECLARE_CONST_UNICODE_STRING(pollModeName, L"POLL_MODE");
+    status = GetDriverParameter(&pollModeName, &pollMode);
     if (!NT_SUCCESS(status)) {
-        TraceError(DBG_INIT, "GetPollModeParameter failed: %!STATUS!", status);
+        TraceError(DBG_INIT, "GetDriverParameter failed: %!STATUS!", status);
         return status;
     }
     for (UINT dir = H2C; dir < 2; dir++) { // 0=H2C, 1=C2H
@@ -235,6 +278,41 @@ NTSTATUS EvtDevicePrepareHardware(IN WDFDEVICE device, IN WDFCMRESLIST Resources
         }
     }
 
+    // small transfers push their descriptors through the bypass BAR, see XDMA_DescriptorBypassSetup
+    ULONG descBypassOffset = MAXULONG;
+    ULONG descBypassThreshold = 0;
+    DECLARE_CONST_UNICODE_STRING(descBypassOffsetName, L"DESC_BYPASS_OFFSET");
+    DECLARE_CONST_UNICODE_STRING(descBypassThresholdName, L"DESC_BYPASS_THRESHOLD");
+    if (!NT_SUCCESS(GetDriverParameter(&descBypassOffsetName, &descBypassOffset))) {
+        descBypassOffset = MAXULONG; // optional parameter, default is no descriptor bypass
+    }
+    if (!NT_SUCCESS(GetDriverParameter(&descBypassThresholdName, &descBypassThreshold))) {
+        descBypassThreshold = 0;
+    }
+    if ((descBypassOffset != MAXULONG) && NT_SUCCESS(XDMA_DescriptorBypassSetup(xdma, descBypassOffset))) {
+        for (UINT dir = H2C; dir < 2; dir++) { // 0=H2C, 1=C2H
+            for (ULONG ch = 0; ch < XDMA_MAX_NUM_CHANNELS; ch++) {
+                XDMA_ENGINE* engine = &(xdma->engines[ch][dir]);
+                if (engine->enabled && (descBypassThreshold != 0)) {
+                    XDMA_EngineSetDescriptorBypass(engine, descBypassThreshold);
+                }
+            }
+        }
+    }
+
+    // small reads/writes on the DMA device nodes served by PIO, see crossover.c
+    ULONG pioWindowBase = MAXULONG;
+    ULONG pioThreshold = XDMA_CROSSOVER_AUTO;
+    DECLARE_CONST_UNICODE_STRING(pioWindowBaseName, L"PIO_WINDOW_BASE");
+    DECLARE_CONST_UNICODE_STRING(pioThresholdName, L"PIO_CROSSOVER_THRESHOLD");
+    if (!NT_SUCCESS(GetDriverParameter(&pioWindowBaseName, &pioWindowBase))) {
+        pioWindowBase = MAXULONG; // optional parameter, default is DMA only
+    }
+    if (!NT_SUCCESS(GetDriverParameter(&pioThresholdName, &pioThreshold))) {
+        pioThreshold = XDMA_CROSSOVER_AUTO;
+    }
+    CrossoverSetup(ctx, pioWindowBase, pioThreshold);
+
     // create a queue for each engine
     for (UINT dir = H2C; dir < 2; dir++) { // 0=H2C, 1=C2H
         for (ULONG ch = 0; ch < XDMA_MAX_NUM_CHANNELS; ch++) {
@@ -251,7 +329,7 @@ NTSTATUS EvtDevicePrepareHardware(IN WDFDEVICE device, IN WDFCMRESLIST Resources
 
     for (UINT i = 0; i < XDMA_MAX_USER_IRQ; ++i) {
         KeInitializeEvent(&ctx->eventSignals[i], NotificationEvent, FALSE);
-        XDMA_UserIsrRegister(xdma, i, HandleUserEvent, &ctx->eventSignals[i]);
+        XDMA_UserIsrRegister(xdma, i, HandleUserEvent, ctx);
     }
 
     TraceVerbose(DBG_INIT, "<--Exit returning %!STATUS!", status);
@@ -267,6 +345,7 @@ NTSTATUS EvtDeviceReleaseHardware(IN WDFDEVICE Device, IN WDFCMRESLIST Resources
     
     DeviceContext* ctx = GetDeviceContext(Device);
     if (ctx != NULL) {
+        ctx->crossover.window = NULL;
         XDMA_DeviceClose(&ctx->xdma);
     }
 
@@ -274,6 +353,16 @@ NTSTATUS EvtDeviceReleaseHardware(IN WDFDEVICE Device, IN WDFCMRESLIST Resources
     return STATUS_SUCCESS;
 }
 
+// Interrupts are connected - measure the PIO/DMA crossover on the first entry
+NTSTATUS EvtDeviceD0EntryPostInterruptsEnabled(IN WDFDEVICE device, IN WDF_POWER_DEVICE_STATE PreviousState) {
+
+    PAGED_CODE();
+    UNREFERENCED_PARAMETER(PreviousState);
+
+    CrossoverCalibrate(GetDeviceContext(device));
+    return STATUS_SUCCESS;
+}
+
 NTSTATUS EngineCreateQueue(WDFDEVICE device, XDMA_ENGINE* engine, WDFQUEUE* queue)
 // Create a WDF IO queue for a DMA engine
 {
@@ -301,6 +390,7 @@ NTSTATUS EngineCreateQueue(WDFDEVICE device, XDMA_ENGINE* engine, WDFQUEUE* queu
             TraceInfo(DBG_INIT, "EvtIoRead=EvtIoReadDma");
         }
     }
+    config.EvtIoDeviceControl = EvtIoDeviceControlDma; // transfers from registered buffers
 
     // serialize all callbacks related to this queue. see ref [2]
     WDF_OBJECT_ATTRIBUTES_INIT(&attribs);
@@ -316,5 +406,18 @@ NTSTATUS EngineCreateQueue(WDFDEVICE device, XDMA_ENGINE* engine, WDFQUEUE* queu
     context = GetQueueContext(*queue);
     context->engine = engine;
 
+    // event trigger of this engine, disarmed until IOCTL_XDMA_TRIGGER_ARM
+    ENGINE_TRIGGER* trigger = &(GetDeviceContext(device)->engineTriggers[engine->dir][engine->channel]);
+    RtlZeroMemory(trigger, sizeof(*trigger));
+    trigger->engine = engine;
+    WDF_OBJECT_ATTRIBUTES_INIT(&attribs);
+    attribs.ParentObject = *queue;
+    status = WdfSpinLockCreate(&attribs, &trigger->lock);
+    if (!NT_SUCCESS(status)) {
+        TraceError(DBG_INIT, "WdfSpinLockCreate failed: %!STATUS!", status);
+        return status;
+    }
+    context->trigger = trigger;
+
     return status;
 }
@@ -23,10 +23,39 @@
 
 #include "xdma.h"
 
+// A DMA transfer held back until a user event arrives - see IOCTL_XDMA_TRIGGER_ARM
+typedef struct ENGINE_TRIGGER_T {
+    XDMA_ENGINE* engine;
+    WDFSPINLOCK lock;
+    WDFFILEOBJECT owner;        // file which armed the trigger
+    ULONG eventId;
+    BOOLEAN armed;
+    BOOLEAN autoRearm;
+    BOOLEAN fired;              // event arrived while no request was waiting
+    WDFREQUEST request;         // request waiting for the event, DMA transaction initialized
+} ENGINE_TRIGGER;
+
+// Small reads/writes on the DMA device nodes served by PIO - see crossover.c
+typedef struct PIO_CROSSOVER_T {
+    PUCHAR window;              // bypass BAR, NULL = no PIO path
+    ULONG windowLength;
+    ULONGLONG windowBase;       // card address at window offset 0
+    BOOLEAN calibrate;          // measure the thresholds on the next D0 entry
+    ULONG threshold[2];         // [0=H2C,1=C2H] max. bytes served by PIO, 0 = DMA only
+    LONGLONG dmaTicks;          // calibration results, 0 = not calibrated
+    LONGLONG pioTicks;
+} PIO_CROSSOVER;
+
 typedef struct DeviceContext_t {
     XDMA_DEVICE xdma;
     WDFQUEUE engineQueue[2][XDMA_MAX_NUM_CHANNELS];
+    ENGINE_TRIGGER engineTriggers[2][XDMA_MAX_NUM_CHANNELS];
     KEVENT eventSignals[XDMA_MAX_USER_IRQ];
+    LIST_ENTRY eventWaiters;            // open 'events' device files, see EVENT_WAITER
+    WDFSPINLOCK eventWaitersLock;
+    ULONG userMapOffset;                // part of the user BAR which may be mapped into processes
+    ULONG userMapLength;                //  - see IOCTL_XDMA_BAR_MAP, length 0 = disabled
+    PIO_CROSSOVER crossover;
 
 }DeviceContext;
 WDF_DECLARE_CONTEXT_TYPE_WITH_NAME(DeviceContext, GetDeviceContext)
\ No newline at end of file
@@ -15,12 +15,16 @@
 * User Operation (e.g. ReadFile())
 * |
 * |-> IO Request -> EvtIoRead()--> ReadBarToRequest()               // PCI BAR access
+*               |            |---> CopyBarToRequest()               // small c2h transfer by PIO
 *               |            |---> EvtIoReadDma()                   // normal dma c2h transfer
 *               |            |---> EvtIoReadEngineRing()            // for streaming interface
 *               |            |---> CopyDescriptorsToRequestMemory() // get dma descriptors to user-space
 *               |            |---> ServiceUserEvent()               // wait on user interrupt
+*               |            |---> EvtReadUserEventMux()            // wait on a set of user interrupts
 *               |
 *               |-> EvtIoWrite()-> WriteBarFromRequest()            // PCI BAR access
+*                             |--> WriteBypassFromRequest()         // wide stores to the bypass BAR
+*                             |--> CopyRequestToBar()               // small h2c transfer by PIO
 *                             |--> EvtIoWriteDma()                  // normal DMA H2C transfer
 *                             |--> WriteBypassDescriptor()          // write descriptors from userspace to bypass BARs
 */
@@ -31,6 +35,13 @@
 #include "dma_engine.h"
 #include "xdma_public.h"
 #include "file_io.h"
+#include "submit_queue.h"
+#include "buffer_registry.h"
+#include "crossover.h"
+
+#if defined(_M_AMD64)
+#include <immintrin.h>
+#endif
 
 #include "trace.h"
 #ifdef DBG
@@ -41,6 +52,9 @@
 
 EVT_WDF_REQUEST_CANCEL      EvtCancelDma;
 
+static VOID TriggerDisarm(ENGINE_TRIGGER* trigger);
+static VOID UnmapBarWindows(PFILE_CONTEXT file);
+
 // ====================== device file nodes =======================================================
 
 const static struct {
@@ -75,6 +89,8 @@ const static struct {
     { DEVNODE_TYPE_EVENTS,      XDMA_FILE_EVENT_13,     13 },
     { DEVNODE_TYPE_EVENTS,      XDMA_FILE_EVENT_14,     14 },
     { DEVNODE_TYPE_EVENTS,      XDMA_FILE_EVENT_15,     15 },
+    { DEVNODE_TYPE_EVENT_MUX,   XDMA_FILE_EVENTS,       0 },
+    { DEVNODE_TYPE_QUEUE,       XDMA_FILE_QUEUE,        0 },
 };
 
 static VOID GetDevNodeType(PUNICODE_STRING fileName, PFILE_CONTEXT file, ULONG* index)
@@ -119,6 +135,7 @@ VOID EvtDeviceFileCreate(IN WDFDEVICE device, IN WDFREQUEST Request, IN WDFFILEO
     switch (devNode->devType) {
     case DEVNODE_TYPE_CONTROL:
         devNode->u.bar = xdma->bar[xdma->configBarIdx];
+        devNode->barLength = xdma->barLength[xdma->configBarIdx];
         break;
     case DEVNODE_TYPE_USER:
         if (xdma->userBarIdx < 0) {
@@ -127,6 +144,18 @@ VOID EvtDeviceFileCreate(IN WDFDEVICE device, IN WDFREQUEST Request, IN WDFFILEO
             goto ErrExit;
         }
         devNode->u.bar = xdma->bar[xdma->userBarIdx];
+        devNode->barLength = xdma->barLength[xdma->userBarIdx];
+        {
+            // serializes IOCTL_XDMA_BAR_MAP/UNMAP on this file
+            WDF_OBJECT_ATTRIBUTES lockAttributes;
+            WDF_OBJECT_ATTRIBUTES_INIT(&lockAttributes);
+            lockAttributes.ParentObject = WdfFile;
+            status = WdfWaitLockCreate(&lockAttributes, &devNode->mappingLock);
+            if (!NT_SUCCESS(status)) {
+                TraceError(DBG_IO, "WdfWaitLockCreate failed: %!STATUS!", status);
+                goto ErrExit;
+            }
+        }
         break;
     case DEVNODE_TYPE_BYPASS:
         if (xdma->bypassBarIdx < 0) {
@@ -135,6 +164,8 @@ VOID EvtDeviceFileCreate(IN WDFDEVICE device, IN WDFREQUEST Request, IN WDFFILEO
             goto ErrExit;
         }
         devNode->u.bar = xdma->bar[xdma->bypassBarIdx];
+        devNode->barLength = xdma->barLength[xdma->bypassBarIdx];
+        devNode->pioWidth = sizeof(ULONG);
         break;
     case DEVNODE_TYPE_H2C:
     case DEVNODE_TYPE_C2H:
@@ -166,6 +197,14 @@ VOID EvtDeviceFileCreate(IN WDFDEVICE device, IN WDFREQUEST Request, IN WDFFILEO
     case DEVNODE_TYPE_EVENTS:
         devNode->u.event = &(xdma->userEvents[index]);
         break;
+    case DEVNODE_TYPE_EVENT_MUX:
+        // no events selected until IOCTL_XDMA_EVENTS_SET_MASK
+        RtlZeroMemory(&devNode->waiter, sizeof(devNode->waiter));
+        KeInitializeEvent(&devNode->waiter.signal, NotificationEvent, FALSE);
+        WdfSpinLockAcquire(ctx->eventWaitersLock);
+        InsertTailList(&ctx->eventWaiters, &devNode->waiter.link);
+        WdfSpinLockRelease(ctx->eventWaitersLock);
+        break;
     default:
         break;
     }
@@ -189,6 +228,27 @@ VOID EvtFileCleanup(IN WDFFILEOBJECT FileObject) {
             EngineRingTeardown(file->u.engine);
         }
     }
+    if ((file->devType == DEVNODE_TYPE_H2C) || (file->devType == DEVNODE_TYPE_C2H)) {
+        DeviceContext* ctx = GetDeviceContext(WdfFileObjectGetDevice(FileObject));
+        ENGINE_TRIGGER* trigger = &ctx->engineTriggers[file->u.engine->dir][file->u.engine->channel];
+        if (trigger->owner == FileObject) {
+            TriggerDisarm(trigger);
+        }
+        if (file->registry != NULL) {
+            BufferRegistryDestroy(file->registry);
+            file->registry = NULL;
+        }
+    } else if (file->devType == DEVNODE_TYPE_EVENT_MUX) {
+        DeviceContext* ctx = GetDeviceContext(WdfFileObjectGetDevice(FileObject));
+        WdfSpinLockAcquire(ctx->eventWaitersLock);
+        RemoveEntryList(&file->waiter.link);
+        WdfSpinLockRelease(ctx->eventWaitersLock);
+    } else if (file->devType == DEVNODE_TYPE_USER) {
+        UnmapBarWindows(file);
+    } else if ((file->devType == DEVNODE_TYPE_QUEUE) && (file->submitQueue != NULL)) {
+        SubmitQueueDestroy(file->submitQueue);
+        file->submitQueue = NULL;
+    }
     TraceVerbose(DBG_IO, "Cleanup %wZ", fileName);
 }
 
@@ -213,25 +273,9 @@ static NTSTATUS ValidateBarParams(IN PXDMA_DEVICE xdma, ULONG nBar, size_t offse
     return STATUS_SUCCESS;
 }
 
-static NTSTATUS ReadBarToRequest(WDFREQUEST request, PVOID bar)
-// Read from PCIe mmap'ed memory into an IO request 
+static NTSTATUS CopyBarToRequest(WDFREQUEST request, PUCHAR readAddr, size_t length)
+// Copy 'length' bytes from a mapped BAR address into the request memory
 {
-    WDF_REQUEST_PARAMETERS params;
-    WDF_REQUEST_PARAMETERS_INIT(&params);
-    WdfRequestGetParameters(request, &params);
-    size_t offset = (size_t)params.Parameters.Read.DeviceOffset;
-    size_t length = params.Parameters.Read.Length;
-
-    // Static Driver Verifier is not smart enough to see that length is checked in ValidateBarParams
-    // Therefore we need to check it here as well
-    if (length == 0) {
-        TraceError(DBG_IO, "Error: attempting to read 0 bytes");
-        return STATUS_INVALID_DEVICE_REQUEST;
-    }
-
-    // calculate virtual address of the mmap'd BAR location
-    PUCHAR readAddr = (PUCHAR)bar + offset;
-
     // get handle to the IO request memory which will hold the read data
     WDFMEMORY requestMemory;
     NTSTATUS status = WdfRequestRetrieveOutputMemory(request, &requestMemory);
@@ -243,7 +287,7 @@ static NTSTATUS ReadBarToRequest(WDFREQUEST request, PVOID bar)
     // get pointer to buffer
     PVOID reqBuffer = WdfMemoryGetBuffer(requestMemory, NULL);
 
-    // write to BAR
+    // read from BAR
     if (length % sizeof(ULONG) == 0) {
         READ_REGISTER_BUFFER_ULONG((volatile ULONG*)readAddr, (PULONG)reqBuffer, (ULONG)length / sizeof(ULONG));
     } else if (length % sizeof(USHORT) == 0) {
@@ -255,6 +299,52 @@ static NTSTATUS ReadBarToRequest(WDFREQUEST request, PVOID bar)
     return status;
 }
 
+static NTSTATUS CopyRequestToBar(WDFREQUEST request, PUCHAR writeAddr, size_t length)
+// Copy 'length' bytes of the request memory to a mapped BAR address
+{
+    WDFMEMORY requestMemory;
+    // get handle to the IO request memory which holds data to write
+    NTSTATUS status = WdfRequestRetrieveInputMemory(request, &requestMemory);
+    if (!NT_SUCCESS(status)) {
+        TraceError(DBG_IO, "WdfRequestRetrieveInputMemory failed: %!STATUS!", status);
+        return status;
+    }
+
+    // get pointer to buffer
+    PVOID reqBuffer = WdfMemoryGetBuffer(requestMemory, NULL);
+
+    // write to BAR
+    if (length % sizeof(ULONG) == 0) {
+        WRITE_REGISTER_BUFFER_ULONG((volatile ULONG*)writeAddr, (PULONG)reqBuffer, (ULONG)length / sizeof(ULONG));
+    } else if (length % sizeof(USHORT) == 0) {
+        WRITE_REGISTER_BUFFER_USHORT((volatile USHORT*)writeAddr, (PUSHORT)reqBuffer, (ULONG)length / sizeof(USHORT));
+    } else {
+        WRITE_REGISTER_BUFFER_UCHAR((volatile UCHAR*)writeAddr, (PUCHAR)reqBuffer, (ULONG)length);
+    }
+
+    return status;
+}
+
+static NTSTATUS ReadBarToRequest(WDFREQUEST request, PVOID bar)
+// Read from PCIe mmap'ed memory into an IO request 
+{
+    WDF_REQUEST_PARAMETERS params;
+    WDF_REQUEST_PARAMETERS_INIT(&params);
+    WdfRequestGetParameters(request, &params);
+    size_t offset = (size_t)params.Parameters.Read.DeviceOffset;
+    size_t length = params.Parameters.Read.Length;
+
+    // Static Driver Verifier is not smart enough to see that length is checked in ValidateBarParams
+    // Therefore we need to check it here as well
+    if (length == 0) {
+        TraceError(DBG_IO, "Error: attempting to read 0 bytes");
+        return STATUS_INVALID_DEVICE_REQUEST;
+    }
+
+    // calculate virtual address of the mmap'd BAR location
+    return CopyBarToRequest(request, (PUCHAR)bar + offset, length);
+}
+
 static NTSTATUS WriteBarFromRequest(WDFREQUEST request, PVOID bar)
 // Write from an IO request into PCIe mmap'ed memory 
 {
@@ -272,29 +362,93 @@ static NTSTATUS WriteBarFromRequest(WDFREQUEST request, PVOID bar)
     }
 
     // calculate virtual address of the mmap'd BAR location
-    PUCHAR writeAddr = (PUCHAR)bar + offset;
+    return CopyRequestToBar(request, (PUCHAR)bar + offset, length);
+}
 
-    WDFMEMORY requestMemory;
-    // get handle to the IO request memory which holds data to write
-    NTSTATUS status = WdfRequestRetrieveInputMemory(request, &requestMemory);
-    if (!NT_SUCCESS(status)) {
-        TraceError(DBG_IO, "WdfRequestRetrieveInputMemory failed: %!STATUS!", status);
-        return status;
+static VOID WriteBarWide(PUCHAR dst, const UCHAR* src, size_t length, ULONG width)
+// Aligned stores of 'width' bytes, dst and length are multiples of width. The store fence drains
+// the write-combining buffers so the data is on its way to the device when the request completes.
+{
+#if defined(_M_AMD64)
+    switch (width) {
+    case 32:
+        for (size_t i = 0; i < length; i += 32) {
+            _mm256_store_si256((__m256i*)(dst + i), _mm256_loadu_si256((const __m256i*)(src + i)));
+        }
+        break;
+    case 16:
+        for (size_t i = 0; i < length; i += 16) {
+            _mm_store_si128((__m128i*)(dst + i), _mm_loadu_si128((const __m128i*)(src + i)));
+        }
+        break;
+    default:
+        for (size_t i = 0; i < length; i += 8) {
+            *(volatile ULONG64*)(dst + i) = *(const ULONG64 UNALIGNED*)(src + i);
+        }
+        break;
     }
+    _mm_sfence();
+#else
+    UNREFERENCED_PARAMETER(dst);
+    UNREFERENCED_PARAMETER(src);
+    UNREFERENCED_PARAMETER(length);
+    UNREFERENCED_PARAMETER(width);
+    ASSERTMSG("wide stores are only supported on x64", FALSE);
+#endif
+}
 
-    // get pointer to buffer
-    PVOID reqBuffer = WdfMemoryGetBuffer(requestMemory, NULL);
+static NTSTATUS WriteBypassFromRequest(WDFREQUEST request, PFILE_CONTEXT file)
+// Write from an IO request into the bypass BAR with the store width selected for the file
+{
+    WDF_REQUEST_PARAMETERS params;
+    WDF_REQUEST_PARAMETERS_INIT(&params);
+    WdfRequestGetParameters(request, &params);
+    size_t offset = (size_t)params.Parameters.Write.DeviceOffset;
+    size_t length = params.Parameters.Write.Length;
+    ULONG width = file->pioWidth;
+    NTSTATUS status = STATUS_SUCCESS;
 
-    // write to BAR
-    if (length % sizeof(ULONG) == 0) {
-        WRITE_REGISTER_BUFFER_ULONG((volatile ULONG*)writeAddr, (PULONG)reqBuffer, (ULONG)length / sizeof(ULONG));
-    } else if (length % sizeof(USHORT) == 0) {
-        WRITE_REGISTER_BUFFER_USHORT((volatile USHORT*)writeAddr, (PUSHORT)reqBuffer, (ULONG)length / sizeof(USHORT));
-    } else {
-        WRITE_REGISTER_BUFFER_UCHAR((volatile UCHAR*)writeAddr, (PUCHAR)reqBuffer, (ULONG)length);
+    if ((length == 0) || ((ULONG64)offset + length > file->barLength)) {
+        TraceError(DBG_IO, "Error: attempting to write bypass BAR offset=%llu size=%llu",
+                   offset, length);
+        return STATUS_INVALID_DEVICE_REQUEST;
     }
 
+    LARGE_INTEGER start;
+    if ((width > sizeof(ULONG)) && (offset % width == 0) && (length % width == 0)) {
+        WDFMEMORY requestMemory;
+        status = WdfRequestRetrieveInputMemory(request, &requestMemory);
+        if (!NT_SUCCESS(status)) {
+            TraceError(DBG_IO, "WdfRequestRetrieveInputMemory failed: %!STATUS!", status);
+            return status;
+        }
+        PUCHAR reqBuffer = (PUCHAR)WdfMemoryGetBuffer(requestMemory, NULL);
+
+        // AVX registers are not saved by the kernel on behalf of drivers
+        XSTATE_SAVE xstate = { 0 };
+        if (width == 32) {
+            status = KeSaveExtendedProcessorState(XSTATE_MASK_AVX, &xstate);
+            if (!NT_SUCCESS(status)) {
+                TraceError(DBG_IO, "KeSaveExtendedProcessorState failed: %!STATUS!", status);
+                return status;
+            }
+        }
+        start = KeQueryPerformanceCounter(NULL);
+        WriteBarWide((PUCHAR)file->u.bar + offset, reqBuffer, length, width);
+        if (width == 32) {
+            KeRestoreExtendedProcessorState(&xstate);
+        }
+    } else {
+        start = KeQueryPerformanceCounter(NULL);
+        status = WriteBarFromRequest(request, file->u.bar);
+    }
+    LARGE_INTEGER end = KeQueryPerformanceCounter(NULL);
 
+    if (NT_SUCCESS(status)) {
+        InterlockedIncrement64(&file->pioStats.numWrites);
+        InterlockedAdd64(&file->pioStats.numBytes, (LONG64)length);
+        InterlockedAdd64(&file->pioStats.ticks, end.QuadPart - start.QuadPart);
+    }
     return status;
 }
 
@@ -326,14 +480,14 @@ VOID EvtIoRead(IN WDFQUEUE queue, IN WDFREQUEST request, IN size_t length)
         // forward request to engine queue - completed by EvtIoReadDma later
         status = EvtReadUserEvent(request, length);
         break;
+    case DEVNODE_TYPE_EVENT_MUX:
+        status = EvtReadUserEventMux(request, length);
+        break;
     case DEVNODE_TYPE_C2H:
-    {
         ASSERTMSG("no engine attached to file context", file->u.engine != NULL);
-
         // forward request to engine queue - completed by EvtIoReadDma later
         status = WdfRequestForwardToIoQueue(request, file->queue);
         break;
-    }
     case DEVNODE_TYPE_H2C:
     default:
         TraceError(DBG_IO, "fails with invalid DevNodeID %d", file->devType);
@@ -362,7 +516,6 @@ VOID EvtIoWrite(IN WDFQUEUE queue, IN WDFREQUEST request, IN size_t length)
     switch (file->devType) {
     case DEVNODE_TYPE_USER:
     case DEVNODE_TYPE_CONTROL:
-    case DEVNODE_TYPE_BYPASS:
         ASSERTMSG("no BAR ptr attached to file context", file->u.bar != NULL);
         // handle request here without forwarding. write to PCIe BAR from request memory
         status = WriteBarFromRequest(request, file->u.bar);
@@ -370,9 +523,15 @@ VOID EvtIoWrite(IN WDFQUEUE queue, IN WDFREQUEST request, IN size_t length)
             WdfRequestCompleteWithInformation(request, status, length);  // complete the request        }
         }
         break;
+    case DEVNODE_TYPE_BYPASS:
+        ASSERTMSG("no BAR ptr attached to file context", file->u.bar != NULL);
+        status = WriteBypassFromRequest(request, file);
+        if (NT_SUCCESS(status)) {
+            WdfRequestCompleteWithInformation(request, status, length);
+        }
+        break;
     case DEVNODE_TYPE_H2C:
         ASSERTMSG("no engine attached to file context", file->u.engine != NULL);
-
         // forward request to write engine queue, it ends up in EvtIoWriteDma() later
         status = WdfRequestForwardToIoQueue(request, file->queue);
         break;
@@ -470,139 +629,1229 @@ static NTSTATUS IoctlSetAddrMode(IN WDFREQUEST request, IN XDMA_ENGINE* engine)
     return status;
 }
 
-// todo separate ioctl functions for sgdma and other?
-VOID EvtIoDeviceControl(IN WDFQUEUE Queue, IN WDFREQUEST request, IN size_t OutputBufferLength,
-                        IN size_t InputBufferLength, IN ULONG IoControlCode) {
+static NTSTATUS IoctlSetDescBypass(IN WDFREQUEST request, IN XDMA_ENGINE* engine) {
 
-    UNREFERENCED_PARAMETER(Queue);
-    UNREFERENCED_PARAMETER(OutputBufferLength);
-    UNREFERENCED_PARAMETER(InputBufferLength);
+    WDFMEMORY requestMemory;
+    NTSTATUS status = WdfRequestRetrieveInputMemory(request, &requestMemory);
+    if (!NT_SUCCESS(status)) {
+        TraceError(DBG_IO, "WdfRequestRetrieveInputMemory failed: %!STATUS!", status);
+        return status;
+    }
+    ULONG threshold = 0;
+    status = WdfMemoryCopyToBuffer(requestMemory, 0, &threshold, sizeof(threshold));
+    if (!NT_SUCCESS(status)) {
+        TraceError(DBG_IO, "WdfMemoryCopyToBuffer failed: %!STATUS!", status);
+        return status;
+    }
+    return XDMA_EngineSetDescriptorBypass(engine, threshold);
+}
 
-    PFILE_CONTEXT file = GetFileContext(WdfRequestGetFileObject(request));
-    PQUEUE_CONTEXT queue = GetQueueContext(file->queue);
-    NTSTATUS status = STATUS_NOT_SUPPORTED;
+static NTSTATUS IoctlSetEventMask(IN WDFREQUEST request, IN DeviceContext* ctx,
+                                  IN EVENT_WAITER* waiter) {
 
-    ASSERT(queue != NULL);
-    if (queue->engine == NULL) {
-        TraceError(DBG_IO, "IOCTL only supported on DMA files (hc2_* or c2h_* devices)");
-        status = STATUS_INVALID_PARAMETER;
-        goto exit;
+    // get handle to the IO request memory which holds the event mask
+    WDFMEMORY requestMemory;
+    NTSTATUS status = WdfRequestRetrieveInputMemory(request, &requestMemory);
+    if (!NT_SUCCESS(status)) {
+        TraceError(DBG_IO, "WdfRequestRetrieveInputMemory failed: %!STATUS!", status);
+        return status;
+    }
+    ULONG mask = 0;
+    status = WdfMemoryCopyToBuffer(requestMemory, 0, &mask, sizeof(mask));
+    if (!NT_SUCCESS(status)) {
+        TraceError(DBG_IO, "WdfMemoryCopyToBuffer failed: %!STATUS!", status);
+        return status;
+    }
+    if (mask & ~((1UL << XDMA_MAX_USER_IRQ) - 1)) {
+        TraceError(DBG_IO, "Error: event mask 0x%08X selects non-existing events", mask);
+        return STATUS_INVALID_PARAMETER;
     }
 
-    // ioctl codes defined in xdma_public.h
-
-    switch (IoControlCode) {
-    case IOCTL_XDMA_PERF_START:
-        TraceInfo(DBG_IO, "%s_%u IOCTL_XDMA_PERF_START",
-                  queue->engine->dir == H2C ? "H2C" : "C2H", queue->engine->channel);
-        EngineStartPerf(queue->engine);
-        status = STATUS_SUCCESS;
-        WdfRequestComplete(request, status);
-        break;
-    case IOCTL_XDMA_PERF_GET:
-        TraceInfo(DBG_IO, "%s_%u IOCTL_XDMA_PERF_GET",
-                  queue->engine->dir == H2C ? "H2C" : "C2H", queue->engine->channel);
-        status = IoctlGetPerf(request, queue->engine);
-        if (NT_SUCCESS(status)) {
-            WdfRequestCompleteWithInformation(request, status, sizeof(XDMA_PERF_DATA));
-        }
-        break;
-    case IOCTL_XDMA_ADDRMODE_GET:
-        TraceInfo(DBG_IO, "%s_%u IOCTL_XDMA_ADDRMODE_GET",
-                  queue->engine->dir == H2C ? "H2C" : "C2H", queue->engine->channel);
-        status = IoctlGetAddrMode(request, queue->engine);
-        if (NT_SUCCESS(status)) {
-            WdfRequestCompleteWithInformation(request, status, sizeof(ULONG));
-        }
-        break;
-    case IOCTL_XDMA_ADDRMODE_SET:
-        TraceInfo(DBG_IO, "%s_%u IOCTL_XDMA_ADDRMODE_SET",
-                  queue->engine->dir == H2C ? "H2C" : "C2H", queue->engine->channel);
-        status = IoctlSetAddrMode(request, queue->engine);
-        if (NT_SUCCESS(status)) {
-            WdfRequestComplete(request, STATUS_SUCCESS);
+    // drop anything collected for events which are no longer selected
+    WdfSpinLockAcquire(ctx->eventWaitersLock);
+    waiter->mask = mask;
+    waiter->fired &= mask;
+    for (UINT i = 0; i < XDMA_MAX_USER_IRQ; ++i) {
+        if ((mask & (1UL << i)) == 0) {
+            waiter->count[i] = 0;
         }
-        break;
-    default:
-        TraceError(DBG_IO, "Unknown IOCTL code!");
-        status = STATUS_NOT_SUPPORTED;
-        break;
     }
+    if (waiter->fired == 0) {
+        KeClearEvent(&waiter->signal);
+    }
+    WdfSpinLockRelease(ctx->eventWaitersLock);
+
+    TraceVerbose(DBG_IO, "event mask=0x%08X", mask);
+    return status;
+}
 
-exit:
+static NTSTATUS IoctlGetLatency(IN WDFREQUEST request, IN PXDMA_DEVICE xdma) {
+
+    // histograms are large - fill the request buffer in place instead of copying from the stack
+    XDMA_LATENCY_DATA* latencyData;
+    NTSTATUS status = WdfRequestRetrieveOutputBuffer(request, sizeof(XDMA_LATENCY_DATA),
+                                                     (PVOID*)&latencyData, NULL);
     if (!NT_SUCCESS(status)) {
-        WdfRequestComplete(request, status);
+        TraceError(DBG_IO, "WdfRequestRetrieveOutputBuffer failed: %!STATUS!", status);
+        return status;
     }
-    TraceVerbose(DBG_IO, "exit with status: %!STATUS!", status);
+
+    XDMA_LatencyGet(xdma, latencyData);
+    WdfRequestCompleteWithInformation(request, status, sizeof(XDMA_LATENCY_DATA));
+    return status;
 }
 
-VOID EvtIoWriteDma(IN WDFQUEUE wdfQueue, IN WDFREQUEST Request, IN size_t length)
-// callback for when a write I/O request enters the SGDMA write queue
-{
+static NTSTATUS IoctlGetStats(IN WDFREQUEST request, IN PXDMA_DEVICE xdma) {
 
-    UNREFERENCED_PARAMETER(length);
-    NTSTATUS status = STATUS_INTERNAL_ERROR;
-    PQUEUE_CONTEXT  queue = GetQueueContext(wdfQueue);
+    // optional flags - read before the output overwrites the shared system buffer
+    UINT32 flags = 0;
+    PVOID input;
+    if (NT_SUCCESS(WdfRequestRetrieveInputBuffer(request, sizeof(UINT32), &input, NULL))) {
+        flags = *(UINT32*)input;
+    }
 
-    TraceVerbose(DBG_IO, "%!FUNC!(queue=%p, request=%p, length=%llu)", wdfQueue, Request, length);
+    XDMA_STATS_DATA* stats;
+    NTSTATUS status = WdfRequestRetrieveOutputBuffer(request, sizeof(XDMA_STATS_DATA),
+                                                     (PVOID*)&stats, NULL);
+    if (!NT_SUCCESS(status)) {
+        TraceError(DBG_IO, "WdfRequestRetrieveOutputBuffer failed: %!STATUS!", status);
+        return status;
+    }
 
-    XDMA_ENGINE* engine = queue->engine;
-    TraceInfo(DBG_IO, "%s_%u writing %llu bytes to device",
-              DirectionToString(engine->dir), engine->channel, length);
+    XDMA_StatsGet(xdma, stats, (flags & XDMA_STATS_CLEAR) != 0);
+    WdfRequestCompleteWithInformation(request, status, sizeof(XDMA_STATS_DATA));
+    return status;
+}
 
-    // initialize a DMA transaction from the request 
-    status = WdfDmaTransactionInitializeUsingRequest(queue->engine->dmaTransaction, Request,
-                                                     XDMA_EngineProgramDma,
-                                                     WdfDmaDirectionWriteToDevice);
+static NTSTATUS IoctlGetCrossover(IN WDFREQUEST request, IN DeviceContext* ctx) {
+
+    XDMA_CROSSOVER* crossover;
+    NTSTATUS status = WdfRequestRetrieveOutputBuffer(request, sizeof(XDMA_CROSSOVER),
+                                                     (PVOID*)&crossover, NULL);
     if (!NT_SUCCESS(status)) {
-        TraceError(DBG_IO, "WdfDmaTransactionInitializeUsingRequest failed: %!STATUS!", status);
-        goto ErrExit;
+        TraceError(DBG_IO, "WdfRequestRetrieveOutputBuffer failed: %!STATUS!", status);
+        return status;
     }
-    status = WdfRequestMarkCancelableEx(Request, EvtCancelDma);
+
+    CrossoverGet(ctx, crossover);
+    WdfRequestCompleteWithInformation(request, status, sizeof(XDMA_CROSSOVER));
+    return status;
+}
+
+static NTSTATUS IoctlSetCrossover(IN WDFREQUEST request, IN DeviceContext* ctx) {
+
+    XDMA_CROSSOVER* crossover;
+    NTSTATUS status = WdfRequestRetrieveInputBuffer(request, sizeof(XDMA_CROSSOVER),
+                                                    (PVOID*)&crossover, NULL);
     if (!NT_SUCCESS(status)) {
-        TraceError(DBG_IO, "WdfRequestMarkCancelableEx failed: %!STATUS!", status);
-        goto ErrExit;
+        TraceError(DBG_IO, "WdfRequestRetrieveInputBuffer failed: %!STATUS!", status);
+        return status;
     }
+    return CrossoverSet(ctx, crossover);
+}
 
-    // supply the Queue as context for EvtProgramDma 
-    status = WdfDmaTransactionExecute(queue->engine->dmaTransaction, queue->engine);
+static NTSTATUS IoctlRegisterOps(IN WDFREQUEST request, IN PVOID bar, IN ULONG barLength) {
+
+    // METHOD_BUFFERED - input and output share the system buffer, results are written in place
+    XDMA_REG_OP* ops;
+    size_t inLength;
+    NTSTATUS status = WdfRequestRetrieveInputBuffer(request, sizeof(XDMA_REG_OP), (PVOID*)&ops,
+                                                    &inLength);
     if (!NT_SUCCESS(status)) {
-        TraceError(DBG_IO, "WdfDmaTransactionExecute failed: %!STATUS!", status);
-        goto ErrExit;
+        TraceError(DBG_IO, "WdfRequestRetrieveInputBuffer failed: %!STATUS!", status);
+        return status;
     }
+    WDF_REQUEST_PARAMETERS params;
+    WDF_REQUEST_PARAMETERS_INIT(&params);
+    WdfRequestGetParameters(request, &params);
+    size_t outLength = params.Parameters.DeviceIoControl.OutputBufferLength;
 
-    if (queue->engine->poll) {
-        status = EnginePollTransfer(queue->engine);
-        if (!NT_SUCCESS(status)) {
-            TraceError(DBG_IO, "EnginePollTransfer failed: %!STATUS!", status);
-            // EnginePollTransfer cleans-up/completes request on error, so no need for goto ErrExit
+    if ((inLength % sizeof(XDMA_REG_OP) != 0) || (inLength > XDMA_MAX_REG_OPS * sizeof(XDMA_REG_OP))) {
+        TraceError(DBG_IO, "Error: invalid register operation buffer size %llu", inLength);
+        return STATUS_INVALID_PARAMETER;
+    }
+    if ((outLength != 0) && (outLength < inLength)) {
+        TraceError(DBG_IO, "Error: output buffer too small (%llu < %llu)", outLength, inLength);
+        return STATUS_BUFFER_TOO_SMALL;
+    }
+    ULONG numOps = (ULONG)(inLength / sizeof(XDMA_REG_OP));
+
+    // validate the whole sequence before touching the hardware
+    for (ULONG i = 0; i < numOps; ++i) {
+        if ((ops[i].op > XDMA_REG_OP_WRITE_READBACK) || (ops[i].offset % sizeof(ULONG) != 0) ||
+            ((ULONG64)ops[i].offset + sizeof(ULONG) > barLength)) {
+            TraceError(DBG_IO, "Error: invalid register operation %u: op=%u offset=0x%08X",
+                       i, ops[i].op, ops[i].offset);
+            return STATUS_INVALID_PARAMETER;
         }
     }
 
-    return; // success
-ErrExit:
-    WdfDmaTransactionRelease(queue->engine->dmaTransaction);
-    WdfRequestComplete(Request, status);
-    TraceError(DBG_IO, "Error Request 0x%p: %!STATUS!", Request, status);
-}
+    for (ULONG i = 0; i < numOps; ++i) {
+        volatile ULONG* reg = (volatile ULONG*)((PUCHAR)bar + ops[i].offset);
+        switch (ops[i].op) {
+        case XDMA_REG_OP_READ:
+            ops[i].value = READ_REGISTER_ULONG(reg);
+            break;
+        case XDMA_REG_OP_WRITE:
+            WRITE_REGISTER_ULONG(reg, ops[i].value);
+            break;
+        case XDMA_REG_OP_RMW:
+        {
+            ULONG old = READ_REGISTER_ULONG(reg);
+            WRITE_REGISTER_ULONG(reg, (old & ~ops[i].mask) | (ops[i].value & ops[i].mask));
+            ops[i].value = old;
+            break;
+        }
+        case XDMA_REG_OP_WRITE_READBACK:
+            WRITE_REGISTER_ULONG(reg, ops[i].value);
+            ops[i].value = READ_REGISTER_ULONG(reg);
+            break;
+        }
+    }
 
-VOID EvtIoReadDma(IN WDFQUEUE wdfQueue, IN WDFREQUEST Request, IN size_t length)
-// 
-{
-    UNREFERENCED_PARAMETER(length);
-    NTSTATUS status = STATUS_INTERNAL_ERROR;
-    PQUEUE_CONTEXT queue = GetQueueContext(wdfQueue);
+    TraceVerbose(DBG_IO, "executed %u register operations", numOps);
+    WdfRequestCompleteWithInformation(request, status, outLength != 0 ? inLength : 0);
+    return status;
+}
 
-    TraceVerbose(DBG_IO, "%!FUNC!(queue=%p, request=%p, length=%llu)", wdfQueue, Request, length);
+static NTSTATUS IoctlRegisterWait(IN WDFREQUEST request, IN PVOID bar, IN ULONG barLength) {
 
-    XDMA_ENGINE* engine = queue->engine;
-    TraceInfo(DBG_IO, "%s_%u reading %llu bytes from device",
-              DirectionToString(engine->dir), engine->channel, length);
+    PAGED_CODE();
+
+    // METHOD_BUFFERED - input and output share the system buffer
+    XDMA_REG_WAIT* wait;
+    NTSTATUS status = WdfRequestRetrieveInputBuffer(request, sizeof(XDMA_REG_WAIT), (PVOID*)&wait,
+                                                    NULL);
+    if (!NT_SUCCESS(status)) {
+        TraceError(DBG_IO, "WdfRequestRetrieveInputBuffer failed: %!STATUS!", status);
+        return status;
+    }
+    status = WdfRequestRetrieveOutputBuffer(request, sizeof(XDMA_REG_WAIT), (PVOID*)&wait, NULL);
+    if (!NT_SUCCESS(status)) {
+        TraceError(DBG_IO, "WdfRequestRetrieveOutputBuffer failed: %!STATUS!", status);
+        return status;
+    }
+    if ((wait->offset % sizeof(ULONG) != 0) || ((ULONG64)wait->offset + sizeof(ULONG) > barLength) ||
+        (wait->spinUs > XDMA_REG_WAIT_MAX_SPIN_US) ||
+        (wait->timeoutUs > XDMA_REG_WAIT_MAX_TIMEOUT_US)) {
+        TraceError(DBG_IO, "Error: invalid register wait offset=0x%08X spin=%uus timeout=%uus",
+                   wait->offset, wait->spinUs, wait->timeoutUs);
+        return STATUS_INVALID_PARAMETER;
+    }
+
+    volatile ULONG* reg = (volatile ULONG*)((PUCHAR)bar + wait->offset);
+    LARGE_INTEGER frequency;
+    const LONG64 start = KeQueryPerformanceCounter(&frequency).QuadPart;
+    const LONG64 spinEnd = start + (frequency.QuadPart * wait->spinUs) / 1000000;
+    const LONG64 timeoutEnd = start + (frequency.QuadPart * wait->timeoutUs) / 1000000;
+    LONG64 now = start;
+    ULONG regValue = READ_REGISTER_ULONG(reg);
+
+    // busy poll first - reacts within a register read if the condition is met soon
+    while (((regValue & wait->mask) != wait->value) && (now < spinEnd) && (now < timeoutEnd)) {
+        YieldProcessor();
+        regValue = READ_REGISTER_ULONG(reg);
+        now = KeQueryPerformanceCounter(NULL).QuadPart;
+    }
+
+    // then give up the CPU between reads
+    LARGE_INTEGER interval;
+    interval.QuadPart = -1; // relative, shortest possible - ends with the next timer tick
+    while (((regValue & wait->mask) != wait->value) && (now < timeoutEnd)) {
+        if (WdfRequestIsCanceled(request)) {
+            TraceInfo(DBG_IO, "register wait canceled");
+            return STATUS_CANCELLED;
+        }
+        KeDelayExecutionThread(KernelMode, FALSE, &interval);
+        regValue = READ_REGISTER_ULONG(reg);
+        now = KeQueryPerformanceCounter(NULL).QuadPart;
+    }
+
+    wait->result = regValue;
+    wait->met = (regValue & wait->mask) == wait->value;
+    const LONG64 elapsed = now - start;
+    wait->elapsedNs = (UINT64)((elapsed / frequency.QuadPart) * 1000000000 +
+                               (elapsed % frequency.QuadPart) * 1000000000 / frequency.QuadPart);
+    TraceVerbose(DBG_IO, "register 0x%08X=0x%08X met=%u after %lluns", wait->offset, regValue,
+                 wait->met, wait->elapsedNs);
+    WdfRequestCompleteWithInformation(request, status, sizeof(XDMA_REG_WAIT));
+    return status;
+}
+
+static NTSTATUS IoctlSetBatchMode(IN WDFREQUEST request, IN ENGINE_TRIGGER* trigger)
+// runs on the engine queue, so no read/write request of the engine is in progress.
+// request is completed on success
+{
+    // held requests use the single transaction of the engine, batches use their own
+    if (trigger->armed) {
+        TraceError(DBG_IO, "Error: batching is not supported with an armed event trigger");
+        return STATUS_INVALID_DEVICE_STATE;
+    }
+
+    WDFMEMORY requestMemory;
+    NTSTATUS status = WdfRequestRetrieveInputMemory(request, &requestMemory);
+    if (!NT_SUCCESS(status)) {
+        TraceError(DBG_IO, "WdfRequestRetrieveInputMemory failed: %!STATUS!", status);
+        return status;
+    }
+    XDMA_BATCH_CONFIG params = { 0 };
+    status = WdfMemoryCopyToBuffer(requestMemory, 0, &params, sizeof(params));
+    if (!NT_SUCCESS(status)) {
+        TraceError(DBG_IO, "WdfMemoryCopyToBuffer failed: %!STATUS!", status);
+        return status;
+    }
+
+    status = XDMA_EngineSetBatchMode(trigger->engine, params.threshold, params.holdoffUs);
+    if (NT_SUCCESS(status)) {
+        WdfRequestComplete(request, status);
+    }
+    return status;
+}
+
+static NTSTATUS IoctlSetPollMode(IN WDFREQUEST request, IN ENGINE_TRIGGER* trigger)
+// runs on the engine queue, so no read/write request of the engine is in progress.
+// request is completed on success
+{
+    XDMA_ENGINE* engine = trigger->engine;
+    ASSERT(engine != NULL);
+
+    UINT32* mode = NULL;
+    NTSTATUS status = WdfRequestRetrieveInputBuffer(request, sizeof(UINT32), (PVOID*)&mode, NULL);
+    if (!NT_SUCCESS(status)) {
+        TraceError(DBG_IO, "WdfRequestRetrieveInputBuffer failed: %!STATUS!", status);
+        return status;
+    }
+    if (*mode > XDMA_COMPLETION_POLL) {
+        TraceError(DBG_IO, "Error: invalid completion mode %u", *mode);
+        return STATUS_INVALID_PARAMETER;
+    }
+
+    // the held transfer of a trigger is started from the user event DPC
+    if ((*mode == XDMA_COMPLETION_POLL) && trigger->armed) {
+        TraceError(DBG_IO, "Error: poll mode is not supported with an armed event trigger");
+        return STATUS_INVALID_DEVICE_STATE;
+    }
+
+    status = XDMA_EngineChangePollMode(engine, *mode == XDMA_COMPLETION_POLL);
+    if (NT_SUCCESS(status)) {
+        WdfRequestComplete(request, status);
+    }
+    return status;
+}
+
+// ====================== event triggered transfers ===============================================
+
+static NTSTATUS IoctlArmTrigger(IN WDFREQUEST request, IN ENGINE_TRIGGER* trigger) {
+
+    XDMA_ENGINE* engine = trigger->engine;
+    ASSERT(engine != NULL);
+
+    // the held transfer is started from the user event DPC, completion must be interrupt driven
+    if (engine->poll) {
+        TraceError(DBG_IO, "Error: event triggers are not supported in poll mode");
+        return STATUS_INVALID_DEVICE_STATE;
+    }
+    if ((engine->type == EngineType_ST) && (engine->dir == C2H)) {
+        TraceError(DBG_IO, "Error: event triggers are not supported on streaming C2H engines");
+        return STATUS_INVALID_DEVICE_REQUEST;
+    }
+    if (engine->batch.threshold != 0) {
+        TraceError(DBG_IO, "Error: event triggers are not supported with batching enabled");
+        return STATUS_INVALID_DEVICE_STATE;
+    }
+    if (engine->direct.done != NULL) {
+        TraceError(DBG_IO, "Error: engine is used by a submission queue");
+        return STATUS_DEVICE_BUSY;
+    }
+
+    WDFMEMORY requestMemory;
+    NTSTATUS status = WdfRequestRetrieveInputMemory(request, &requestMemory);
+    if (!NT_SUCCESS(status)) {
+        TraceError(DBG_IO, "WdfRequestRetrieveInputMemory failed: %!STATUS!", status);
+        return status;
+    }
+    XDMA_TRIGGER params = { 0 };
+    status = WdfMemoryCopyToBuffer(requestMemory, 0, &params, sizeof(params));
+    if (!NT_SUCCESS(status)) {
+        TraceError(DBG_IO, "WdfMemoryCopyToBuffer failed: %!STATUS!", status);
+        return status;
+    }
+    if (params.eventId >= XDMA_MAX_USER_IRQ) {
+        TraceError(DBG_IO, "Error: invalid user event index %u", params.eventId);
+        return STATUS_INVALID_PARAMETER;
+    }
+
+    WdfSpinLockAcquire(trigger->lock);
+    if (trigger->request != NULL) {
+        // a request is already waiting on the current event
+        status = STATUS_DEVICE_BUSY;
+    } else {
+        trigger->eventId = params.eventId;
+        trigger->autoRearm = (params.flags & XDMA_TRIGGER_AUTO_REARM) != 0;
+        trigger->fired = FALSE;
+        trigger->owner = WdfRequestGetFileObject(request);
+        trigger->armed = TRUE;
+    }
+    WdfSpinLockRelease(trigger->lock);
+
+    TraceInfo(DBG_IO, "%s_%u armed on event_%u autoRearm=%u: %!STATUS!",
+              DirectionToString(engine->dir), engine->channel, params.eventId,
+              (params.flags & XDMA_TRIGGER_AUTO_REARM) != 0, status);
+    return status;
+}
+
+static VOID TriggerDisarm(ENGINE_TRIGGER* trigger) {
+
+    WdfSpinLockAcquire(trigger->lock);
+    WDFREQUEST request = trigger->request;
+    trigger->request = NULL;
+    trigger->armed = FALSE;
+    trigger->fired = FALSE;
+    trigger->owner = NULL;
+    WdfSpinLockRelease(trigger->lock);
+
+    // a held request never started - give it back. if it is being cancelled EvtCancelDma does it
+    if ((request != NULL) && (WdfRequestUnmarkCancelable(request) != STATUS_CANCELLED)) {
+        WdfDmaTransactionRelease(trigger->engine->dmaTransaction);
+        WdfRequestComplete(request, STATUS_CANCELLED);
+    }
+}
+
+static BOOLEAN TriggerHoldRequest(ENGINE_TRIGGER* trigger, WDFREQUEST request)
+// returns TRUE if the request has to wait for the trigger event, FALSE to start it right away
+{
+    BOOLEAN hold = FALSE;
+
+    WdfSpinLockAcquire(trigger->lock);
+    if (trigger->armed) {
+        if (trigger->fired) {
+            // event arrived before the request
+            trigger->fired = FALSE;
+            trigger->armed = trigger->autoRearm;
+        } else {
+            trigger->request = request;
+            hold = TRUE;
+        }
+    }
+    WdfSpinLockRelease(trigger->lock);
+
+    return hold;
+}
+
+static VOID TriggerFire(ENGINE_TRIGGER* trigger, ULONG eventId)
+// called from the user event DPC - start the held DMA transfer if armed on this event
+{
+    // unlocked check keeps the common 'not armed' case cheap
+    if ((trigger->lock == NULL) || !trigger->armed || (trigger->eventId != eventId)) {
+        return;
+    }
+
+    WdfSpinLockAcquire(trigger->lock);
+    WDFREQUEST request = NULL;
+    if (trigger->armed && (trigger->eventId == eventId)) {
+        request = trigger->request;
+        trigger->request = NULL;
+        if (request == NULL) {
+            trigger->fired = TRUE; // start the next request immediately
+        } else {
+            trigger->armed = trigger->autoRearm;
+        }
+    }
+    WdfSpinLockRelease(trigger->lock);
+
+    if (request == NULL) {
+        return;
+    }
+
+    XDMA_ENGINE* engine = trigger->engine;
+    TraceInfo(DBG_IO, "event_%u starts %s_%u transfer", eventId, DirectionToString(engine->dir),
+              engine->channel);
+    NTSTATUS status = WdfDmaTransactionExecute(engine->dmaTransaction, engine);
+    if (!NT_SUCCESS(status)) {
+        TraceError(DBG_IO, "WdfDmaTransactionExecute failed: %!STATUS!", status);
+        if (WdfRequestUnmarkCancelable(request) != STATUS_CANCELLED) {
+            WdfDmaTransactionRelease(engine->dmaTransaction);
+            WdfRequestComplete(request, status);
+        }
+    }
+}
+
+// ====================== IOCTLs ==================================================================
+
+static NTSTATUS EngineIoControl(IN WDFREQUEST request, IN XDMA_ENGINE* engine,
+                                IN ENGINE_TRIGGER* trigger, IN ULONG IoControlCode)
+// IOCTLs on DMA files (h2c_* or c2h_* devices). request is completed on success
+{
+    NTSTATUS status = STATUS_NOT_SUPPORTED;
+
+    switch (IoControlCode) {
+    case IOCTL_XDMA_PERF_START:
+        TraceInfo(DBG_IO, "%s_%u IOCTL_XDMA_PERF_START",
+                  engine->dir == H2C ? "H2C" : "C2H", engine->channel);
+        EngineStartPerf(engine);
+        status = STATUS_SUCCESS;
+        WdfRequestComplete(request, status);
+        break;
+    case IOCTL_XDMA_PERF_GET:
+        TraceInfo(DBG_IO, "%s_%u IOCTL_XDMA_PERF_GET",
+                  engine->dir == H2C ? "H2C" : "C2H", engine->channel);
+        status = IoctlGetPerf(request, engine);
+        if (NT_SUCCESS(status)) {
+            WdfRequestCompleteWithInformation(request, status, sizeof(XDMA_PERF_DATA));
+        }
+        break;
+    case IOCTL_XDMA_ADDRMODE_GET:
+        TraceInfo(DBG_IO, "%s_%u IOCTL_XDMA_ADDRMODE_GET",
+                  engine->dir == H2C ? "H2C" : "C2H", engine->channel);
+        status = IoctlGetAddrMode(request, engine);
+        if (NT_SUCCESS(status)) {
+            WdfRequestCompleteWithInformation(request, status, sizeof(ULONG));
+        }
+        break;
+    case IOCTL_XDMA_ADDRMODE_SET:
+        TraceInfo(DBG_IO, "%s_%u IOCTL_XDMA_ADDRMODE_SET",
+                  engine->dir == H2C ? "H2C" : "C2H", engine->channel);
+        status = IoctlSetAddrMode(request, engine);
+        if (NT_SUCCESS(status)) {
+            WdfRequestComplete(request, STATUS_SUCCESS);
+        }
+        break;
+    case IOCTL_XDMA_TRIGGER_ARM:
+        status = IoctlArmTrigger(request, trigger);
+        if (NT_SUCCESS(status)) {
+            WdfRequestComplete(request, STATUS_SUCCESS);
+        }
+        break;
+    case IOCTL_XDMA_DESC_BYPASS_SET:
+        TraceInfo(DBG_IO, "%s_%u IOCTL_XDMA_DESC_BYPASS_SET",
+                  engine->dir == H2C ? "H2C" : "C2H", engine->channel);
+        status = IoctlSetDescBypass(request, engine);
+        if (NT_SUCCESS(status)) {
+            WdfRequestComplete(request, status);
+        }
+        break;
+    case IOCTL_XDMA_TRIGGER_DISARM:
+        TraceInfo(DBG_IO, "%s_%u IOCTL_XDMA_TRIGGER_DISARM",
+                  engine->dir == H2C ? "H2C" : "C2H", engine->channel);
+        TriggerDisarm(trigger);
+        status = STATUS_SUCCESS;
+        WdfRequestComplete(request, status);
+        break;
+    default:
+        TraceError(DBG_IO, "Unknown IOCTL code!");
+        status = STATUS_NOT_SUPPORTED;
+        break;
+    }
+
+    return status;
+}
+
+static NTSTATUS IoctlSetPioWidth(IN WDFREQUEST request, IN PFILE_CONTEXT file) {
+
+    WDFMEMORY requestMemory;
+    NTSTATUS status = WdfRequestRetrieveInputMemory(request, &requestMemory);
+    if (!NT_SUCCESS(status)) {
+        TraceError(DBG_IO, "WdfRequestRetrieveInputMemory failed: %!STATUS!", status);
+        return status;
+    }
+    ULONG width = 0;
+    status = WdfMemoryCopyToBuffer(requestMemory, 0, &width, sizeof(width));
+    if (!NT_SUCCESS(status)) {
+        TraceError(DBG_IO, "WdfMemoryCopyToBuffer failed: %!STATUS!", status);
+        return status;
+    }
+
+    switch (width) {
+    case 4:
+        break;
+#if defined(_M_AMD64)
+    case 8:
+    case 16:
+        break;
+    case 32:
+        if ((RtlGetEnabledExtendedFeatures(XSTATE_MASK_AVX) & XSTATE_MASK_AVX) == 0) {
+            TraceError(DBG_IO, "Error: 32 byte stores require AVX");
+            return STATUS_NOT_SUPPORTED;
+        }
+        break;
+#endif
+    default:
+        TraceError(DBG_IO, "Error: store width of %u bytes not supported", width);
+        return STATUS_NOT_SUPPORTED;
+    }
+    file->pioWidth = width;
+
+    TraceVerbose(DBG_IO, "PIO width=%u", width);
+    return status;
+}
+
+static NTSTATUS IoctlGetPioStats(IN WDFREQUEST request, IN PFILE_CONTEXT file,
+                                 IN PXDMA_DEVICE xdma) {
+
+    LARGE_INTEGER frequency;
+    KeQueryPerformanceCounter(&frequency);
+    XDMA_PIO_STATS stats = { 0 };
+    stats.frequency = frequency.QuadPart;
+    stats.numWrites = file->pioStats.numWrites;
+    stats.numBytes = file->pioStats.numBytes;
+    stats.ticks = file->pioStats.ticks;
+    stats.width = file->pioWidth;
+    stats.writeCombined = xdma->bypassWriteCombined;
+
+    WDFMEMORY requestMemory;
+    NTSTATUS status = WdfRequestRetrieveOutputMemory(request, &requestMemory);
+    if (!NT_SUCCESS(status)) {
+        TraceError(DBG_IO, "WdfRequestRetrieveOutputMemory failed: %!STATUS!", status);
+        return status;
+    }
+    status = WdfMemoryCopyFromBuffer(requestMemory, 0, &stats, sizeof(stats));
+    if (!NT_SUCCESS(status)) {
+        TraceError(DBG_IO, "WdfMemoryCopyFromBuffer failed: %!STATUS!", status);
+        return status;
+    }
+    WdfRequestCompleteWithInformation(request, status, sizeof(stats));
+    return status;
+}
+
+// ====================== user BAR mappings =======================================================
+
+static VOID UnmapBarWindow(BAR_MAPPING* mapping)
+// Must be called in the context of the process owning the mapping
+{
+    MmUnmapLockedPages(mapping->userAddr, mapping->mdl);
+    IoFreeMdl(mapping->mdl);
+    mapping->mdl = NULL;
+    mapping->userAddr = NULL;
+}
+
+static VOID UnmapBarWindows(PFILE_CONTEXT file)
+// Remove all mappings of the file. The last handle may be closed by another process than the one
+// which created the mappings (e.g. after DuplicateHandle), so attach to the owner if needed.
+{
+    WdfWaitLockAcquire(file->mappingLock, NULL);
+    PEPROCESS owner = file->mappingProcess;
+    if (owner != NULL) {
+        KAPC_STATE apcState;
+        BOOLEAN attached = FALSE;
+        if (PsGetCurrentProcess() != owner) {
+            KeStackAttachProcess((PRKPROCESS)owner, &apcState);
+            attached = TRUE;
+        }
+        for (UINT i = 0; i < XDMA_MAX_BAR_MAPPINGS; ++i) {
+            if (file->mappings[i].mdl != NULL) {
+                UnmapBarWindow(&file->mappings[i]);
+            }
+        }
+        if (attached) {
+            KeUnstackDetachProcess(&apcState);
+        }
+        file->mappingProcess = NULL;
+        ObDereferenceObject(owner);
+    }
+    WdfWaitLockRelease(file->mappingLock);
+}
+
+static NTSTATUS IoctlMapBar(IN WDFREQUEST request, IN PFILE_CONTEXT file, IN DeviceContext* ctx) {
+
+    if (WdfRequestGetRequestorMode(request) != UserMode) {
+        TraceError(DBG_IO, "Error: BAR mappings are only available to user mode callers");
+        return STATUS_INVALID_DEVICE_REQUEST;
+    }
+
+    // METHOD_BUFFERED - input and output share the system buffer
+    XDMA_BAR_MAPPING* mapping;
+    NTSTATUS status = WdfRequestRetrieveInputBuffer(request, sizeof(XDMA_BAR_MAPPING),
+                                                    (PVOID*)&mapping, NULL);
+    if (!NT_SUCCESS(status)) {
+        TraceError(DBG_IO, "WdfRequestRetrieveInputBuffer failed: %!STATUS!", status);
+        return status;
+    }
+    status = WdfRequestRetrieveOutputBuffer(request, sizeof(XDMA_BAR_MAPPING), (PVOID*)&mapping,
+                                            NULL);
+    if (!NT_SUCCESS(status)) {
+        TraceError(DBG_IO, "WdfRequestRetrieveOutputBuffer failed: %!STATUS!", status);
+        return status;
+    }
+
+    // only the window enabled in the registry may be mapped
+    ULONG64 offset = mapping->offset;
+    ULONG64 length = ROUND_TO_PAGES((ULONG64)mapping->length);
+    if ((length == 0) || (offset % PAGE_SIZE != 0) || (offset < ctx->userMapOffset) ||
+        (offset + length > (ULONG64)ctx->userMapOffset + ctx->userMapLength) ||
+        (offset + length > file->barLength)) {
+        TraceError(DBG_IO, "Error: mapping BAR offset=0x%llx length=0x%llx not permitted",
+                   offset, length);
+        return STATUS_ACCESS_DENIED;
+    }
+
+    WdfWaitLockAcquire(file->mappingLock, NULL);
+
+    // all mappings of a file belong to one process, the one which is unmapped on cleanup
+    if ((file->mappingProcess != NULL) && (file->mappingProcess != PsGetCurrentProcess())) {
+        TraceError(DBG_IO, "Error: BAR already mapped by another process");
+        status = STATUS_ACCESS_DENIED;
+        goto Exit;
+    }
+    BAR_MAPPING* slot = NULL;
+    for (UINT i = 0; i < XDMA_MAX_BAR_MAPPINGS; ++i) {
+        if (file->mappings[i].mdl == NULL) {
+            slot = &file->mappings[i];
+            break;
+        }
+    }
+    if (slot == NULL) {
+        TraceError(DBG_IO, "Error: all %u BAR mappings of the file in use", XDMA_MAX_BAR_MAPPINGS);
+        status = STATUS_INSUFFICIENT_RESOURCES;
+        goto Exit;
+    }
+
+    PMDL mdl = IoAllocateMdl((PUCHAR)file->u.bar + offset, (ULONG)length, FALSE, FALSE, NULL);
+    if (mdl == NULL) {
+        TraceError(DBG_IO, "IoAllocateMdl failed");
+        status = STATUS_INSUFFICIENT_RESOURCES;
+        goto Exit;
+    }
+    MmBuildMdlForNonPagedPool(mdl);
+
+    // registers must not be cached - same attributes as the kernel mapping of the BAR
+    PVOID userAddr = NULL;
+    __try {
+        userAddr = MmMapLockedPagesSpecifyCache(mdl, UserMode, MmNonCached, NULL, FALSE,
+                                                NormalPagePriority);
+    } __except (EXCEPTION_EXECUTE_HANDLER) {
+        userAddr = NULL;
+    }
+    if (userAddr == NULL) {
+        TraceError(DBG_IO, "MmMapLockedPagesSpecifyCache failed");
+        IoFreeMdl(mdl);
+        status = STATUS_INSUFFICIENT_RESOURCES;
+        goto Exit;
+    }
+
+    slot->mdl = mdl;
+    slot->userAddr = userAddr;
+    if (file->mappingProcess == NULL) {
+        file->mappingProcess = PsGetCurrentProcess();
+        ObReferenceObject(file->mappingProcess);
+    }
+    mapping->address = (UINT64)userAddr;
+    TraceInfo(DBG_IO, "mapped user BAR offset=0x%llx length=0x%llx at 0x%p", offset, length,
+              userAddr);
+
+Exit:
+    WdfWaitLockRelease(file->mappingLock);
+    if (NT_SUCCESS(status)) {
+        WdfRequestCompleteWithInformation(request, status, sizeof(XDMA_BAR_MAPPING));
+    }
+    return status;
+}
+
+static NTSTATUS IoctlUnmapBar(IN WDFREQUEST request, IN PFILE_CONTEXT file) {
+
+    XDMA_BAR_MAPPING* mapping;
+    NTSTATUS status = WdfRequestRetrieveInputBuffer(request, sizeof(XDMA_BAR_MAPPING),
+                                                    (PVOID*)&mapping, NULL);
+    if (!NT_SUCCESS(status)) {
+        TraceError(DBG_IO, "WdfRequestRetrieveInputBuffer failed: %!STATUS!", status);
+        return status;
+    }
+
+    status = STATUS_INVALID_PARAMETER;
+    WdfWaitLockAcquire(file->mappingLock, NULL);
+    if (file->mappingProcess == PsGetCurrentProcess()) {
+        BOOLEAN inUse = FALSE;
+        for (UINT i = 0; i < XDMA_MAX_BAR_MAPPINGS; ++i) {
+            if ((file->mappings[i].mdl != NULL) &&
+                ((UINT64)file->mappings[i].userAddr == mapping->address)) {
+                UnmapBarWindow(&file->mappings[i]);
+                status = STATUS_SUCCESS;
+            }
+            inUse |= file->mappings[i].mdl != NULL;
+        }
+        if (!inUse) {
+            ObDereferenceObject(file->mappingProcess);
+            file->mappingProcess = NULL;
+        }
+    }
+    WdfWaitLockRelease(file->mappingLock);
+
+    if (NT_SUCCESS(status)) {
+        WdfRequestComplete(request, status);
+    } else {
+        TraceError(DBG_IO, "Error: no BAR mapping at 0x%llx", mapping->address);
+    }
+    return status;
+}
+
+static NTSTATUS IoctlSetupQueue(IN WDFREQUEST request, IN PFILE_CONTEXT file, IN DeviceContext* ctx)
+// caller context - the ring and the buffers are locked in the requesting process
+{
+    SUBMIT_QUEUE* queue = NULL;
+    NTSTATUS status = SubmitQueueCreate(request, ctx, &queue);
+    if (!NT_SUCCESS(status)) {
+        return status;
+    }
+    // one queue per file
+    if (InterlockedCompareExchangePointer((PVOID*)&file->submitQueue, queue, NULL) != NULL) {
+        TraceError(DBG_IO, "Error: queue already set up on this file");
+        SubmitQueueDestroy(queue);
+        return STATUS_INVALID_DEVICE_STATE;
+    }
+    return STATUS_SUCCESS;
+}
+
+static NTSTATUS IoctlRegisterBuffer(IN WDFREQUEST request, IN PFILE_CONTEXT file,
+                                    IN DeviceContext* ctx)
+// caller context - the buffer is locked in the requesting process
+{
+    XDMA_BUFFER_REGISTER* params = NULL;
+    NTSTATUS status = WdfRequestRetrieveInputBuffer(request, sizeof(XDMA_BUFFER_REGISTER),
+                                                    (PVOID*)&params, NULL);
+    if (!NT_SUCCESS(status)) {
+        TraceError(DBG_IO, "WdfRequestRetrieveInputBuffer failed: %!STATUS!", status);
+        return status;
+    }
+    XDMA_BUFFER_REGISTER* result = NULL;
+    status = WdfRequestRetrieveOutputBuffer(request, sizeof(XDMA_BUFFER_REGISTER),
+                                            (PVOID*)&result, NULL);
+    if (!NT_SUCCESS(status)) {
+        TraceError(DBG_IO, "WdfRequestRetrieveOutputBuffer failed: %!STATUS!", status);
+        return status;
+    }
+
+    if (file->registry == NULL) {
+        BUFFER_REGISTRY* registry = NULL;
+        status = BufferRegistryCreate(ctx, file->u.engine, &registry);
+        if (!NT_SUCCESS(status)) {
+            return status;
+        }
+        if (InterlockedCompareExchangePointer((PVOID*)&file->registry, registry, NULL) != NULL) {
+            BufferRegistryDestroy(registry); // lost the race against another thread
+        }
+    }
+
+    const UINT64 address = params->address;
+    const ULONG length = params->length;
+    ULONG handle = 0;
+    status = BufferRegistryAdd(file->registry, address, length, &handle);
+    if (NT_SUCCESS(status)) {
+        // same system buffer as the input
+        result->address = address;
+        result->length = length;
+        result->handle = handle;
+        WdfRequestCompleteWithInformation(request, status, sizeof(XDMA_BUFFER_REGISTER));
+    }
+    return status;
+}
+
+static NTSTATUS IoctlDeregisterBuffer(IN WDFREQUEST request, IN PFILE_CONTEXT file) {
+    UINT32* handle = NULL;
+    NTSTATUS status = WdfRequestRetrieveInputBuffer(request, sizeof(UINT32), (PVOID*)&handle, NULL);
+    if (!NT_SUCCESS(status)) {
+        TraceError(DBG_IO, "WdfRequestRetrieveInputBuffer failed: %!STATUS!", status);
+        return status;
+    }
+    if (file->registry == NULL) {
+        return STATUS_INVALID_HANDLE;
+    }
+    return BufferRegistryRemove(file->registry, *handle);
+}
+
+static NTSTATUS IoctlCreateProgram(IN WDFREQUEST request, IN PFILE_CONTEXT file) {
+    XDMA_PROGRAM_CREATE* params = NULL;
+    NTSTATUS status = WdfRequestRetrieveInputBuffer(request, sizeof(XDMA_PROGRAM_CREATE),
+                                                    (PVOID*)&params, NULL);
+    if (!NT_SUCCESS(status)) {
+        TraceError(DBG_IO, "WdfRequestRetrieveInputBuffer failed: %!STATUS!", status);
+        return status;
+    }
+    XDMA_PROGRAM_CREATE* result = NULL;
+    status = WdfRequestRetrieveOutputBuffer(request, sizeof(XDMA_PROGRAM_CREATE),
+                                            (PVOID*)&result, NULL);
+    if (!NT_SUCCESS(status)) {
+        TraceError(DBG_IO, "WdfRequestRetrieveOutputBuffer failed: %!STATUS!", status);
+        return status;
+    }
+    if (file->registry == NULL) {
+        TraceError(DBG_IO, "Error: no buffers registered on this file");
+        return STATUS_INVALID_HANDLE;
+    }
+
+    ULONG programId = 0;
+    status = BufferRegistryCompile(file->registry, params, &programId);
+    if (NT_SUCCESS(status)) {
+        result->program = programId; // same system buffer as the input
+        WdfRequestCompleteWithInformation(request, status, sizeof(XDMA_PROGRAM_CREATE));
+    }
+    return status;
+}
+
+static NTSTATUS IoctlDeleteProgram(IN WDFREQUEST request, IN PFILE_CONTEXT file) {
+    UINT32* programId = NULL;
+    NTSTATUS status = WdfRequestRetrieveInputBuffer(request, sizeof(UINT32),
+                                                    (PVOID*)&programId, NULL);
+    if (!NT_SUCCESS(status)) {
+        TraceError(DBG_IO, "WdfRequestRetrieveInputBuffer failed: %!STATUS!", status);
+        return status;
+    }
+    if (file->registry == NULL) {
+        return STATUS_INVALID_HANDLE;
+    }
+    return BufferRegistryDeleteProgram(file->registry, *programId);
+}
+
+VOID EvtIoInCallerContext(IN WDFDEVICE device, IN WDFREQUEST request)
+// Called for every request before it is queued. BAR (un)mapping and queue setup are handled right
+// here since they have to run in the context of the requesting process. Register waits block the
+// calling thread, they are done here as well, at the caller's PASSIVE_LEVEL. All other requests go
+// to the default queue.
+{
+    WDF_REQUEST_PARAMETERS params;
+    WDF_REQUEST_PARAMETERS_INIT(&params);
+    WdfRequestGetParameters(request, &params);
+
+    if (params.Type == WdfRequestTypeDeviceControl) {
+        ULONG ioControlCode = params.Parameters.DeviceIoControl.IoControlCode;
+        if (ioControlCode == IOCTL_XDMA_BUFFER_REGISTER) {
+            PFILE_CONTEXT file = GetFileContext(WdfRequestGetFileObject(request));
+            NTSTATUS status = STATUS_INVALID_PARAMETER;
+            if ((file->devType == DEVNODE_TYPE_H2C) || (file->devType == DEVNODE_TYPE_C2H)) {
+                status = IoctlRegisterBuffer(request, file, GetDeviceContext(device));
+            } else {
+                TraceError(DBG_IO, "IOCTL not supported on device node type %d", file->devType);
+            }
+            if (!NT_SUCCESS(status)) {
+                WdfRequestComplete(request, status);
+            }
+            return;
+        }
+        if (ioControlCode == IOCTL_XDMA_QUEUE_SETUP) {
+            PFILE_CONTEXT file = GetFileContext(WdfRequestGetFileObject(request));
+            NTSTATUS status = STATUS_INVALID_PARAMETER;
+            if (file->devType == DEVNODE_TYPE_QUEUE) {
+                status = IoctlSetupQueue(request, file, GetDeviceContext(device));
+            } else {
+                TraceError(DBG_IO, "IOCTL not supported on device node type %d", file->devType);
+            }
+            WdfRequestComplete(request, status);
+            return;
+        }
+        if (ioControlCode == IOCTL_XDMA_REGISTER_WAIT) {
+            PFILE_CONTEXT file = GetFileContext(WdfRequestGetFileObject(request));
+            NTSTATUS status = STATUS_INVALID_PARAMETER;
+            if ((file->devType == DEVNODE_TYPE_USER) || (file->devType == DEVNODE_TYPE_CONTROL)) {
+                status = IoctlRegisterWait(request, file->u.bar, file->barLength);
+            } else {
+                TraceError(DBG_IO, "IOCTL not supported on device node type %d", file->devType);
+            }
+            if (!NT_SUCCESS(status)) {
+                WdfRequestComplete(request, status);
+            }
+            return;
+        }
+        if ((ioControlCode == IOCTL_XDMA_BAR_MAP) || (ioControlCode == IOCTL_XDMA_BAR_UNMAP)) {
+            PFILE_CONTEXT file = GetFileContext(WdfRequestGetFileObject(request));
+            NTSTATUS status = STATUS_INVALID_PARAMETER;
+            if (file->devType != DEVNODE_TYPE_USER) {
+                TraceError(DBG_IO, "IOCTL not supported on device node type %d", file->devType);
+            } else if (ioControlCode == IOCTL_XDMA_BAR_MAP) {
+                status = IoctlMapBar(request, file, GetDeviceContext(device));
+            } else {
+                status = IoctlUnmapBar(request, file);
+            }
+            if (!NT_SUCCESS(status)) {
+                WdfRequestComplete(request, status);
+            }
+            return;
+        }
+    }
+
+    NTSTATUS status = WdfDeviceEnqueueRequest(device, request);
+    if (!NT_SUCCESS(status)) {
+        TraceError(DBG_IO, "WdfDeviceEnqueueRequest failed: %!STATUS!", status);
+        WdfRequestComplete(request, status);
+    }
+}
+
+VOID EvtIoDeviceControl(IN WDFQUEUE Queue, IN WDFREQUEST request, IN size_t OutputBufferLength,
+                        IN size_t InputBufferLength, IN ULONG IoControlCode) {
+
+    UNREFERENCED_PARAMETER(Queue);
+    UNREFERENCED_PARAMETER(OutputBufferLength);
+    UNREFERENCED_PARAMETER(InputBufferLength);
+
+    WDFFILEOBJECT fileObject = WdfRequestGetFileObject(request);
+    PFILE_CONTEXT file = GetFileContext(fileObject);
+    DeviceContext* ctx = GetDeviceContext(WdfFileObjectGetDevice(fileObject));
+    NTSTATUS status = STATUS_NOT_SUPPORTED;
+
+    // ioctl codes defined in xdma_public.h
+
+    // device wide ioctls, accepted on every device node
+    switch (IoControlCode) {
+    case IOCTL_XDMA_LATENCY_GET:
+        status = IoctlGetLatency(request, &ctx->xdma);
+        goto Exit;
+    case IOCTL_XDMA_LATENCY_RESET:
+        XDMA_LatencyReset(&ctx->xdma);
+        status = STATUS_SUCCESS;
+        WdfRequestComplete(request, status);
+        goto Exit;
+    case IOCTL_XDMA_STATS_GET:
+        status = IoctlGetStats(request, &ctx->xdma);
+        goto Exit;
+    case IOCTL_XDMA_CROSSOVER_GET:
+        status = IoctlGetCrossover(request, ctx);
+        goto Exit;
+    case IOCTL_XDMA_CROSSOVER_SET:
+        status = IoctlSetCrossover(request, ctx);
+        if (NT_SUCCESS(status)) {
+            WdfRequestComplete(request, status);
+        }
+        goto Exit;
+    default:
+        break;
+    }
+
+    switch (file->devType) {
+    case DEVNODE_TYPE_USER:
+    case DEVNODE_TYPE_CONTROL:
+        if (IoControlCode != IOCTL_XDMA_REGISTER_OPS) {
+            TraceError(DBG_IO, "Unknown IOCTL code!");
+            status = STATUS_NOT_SUPPORTED;
+            break;
+        }
+        status = IoctlRegisterOps(request, file->u.bar, file->barLength);
+        break;
+    case DEVNODE_TYPE_BYPASS:
+        switch (IoControlCode) {
+        case IOCTL_XDMA_PIO_SET_WIDTH:
+            status = IoctlSetPioWidth(request, file);
+            if (NT_SUCCESS(status)) {
+                WdfRequestComplete(request, STATUS_SUCCESS);
+            }
+            break;
+        case IOCTL_XDMA_PIO_STATS_GET:
+            status = IoctlGetPioStats(request, file, &ctx->xdma);
+            break;
+        default:
+            TraceError(DBG_IO, "Unknown IOCTL code!");
+            status = STATUS_NOT_SUPPORTED;
+            break;
+        }
+        break;
+    case DEVNODE_TYPE_H2C:
+    case DEVNODE_TYPE_C2H:
+        ASSERTMSG("no engine attached to file context", file->u.engine != NULL);
+        if ((IoControlCode == IOCTL_XDMA_BUFFER_TRANSFER) || (IoControlCode == IOCTL_XDMA_PROGRAM_LAUNCH) ||
+            (IoControlCode == IOCTL_XDMA_POLL_MODE_SET) || (IoControlCode == IOCTL_XDMA_BATCH_SET)) {
+            // runs in order with the read/write requests of the engine, see EvtIoDeviceControlDma
+            status = WdfRequestForwardToIoQueue(request, file->queue);
+            break;
+        }
+        if (IoControlCode == IOCTL_XDMA_BUFFER_DEREGISTER) {
+            status = IoctlDeregisterBuffer(request, file);
+            if (NT_SUCCESS(status)) {
+                WdfRequestComplete(request, STATUS_SUCCESS);
+            }
+            break;
+        }
+        if (IoControlCode == IOCTL_XDMA_PROGRAM_CREATE) {
+            status = IoctlCreateProgram(request, file);
+            break;
+        }
+        if (IoControlCode == IOCTL_XDMA_PROGRAM_DELETE) {
+            status = IoctlDeleteProgram(request, file);
+            if (NT_SUCCESS(status)) {
+                WdfRequestComplete(request, STATUS_SUCCESS);
+            }
+            break;
+        }
+        status = EngineIoControl(request, file->u.engine,
+                                 &ctx->engineTriggers[file->u.engine->dir][file->u.engine->channel],
+                                 IoControlCode);
+        break;
+    case DEVNODE_TYPE_EVENT_MUX:
+        if (IoControlCode != IOCTL_XDMA_EVENTS_SET_MASK) {
+            TraceError(DBG_IO, "Unknown IOCTL code!");
+            status = STATUS_NOT_SUPPORTED;
+            break;
+        }
+        status = IoctlSetEventMask(request, ctx, &file->waiter);
+        if (NT_SUCCESS(status)) {
+            WdfRequestComplete(request, STATUS_SUCCESS);
+        }
+        break;
+    case DEVNODE_TYPE_QUEUE:
+        if (IoControlCode != IOCTL_XDMA_QUEUE_DOORBELL) {
+            TraceError(DBG_IO, "Unknown IOCTL code!");
+            status = STATUS_NOT_SUPPORTED;
+            break;
+        }
+        if (file->submitQueue == NULL) {
+            TraceError(DBG_IO, "Error: doorbell before IOCTL_XDMA_QUEUE_SETUP");
+            status = STATUS_INVALID_DEVICE_STATE;
+            break;
+        }
+        SubmitQueueDoorbell(file->submitQueue);
+        status = STATUS_SUCCESS;
+        WdfRequestComplete(request, status);
+        break;
+    default:
+        TraceError(DBG_IO, "IOCTL not supported on device node type %d", file->devType);
+        status = STATUS_INVALID_PARAMETER;
+        break;
+    }
+
+Exit:
+    if (!NT_SUCCESS(status)) {
+        WdfRequestComplete(request, status);
+    }
+    TraceVerbose(DBG_IO, "exit with status: %!STATUS!", status);
+}
+
+static NTSTATUS EngineTransactionInitialize(IN XDMA_ENGINE* engine, IN WDFREQUEST request,
+                                            IN WDF_DMA_DIRECTION direction)
+// set up the transaction of the engine for a read/write request. IOCTL_XDMA_QUEUE_SETUP claims
+// engines from the caller's context; the claim checks for an initialized transaction under the
+// batch lock, so checking the claim under the same lock lets exactly one of the two win.
+// returns STATUS_DEVICE_BUSY if the engine is claimed
+{
+    NTSTATUS status = STATUS_DEVICE_BUSY;
+    WdfSpinLockAcquire(engine->batch.lock);
+    if (engine->direct.done == NULL) {
+        status = WdfDmaTransactionInitializeUsingRequest(engine->dmaTransaction, request,
+                                                         XDMA_EngineProgramDma, direction);
+    }
+    WdfSpinLockRelease(engine->batch.lock);
+    return status;
+}
+
+VOID EvtIoWriteDma(IN WDFQUEUE wdfQueue, IN WDFREQUEST Request, IN size_t length)
+// callback for when a write I/O request enters the SGDMA write queue
+{
+
+    UNREFERENCED_PARAMETER(length);
+    NTSTATUS status = STATUS_INTERNAL_ERROR;
+    PQUEUE_CONTEXT  queue = GetQueueContext(wdfQueue);
+
+    TraceVerbose(DBG_IO, "%!FUNC!(queue=%p, request=%p, length=%llu)", wdfQueue, Request, length);
+
+    XDMA_ENGINE* engine = queue->engine;
+    TraceInfo(DBG_IO, "%s_%u writing %llu bytes to device",
+              DirectionToString(engine->dir), engine->channel, length);
+
+    // with completion coalescing the request joins the next batch instead. An engine with batching
+    // enabled cannot be claimed by a submission queue
+    if (engine->batch.threshold != 0) {
+        status = EngineBatchSubmit(engine, Request);
+        if (!NT_SUCCESS(status)) {
+            WdfRequestComplete(Request, status);
+        }
+        return;
+    }
+
+    // small transfers are faster by PIO, see crossover.c
+    WDF_REQUEST_PARAMETERS params;
+    WDF_REQUEST_PARAMETERS_INIT(&params);
+    WdfRequestGetParameters(Request, &params);
+    PUCHAR pioAddr = CrossoverSelectPio(GetDeviceContext(WdfIoQueueGetDevice(wdfQueue)), engine,
+                                        params.Parameters.Write.DeviceOffset, length);
+    if (pioAddr != NULL) {
+        status = CopyRequestToBar(Request, pioAddr, length);
+        WdfRequestCompleteWithInformation(Request, status, NT_SUCCESS(status) ? length : 0);
+        return;
+    }
+
+    // initialize a DMA transaction from the request 
+    status = EngineTransactionInitialize(engine, Request, WdfDmaDirectionWriteToDevice);
+    if (status == STATUS_DEVICE_BUSY) {
+        // engine is used exclusively by a submission queue - see IOCTL_XDMA_QUEUE_SETUP
+        TraceError(DBG_IO, "Error: engine is used by a submission queue");
+        WdfRequestComplete(Request, status);
+        return;
+    }
+    if (!NT_SUCCESS(status)) {
+        TraceError(DBG_IO, "WdfDmaTransactionInitializeUsingRequest failed: %!STATUS!", status);
+        goto ErrExit;
+    }
+    status = WdfRequestMarkCancelableEx(Request, EvtCancelDma);
+    if (!NT_SUCCESS(status)) {
+        TraceError(DBG_IO, "WdfRequestMarkCancelableEx failed: %!STATUS!", status);
+        goto ErrExit;
+    }
+
+    // with an armed event trigger the transfer is started by HandleUserEvent() instead
+    if (TriggerHoldRequest(queue->trigger, Request)) {
+        TraceVerbose(DBG_IO, "request 0x%p waits on event_%u", Request, queue->trigger->eventId);
+        return;
+    }
+
+    // supply the Queue as context for EvtProgramDma 
+    status = WdfDmaTransactionExecute(queue->engine->dmaTransaction, queue->engine);
+    if (!NT_SUCCESS(status)) {
+        TraceError(DBG_IO, "WdfDmaTransactionExecute failed: %!STATUS!", status);
+        goto ErrExit;
+    }
+
+    if (queue->engine->poll) {
+        status = EnginePollTransfer(queue->engine);
+        if (!NT_SUCCESS(status)) {
+            TraceError(DBG_IO, "EnginePollTransfer failed: %!STATUS!", status);
+            // EnginePollTransfer cleans-up/completes request on error, so no need for goto ErrExit
+        }
+    }
+
+    return; // success
+ErrExit:
+    WdfDmaTransactionRelease(queue->engine->dmaTransaction);
+    WdfRequestComplete(Request, status);
+    TraceError(DBG_IO, "Error Request 0x%p: %!STATUS!", Request, status);
+}
+
+VOID EvtIoReadDma(IN WDFQUEUE wdfQueue, IN WDFREQUEST Request, IN size_t length)
+// 
+{
+    UNREFERENCED_PARAMETER(length);
+    NTSTATUS status = STATUS_INTERNAL_ERROR;
+    PQUEUE_CONTEXT queue = GetQueueContext(wdfQueue);
+
+    TraceVerbose(DBG_IO, "%!FUNC!(queue=%p, request=%p, length=%llu)", wdfQueue, Request, length);
+
+    XDMA_ENGINE* engine = queue->engine;
+    TraceInfo(DBG_IO, "%s_%u reading %llu bytes from device",
+              DirectionToString(engine->dir), engine->channel, length);
+
+    // with completion coalescing the request joins the next batch instead. An engine with batching
+    // enabled cannot be claimed by a submission queue
+    if (engine->batch.threshold != 0) {
+        status = EngineBatchSubmit(engine, Request);
+        if (!NT_SUCCESS(status)) {
+            WdfRequestComplete(Request, status);
+        }
+        return;
+    }
+
+    // small transfers are faster by PIO, see crossover.c
+    WDF_REQUEST_PARAMETERS params;
+    WDF_REQUEST_PARAMETERS_INIT(&params);
+    WdfRequestGetParameters(Request, &params);
+    PUCHAR pioAddr = CrossoverSelectPio(GetDeviceContext(WdfIoQueueGetDevice(wdfQueue)), engine,
+                                        params.Parameters.Read.DeviceOffset, length);
+    if (pioAddr != NULL) {
+        status = CopyBarToRequest(Request, pioAddr, length);
+        WdfRequestCompleteWithInformation(Request, status, NT_SUCCESS(status) ? length : 0);
+        return;
+    }
 
     // initialize a DMA transaction from the request
-    status = WdfDmaTransactionInitializeUsingRequest(queue->engine->dmaTransaction, Request,
-                                                     XDMA_EngineProgramDma,
-                                                     WdfDmaDirectionReadFromDevice);
+    status = EngineTransactionInitialize(engine, Request, WdfDmaDirectionReadFromDevice);
+    if (status == STATUS_DEVICE_BUSY) {
+        // engine is used exclusively by a submission queue - see IOCTL_XDMA_QUEUE_SETUP
+        TraceError(DBG_IO, "Error: engine is used by a submission queue");
+        WdfRequestComplete(Request, status);
+        return;
+    }
     if (!NT_SUCCESS(status)) {
         TraceError(DBG_IO, "WdfDmaTransactionInitializeUsingRequest failed: %!STATUS!",
                    status);
@@ -614,6 +1863,12 @@ VOID EvtIoReadDma(IN WDFQUEUE wdfQueue, IN WDFREQUEST Request, IN size_t length)
         goto ErrExit;
     }
 
+    // with an armed event trigger the transfer is started by HandleUserEvent() instead
+    if (TriggerHoldRequest(queue->trigger, Request)) {
+        TraceVerbose(DBG_IO, "request 0x%p waits on event_%u", Request, queue->trigger->eventId);
+        return;
+    }
+
     // supply the Queue as context for EvtProgramDma
     status = WdfDmaTransactionExecute(queue->engine->dmaTransaction, queue->engine);
     if (!NT_SUCCESS(status)) {
@@ -636,6 +1891,69 @@ ErrExit:
     TraceError(DBG_IO, "Error Request 0x%p: %!STATUS!", Request, status);
 }
 
+VOID EvtIoDeviceControlDma(IN WDFQUEUE wdfQueue, IN WDFREQUEST request, IN size_t OutputBufferLength,
+                           IN size_t InputBufferLength, IN ULONG IoControlCode)
+// IOCTL_XDMA_BUFFER_TRANSFER and IOCTL_XDMA_PROGRAM_LAUNCH forwarded to the engine queue,
+// completed from the engine DPC. IOCTL_XDMA_POLL_MODE_SET and IOCTL_XDMA_BATCH_SET complete right
+// away.
+{
+    UNREFERENCED_PARAMETER(OutputBufferLength);
+    UNREFERENCED_PARAMETER(InputBufferLength);
+
+    PFILE_CONTEXT file = GetFileContext(WdfRequestGetFileObject(request));
+    XDMA_ENGINE* engine = file->u.engine;
+    DeviceContext* ctx = GetDeviceContext(WdfIoQueueGetDevice(wdfQueue));
+    ENGINE_TRIGGER* trigger = &ctx->engineTriggers[engine->dir][engine->channel];
+    XDMA_BUFFER_TRANSFER* transfer = NULL;
+    XDMA_PROGRAM_LAUNCH* launch = NULL;
+    NTSTATUS status = STATUS_NOT_SUPPORTED;
+    if ((file->registry == NULL) &&
+        ((IoControlCode == IOCTL_XDMA_BUFFER_TRANSFER) || (IoControlCode == IOCTL_XDMA_PROGRAM_LAUNCH))) {
+        TraceError(DBG_IO, "Error: no buffers registered on this file");
+        status = STATUS_INVALID_HANDLE;
+        goto ErrExit;
+    }
+
+    switch (IoControlCode) {
+    case IOCTL_XDMA_POLL_MODE_SET:
+        TraceInfo(DBG_IO, "%s_%u IOCTL_XDMA_POLL_MODE_SET",
+                  engine->dir == H2C ? "H2C" : "C2H", engine->channel);
+        status = IoctlSetPollMode(request, trigger);
+        break;
+    case IOCTL_XDMA_BATCH_SET:
+        TraceInfo(DBG_IO, "%s_%u IOCTL_XDMA_BATCH_SET",
+                  engine->dir == H2C ? "H2C" : "C2H", engine->channel);
+        status = IoctlSetBatchMode(request, trigger);
+        break;
+    case IOCTL_XDMA_BUFFER_TRANSFER:
+        status = WdfRequestRetrieveInputBuffer(request, sizeof(XDMA_BUFFER_TRANSFER),
+                                               (PVOID*)&transfer, NULL);
+        if (NT_SUCCESS(status)) {
+            status = BufferRegistryStartTransfer(file->registry, request, transfer);
+        }
+        break;
+    case IOCTL_XDMA_PROGRAM_LAUNCH:
+        status = WdfRequestRetrieveInputBuffer(request, sizeof(XDMA_PROGRAM_LAUNCH),
+                                               (PVOID*)&launch, NULL);
+        if (NT_SUCCESS(status)) {
+            status = BufferRegistryLaunch(file->registry, request, launch->program);
+        }
+        break;
+    default:
+        TraceError(DBG_IO, "Unknown IOCTL code!");
+        status = STATUS_NOT_SUPPORTED;
+        break;
+    }
+    if (!NT_SUCCESS(status)) {
+        goto ErrExit;
+    }
+    return; // success
+
+ErrExit:
+    WdfRequestComplete(request, status);
+    TraceError(DBG_IO, "Error Request 0x%p: %!STATUS!", request, status);
+}
+
 VOID EvtIoReadEngineRing(IN WDFQUEUE wdfQueue, IN WDFREQUEST Request, IN size_t length) {
     NTSTATUS status = STATUS_UNSUCCESSFUL;
     PQUEUE_CONTEXT queue = GetQueueContext(wdfQueue);
@@ -664,6 +1982,14 @@ VOID EvtIoReadEngineRing(IN WDFQUEUE wdfQueue, IN WDFREQUEST Request, IN size_t
 VOID EvtCancelDma(IN WDFREQUEST request) {
     PQUEUE_CONTEXT queue = GetQueueContext(WdfRequestGetIoQueue(request));
     TraceInfo(DBG_IO, "Request 0x%p from Queue 0x%p", request, queue);
+
+    // request may still be waiting on its trigger event
+    WdfSpinLockAcquire(queue->trigger->lock);
+    if (queue->trigger->request == request) {
+        queue->trigger->request = NULL;
+    }
+    WdfSpinLockRelease(queue->trigger->lock);
+
     EngineStop(queue->engine);
     NTSTATUS status = WdfRequestUnmarkCancelable(request);
     if (!NT_SUCCESS(status)) {
@@ -676,10 +2002,20 @@ VOID EvtCancelDma(IN WDFREQUEST request) {
     WdfRequestComplete(request, STATUS_CANCELLED);
 }
 
+static KEVENT* GetUserEventSignal(WDFREQUEST request)
+// get the signal of the user event which an 'event_*' device file is attached to
+{
+    WDFFILEOBJECT fileObject = WdfRequestGetFileObject(request);
+    PFILE_CONTEXT file = GetFileContext(fileObject);
+    DeviceContext* ctx = GetDeviceContext(WdfFileObjectGetDevice(fileObject));
+    ULONG eventId = (ULONG)(file->u.event - ctx->xdma.userEvents);
+    ASSERT(eventId < XDMA_MAX_USER_IRQ);
+    return &ctx->eventSignals[eventId];
+}
+
 VOID EvtCancelReadUserEvent(IN WDFREQUEST request) {
 
-    PFILE_CONTEXT file = GetFileContext(WdfRequestGetFileObject(request));
-    KEVENT* event = (KEVENT*)file->u.event->userData;
+    KEVENT* event = GetUserEventSignal(request);
     KePulseEvent(event, IO_NO_INCREMENT, FALSE);
 
     NTSTATUS status = WdfRequestUnmarkCancelable(request);
@@ -706,8 +2042,7 @@ NTSTATUS EvtReadUserEvent(WDFREQUEST request, size_t length) {
     //}
 
     // wait for event to occur - return error on timeout
-    PFILE_CONTEXT file = GetFileContext(WdfRequestGetFileObject(request));
-    KEVENT* event = (KEVENT*)file->u.event->userData;
+    KEVENT* event = GetUserEventSignal(request);
     KeClearEvent(event);
     LARGE_INTEGER timeout;
     timeout.QuadPart = -3 * 10000000; // 3 second timeout
@@ -748,11 +2083,98 @@ Exit:
     return status;
 }
 
+NTSTATUS EvtReadUserEventMux(WDFREQUEST request, size_t length)
+// wait until any of the selected user events fired and return what happened since the last read
+{
+    NTSTATUS status = STATUS_SUCCESS;
+    WDFFILEOBJECT fileObject = WdfRequestGetFileObject(request);
+    PFILE_CONTEXT file = GetFileContext(fileObject);
+    DeviceContext* ctx = GetDeviceContext(WdfFileObjectGetDevice(fileObject));
+    EVENT_WAITER* waiter = &file->waiter;
+
+    if (length != sizeof(XDMA_EVENTS_DATA)) {
+        status = STATUS_INVALID_PARAMETER;
+        TraceError(DBG_IO, "Error: length is %llu but must be %llu", length, sizeof(XDMA_EVENTS_DATA));
+        goto Exit;
+    }
+    if (waiter->mask == 0) {
+        status = STATUS_INVALID_DEVICE_STATE;
+        TraceError(DBG_IO, "Error: no events selected, use IOCTL_XDMA_EVENTS_SET_MASK first");
+        goto Exit;
+    }
+
+    // wait for any event to occur - return an empty mask on timeout
+    LARGE_INTEGER timeout;
+    timeout.QuadPart = -3 * 10000000; // 3 second timeout
+    KeWaitForSingleObject(&waiter->signal, Executive, KernelMode, FALSE, &timeout);
+
+    XDMA_EVENTS_DATA eventsData = { 0 };
+    LARGE_INTEGER frequency;
+    KeQueryPerformanceCounter(&frequency);
+    eventsData.frequency = frequency.QuadPart;
+
+    // take everything collected so far - events arriving from now on go into the next read
+    WdfSpinLockAcquire(ctx->eventWaitersLock);
+    eventsData.firedMask = waiter->fired;
+    for (UINT i = 0; i < XDMA_MAX_USER_IRQ; ++i) {
+        if (waiter->fired & (1UL << i)) {
+            eventsData.count[i] = waiter->count[i];
+            eventsData.timestamp[i] = waiter->timestamp[i].QuadPart;
+            waiter->count[i] = 0;
+        }
+    }
+    waiter->fired = 0;
+    KeClearEvent(&waiter->signal);
+    WdfSpinLockRelease(ctx->eventWaitersLock);
+
+    // get output buffer
+    WDFMEMORY outputMem;
+    status = WdfRequestRetrieveOutputMemory(request, &outputMem);
+    if (!NT_SUCCESS(status)) {
+        TraceError(DBG_IO, "WdfRequestRetrieveOutputMemory failed: %!STATUS!", status);
+        goto Exit;
+    }
+
+    status = WdfMemoryCopyFromBuffer(outputMem, 0, &eventsData, sizeof(eventsData));
+    if (!NT_SUCCESS(status)) {
+        TraceError(DBG_IO, "WdfMemoryCopyFromBuffer failed: %!STATUS!", status);
+        goto Exit;
+    }
+
+    WdfRequestCompleteWithInformation(request, status, sizeof(eventsData));
+    TraceInfo(DBG_IO, "user events returned is 0x%08X", eventsData.firedMask);
+
+Exit:
+    return status;
+}
+
 VOID HandleUserEvent(ULONG eventId, void* userData) {
 
     ASSERTMSG("userData=NULL!", userData != NULL);
-    KEVENT* event = (KEVENT*)userData;
+    DeviceContext* ctx = (DeviceContext*)userData;
+
+    // start DMA transfers armed on this event first
+    for (UINT dir = H2C; dir < 2; dir++) { // 0=H2C, 1=C2H
+        for (ULONG ch = 0; ch < XDMA_MAX_NUM_CHANNELS; ch++) {
+            TriggerFire(&ctx->engineTriggers[dir][ch], eventId);
+        }
+    }
 
     TraceInfo(DBG_IO, "event_%u signaling completion", eventId);
-    KePulseEvent(event, IO_NO_INCREMENT, FALSE);
+    KePulseEvent(&ctx->eventSignals[eventId], IO_NO_INCREMENT, FALSE);
+
+    // record the event for every 'events' device file which selected it
+    LARGE_INTEGER now = KeQueryPerformanceCounter(NULL);
+    WdfSpinLockAcquire(ctx->eventWaitersLock);
+    for (PLIST_ENTRY entry = ctx->eventWaiters.Flink; entry != &ctx->eventWaiters;
+         entry = entry->Flink) {
+        EVENT_WAITER* waiter = CONTAINING_RECORD(entry, EVENT_WAITER, link);
+        if (waiter->mask & (1UL << eventId)) {
+            waiter->fired |= (1UL << eventId);
+            waiter->count[eventId]++;
+            waiter->timestamp[eventId] = now;
+            KeSetEvent(&waiter->signal, IO_NO_INCREMENT, FALSE);
+        }
+    }
+    WdfSpinLockRelease(ctx->eventWaitersLock);
 }
@@ -29,9 +29,35 @@ typedef enum {
     DEVNODE_TYPE_BYPASS,
     DEVNODE_TYPE_H2C,
     DEVNODE_TYPE_C2H,
+    DEVNODE_TYPE_EVENT_MUX,
+    DEVNODE_TYPE_QUEUE,
     ID_DEVNODE_UNKNOWN = 255,
 } DEVNODE_TYPE;
 
+// State of an open 'events' device file - collects the user events selected by 'mask' until the
+// next read. protected by DeviceContext::eventWaitersLock
+typedef struct _EVENT_WAITER {
+    LIST_ENTRY link;                                // entry in DeviceContext::eventWaiters
+    ULONG mask;                                     // events this file waits on
+    ULONG fired;                                    // events fired since the last read
+    ULONG count[XDMA_MAX_USER_IRQ];                 // occurrences since the last read
+    LARGE_INTEGER timestamp[XDMA_MAX_USER_IRQ];     // latest occurrence (performance counter)
+    KEVENT signal;                                  // set while fired != 0
+} EVENT_WAITER;
+
+// A window of the user BAR mapped into the process which opened the file
+typedef struct _BAR_MAPPING {
+    PMDL mdl;                   // NULL if unused
+    PVOID userAddr;
+} BAR_MAPPING;
+
+// PIO write statistics of a 'bypass' device file - see IOCTL_XDMA_PIO_STATS_GET
+typedef struct _PIO_STATS {
+    volatile LONG64 numWrites;
+    volatile LONG64 numBytes;
+    volatile LONG64 ticks;
+} PIO_STATS;
+
 // File Context Data
 typedef struct _FILE_CONTEXT {
     DEVNODE_TYPE devType;
@@ -40,7 +66,16 @@ typedef struct _FILE_CONTEXT {
         XDMA_EVENT* event;      // EVENTS
         XDMA_ENGINE* engine;    // H2C / C2H
     } u;
+    ULONG barLength;            // USER / CONTROL / BYPASS
     WDFQUEUE queue;
+    EVENT_WAITER waiter;        // EVENT_MUX
+    BAR_MAPPING mappings[XDMA_MAX_BAR_MAPPINGS]; // USER
+    PEPROCESS mappingProcess;   // process owning the mappings, referenced while any exists
+    WDFWAITLOCK mappingLock;
+    ULONG pioWidth;             // BYPASS, bytes per store
+    PIO_STATS pioStats;         // BYPASS
+    struct _SUBMIT_QUEUE* submitQueue; // QUEUE, NULL until IOCTL_XDMA_QUEUE_SETUP
+    struct _BUFFER_REGISTRY* registry; // H2C / C2H, NULL until IOCTL_XDMA_BUFFER_REGISTER
 
 } FILE_CONTEXT, *PFILE_CONTEXT;
 WDF_DECLARE_CONTEXT_TYPE_WITH_NAME(FILE_CONTEXT, GetFileContext)
@@ -48,12 +83,14 @@ WDF_DECLARE_CONTEXT_TYPE_WITH_NAME(FILE_CONTEXT, GetFileContext)
 // Queue Context Data
 typedef struct _QUEUE_CONTEXT {
     XDMA_ENGINE* engine;
+    ENGINE_TRIGGER* trigger;
 } QUEUE_CONTEXT, *PQUEUE_CONTEXT;
 WDF_DECLARE_CONTEXT_TYPE_WITH_NAME(QUEUE_CONTEXT, GetQueueContext)
 
 EVT_WDF_DEVICE_FILE_CREATE          EvtDeviceFileCreate;
 EVT_WDF_FILE_CLOSE                  EvtFileClose;
 EVT_WDF_FILE_CLEANUP                EvtFileCleanup;
+EVT_WDF_IO_IN_CALLER_CONTEXT        EvtIoInCallerContext;
 EVT_WDF_IO_QUEUE_IO_DEVICE_CONTROL  EvtIoDeviceControl;
 EVT_WDF_IO_QUEUE_IO_READ			EvtIoRead;
 EVT_WDF_IO_QUEUE_IO_WRITE			EvtIoWrite;
@@ -61,6 +98,8 @@ EVT_WDF_IO_QUEUE_IO_WRITE			EvtIoWrite;
 EVT_WDF_IO_QUEUE_IO_READ    EvtIoReadDma;
 EVT_WDF_IO_QUEUE_IO_WRITE   EvtIoWriteDma;
 EVT_WDF_IO_QUEUE_IO_READ    EvtIoReadEngineRing;
+EVT_WDF_IO_QUEUE_IO_DEVICE_CONTROL EvtIoDeviceControlDma;
 
 NTSTATUS EvtReadUserEvent(WDFREQUEST request, size_t length);
+NTSTATUS EvtReadUserEventMux(WDFREQUEST request, size_t length);
 VOID HandleUserEvent(ULONG eventId, void* userData);
\ No newline at end of file
@@ -0,0 +1,427 @@
+/*
+* XDMA Submission/Completion Queues
+* ===============================
+*
+* Copyright 2017 Xilinx Inc.
+*
+* Description:
+* ------------
+* The application posts XDMA_SQE entries into a submission ring and advances sqTail. The driver
+* consumes the entries in order, starting each transfer directly on a claimed engine (see
+* XDMA_EngineClaimDirect), and posts an XDMA_CQE for every entry into the completion ring.
+* Completions drive the next submissions from the engine DPC, so while transfers are in flight
+* no system call is needed at all. Only when the driver runs dry it sets XDMA_QUEUE_NEED_DOORBELL
+* and waits for IOCTL_XDMA_QUEUE_DOORBELL.
+*
+* Entries of one engine are processed strictly one after another, different engines work in
+* parallel. An entry for a busy engine holds back all entries behind it.
+*/
+
+// ========================= include dependencies =================================================
+
+#include "driver.h"
+#include "dma_engine.h"
+#include "xdma_public.h"
+#include "submit_queue.h"
+
+#include "trace.h"
+#ifdef DBG
+// The trace message header (.tmh) file must be included in a source file before any WPP macro
+// calls and after defining a WPP_CONTROL_GUIDS macro (defined in trace.h). see trace.h
+#include "submit_queue.tmh"
+#endif
+
+// ========================= definitions ==========================================================
+
+#define SUBMIT_QUEUE_POOL_TAG           ('QmdX')
+#define SUBMIT_QUEUE_DRAIN_TIMEOUT_MS   (5000)
+#define SUBMIT_QUEUE_NUM_ENGINES        (XDMA_NUM_DIRECTIONS * XDMA_MAX_NUM_CHANNELS)
+
+typedef struct _QUEUE_ENGINE {
+    SUBMIT_QUEUE* queue;
+    XDMA_ENGINE* engine;        // NULL if not selected in the engine mask
+    PDMA_ADAPTER adapter;       // WDM adapter of the engine's transfer direction
+    BOOLEAN claimed;
+    BOOLEAN busy;               // transfer in flight
+    UINT64 userData;            // of the transfer in flight
+    LONGLONG deviceOffset;
+    PSCATTER_GATHER_LIST sgList;
+} QUEUE_ENGINE;
+
+typedef struct _QUEUE_BUFFER {
+    PMDL mdl;
+    ULONG length;
+} QUEUE_BUFFER;
+
+struct _SUBMIT_QUEUE {
+    PDEVICE_OBJECT deviceObject;
+    PMDL ringMdl;
+    XDMA_QUEUE_HEADER* header;  // shared with the application
+    volatile XDMA_SQE* sq;
+    volatile XDMA_CQE* cq;
+    ULONG numEntries;
+    ULONG sqHead;               // private copies - the shared indices are only ever written
+    ULONG cqTail;
+    ULONG numBuffers;
+    QUEUE_BUFFER buffers[XDMA_QUEUE_MAX_BUFFERS];
+    QUEUE_ENGINE engines[SUBMIT_QUEUE_NUM_ENGINES];
+    KSPIN_LOCK lock;            // protects everything below and the per engine state
+    ULONG inFlight;             // transfers started but not completed yet
+    BOOLEAN stopping;
+    KEVENT drained;             // set when stopping and inFlight drops to 0
+};
+
+static VOID QueuePump(IN SUBMIT_QUEUE* queue);
+
+// ========================= memory ===============================================================
+
+static NTSTATUS LockUserBuffer(IN UINT64 address, IN ULONG length, OUT PMDL* mdl)
+// lock a buffer of the calling process for DMA in both directions
+{
+    *mdl = IoAllocateMdl((PVOID)(ULONG_PTR)address, length, FALSE, FALSE, NULL);
+    if (*mdl == NULL) {
+        TraceError(DBG_IO, "IoAllocateMdl failed for %u bytes at 0x%llx", length, address);
+        return STATUS_INSUFFICIENT_RESOURCES;
+    }
+
+    NTSTATUS status = STATUS_SUCCESS;
+    __try {
+        MmProbeAndLockPages(*mdl, UserMode, IoWriteAccess);
+    } __except (EXCEPTION_EXECUTE_HANDLER) {
+        status = GetExceptionCode();
+    }
+    if (!NT_SUCCESS(status)) {
+        TraceError(DBG_IO, "MmProbeAndLockPages failed for 0x%llx: %!STATUS!", address, status);
+        IoFreeMdl(*mdl);
+        *mdl = NULL;
+    }
+    return status;
+}
+
+static VOID UnlockUserBuffer(IN PMDL* mdl) {
+    if (*mdl != NULL) {
+        MmUnlockPages(*mdl);
+        IoFreeMdl(*mdl);
+        *mdl = NULL;
+    }
+}
+
+// ========================= transfers ============================================================
+
+static VOID QueuePostCompletion(IN SUBMIT_QUEUE* queue, IN UINT64 userData, IN NTSTATUS status,
+                                IN ULONG length)
+// space in the completion queue was reserved by QueuePump() before the entry was consumed
+{
+    volatile XDMA_CQE* cqe = &queue->cq[queue->cqTail & (queue->numEntries - 1)];
+    cqe->userData = userData;
+    cqe->status = status;
+    cqe->length = length;
+    queue->cqTail++;
+
+    // entry contents must be visible before the new tail
+    KeMemoryBarrier();
+    queue->header->cqTail = queue->cqTail;
+}
+
+static VOID QueueTransferDone(IN XDMA_ENGINE* engine, IN PVOID context, IN NTSTATUS status,
+                              IN ULONG numBytes)
+// PFN_XDMA_DIRECT_DONE, called from the engine DPC
+{
+    QUEUE_ENGINE* qe = (QUEUE_ENGINE*)context;
+    SUBMIT_QUEUE* queue = qe->queue;
+
+    qe->adapter->DmaOperations->PutScatterGatherList(qe->adapter, qe->sgList, engine->dir == H2C);
+
+    KeAcquireSpinLockAtDpcLevel(&queue->lock);
+    qe->sgList = NULL;
+    qe->busy = FALSE;
+    queue->inFlight--;
+    QueuePostCompletion(queue, qe->userData, status, numBytes);
+    if (queue->stopping) {
+        if (queue->inFlight == 0) {
+            KeSetEvent(&queue->drained, IO_NO_INCREMENT, FALSE);
+        }
+    } else {
+        QueuePump(queue);
+    }
+    KeReleaseSpinLockFromDpcLevel(&queue->lock);
+}
+
+static VOID QueueProgramDma(IN PDEVICE_OBJECT deviceObject, IN PIRP irp,
+                            IN PSCATTER_GATHER_LIST sgList, IN PVOID context)
+// DRIVER_LIST_CONTROL, called at DISPATCH_LEVEL once the scatter-gather list is available
+{
+    UNREFERENCED_PARAMETER(deviceObject);
+    UNREFERENCED_PARAMETER(irp);
+    QUEUE_ENGINE* qe = (QUEUE_ENGINE*)context;
+    qe->sgList = sgList;
+    EngineDirectStart(qe->engine, sgList, qe->deviceOffset);
+}
+
+static NTSTATUS QueueStartTransfer(IN SUBMIT_QUEUE* queue, IN QUEUE_ENGINE* qe,
+                                   IN const XDMA_SQE* sqe)
+// queue lock held
+{
+    if ((sqe->buffer >= queue->numBuffers) || (sqe->length == 0) ||
+        (sqe->length > XDMA_MAX_TRANSFER_SIZE) ||
+        ((UINT64)sqe->bufferOffset + sqe->length > queue->buffers[sqe->buffer].length)) {
+        TraceError(DBG_IO, "Error: invalid buffer %u, offset %u, length %u",
+                   sqe->buffer, sqe->bufferOffset, sqe->length);
+        return STATUS_INVALID_PARAMETER;
+    }
+
+    PMDL mdl = queue->buffers[sqe->buffer].mdl;
+    PVOID va = (PUCHAR)MmGetMdlVirtualAddress(mdl) + sqe->bufferOffset;
+
+    qe->busy = TRUE;
+    qe->userData = sqe->userData;
+    qe->deviceOffset = (LONGLONG)sqe->deviceOffset;
+    queue->inFlight++;
+
+    // may call QueueProgramDma() right away
+    NTSTATUS status = qe->adapter->DmaOperations->GetScatterGatherList(qe->adapter,
+                                                                       queue->deviceObject, mdl,
+                                                                       va, sqe->length,
+                                                                       QueueProgramDma, qe,
+                                                                       qe->engine->dir == H2C);
+    if (!NT_SUCCESS(status)) {
+        TraceError(DBG_IO, "GetScatterGatherList failed: %!STATUS!", status);
+        qe->busy = FALSE;
+        queue->inFlight--;
+    }
+    return status;
+}
+
+static VOID QueuePump(IN SUBMIT_QUEUE* queue)
+// Consume submission entries until the queue is empty, the completion queue has no space left or
+// the next entry is for a busy engine. queue lock held.
+{
+    const ULONG mask = queue->numEntries - 1;
+    BOOLEAN doorbellArmed = FALSE;
+
+    for (;;) {
+        const ULONG sqTail = queue->header->sqTail;
+        const ULONG cqHead = queue->header->cqHead;
+        KeMemoryBarrier(); // read the entries after the indices
+
+        QUEUE_ENGINE* qe = NULL;
+        BOOLEAN blocked = FALSE;
+        if (((sqTail - queue->sqHead) == 0) || ((sqTail - queue->sqHead) > queue->numEntries)) {
+            blocked = TRUE; // empty, or a corrupt tail which is ignored until fixed
+        } else if ((queue->cqTail - cqHead) + queue->inFlight >= queue->numEntries) {
+            blocked = TRUE; // no completion space for another transfer
+        } else {
+            const ULONG engineIdx = queue->sq[queue->sqHead & mask].engine;
+            if (engineIdx < SUBMIT_QUEUE_NUM_ENGINES) {
+                qe = &queue->engines[engineIdx];
+                blocked = qe->busy;
+            }
+        }
+
+        if (blocked) {
+            // a pending completion will call again - otherwise the application has to be told to
+            // ring the doorbell. Look once more after raising the flag since the application may
+            // have posted in between without seeing it.
+            if ((queue->inFlight != 0) || doorbellArmed) {
+                break;
+            }
+            queue->header->flags = XDMA_QUEUE_NEED_DOORBELL;
+            KeMemoryBarrier();
+            doorbellArmed = TRUE;
+            continue;
+        }
+        if (doorbellArmed) {
+            queue->header->flags = 0;
+            doorbellArmed = FALSE;
+        }
+
+        // copy - the application may modify the ring at any time
+        XDMA_SQE sqe;
+        RtlCopyMemory(&sqe, (const void*)&queue->sq[queue->sqHead & mask], sizeof(sqe));
+        queue->sqHead++;
+        queue->header->sqHead = queue->sqHead;
+
+        NTSTATUS status = STATUS_INVALID_PARAMETER;
+        if ((qe == NULL) || (qe->engine == NULL) || (sqe.engine != (ULONG)(qe - queue->engines))) {
+            TraceError(DBG_IO, "Error: engine %u not selected for this queue", sqe.engine);
+        } else {
+            status = QueueStartTransfer(queue, qe, &sqe);
+        }
+        if (!NT_SUCCESS(status)) {
+            QueuePostCompletion(queue, sqe.userData, status, 0);
+        }
+    }
+}
+
+// ========================= public interface =====================================================
+
+NTSTATUS SubmitQueueCreate(IN WDFREQUEST request, IN DeviceContext* ctx, OUT SUBMIT_QUEUE** result) {
+
+    *result = NULL;
+    XDMA_QUEUE_SETUP* setup = NULL;
+    NTSTATUS status = WdfRequestRetrieveInputBuffer(request, sizeof(XDMA_QUEUE_SETUP),
+                                                    (PVOID*)&setup, NULL);
+    if (!NT_SUCCESS(status)) {
+        TraceError(DBG_IO, "WdfRequestRetrieveInputBuffer failed: %!STATUS!", status);
+        return status;
+    }
+    const ULONG numEntries = setup->numEntries;
+    if ((numEntries == 0) || (numEntries > XDMA_QUEUE_MAX_ENTRIES) ||
+        ((numEntries & (numEntries - 1)) != 0) || (setup->numBuffers > XDMA_QUEUE_MAX_BUFFERS) ||
+        (setup->engineMask == 0) || ((setup->engineMask >> SUBMIT_QUEUE_NUM_ENGINES) != 0)) {
+        TraceError(DBG_IO, "Error: invalid queue setup, %u entries, %u buffers, engines 0x%x",
+                   numEntries, setup->numBuffers, setup->engineMask);
+        return STATUS_INVALID_PARAMETER;
+    }
+
+    SUBMIT_QUEUE* queue = (SUBMIT_QUEUE*)ExAllocatePoolWithTag(NonPagedPoolNx, sizeof(SUBMIT_QUEUE),
+                                                               SUBMIT_QUEUE_POOL_TAG);
+    if (queue == NULL) {
+        return STATUS_INSUFFICIENT_RESOURCES;
+    }
+    RtlZeroMemory(queue, sizeof(SUBMIT_QUEUE));
+    queue->deviceObject = WdfDeviceWdmGetDeviceObject(ctx->xdma.wdfDevice);
+    queue->numEntries = numEntries;
+    KeInitializeSpinLock(&queue->lock);
+    KeInitializeEvent(&queue->drained, NotificationEvent, FALSE);
+
+    // shared ring memory
+    const ULONG ringSize = sizeof(XDMA_QUEUE_HEADER) + numEntries * (sizeof(XDMA_SQE) + sizeof(XDMA_CQE));
+    status = LockUserBuffer(setup->ringAddress, ringSize, &queue->ringMdl);
+    if (!NT_SUCCESS(status)) {
+        goto ErrExit;
+    }
+    queue->header = (XDMA_QUEUE_HEADER*)MmGetSystemAddressForMdlSafe(queue->ringMdl,
+                                                                     NormalPagePriority);
+    if (queue->header == NULL) {
+        status = STATUS_INSUFFICIENT_RESOURCES;
+        goto ErrExit;
+    }
+    queue->sq = (volatile XDMA_SQE*)(queue->header + 1);
+    queue->cq = (volatile XDMA_CQE*)(queue->sq + numEntries);
+    RtlZeroMemory(queue->header, sizeof(XDMA_QUEUE_HEADER));
+
+    // data buffers
+    for (ULONG i = 0; i < setup->numBuffers; i++) {
+        if (setup->buffers[i].length == 0) {
+            status = STATUS_INVALID_PARAMETER;
+            goto ErrExit;
+        }
+        status = LockUserBuffer(setup->buffers[i].address, setup->buffers[i].length,
+                                &queue->buffers[i].mdl);
+        if (!NT_SUCCESS(status)) {
+            goto ErrExit;
+        }
+        queue->buffers[i].length = setup->buffers[i].length;
+        queue->numBuffers++;
+    }
+
+    // engines
+    for (ULONG i = 0; i < SUBMIT_QUEUE_NUM_ENGINES; i++) {
+        if ((setup->engineMask & (1UL << i)) == 0) {
+            continue;
+        }
+        const DirToDev dir = (i / XDMA_MAX_NUM_CHANNELS) == 0 ? H2C : C2H;
+        XDMA_ENGINE* engine = &ctx->xdma.engines[i % XDMA_MAX_NUM_CHANNELS][dir];
+        QUEUE_ENGINE* qe = &queue->engines[i];
+        if (!engine->enabled) {
+            TraceError(DBG_IO, "Error: engine %s_%u not enabled in XDMA IP core",
+                       DirectionToString(dir), i % XDMA_MAX_NUM_CHANNELS);
+            status = STATUS_INVALID_PARAMETER;
+            goto ErrExit;
+        }
+        qe->queue = queue;
+        qe->engine = engine;
+        qe->adapter = WdfDmaEnablerWdmGetDmaAdapter(ctx->xdma.dmaEnabler, dir == H2C ?
+                                                    WdfDmaDirectionWriteToDevice :
+                                                    WdfDmaDirectionReadFromDevice);
+        // caller context - read/write requests of the engine may be dispatched meanwhile, they
+        // check the claim under the same lock (see EngineTransactionInitialize in file_io.c)
+        status = XDMA_EngineClaimDirect(engine, QueueTransferDone, qe);
+        if (!NT_SUCCESS(status)) {
+            goto ErrExit;
+        }
+        qe->claimed = TRUE;
+        EngineEnableInterrupt(engine);
+    }
+
+    // nothing to do until the first doorbell
+    queue->header->flags = XDMA_QUEUE_NEED_DOORBELL;
+
+    TraceInfo(DBG_IO, "queue with %u entries, %u buffers, engines 0x%x",
+              numEntries, queue->numBuffers, setup->engineMask);
+    *result = queue;
+    return STATUS_SUCCESS;
+
+ErrExit:
+    SubmitQueueDestroy(queue);
+    return status;
+}
+
+VOID SubmitQueueDoorbell(IN SUBMIT_QUEUE* queue) {
+    KIRQL irql;
+    KeAcquireSpinLock(&queue->lock, &irql);
+    queue->header->flags = 0;
+    if (!queue->stopping) {
+        QueuePump(queue);
+    }
+    KeReleaseSpinLock(&queue->lock, irql);
+}
+
+VOID SubmitQueueDestroy(IN SUBMIT_QUEUE* queue) {
+    KIRQL irql;
+    KeAcquireSpinLock(&queue->lock, &irql);
+    queue->stopping = TRUE;
+    const BOOLEAN wait = (queue->inFlight != 0);
+    KeReleaseSpinLock(&queue->lock, irql);
+
+    BOOLEAN forced = FALSE;
+    if (wait) {
+        LARGE_INTEGER timeout;
+        timeout.QuadPart = WDF_REL_TIMEOUT_IN_MS(SUBMIT_QUEUE_DRAIN_TIMEOUT_MS);
+        if (KeWaitForSingleObject(&queue->drained, Executive, KernelMode, FALSE, &timeout) == STATUS_TIMEOUT) {
+            TraceError(DBG_IO, "Error: %u transfers did not complete, stopping the engines",
+                       queue->inFlight);
+            forced = TRUE;
+        }
+    }
+
+    // the pages are about to be unlocked - make sure the hardware is done with them
+    if (forced) {
+        KeAcquireSpinLock(&queue->lock, &irql);
+        for (ULONG i = 0; i < SUBMIT_QUEUE_NUM_ENGINES; i++) {
+            QUEUE_ENGINE* qe = &queue->engines[i];
+            if (qe->busy) {
+                EngineStop(qe->engine);
+                qe->engine->direct.numDescriptors = 0;
+            }
+        }
+        KeReleaseSpinLock(&queue->lock, irql);
+    }
+
+    for (ULONG i = 0; i < SUBMIT_QUEUE_NUM_ENGINES; i++) {
+        if (queue->engines[i].claimed) {
+            XDMA_EngineReleaseDirect(queue->engines[i].engine);
+        }
+    }
+
+    if (forced) {
+        // a completion racing with the timeout has finished once all queued DPCs ran
+        KeFlushQueuedDpcs();
+        KeRaiseIrql(DISPATCH_LEVEL, &irql);
+        for (ULONG i = 0; i < SUBMIT_QUEUE_NUM_ENGINES; i++) {
+            QUEUE_ENGINE* qe = &queue->engines[i];
+            if (qe->busy && (qe->sgList != NULL)) {
+                qe->adapter->DmaOperations->PutScatterGatherList(qe->adapter, qe->sgList,
+                                                                 qe->engine->dir == H2C);
+            }
+        }
+        KeLowerIrql(irql);
+    }
+
+    for (ULONG i = 0; i < queue->numBuffers; i++) {
+        UnlockUserBuffer(&queue->buffers[i].mdl);
+    }
+    UnlockUserBuffer(&queue->ringMdl);
+    ExFreePoolWithTag(queue, SUBMIT_QUEUE_POOL_TAG);
+}
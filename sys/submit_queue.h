@@ -0,0 +1,35 @@
+/*
+* XDMA Submission/Completion Queues
+* ===============================
+*
+* Copyright 2017 Xilinx Inc.
+*
+* Description:
+* ------------
+* DMA transfers posted by the application into a ring in shared memory instead of one
+* ReadFile()/WriteFile() per transfer. Completions are posted back into the same memory, a
+* doorbell IOCTL is only needed when the driver ran out of work - see IOCTL_XDMA_QUEUE_SETUP.
+*/
+
+#pragma once
+
+// ========================= include dependencies =================================================
+
+#include <ntddk.h>
+#include <wdf.h>
+
+#include "driver.h"
+
+// ========================= declarations =========================================================
+
+typedef struct _SUBMIT_QUEUE SUBMIT_QUEUE;
+
+/// Lock the ring memory and buffers described by the IOCTL_XDMA_QUEUE_SETUP request and claim the
+/// selected engines. Must be called in the context of the requesting process at PASSIVE_LEVEL.
+NTSTATUS SubmitQueueCreate(IN WDFREQUEST request, IN DeviceContext* ctx, OUT SUBMIT_QUEUE** queue);
+
+/// Resume consuming the submission queue after XDMA_QUEUE_NEED_DOORBELL was set.
+VOID SubmitQueueDoorbell(IN SUBMIT_QUEUE* queue);
+
+/// Wait for the transfers in flight, release the engines and unlock all memory.
+VOID SubmitQueueDestroy(IN SUBMIT_QUEUE* queue);
@@ -0,0 +1,474 @@
+// Unit tests of the OS independent descriptor and ring logic (libxdma/dma_core.c): descriptor list
+// construction, the fetch block optimization checked against the limits of the software model, and
+// a streaming C2H ring which the model fills for several laps in credit mode.
+//
+// Usage: core_test
+
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <vector>
+
+#include "dma_core.h"
+#include "test_check.h"
+#include "xdma_model.h"
+
+namespace {
+
+const size_t page_size = 4096;
+
+// page aligned host memory, freed on scope exit
+struct aligned_buffer {
+    explicit aligned_buffer(size_t size)
+        : size(size), data(std::aligned_alloc(page_size, (size + page_size - 1) & ~(page_size - 1))) {
+        std::memset(data, 0, size);
+    }
+    ~aligned_buffer() { std::free(data); }
+    aligned_buffer(const aligned_buffer&) = delete;
+    aligned_buffer& operator=(const aligned_buffer&) = delete;
+    template <typename T> T* as(size_t offset = 0) {
+        return reinterpret_cast<T*>(static_cast<unsigned char*>(data) + offset);
+    }
+    uint64_t bus(size_t offset = 0) const { return reinterpret_cast<uintptr_t>(data) + offset; }
+    size_t size;
+    void* data;
+};
+
+XDMA_DESC_PARAMS default_params() {
+    XDMA_DESC_PARAMS params;
+    params.streaming = FALSE;
+    params.fixedAddress = FALSE;
+    params.alignAddr = 1;
+    params.alignLength = 1;
+    params.dataPathBytes = 16;  // 128 bit
+    params.mrrsBytes = 512;     // the model default
+    return params;
+}
+
+XDMA_SG_VIEW view(const std::vector<XDMA_SG_ELEMENT>& sg) {
+    XDMA_SG_VIEW v;
+    v.elements = sg.data();
+    v.stride = sizeof(XDMA_SG_ELEMENT);
+    v.numElements = static_cast<UINT32>(sg.size());
+    return v;
+}
+
+uint64_t address(UINT32 lo, UINT32 hi) {
+    return (static_cast<uint64_t>(hi) << 32) | lo;
+}
+
+UINT32 next_adj(const DMA_DESCRIPTOR& desc) {
+    return (desc.control >> XDMA_DESC_NEXT_ADJ_SHIFT) & XDMA_DESC_NEXT_ADJ_MASK;
+}
+
+// ============= Descriptor building ==========================================
+
+void test_build_to_device() {
+    const std::vector<XDMA_SG_ELEMENT> sg = {
+        { 0x123456789000ULL, 0x1000, 0 },
+        { 0x200000000ULL, 0x800, 0 },
+        { 0x300001000ULL, 0x40, 0 },
+    };
+    const XDMA_SG_VIEW v = view(sg);
+    const XDMA_DESC_PARAMS params = default_params();
+    const uint64_t desc_bus = 0x1FFFFFFE0ULL; // the next pointers carry into the upper half
+    const uint64_t device_offset = 0x10000;
+    DMA_DESCRIPTOR desc[3];
+    UINT32 misaligned = 99;
+
+    const UINT32 bytes = DescriptorBuildList(&params, desc, desc_bus, device_offset, TRUE, &v,
+                                             &misaligned);
+    CHECK_EQUAL(bytes, 0x1840);
+    CHECK_EQUAL(misaligned, 0);
+
+    uint64_t card = device_offset;
+    for (UINT32 i = 0; i < 3; i++) {
+        CHECK_EQUAL(desc[i].control & 0xFFFF0000UL, XDMA_DESC_MAGIC);
+        CHECK_EQUAL(desc[i].numBytes, sg[i].length);
+        CHECK_EQUAL(address(desc[i].srcAddrLo, desc[i].srcAddrHi), sg[i].address);
+        CHECK_EQUAL(address(desc[i].dstAddrLo, desc[i].dstAddrHi), card);
+        card += sg[i].length;
+    }
+    CHECK_EQUAL(desc[0].control, XDMA_DESC_MAGIC);
+    CHECK_EQUAL(address(desc[0].nextLo, desc[0].nextHi), desc_bus + 1 * sizeof(DMA_DESCRIPTOR));
+    CHECK_EQUAL(desc[1].control, XDMA_DESC_MAGIC);
+    CHECK_EQUAL(address(desc[1].nextLo, desc[1].nextHi), desc_bus + 2 * sizeof(DMA_DESCRIPTOR));
+
+    // the last descriptor stops the engine and requests an interrupt, EOP only for AXI-ST
+    CHECK_EQUAL(desc[2].control, XDMA_DESC_MAGIC | XDMA_DESC_STOP_BIT | XDMA_DESC_COMPLETED_BIT);
+    CHECK_EQUAL(address(desc[2].nextLo, desc[2].nextHi), 0);
+}
+
+void test_build_from_device() {
+    const std::vector<XDMA_SG_ELEMENT> sg = {
+        { 0x7000, 0x100, 0 },
+        { 0x9000, 0x200, 0 },
+    };
+    const XDMA_SG_VIEW v = view(sg);
+    XDMA_DESC_PARAMS params = default_params();
+    params.streaming = TRUE;
+    DMA_DESCRIPTOR desc[2];
+    UINT32 misaligned;
+
+    CHECK_EQUAL(DescriptorBuildList(&params, desc, 0x4000, 0x20000, FALSE, &v, &misaligned), 0x300);
+    CHECK_EQUAL(address(desc[0].srcAddrLo, desc[0].srcAddrHi), 0x20000);
+    CHECK_EQUAL(address(desc[0].dstAddrLo, desc[0].dstAddrHi), 0x7000);
+    CHECK_EQUAL(address(desc[1].srcAddrLo, desc[1].srcAddrHi), 0x20100);
+    CHECK_EQUAL(address(desc[1].dstAddrLo, desc[1].dstAddrHi), 0x9000);
+    CHECK_EQUAL(desc[0].control, XDMA_DESC_MAGIC);
+    CHECK_EQUAL(desc[1].control, XDMA_DESC_MAGIC | XDMA_DESC_STOP_BIT | XDMA_DESC_COMPLETED_BIT |
+                                 XDMA_DESC_EOP_BIT);
+
+    // a fixed card address does not advance with the elements
+    params.fixedAddress = TRUE;
+    DescriptorBuildList(&params, desc, 0x4000, 0x20000, FALSE, &v, &misaligned);
+    CHECK_EQUAL(address(desc[1].srcAddrLo, desc[1].srcAddrHi), 0x20000);
+}
+
+void test_alignment() {
+    const std::vector<XDMA_SG_ELEMENT> sg = {
+        { 0x1000, 0x100, 0 },   // aligned
+        { 0x2001, 0x100, 0 },   // host address
+        { 0x3000, 0x0FF, 0 },   // length, which moves the card address of the next one as well
+        { 0x4000, 0x100, 0 },
+    };
+    const XDMA_SG_VIEW v = view(sg);
+    XDMA_DESC_PARAMS params = default_params();
+    params.alignAddr = 64;
+    params.alignLength = 4;
+    DMA_DESCRIPTOR desc[4];
+    UINT32 misaligned;
+
+    DescriptorBuildList(&params, desc, 0x8000, 0, TRUE, &v, &misaligned);
+    CHECK_EQUAL(misaligned, 3);
+    CHECK(DescriptorIsAligned(&params, &desc[0]));
+    CHECK(!DescriptorIsAligned(&params, &desc[1]));
+    CHECK(!DescriptorIsAligned(&params, &desc[2]));
+    CHECK(!DescriptorIsAligned(&params, &desc[3]));
+
+    // fixed address mode: host and card address must agree modulo the data path width
+    params.fixedAddress = TRUE;
+    DescriptorBuildList(&params, desc, 0x8000, 0x10, TRUE, &v, &misaligned);
+    CHECK_EQUAL(misaligned, 1);
+    DescriptorBuildList(&params, desc, 0x8000, 0x21, TRUE, &v, &misaligned);
+    CHECK_EQUAL(misaligned, 3);
+    CHECK(DescriptorIsAligned(&params, &desc[1]));
+}
+
+// ============= Fetch block optimization =====================================
+
+// Walk the fetch blocks the engine makes of an optimized list and check them against the limits of
+// [1] table 2-9, like the model does, without running the model.
+void check_fetch_blocks(const XDMA_DESC_PARAMS& params, const DMA_DESCRIPTOR* desc, UINT32 n,
+                        uint64_t desc_bus, UINT32 first_adj) {
+    UINT32 index = 0;
+    UINT32 block = first_adj + 1;
+    while (index < n) {
+        const uint64_t addr = desc_bus + index * sizeof(DMA_DESCRIPTOR);
+        const uint64_t bytes = block * sizeof(DMA_DESCRIPTOR);
+        CHECK((addr & 0xFFF) + bytes <= 0x1000);
+        CHECK(bytes <= params.mrrsBytes);
+        CHECK(index + block <= n);
+        index += block;
+        block = next_adj(desc[index - 1]) + 1;
+    }
+    CHECK_EQUAL(index, n);
+}
+
+void test_optimize_first_adj() {
+    const XDMA_DESC_PARAMS params = default_params(); // 512 bytes = 16 descriptors per fetch
+    std::vector<DMA_DESCRIPTOR> desc(100);
+    std::vector<XDMA_SG_ELEMENT> sg(desc.size(), XDMA_SG_ELEMENT{ 0x10000, 64, 0 });
+    const XDMA_SG_VIEW v = view(sg);
+    UINT32 misaligned;
+
+    struct {
+        UINT32 first_lo;
+        UINT32 n;
+        UINT32 first_adj;
+    } const cases[] = {
+        { 0x0000, 100, 15 },    // MRRS
+        { 0x0000, 1, 0 },       // single descriptor
+        { 0x0000, 5, 4 },       // remaining descriptors
+        { 0x0F00, 100, 7 },     // 8 descriptors to the 4K boundary
+        { 0x0FE0, 100, 0 },     // last slot of the page
+        { 0x1F40, 3, 2 },
+    };
+    for (const auto& c : cases) {
+        DescriptorBuildList(&params, desc.data(), c.first_lo, 0, TRUE, &v, &misaligned);
+        const UINT32 first_adj = DescriptorOptimizeList(&params, desc.data(), c.n, c.first_lo);
+        CHECK_EQUAL(first_adj, c.first_adj);
+    }
+}
+
+void test_optimize_blocks() {
+    std::vector<DMA_DESCRIPTOR> desc(300);
+    std::vector<XDMA_SG_ELEMENT> sg(desc.size(), XDMA_SG_ELEMENT{ 0x10000, 64, 0 });
+    UINT32 misaligned;
+
+    for (UINT32 mrrs : { 128U, 256U, 512U, 1024U, 2048U }) {
+        XDMA_DESC_PARAMS params = default_params();
+        params.mrrsBytes = mrrs;
+        for (UINT32 n : { 1U, 2U, 15U, 16U, 17U, 127U, 128U, 129U, 300U }) {
+            for (UINT32 start = 0; start < 0x1000; start += 0x20) {
+                const uint64_t desc_bus = 0x40000 + start;
+                sg.resize(n);
+                const XDMA_SG_VIEW v = view(sg);
+                DescriptorBuildList(&params, desc.data(), desc_bus, 0, TRUE, &v, &misaligned);
+                const UINT32 first_adj = DescriptorOptimizeList(&params, desc.data(), n,
+                                                                static_cast<UINT32>(desc_bus));
+                check_fetch_blocks(params, desc.data(), n, desc_bus, first_adj);
+            }
+        }
+    }
+}
+
+struct model_run {
+    uint32_t status;
+    XDMA_MODEL_STATS stats;
+};
+
+// What XDMA_EngineProgramDma does for a H2C transfer, executed by the model
+model_run run_h2c(XDMA_MODEL* model, uint64_t desc_bus, UINT32 first_adj) {
+    const uint32_t sgdma = SGDMA_BLOCK_OFFSET;
+    model_run r;
+    xdma_model_get_stats(model, XDMA_MODEL_H2C, 0, &r.stats, 1);
+    xdma_model_write32(model, sgdma + offsetof(XDMA_SGDMA_REGS, firstDescLo),
+                       static_cast<uint32_t>(desc_bus));
+    xdma_model_write32(model, sgdma + offsetof(XDMA_SGDMA_REGS, firstDescHi),
+                       static_cast<uint32_t>(desc_bus >> 32));
+    xdma_model_write32(model, sgdma + offsetof(XDMA_SGDMA_REGS, firstDescAdj), first_adj);
+    xdma_model_write32(model, offsetof(XDMA_ENGINE_REGS, controlW1S), XDMA_CTRL_RUN_BIT);
+    while (xdma_model_run(model) != 0) {
+    }
+    r.status = xdma_model_read32(model, offsetof(XDMA_ENGINE_REGS, statusRC));
+    xdma_model_write32(model, offsetof(XDMA_ENGINE_REGS, controlW1C), XDMA_CTRL_RUN_BIT);
+    xdma_model_get_stats(model, XDMA_MODEL_H2C, 0, &r.stats, 1);
+    return r;
+}
+
+void test_optimize_model() {
+    const UINT32 n = 200;
+    const UINT32 element = 64;
+    XDMA_MODEL_CONFIG config;
+    xdma_model_config_init(&config);
+    config.numH2C = 1;
+    config.numC2H = 0;
+    config.cardMemorySize = n * element;
+    XDMA_MODEL* model = xdma_model_create(&config);
+    CHECK(model != nullptr);
+    if (model == nullptr) {
+        return;
+    }
+
+    aligned_buffer desc(4 * page_size);
+    aligned_buffer data(n * element);
+    for (size_t i = 0; i < data.size; i++) {
+        data.as<unsigned char>()[i] = static_cast<unsigned char>(i * 7 + 1);
+    }
+    std::vector<XDMA_SG_ELEMENT> sg(n);
+    for (UINT32 i = 0; i < n; i++) { // reversed, so the card data shows the order of the list
+        sg[i] = XDMA_SG_ELEMENT{ data.bus((n - 1 - i) * element), element, 0 };
+    }
+    const XDMA_SG_VIEW v = view(sg);
+    const XDMA_DESC_PARAMS params = default_params();
+    size_t card_size;
+    uint8_t* card = xdma_model_card_memory(model, &card_size);
+
+    // lists starting at the page, in the middle, shortly before and in the last slot before a 4K
+    // boundary; 200 descriptors span two boundaries
+    for (size_t start : { 0x000, 0x7A0, 0xF00, 0xFE0 }) {
+        DMA_DESCRIPTOR* d = desc.as<DMA_DESCRIPTOR>(start);
+        UINT32 misaligned;
+        DescriptorBuildList(&params, d, desc.bus(start), 0, TRUE, &v, &misaligned);
+        const UINT32 first_adj = DescriptorOptimizeList(&params, d, n,
+                                                        static_cast<UINT32>(desc.bus(start)));
+        std::memset(card, 0, card_size);
+
+        const model_run r = run_h2c(model, desc.bus(start), first_adj);
+        CHECK_EQUAL(r.status & (XDMA_STAT_EXPECTED_ZERO | XDMA_DESCRIPTOR_STOPPED_BIT),
+                    XDMA_DESCRIPTOR_STOPPED_BIT);
+        CHECK_EQUAL(r.stats.numDescriptors, n);
+        CHECK_EQUAL(r.stats.numAdjMismatches, 0);
+        CHECK_EQUAL(r.stats.numBytes, n * element);
+        CHECK(r.stats.numFetches >= (n + 15) / 16);
+        UINT32 i = 0;
+        while ((i < n) && (std::memcmp(card + i * element,
+                                       data.as<unsigned char>((n - 1 - i) * element), element) == 0)) {
+            i++;
+        }
+        CHECK_EQUAL(i, n); // the first element which went to the wrong place
+
+    }
+
+    // the model has to catch a fetch across a 4K boundary for the test above to mean anything
+    {
+        const size_t start = 0xF00;
+        DMA_DESCRIPTOR* d = desc.as<DMA_DESCRIPTOR>(start);
+        UINT32 misaligned;
+        DescriptorBuildList(&params, d, desc.bus(start), 0, TRUE, &v, &misaligned);
+        DescriptorOptimizeList(&params, d, n, static_cast<UINT32>(desc.bus(start)));
+        const model_run r = run_h2c(model, desc.bus(start), 15);
+        CHECK(r.status & XDMA_STAT_DESCRIPTOR_ERROR);
+        CHECK_EQUAL(r.stats.numDescriptors, 0);
+    }
+    xdma_model_destroy(model);
+}
+
+// ============= Streaming ring ===============================================
+
+// AXI-ST source of the model: packets of varying length, filled with a byte counter
+struct ring_source {
+    uint8_t next_byte = 0;
+    uint32_t packet = 0;
+    size_t produced = 0;
+
+    static size_t produce(void* context, unsigned, void* data, size_t length, int* eop) {
+        ring_source* s = static_cast<ring_source*>(context);
+        size_t n = 1 + (s->packet++ * 37) % length; // 1..block size
+        uint8_t* p = static_cast<uint8_t*>(data);
+        for (size_t i = 0; i < n; i++) {
+            p[i] = s->next_byte++;
+        }
+        s->produced += n;
+        *eop = 1;
+        return n;
+    }
+};
+
+struct ring_consumer {
+    uint8_t* blocks;
+    UINT32 block_size;
+    std::vector<uint8_t> output;
+
+    static BOOLEAN copy(void* context, UINT32 block, size_t offset, size_t length) {
+        ring_consumer* c = static_cast<ring_consumer*>(context);
+        std::memcpy(c->output.data() + offset, c->blocks + block * c->block_size, length);
+        return TRUE;
+    }
+};
+
+// The ring of XDMA_EngineRingSetup/EngineRingProgramDma: a circular descriptor list in credit mode,
+// with the credits of the consumed blocks given back, run for several laps. The engine must never
+// overwrite a block which was not consumed yet, and the data must come out in order.
+void test_ring_wrap() {
+    const UINT32 num_blocks = 8;
+    const UINT32 block_size = 256;
+    const uint32_t sgdma = SGDMA_BLOCK_OFFSET + BLOCK_OFFSET; // C2H
+    const uint32_t engine = BLOCK_OFFSET;
+
+    XDMA_MODEL_CONFIG config;
+    xdma_model_config_init(&config);
+    config.numH2C = 0;
+    config.numC2H = 1;
+    config.streaming = 1;
+    XDMA_MODEL* model = xdma_model_create(&config);
+    CHECK(model != nullptr);
+    if (model == nullptr) {
+        return;
+    }
+    ring_source source;
+    xdma_model_set_stream(model, XDMA_MODEL_C2H, 0, ring_source::produce, &source);
+
+    aligned_buffer desc(num_blocks * sizeof(DMA_DESCRIPTOR));
+    aligned_buffer results(num_blocks * sizeof(DMA_RESULT));
+    aligned_buffer blocks(num_blocks * block_size);
+    DMA_DESCRIPTOR* d = desc.as<DMA_DESCRIPTOR>();
+    DMA_RESULT* r = results.as<DMA_RESULT>();
+
+    RingBuildDescriptors(d, desc.bus(), results.bus(), num_blocks, block_size);
+    for (UINT32 i = 0; i < num_blocks; i++) {
+        const uint64_t dst = blocks.bus(i * block_size);
+        d[i].dstAddrLo = static_cast<UINT32>(dst);
+        d[i].dstAddrHi = static_cast<UINT32>(dst >> 32);
+        CHECK_EQUAL(address(d[i].srcAddrLo, d[i].srcAddrHi), results.bus(i * sizeof(DMA_RESULT)));
+        CHECK_EQUAL(address(d[i].nextLo, d[i].nextHi), desc.bus(((i + 1) % num_blocks) *
+                                                                sizeof(DMA_DESCRIPTOR)));
+    }
+    const XDMA_DESC_PARAMS params = default_params();
+    const UINT32 first_adj = DescriptorOptimizeList(&params, d, num_blocks,
+                                                    static_cast<UINT32>(desc.bus()));
+
+    xdma_model_write32(model, SGDMA_COMMON_BLOCK_OFFSET +
+                       offsetof(XDMA_SGDMA_COMMON_REGS, creditModeEnableW1S), 1UL << 16);
+    xdma_model_write32(model, sgdma + offsetof(XDMA_SGDMA_REGS, firstDescLo),
+                       static_cast<uint32_t>(desc.bus()));
+    xdma_model_write32(model, sgdma + offsetof(XDMA_SGDMA_REGS, firstDescHi),
+                       static_cast<uint32_t>(desc.bus() >> 32));
+    xdma_model_write32(model, sgdma + offsetof(XDMA_SGDMA_REGS, firstDescAdj), first_adj);
+    // a full ring holds numBlocks - 1 results, so head == tail always means empty
+    xdma_model_write32(model, sgdma + offsetof(XDMA_SGDMA_REGS, descCredits), num_blocks - 1);
+    xdma_model_write32(model, engine + offsetof(XDMA_ENGINE_REGS, controlW1S), XDMA_CTRL_RUN_BIT);
+
+    ring_consumer consumer{ blocks.as<uint8_t>(), block_size, {} };
+    UINT32 head = 0;
+    UINT32 tail = 0;
+    uint8_t expected = 0;
+    size_t received = 0;
+    UINT32 packets = 0;
+    const UINT32 laps = 10;
+    for (UINT32 step = 0; packets < laps * num_blocks; step++) {
+        while (xdma_model_run(model) != 0) {
+        }
+
+        const UINT32 old_tail = tail;
+        const UINT32 eop = RingCollectResults(r, &tail, num_blocks);
+        CHECK_EQUAL(eop, (tail + num_blocks - old_tail) % num_blocks); // every packet fits a block
+        packets += eop;
+
+        // the engine used all its credits: the ring is full, but not overrun
+        CHECK_EQUAL((tail + num_blocks - head) % num_blocks, num_blocks - 1);
+        if (head == tail) {
+            break;
+        }
+
+        // alternate between draining the ring and taking a single packet
+        const size_t length = (step % 2) ? num_blocks * block_size : r[head].length;
+        consumer.output.assign(length, 0);
+        const UINT32 old_head = head;
+        size_t num_bytes;
+        UINT32 consumed;
+        CHECK(RingConsume(r, &head, tail, num_blocks, length, ring_consumer::copy, &consumer,
+                          &num_bytes, &consumed));
+        CHECK_EQUAL(consumed, (step % 2) ? num_blocks - 1 : 1);
+        CHECK_EQUAL(head, (step % 2) ? tail : RingAdvance(old_head, num_blocks));
+        for (size_t i = 0; i < num_bytes; i++) {
+            if (consumer.output[i] != expected) {
+                CHECK_EQUAL(consumer.output[i], expected);
+                break;
+            }
+            expected++;
+        }
+        received += num_bytes;
+        xdma_model_write32(model, sgdma + offsetof(XDMA_SGDMA_REGS, descCredits), consumed);
+    }
+    CHECK(packets >= laps * num_blocks);
+
+    // everything the source produced was received or still waits in the ring
+    for (UINT32 i = head; i != tail; i = RingAdvance(i, num_blocks)) {
+        received += r[i].length;
+    }
+    CHECK_EQUAL(received, source.produced);
+
+    XDMA_MODEL_STATS stats;
+    xdma_model_get_stats(model, XDMA_MODEL_C2H, 0, &stats, 0);
+    CHECK_EQUAL(stats.numAdjMismatches, 0);
+    CHECK(stats.numStalls > 0);
+    // the ring engine keeps running, without an error
+    const uint32_t status = xdma_model_read32(model, engine + offsetof(XDMA_ENGINE_REGS, status));
+    CHECK_EQUAL(status & (XDMA_STAT_EXPECTED_ZERO | XDMA_BUSY_BIT), XDMA_BUSY_BIT);
+    xdma_model_destroy(model);
+}
+
+} // namespace
+
+int main() {
+    test_build_to_device();
+    test_build_from_device();
+    test_alignment();
+    test_optimize_first_adj();
+    test_optimize_blocks();
+    test_optimize_model();
+    test_ring_wrap();
+    return test_result("core_test");
+}
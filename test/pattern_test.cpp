@@ -0,0 +1,172 @@
+// Unit tests of the test data patterns (exe/common/xdma_pattern.cpp): every kernel the CPU supports
+// has to produce and accept the same stream as the scalar kernels, for any split of the stream into
+// calls and any alignment of the buffers, and has to report the same first mismatch.
+//
+// Usage: pattern_test
+
+#include <cstdint>
+#include <cstring>
+#include <vector>
+
+#include "test_check.h"
+#include "xdma_pattern.h"
+
+namespace {
+
+const struct {
+    pattern_type type;
+    uint64_t seed;
+    size_t block_size;
+    const char* name;
+} patterns[] = {
+    { pattern_type::counter, 0xFFFFFF00ULL, 4096, "counter" }, // wraps the 32-bit word
+    { pattern_type::prbs, 1234, 4096, "prbs" },
+    { pattern_type::stamp, 0x1FFFFFFF0ULL, 4096, "stamp" },
+    { pattern_type::stamp, 77, 8, "stamp/8" },                 // sequence numbers only
+    { pattern_type::stamp, 78, 44, "stamp/44" },
+};
+
+// lengths of consecutive calls: partial words, less and more than one vector of the SSE2/AVX2
+// kernels, less and more than a stamp block
+const size_t call_lengths[] = { 0, 1, 2, 3, 4, 5, 7, 8, 15, 16, 17, 31, 32, 33, 63, 64, 65,
+                                127, 255, 1000, 4095, 4096, 4097, 3, 65539 };
+
+const pattern_isa isas[] = { pattern_isa::scalar, pattern_isa::sse2, pattern_isa::avx2 };
+
+size_t stream_length() {
+    size_t total = 0;
+    for (size_t length : call_lengths) {
+        total += length;
+    }
+    return total;
+}
+
+uint32_t load_word(const uint8_t* p) {
+    uint32_t v;
+    std::memcpy(&v, p, sizeof(v));
+    return v;
+}
+
+// the scalar stream, generated in one call, checked against the definition in xdma_pattern.h
+// where it is simple enough
+std::vector<uint8_t> reference(pattern_type type, uint64_t seed, size_t block_size) {
+    std::vector<uint8_t> data(stream_length());
+    pattern_stream stream(type, seed, block_size, pattern_isa::scalar);
+    stream.fill(data.data(), data.size());
+
+    for (size_t i = 0; i + 4 <= data.size(); i += 4) {
+        const uint64_t word = i / 4;
+        if (type == pattern_type::counter) {
+            CHECK_EQUAL(load_word(&data[i]), static_cast<uint32_t>(seed + word));
+        } else if ((type == pattern_type::stamp) && (i % block_size == 0)) {
+            const uint64_t seq = load_word(&data[i]) |
+                                 (static_cast<uint64_t>(load_word(&data[i + 4])) << 32);
+            CHECK_EQUAL(seq, seed + i / block_size);
+        }
+    }
+    return data;
+}
+
+void test_fill(pattern_isa isa) {
+    for (const auto& p : patterns) {
+        const std::vector<uint8_t> expected = reference(p.type, p.seed, p.block_size);
+        for (size_t misalign = 0; misalign < 8; misalign++) {
+            std::vector<uint8_t> buffer(expected.size() + misalign);
+            uint8_t* data = buffer.data() + misalign;
+            pattern_stream stream(p.type, p.seed, p.block_size, isa);
+            CHECK(stream.isa() == isa);
+
+            size_t offset = 0;
+            for (size_t length : call_lengths) {
+                stream.fill(data + offset, length);
+                offset += length;
+                CHECK_EQUAL(stream.position(), offset);
+            }
+            if (std::memcmp(data, expected.data(), expected.size()) != 0) {
+                std::fprintf(stderr, "%s %s fill, misaligned by %zu: differs from scalar\n",
+                             p.name, pattern_isa_name(isa), misalign);
+                CHECK(!"fill matches the scalar stream");
+            }
+        }
+    }
+}
+
+void test_verify(pattern_isa isa) {
+    for (const auto& p : patterns) {
+        const std::vector<uint8_t> expected = reference(p.type, p.seed, p.block_size);
+        for (size_t misalign = 0; misalign < 8; misalign++) {
+            std::vector<uint8_t> buffer(expected.size() + misalign);
+            uint8_t* data = buffer.data() + misalign;
+            std::memcpy(data, expected.data(), expected.size());
+            pattern_stream stream(p.type, p.seed, p.block_size, isa);
+
+            size_t offset = 0;
+            for (size_t length : call_lengths) {
+                pattern_mismatch mismatch;
+                if (!stream.verify(data + offset, length, &mismatch)) {
+                    std::fprintf(stderr, "%s %s verify, misaligned by %zu: mismatch at %llu\n",
+                                 p.name, pattern_isa_name(isa), misalign,
+                                 static_cast<unsigned long long>(mismatch.offset));
+                    CHECK(!"verify accepts the scalar stream");
+                }
+                offset += length;
+            }
+            CHECK_EQUAL(stream.position(), offset);
+        }
+    }
+}
+
+// a corrupted byte is reported at the same offset, with the same words, as by the scalar kernels,
+// and the stream stays in sync behind it
+void test_mismatch(pattern_isa isa) {
+    for (const auto& p : patterns) {
+        const std::vector<uint8_t> expected = reference(p.type, p.seed, p.block_size);
+        const size_t total = expected.size();
+        for (size_t bad : { size_t(0), size_t(1), size_t(3), size_t(4), size_t(30), size_t(32),
+                            size_t(37), size_t(100), size_t(4101), size_t(8192), total / 2,
+                            total - 1 }) {
+            for (size_t misalign : { size_t(0), size_t(1), size_t(3) }) {
+                std::vector<uint8_t> buffer(total + misalign);
+                uint8_t* data = buffer.data() + misalign;
+                std::memcpy(data, expected.data(), total);
+                data[bad] ^= 0x40;
+
+                pattern_stream stream(p.type, p.seed, p.block_size, isa);
+                pattern_stream scalar(p.type, p.seed, p.block_size, pattern_isa::scalar);
+                size_t offset = 0;
+                for (size_t length : call_lengths) {
+                    pattern_mismatch m = {};
+                    pattern_mismatch s = {};
+                    const bool ok = stream.verify(data + offset, length, &m);
+                    const bool scalar_ok = scalar.verify(data + offset, length, &s);
+                    const bool hit = (bad >= offset) && (bad < offset + length);
+                    CHECK(ok == !hit);
+                    CHECK(scalar_ok == !hit);
+                    if (hit) {
+                        CHECK_EQUAL(m.offset, bad);
+                        CHECK_EQUAL(s.offset, bad);
+                        CHECK_EQUAL(m.expected, s.expected);
+                        CHECK_EQUAL(m.actual, s.actual);
+                        CHECK(m.expected != m.actual);
+                    }
+                    offset += length;
+                }
+            }
+        }
+    }
+}
+
+} // namespace
+
+int main() {
+    for (pattern_isa isa : isas) {
+        if (isa > pattern_best_isa()) {
+            std::printf("%s: not supported by this CPU, skipped\n", pattern_isa_name(isa));
+            continue;
+        }
+        test_fill(isa);
+        test_verify(isa);
+        test_mismatch(isa);
+    }
+    return test_result("pattern_test");
+}
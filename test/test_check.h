@@ -0,0 +1,40 @@
+#pragma once
+
+// Minimal checks for the unit tests. A failed CHECK prints its location and the test continues, so
+// one run reports every failure; main() returns test_result(), which CTest takes as the outcome.
+
+#include <cstdio>
+
+inline unsigned& test_failures() {
+    static unsigned failures = 0;
+    return failures;
+}
+
+#define CHECK(EXP)                                                                  \
+    do {                                                                            \
+        if (!(EXP)) {                                                               \
+            std::fprintf(stderr, "%s:%d: CHECK(%s) failed\n", __FILE__, __LINE__, #EXP); \
+            test_failures()++;                                                      \
+        }                                                                           \
+    } while (0)
+
+// CHECK(A == B) which also prints both values
+#define CHECK_EQUAL(A, B)                                                           \
+    do {                                                                            \
+        const unsigned long long a_ = (unsigned long long)(A);                      \
+        const unsigned long long b_ = (unsigned long long)(B);                      \
+        if (a_ != b_) {                                                             \
+            std::fprintf(stderr, "%s:%d: CHECK_EQUAL(%s, %s) failed: 0x%llx != 0x%llx\n", \
+                         __FILE__, __LINE__, #A, #B, a_, b_);                       \
+            test_failures()++;                                                      \
+        }                                                                           \
+    } while (0)
+
+inline int test_result(const char* name) {
+    if (test_failures() != 0) {
+        std::fprintf(stderr, "%s: %u check(s) failed\n", name, test_failures());
+        return 1;
+    }
+    std::printf("%s: all checks passed\n", name);
+    return 0;
+}